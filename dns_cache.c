@@ -31,6 +31,21 @@ http://www.accre.vanderbilt.edu
 //
 //  Provides a simple DNS cache
 //
+//  Entries are immutable once published and live in a fixed size open
+//  addressed table of pointers.  Readers never take a lock.  They probe
+//  the table and copy what they need.  Writers serialize on the cache lock
+//  only long enough to swap a slot.  Resolution happens outside the lock
+//  so a slow resolver only stalls the threads that want that name.
+//  Replaced entries are parked on a retired list.  Readers register in
+//  one of two counters picked by the cache epoch and the epoch only
+//  advances once the other counter drains.  An entry retired in an
+//  earlier epoch is freed then since no reader can still see it.
+//
+//  A background thread re-resolves entries that were used since they
+//  were published before they expire so the application threads rarely
+//  see the resolver.  Failed lookups are cached with an exponential 
+//  backoff.
+//
 //**************************************************************************
 
 #include <pthread.h>
@@ -39,129 +54,500 @@ http://www.accre.vanderbilt.edu
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 #include <unistd.h>
-#include <apr_hash.h>
+#include <apr_atomic.h>
 #include <apr_network_io.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_cond.h>
+#include <apr_time.h>
 
 #include "log.h"
 #include "fmttypes.h"
 #include "dns_cache.h"
-#include "string_token.h"
 
 #define BUF_SIZE 128
+#define DNS_PROBE_MAX   16   //** Max slots probed for a name
+#define DNS_NEG_TTL_MIN 5    //** Secs a failed lookup is cached the 1st time.  Doubles with each failure
+#define DNS_REFRESH_BATCH 64 //** Max entries re-resolved in each refresh pass
 
-typedef struct {
+typedef struct DNS_entry_s {
    char name[BUF_SIZE];
-   unsigned char addr[DNS_ADDR_MAX];
-   char ip_addr[256];
-   int family;
+   time_t expire;                                 //** Entry is stale after this.  Monotonic secs
+   int n;                                         //** Number of addresses.  0 means the lookup failed
+   int fails;                                     //** Consecutive failed lookups
+   int is_alias;                                  //** Entry is keyed by one of a host's addresses
+   volatile apr_uint32_t hits;                    //** Lookups since the entry was published
+   unsigned char addr[DNS_LIST_MAX][DNS_ADDR_MAX]; //** Byte addresses in resolver order
+   char ip_addr[DNS_LIST_MAX][DNS_IP_LEN];        //** ..and as strings
+   int family[DNS_LIST_MAX];
+   apr_uint32_t epoch;                            //** Cache epoch when the entry was replaced
+   struct DNS_entry_s *next;                      //** Retired list link
 } DNS_entry_t;
 
 typedef struct {
-   apr_pool_t *mpool;
+   int n_slots;                    //** Always a power of 2
+   int ttl;                        //** Secs an entry is valid
+   int neg_ttl_max;                //** Max secs a failed lookup is cached
+   int refresh_ahead;              //** Hot entries are re-resolved this many secs before expiring.  0 disables it
+   DNS_entry_t * volatile *slot;   //** The table.  Only read with atomics
+   DNS_entry_t *retired;           //** Replaced entries waiting to be freed
+   volatile apr_uint32_t epoch;    //** Reclamation epoch.  Only advanced with the lock held
+   volatile apr_uint32_t readers[2]; //** Lock free readers in the even and odd epochs
+   volatile apr_uint32_t hits;     //** Lookup counters updated without the lock
+   volatile apr_uint32_t misses;
+   volatile apr_uint32_t neg_hits;
+   DNS_cache_stats_t stats;        //** Resolver stats.  Protected by the lock
+   int shutdown;
+   apr_thread_t *refresh_thread;
+   apr_thread_cond_t *cond;
    apr_pool_t *lockpool;
-   apr_hash_t *table;
-   int size;
-   time_t restart_time;
-   apr_thread_mutex_t *lock;
+   apr_thread_mutex_t *lock;       //** Only taken by writers
 } DNS_cache_t;
 
 DNS_cache_t *_cache = NULL;
 
+//**************************************************************************
+// _dns_hash - FNV-1a hash of the name
+//**************************************************************************
+
+unsigned int _dns_hash(const char *name)
+{
+  unsigned int h = 2166136261U;
+
+  while (*name != '\0') {
+     h ^= (unsigned char)*name;
+     h *= 16777619U;
+     name++;
+  }
+
+  return(h);
+}
 
 //**************************************************************************
-//  wipe_entries - Wipes the existing entries and resets the timer
+// _dns_now - Returns the monotonic time in secs
 //**************************************************************************
 
-void wipe_entries(DNS_cache_t *cache)
+time_t _dns_now()
 {
-  if (cache->mpool != NULL) apr_pool_destroy(cache->mpool);
+  struct timespec ts;
 
-  assert(apr_pool_create(&(cache->mpool), NULL) == APR_SUCCESS);
-  assert((cache->table = apr_hash_make(cache->mpool)) != NULL);
-  
-  cache->restart_time = time(NULL) + 600;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec);
 }
 
 //**************************************************************************
-//  lookup_host - Looks up the host.  Make sure that the lock/unlock routines
-//      are used to make it threadsafe!
-//
+// _dns_read_begin - Registers a lock free reader.  Any entry found before
+//    the matching _dns_read_end() call won't be freed.  Returns the
+//    counter to pass to _dns_read_end().
 //**************************************************************************
-   
-int lookup_host(const char *name, char *byte_addr, char *ip_addr) {
-  char ip_buffer[256];
-//  char byte_buffer[256];
-  char *s, *bstate;
-  int err, i;
+
+int _dns_read_begin()
+{
+  int r;
+
+  r = apr_atomic_read32(&(_cache->epoch)) & 1;
+  apr_atomic_inc32(&(_cache->readers[r]));
+  return(r);
+}
+
+//**************************************************************************
+// _dns_read_end - Ends a lock free read
+//**************************************************************************
+
+void _dns_read_end(int r)
+{
+  apr_atomic_dec32(&(_cache->readers[r]));
+}
+
+//**************************************************************************
+// _dns_slot - Returns the slot pointer.  A CAS that never changes
+//    anything is used to get a load with a full barrier.
+//**************************************************************************
+
+DNS_entry_t *_dns_slot(int i)
+{
+  return((DNS_entry_t *)apr_atomic_casptr((volatile void **)&(_cache->slot[i]), NULL, NULL));
+}
+
+//**************************************************************************
+// _find_entry - Returns the entry for the name, fresh or not, or NULL.
+//    No lock is needed but the caller should be between _dns_read_begin()
+//    and _dns_read_end() while it uses the entry.
+//**************************************************************************
+
+DNS_entry_t *_find_entry(const char *name)
+{
   DNS_entry_t *h;
-  apr_sockaddr_t *sa;
-  int family;
+  unsigned int mask, slot;
+  int i;
+
+  mask = _cache->n_slots - 1;
+  slot = _dns_hash(name);
+  for (i=0; i<DNS_PROBE_MAX; i++) {
+     h = _dns_slot((slot + i) & mask);
+     if (h == NULL) continue;
+     if (strcmp(h->name, name) == 0) return(h);
+  }
 
-log_printf(20, "lookup_host: start time=" TT " name=%s\n", time(NULL), name);
-if (_cache == NULL) log_printf(20, "lookup_host: _cache == NULL\n");
+  return(NULL);
+}
 
-  if (name[0] == '\0') return(1);  //** Return early if name is NULL
+//**************************************************************************
+// _resolve_entry - Resolves the host.  Both A and AAAA records are kept.
+//     If the lookup fails a negative entry is returned that expires 
+//     after a backoff based on the previous failures.  No locks are held.
+//**************************************************************************
+
+DNS_entry_t *_resolve_entry(const char *name, int prev_fails)
+{
+  apr_pool_t *mpool;
+  apr_sockaddr_t *sa, *s;
+  DNS_entry_t *h;
+  apr_time_t start;
+  int64_t dt;
+  int err, i, neg_ttl;
+
+  assert(apr_pool_create(&mpool, NULL) == APR_SUCCESS);
+
+  assert((h = (DNS_entry_t *)malloc(sizeof(DNS_entry_t))) != NULL);
+  memset(h, 0, sizeof(DNS_entry_t));
+  strncpy(h->name, name, sizeof(h->name));  h->name[sizeof(h->name)-1] = '\0';
+
+  start = apr_time_now();
+  err = apr_sockaddr_info_get(&sa, name, APR_UNSPEC, 80, 0, mpool);
+  dt = apr_time_now() - start;
+
+  //** Keep every address.  The resolver has already sorted them by preference
+  i = 0;
+  if (err == APR_SUCCESS) {
+     for (s = sa; (s != NULL) && (i < DNS_LIST_MAX); s = s->next) {
+        apr_sockaddr_ip_getbuf(h->ip_addr[i], DNS_IP_LEN, s);
+        if (s->ipaddr_len <= DNS_ADDR_MAX) memcpy(h->addr[i], s->ipaddr_ptr, s->ipaddr_len);
+        h->family[i] = (s->family == APR_INET6) ? DNS_IPV6 : DNS_IPV4;
+        log_printf(20, "_resolve_entry: host=%s address[%d]=%s\n", name, i, h->ip_addr[i]);
+        i++;
+     }
+  }
+  h->n = i;
+
+  apr_pool_destroy(mpool);
+
+  if (h->n == 0) {  //** Negative entry
+     h->fails = prev_fails + 1;
+     neg_ttl = DNS_NEG_TTL_MIN;
+     for (i=1; (i<h->fails) && (neg_ttl < _cache->neg_ttl_max); i++) neg_ttl *= 2;
+     if (neg_ttl > _cache->neg_ttl_max) neg_ttl = _cache->neg_ttl_max;
+     h->expire = _dns_now() + neg_ttl;
+     log_printf(5, "_resolve_entry: Can't resolve host=%s err=%d fails=%d retry in %ds\n", name, err, h->fails, neg_ttl);
+  } else {
+     h->expire = _dns_now() + _cache->ttl;
+  }
 
-//  ipaddr = (ip_addr == NULL) ? ip_buffer : ip_addr;
-//  addr = (byte_addr == NULL) ? byte_buffer : byte_addr;
-  
-//log_printf(20, "lookup_host: before lock\n");
   apr_thread_mutex_lock(_cache->lock);
-//log_printf(20, "lookup_host: after lock\n");
- 
-  if ((time(NULL) > _cache->restart_time) || (apr_hash_count(_cache->table) > _cache->size)) wipe_entries(_cache);
-  
-  h = (DNS_entry_t *)apr_hash_get(_cache->table, name, APR_HASH_KEY_STRING);
-
-  if (h != NULL) {  //** Got a hit!!
-     if (ip_addr != NULL) strcpy(ip_addr, h->ip_addr);
-     if (byte_addr != NULL) memcpy(byte_addr, h->addr, DNS_ADDR_MAX);
-     family = h->family;
-     apr_thread_mutex_unlock(_cache->lock);
+  _cache->stats.resolves++;
+  if (h->n == 0) _cache->stats.failures++;
+  _cache->stats.resolve_us += dt;
+  if (dt > _cache->stats.max_resolve_us) _cache->stats.max_resolve_us = dt;
+  apr_thread_mutex_unlock(_cache->lock);
+
+  return(h);
+}
+
+//**************************************************************************
+// _reap_retired - Frees retired entries no reader can still be using.
+//     Readers from the previous epoch must have drained.  Anything
+//     retired before the current epoch is then unreachable and the
+//     epoch advances.  The cache lock must be held.
+//**************************************************************************
+
+void _reap_retired()
+{
+  DNS_entry_t *h, *prev, *next;
+  apr_uint32_t epoch;
+
+  if (_cache->retired == NULL) return;
+
+  epoch = apr_atomic_read32(&(_cache->epoch));
+  if (apr_atomic_read32(&(_cache->readers[(epoch+1) & 1])) != 0) return;
+
+  prev = NULL;
+  for (h = _cache->retired; h != NULL; h = next) {
+     next = h->next;
+     if (h->epoch != epoch) {
+        if (prev == NULL) { _cache->retired = next; } else { prev->next = next; }
+        free(h);
+     } else {
+        prev = h;
+     }
+  }
+
+  apr_atomic_inc32(&(_cache->epoch));
+}
+
+//**************************************************************************
+// _install_entry - Publishes the entry replacing any existing one for the
+//     same name.  If the probe window is full the stalest entry is
+//     evicted.  The cache lock must be held.
+//**************************************************************************
+
+void _install_entry(DNS_entry_t *h)
+{
+  DNS_entry_t *e, *old;
+  unsigned int mask, slot, hash;
+  int i, best;
+  time_t best_expire;
+
+  mask = _cache->n_slots - 1;
+  hash = _dns_hash(h->name);
+  best = -1;
+  best_expire = 0;
+  for (i=0; i<DNS_PROBE_MAX; i++) {
+     slot = (hash + i) & mask;
+     e = _cache->slot[slot];
+     if (e == NULL) {
+        if ((best == -1) || (best_expire > 0)) { best = slot; best_expire = 0; }
+     } else if (strcmp(e->name, h->name) == 0) {
+        best = slot;
+        break;
+     } else if ((best == -1) || (e->expire < best_expire)) {
+        best = slot;
+        best_expire = e->expire;
+     }
+  }
+
+  old = _cache->slot[best];
+  apr_atomic_casptr((volatile void **)&(_cache->slot[best]), h, old);
+
+  if (old != NULL) {
+     old->epoch = apr_atomic_read32(&(_cache->epoch));
+     old->next = _cache->retired;
+     _cache->retired = old;
+  }
+}
+
+//**************************************************************************
+// _store_entry - Adds the host and an alias for each of its addresses
+//     so a lookup by address returns the whole host with that address 1st.
+//**************************************************************************
+
+void _store_entry(DNS_entry_t *h)
+{
+  DNS_entry_t *a;
+  int i;
+
+  apr_thread_mutex_lock(_cache->lock);
+
+  _reap_retired();
+  _install_entry(h);
+
+  for (i=0; i<h->n; i++) {
+     if (strcmp(h->ip_addr[i], h->name) == 0) continue;
+
+     assert((a = (DNS_entry_t *)malloc(sizeof(DNS_entry_t))) != NULL);
+     *a = *h;
+     a->is_alias = 1;
+     strncpy(a->name, h->ip_addr[i], sizeof(a->name));  a->name[sizeof(a->name)-1] = '\0';
+     if (i > 0) {  //** Move the address to the front
+        memcpy(a->addr[0], h->addr[i], DNS_ADDR_MAX);
+        memcpy(a->addr[i], h->addr[0], DNS_ADDR_MAX);
+        strcpy(a->ip_addr[0], h->ip_addr[i]);
+        strcpy(a->ip_addr[i], h->ip_addr[0]);
+        a->family[0] = h->family[i];
+        a->family[i] = h->family[0];
+     }
+     _install_entry(a);
+  }
+
+  apr_thread_mutex_unlock(_cache->lock);
+}
+
+//**************************************************************************
+// _lookup_entry - Copies the cache entry for the host into e, resolving
+//     it if needed.  Returns 0 on success or -1 if the host can't be 
+//     resolved.  The resolver is called outside the read side so it 
+//     doesn't hold up reclamation.  Concurrent misses on the same name
+//     may each resolve it.
+//**************************************************************************
+
+int _lookup_entry(const char *name, DNS_entry_t *e)
+{
+  DNS_entry_t *h;
+  int fails, r;
+
+  r = _dns_read_begin();
+  h = _find_entry(name);
+  if ((h != NULL) && (h->expire > _dns_now())) {  //** Got a hit!!
+     if (h->n == 0) {
+        _dns_read_end(r);
+        apr_atomic_inc32(&(_cache->neg_hits));
+        return(-1);
+     }
+
+     apr_atomic_inc32(&(h->hits));
+     *e = *h;
+     _dns_read_end(r);
+     apr_atomic_inc32(&(_cache->hits));
      return(0);
   }
-  
+
+  fails = ((h != NULL) && (h->n == 0)) ? h->fails : 0;
+  _dns_read_end(r);
+
   //** If we made it here that means we have to look it up
-  err = apr_sockaddr_info_get(&sa, name, APR_INET, 80, 0, _cache->mpool);
-//log_printf(20, "lookup_host: apr_sockaddr_info_get=%d\n", err);
+  apr_atomic_inc32(&(_cache->misses));
+  h = _resolve_entry(name, fails);
+  *e = *h;   //** h belongs to the cache once it's stored
+  _store_entry(h);
+
+  return((e->n > 0) ? 0 : -1);
+}
 
-  if (err != APR_SUCCESS) {
-    apr_thread_mutex_unlock(_cache->lock);
-    return(-1);
+//**************************************************************************
+// _refresh_pass - Re-resolves the entries that are about to expire and
+//     have been used since they were published.  A failed refresh leaves
+//     the old entry in place.
+//**************************************************************************
+
+void _refresh_pass()
+{
+  char name[DNS_REFRESH_BATCH][BUF_SIZE];
+  DNS_entry_t *h;
+  time_t now;
+  int i, n, r;
+
+  if (_cache->refresh_ahead <= 0) return;
+
+  now = _dns_now();
+  n = 0;
+  r = _dns_read_begin();
+  for (i=0; (i<_cache->n_slots) && (n<DNS_REFRESH_BATCH); i++) {
+     h = _dns_slot(i);
+     if ((h == NULL) || (h->n == 0) || (h->is_alias == 1)) continue;
+     if ((h->expire - now) > _cache->refresh_ahead) continue;
+     if (apr_atomic_read32(&(h->hits)) == 0) continue;
+
+     apr_atomic_set32(&(h->hits), 0);  //** Only retried if it's used again
+     strcpy(name[n], h->name);
+     n++;
   }
-  h = (DNS_entry_t *)apr_palloc(_cache->mpool, sizeof(DNS_entry_t)); //** This is created withthe pool for easy cleanup
-  memset(h, 0, sizeof(DNS_entry_t));
+  _dns_read_end(r);
+
+  for (i=0; i<n; i++) {
+     h = _resolve_entry(name[i], 0);
+     if (h->n == 0) {
+        free(h);
+        continue;
+     }
+
+     log_printf(15, "_refresh_pass: refreshed host=%s\n", name[i]);
+     _store_entry(h);
+     apr_thread_mutex_lock(_cache->lock);
+     _cache->stats.refreshes++;
+     apr_thread_mutex_unlock(_cache->lock);
+  }
+}
 
-  strncpy(h->name, name, sizeof(h->name));  h->name[sizeof(h->name)-1] = '\0';
+//**************************************************************************
+// dns_refresh_thread - Background refresher.  Runs a refresh pass 
+//     every second and frees retired entries once it's safe.
+//**************************************************************************
 
-  apr_sockaddr_ip_getbuf(ip_buffer, sizeof(ip_buffer), sa);
-  strcpy(h->ip_addr, ip_buffer);
-  
-log_printf(20, "lookup_host: start host=%s address=%s\n", name, ip_buffer);
+void *dns_refresh_thread(apr_thread_t *th, void *data)
+{
+  apr_thread_mutex_lock(_cache->lock);
+  while (_cache->shutdown == 0) {
+     apr_thread_cond_timedwait(_cache->cond, _cache->lock, apr_time_from_sec(1));
+     if (_cache->shutdown == 1) break;
 
-  h->family = DNS_IPV4;
-  i = 0;
-  for (s = string_token(ip_buffer, ".", &bstate, &err); err == 0; s = string_token(NULL, ".", &bstate, &err)) {
-      h->addr[i] = atoi(s);
-//n = h->addr[i];
-//log_printf(20, "lookup_host: err=%d i=%d n=%d s=%s\n", err, i, n, s);
+     _reap_retired();
+     apr_thread_mutex_unlock(_cache->lock);
+     _refresh_pass();
+     apr_thread_mutex_lock(_cache->lock);
+  }
+  apr_thread_mutex_unlock(_cache->lock);
+
+  apr_thread_exit(th, 0);
+  return(NULL);
+}
+
+//**************************************************************************
+//  lookup_host - Looks up the host.  Hits never take a lock.
+//**************************************************************************
+   
+int lookup_host(const char *name, char *byte_addr, char *ip_addr) {
+  DNS_entry_t h;
 
-      i++;
+log_printf(20, "lookup_host: start time=" TT " name=%s\n", time(NULL), name);
+if (_cache == NULL) log_printf(20, "lookup_host: _cache == NULL\n");
+
+  if (name[0] == '\0') return(1);  //** Return early if name is NULL
+
+  if (_lookup_entry(name, &h) != 0) return(-1);
+
+  //** Return the preferred address
+  if (ip_addr != NULL) strcpy(ip_addr, h.ip_addr[0]);
+  if (byte_addr != NULL) memcpy(byte_addr, h.addr[0], DNS_ADDR_MAX);
+
+  return(0);
+}
+
+//**************************************************************************
+// lookup_host_addrs - Returns all the address strings for the host, 
+//     preferred first.  If name is an address returned by an earlier
+//     lookup then the addresses of that host are returned with name 
+//     first.  This lets a multi-homed depot be raced even though its
+//     hostport only carries one address.  Returns the number of
+//     addresses or -1 on error.
+//**************************************************************************
+
+int lookup_host_addrs(const char *name, char ip_list[][DNS_IP_LEN], int max)
+{
+  DNS_entry_t h;
+  int i, n;
+
+  if ((_cache == NULL) || (name[0] == '\0')) return(-1);
+
+  if (_lookup_entry(name, &h) != 0) return(-1);
+
+  n = 0;
+  for (i=0; (i<h.n) && (n<max); i++) {
+     strcpy(ip_list[n], h.ip_addr[i]);
+     n++;
   }
-  if (i>4) h->family = DNS_IPV6;
 
-  //** Add the enry to the table
-  apr_hash_set(_cache->table, h->name, APR_HASH_KEY_STRING, h);
+  return(n);
+}
+
+//**************************************************************************
+// dns_cache_set_ttl - Sets how long new entries are valid
+//**************************************************************************
 
-  //** Return the address
-  if (ip_addr != NULL) strcpy(ip_addr, h->ip_addr);
-  if (byte_addr != NULL) memcpy(byte_addr, h->addr, DNS_ADDR_MAX);
-  family = h->family;
+void dns_cache_set_ttl(int ttl) { _cache->ttl = ttl; }
+int dns_cache_get_ttl() { return(_cache->ttl); }
+void dns_cache_set_refresh(int secs_ahead) { _cache->refresh_ahead = secs_ahead; }
+void dns_cache_set_neg_ttl(int max_secs) { _cache->neg_ttl_max = (max_secs < DNS_NEG_TTL_MIN) ? DNS_NEG_TTL_MIN : max_secs; }
 
+//**************************************************************************
+// dns_cache_stats - Returns the cache stats
+//**************************************************************************
+
+void dns_cache_stats(DNS_cache_stats_t *stats)
+{
+  int i;
+
+  apr_thread_mutex_lock(_cache->lock);
+  *stats = _cache->stats;
   apr_thread_mutex_unlock(_cache->lock);
 
-  return(0);
+  stats->hits = apr_atomic_read32(&(_cache->hits));
+  stats->misses = apr_atomic_read32(&(_cache->misses));
+  stats->neg_hits = apr_atomic_read32(&(_cache->neg_hits));
+
+  stats->size = 0;
+  for (i=0; i<_cache->n_slots; i++) {
+     if (_dns_slot(i) != NULL) stats->size++;
+  }
 }
 
 //**************************************************************************
@@ -174,23 +560,54 @@ void dns_cache_init(int size) {
    _cache = (DNS_cache_t *)malloc(sizeof(DNS_cache_t));
    assert(_cache != NULL);
 
-   _cache->size = size;
-   _cache->mpool = NULL;
+   //** Size the table so a full cache is at most 1/4 used
+   _cache->n_slots = 64;
+   while (_cache->n_slots < 4*size) _cache->n_slots *= 2;
+   assert((_cache->slot = (DNS_entry_t **)calloc(_cache->n_slots, sizeof(DNS_entry_t *))) != NULL);
+
+   _cache->ttl = 600;
+   _cache->neg_ttl_max = 300;
+   _cache->refresh_ahead = 30;
+   _cache->retired = NULL;
+   _cache->epoch = 0;
+   _cache->readers[0] = _cache->readers[1] = 0;
+   _cache->hits = _cache->misses = _cache->neg_hits = 0;
+   memset(&(_cache->stats), 0, sizeof(DNS_cache_stats_t));
+   _cache->shutdown = 0;
    assert(apr_pool_create(&(_cache->lockpool), NULL) == APR_SUCCESS);
    apr_thread_mutex_create(&(_cache->lock), APR_THREAD_MUTEX_DEFAULT,_cache->lockpool);
-  
-   wipe_entries(_cache);
+   apr_thread_cond_create(&(_cache->cond), _cache->lockpool);
+   apr_thread_create(&(_cache->refresh_thread), NULL, dns_refresh_thread, NULL, _cache->lockpool);
 }
 
 //**************************************************************************
 
 void finalize_dns_cache() {
+  DNS_entry_t *h;
+  apr_status_t value;
+  int i;
+
+  apr_thread_mutex_lock(_cache->lock);
+  _cache->shutdown = 1;
+  apr_thread_cond_signal(_cache->cond);
+  apr_thread_mutex_unlock(_cache->lock);
+  apr_thread_join(&value, _cache->refresh_thread);
+
+  apr_thread_cond_destroy(_cache->cond);
   apr_thread_mutex_destroy(_cache->lock);
 
-  if (_cache->mpool != NULL) apr_pool_destroy(_cache->mpool);
+  for (i=0; i<_cache->n_slots; i++) {
+     if (_cache->slot[i] != NULL) free(_cache->slot[i]);
+  }
+  free((void *)_cache->slot);
+
+  while ((h = _cache->retired) != NULL) {
+     _cache->retired = h->next;
+     free(h);
+  }
+
   if (_cache->lockpool != NULL) apr_pool_destroy(_cache->lockpool);
 
   free(_cache);
+  _cache = NULL;
 }
-
-
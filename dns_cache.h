@@ -33,17 +33,39 @@ http://www.accre.vanderbilt.edu
 #ifndef __DNS_CACHE_H__
 #define __DNS_CACHE_H__
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 //#define DNS_IPV4_LEN 4
 //#define DNS_IPV6_LEN 16
-#define DNS_ADDR_MAX 4
+#define DNS_ADDR_MAX 16   //** Big enough for an IPv6 address
+#define DNS_LIST_MAX 8    //** Max addresses kept for each host
+#define DNS_IP_LEN   64   //** Max length of an address string
 #define DNS_IPV4  0
 #define DNS_IPV6  1
 
+typedef struct {
+   int64_t hits;           //** Lookups answered from the cache
+   int64_t misses;         //** Lookups that resolved the name inline
+   int64_t neg_hits;       //** Lookups failed from a cached resolver error
+   int64_t resolves;       //** Resolver calls, inline and background
+   int64_t failures;       //** Resolver calls that failed
+   int64_t refreshes;      //** Hot entries re-resolved in the background
+   int64_t resolve_us;     //** Total time spent in the resolver
+   int64_t max_resolve_us; //** Slowest resolver call
+   int size;               //** Entries in the table, aliases included
+} DNS_cache_stats_t;
+
 int lookup_host(const char *, char *, char *);
+int lookup_host_addrs(const char *name, char ip_list[][DNS_IP_LEN], int max);
+void dns_cache_set_ttl(int ttl);
+int dns_cache_get_ttl();
+void dns_cache_set_refresh(int secs_ahead);
+void dns_cache_set_neg_ttl(int max_secs);
+void dns_cache_stats(DNS_cache_stats_t *stats);
 void dns_cache_init(int);
 void finalize_dns_cache();
 
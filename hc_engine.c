@@ -0,0 +1,822 @@
+/*
+Advanced Computing Center for Research and Education Proprietary License
+Version 1.0 (April 2006)
+
+Copyright (c) 2006, Advanced Computing Center for Research and Education,
+ Vanderbilt University, All rights reserved.
+
+This Work is the sole and exclusive property of the Advanced Computing Center
+for Research and Education department at Vanderbilt University.  No right to
+disclose or otherwise disseminate any of the information contained herein is
+granted by virtue of your possession of this software except in accordance with
+the terms and conditions of a separate License Agreement entered into with
+Vanderbilt University.
+
+THE AUTHOR OR COPYRIGHT HOLDERS PROVIDES THE "WORK" ON AN "AS IS" BASIS,
+WITHOUT WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT
+LIMITED TO THE WARRANTIES OF MERCHANTABILITY, TITLE, FITNESS FOR A PARTICULAR
+PURPOSE, AND NON-INFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+Vanderbilt University
+Advanced Computing Center for Research and Education
+230 Appleton Place
+Nashville, TN 37203
+http://www.accre.vanderbilt.edu
+*/ 
+
+//*************************************************************************
+// hc_engine - Event driven engine for depot connections.  Instead of
+//    a send/recv thread pair per connection a small fixed pool of
+//    threads watches all the connections.  Each engine thread owns a set
+//    of connections and polls the sockets with outstanding commands.
+//    The existing send_command/send_phase/recv_phase callbacks block
+//    until the whole op is done, which can be a multi-GB transfer, so
+//    they are never run on an engine thread.  A connection with work
+//    to do is handed to a data worker which runs it until it would have
+//    to wait on the depot and then hands it back.  Workers are only
+//    created when all the others are busy, are capped by engine_workers,
+//    and exit after sitting idle.  Idle connections cost no threads and
+//    a slow depot only ties up the worker running it.
+//*************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <apr_pools.h>
+#include <apr_poll.h>
+#include <apr_file_io.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#include "host_portal.h"
+#include "log.h"
+#include "network.h"
+
+//*************************************************************
+// _hc_engine_wakeup - Breaks the engine thread out of the poll.
+//     NOTE: et->lock should be held
+//*************************************************************
+
+void _hc_engine_wakeup(Hc_engine_thread_t *et)
+{
+  char c = 1;
+  apr_size_t nbytes = 1;
+
+  if (et->wake_pending == 1) return;
+
+  et->wake_pending = 1;
+  apr_file_write(et->wake_write, &c, &nbytes);
+}
+
+//*************************************************************
+// hc_engine_schedule - Places the connection on its engine thread's
+//    ready list
+//*************************************************************
+
+void hc_engine_schedule(Host_connection_t *hc)
+{
+  Hc_engine_thread_t *et = hc->et;
+
+  apr_thread_mutex_lock(et->lock);
+  if ((hc->scheduled == 0) && (hc->engine_closing == 0)) {
+     hc->scheduled = 1;
+     push(et->ready, (void *)hc);
+     _hc_engine_wakeup(et);
+  }
+  apr_thread_mutex_unlock(et->lock);
+}
+
+//*************************************************************
+// hc_engine_notify - Schedules an idle connection on the depot to 
+//    pick up new work.  A reserved connection is only used if all the
+//    others are full.
+//     NOTE: hp->lock should be held
+//*************************************************************
+
+void hc_engine_notify(Host_portal_t *hp)
+{
+  Host_connection_t *hc, *reserved;
+
+  reserved = NULL;
+  move_to_top(hp->conn_list);
+  while ((hc = (Host_connection_t *)get_ele_data(hp->conn_list)) != NULL) {
+     if ((hc->et != NULL) && (hc->state == HC_STATE_RUNNING) && (hc_pipeline_full(hc) == 0)) {
+        if (hc->reserved == 0) {
+           hc_engine_schedule(hc);
+           return;
+        } else if (reserved == NULL) {
+           reserved = hc;
+        }
+     }
+     move_down(hp->conn_list);
+  }
+
+  if (reserved != NULL) hc_engine_schedule(reserved);
+}
+
+//*************************************************************
+// hc_engine_request_close - Flags the connection to close and 
+//    returns without waiting.  The engine places the connection on
+//    the hportal's closed que for reaping.
+//*************************************************************
+
+void hc_engine_request_close(Host_connection_t *hc)
+{
+  lock_hc(hc);
+  hc->shutdown_request = 1;
+  unlock_hc(hc);
+
+  hc_engine_schedule(hc);
+}
+
+//*************************************************************
+// hc_engine_close_wait - Closes the connection, waits for the 
+//    engine to release it, and destroys it.  This should never be 
+//    called from an engine thread.
+//*************************************************************
+
+void hc_engine_close_wait(Host_connection_t *hc)
+{
+  Host_portal_t *hp = hc->hp;
+
+  log_printf(15, "hc_engine_close_wait: Closing ns=%d\n", ns_getid(hc->ns));
+
+  hportal_lock(hp);
+  if (hc->state == HC_STATE_CLOSED) {  //** Already on the closed que
+     hportal_unlock(hp);
+     return;
+  }
+
+  hc->close_waiter = 1;
+  lock_hc(hc);
+  hc->shutdown_request = 1;
+  unlock_hc(hc);
+  hc_engine_schedule(hc);
+
+  while (hc->state != HC_STATE_CLOSED) {
+     hportal_wait(hp, 1);
+  }
+  hportal_unlock(hp);
+
+  destroy_host_connection(hc);
+}
+
+//*************************************************************
+// hc_engine_retire - Called by hc_release() once the connection's work
+//    has been handed back.  The owning engine thread removes it from
+//    the hportal after it's done with its poll results and run list
+//    so nothing references the connection when it's reaped.
+//*************************************************************
+
+void hc_engine_retire(Host_connection_t *hc)
+{
+  Hc_engine_thread_t *et = hc->et;
+
+  apr_thread_mutex_lock(et->lock);
+  push(et->closed, (void *)hc);
+  _hc_engine_wakeup(et);
+  apr_thread_mutex_unlock(et->lock);
+}
+
+//*************************************************************
+// hc_engine_close - Closes the connection and hands any remaining
+//    work back to the hportal.  After this call the connection 
+//    should no longer be touched by the engine.
+//*************************************************************
+
+void hc_engine_close(Hc_engine_thread_t *et, Host_connection_t *hc, Hportal_stack_op_t *hsop)
+{
+  Hportal_context_t *hpc = hc->hp->context;
+  Host_connection_t *shc;
+
+  log_printf(5, "hc_engine_close: Total commands processed: %d (ns=%d, host=%s:%d)\n", 
+       hc->cmd_count, ns_getid(hc->ns), hc->hp->host, hc->hp->port);
+
+  if (hc->in_pollset == 1) {
+     apr_pollset_remove(et->pollset, &(hc->pfd));
+     hc->in_pollset = 0;
+  }
+
+  if (hc->engine_idle == 1) {
+     hc->engine_idle = 0;
+     apr_atomic_dec32(&(hc->hp->engine_idle));
+  }
+
+  lock_hc(hc);
+  if (hsop != NULL) hc->idle_close = 0;
+  _hc_close_ns(hc);
+  hc->curr_workload = 0;
+  hc->shutdown_request = 1;
+  unlock_hc(hc);
+
+  apr_thread_mutex_lock(et->lock);
+  move_to_ptr(et->conns, hc->engine_pos);
+  delete_current(et->conns, 1, 0);
+  et->n_conn--;
+  hc->engine_closing = 1;  //** No more scheduling
+  if (hc->scheduled == 1) {  //** and pull it off the ready list
+     move_to_top(et->ready);
+     while ((shc = (Host_connection_t *)get_ele_data(et->ready)) != NULL) {
+        if (shc == hc) {
+           delete_current(et->ready, 1, 0);
+           break;
+        }
+        move_down(et->ready);
+     }
+     hc->scheduled = 0;
+  }
+  apr_thread_mutex_unlock(et->lock);
+
+  modify_hpc_thread_count(hpc, -1);
+
+  hc_release(hc, hsop, hc->start_cmds_processed);
+}
+
+//*************************************************************
+// hc_engine_step - Drives the connection as far as it can go without
+//    waiting on the depot.  Completed responses are processed, new 
+//    commands are sent if the workload allows, and the socket is
+//    (un)registered with the pollset depending on if responses are
+//    outstanding.  Runs on a data worker.  Returns 1 if the connection
+//    was closed and should no longer be touched.
+//*************************************************************
+
+int hc_engine_step(Hc_engine_thread_t *et, Host_connection_t *hc, int do_check)
+{
+  Host_portal_t *hp = hc->hp;
+  Hportal_context_t *hpc = hp->context;
+  NetStream_t *ns = hc->ns;
+  Hportal_stack_op_t *hsop;
+  int finished, psize, shutdown, pollable, full;
+
+  if (hc->state == HC_STATE_CLOSED) return(1);
+
+  if (hc->state == HC_STATE_CONNECT) {  //** Check if the connect worker is done
+     lock_hc(hc);
+     finished = hc->connect_done;
+     unlock_hc(hc);
+     if (finished == 0) return(0);
+
+     hc->state = HC_STATE_RUNNING;
+     if (hc->net_connect_status != 0) {
+        hc_engine_close(et, hc, NULL);
+        return(1);
+     }
+
+     hc->pfd.p = hc->mpool;
+     hc->pfd.desc_type = APR_POLL_SOCKET;
+     hc->pfd.reqevents = APR_POLLIN;
+     hc->pfd.rtnevents = 0;
+     hc->pfd.desc.s = ns_poll_fd(ns);
+     hc->pfd.client_data = (void *)hc;
+  }
+
+  if (do_check == 1) {
+     log_printf(15, "hc_engine_step: Checking if we need more connections. ns=%d\n", ns_getid(ns));
+     check_hportal_connections(hp);
+  }
+
+  //** Sockets that can't be polled are serviced in a blocking fashion.
+  //** This only ties up the connection's own worker.
+  pollable = (hc->pfd.desc.s == NULL) ? 0 : 1;
+
+  do {
+     //** Process any responses that are ready
+     finished = 0;
+     hsop = NULL;
+     while (finished == 0) {
+        lock_hc(hc);
+        move_to_bottom(hc->pending_stack);
+        hsop = (Hportal_stack_op_t *)get_ele_data(hc->pending_stack);
+        unlock_hc(hc);
+
+        if (hsop == NULL) break;
+        if ((pollable == 1) && (hc->readable == 0) && (ns_read_pending(ns) == 0)) {
+           hsop = NULL;
+           break;
+        }
+
+        hc->readable = 0;
+        finished = hc_recv_op(hc, hsop);
+     }
+
+     if (finished == 1) {
+        hc_engine_close(et, hc, hsop);
+        return(1);
+     }
+
+     //** Send new commands while the workload allows
+     lock_hc(hc);
+     shutdown = hc->shutdown_request;
+     unlock_hc(hc);
+
+     finished = hpc->imp->hp_ok;
+     lock_hc(hc);
+     full = hc_pipeline_full(hc);
+     unlock_hc(hc);
+     while ((shutdown == 0) && (finished == hpc->imp->hp_ok) && (full == 0)) {
+        hsop = hc_get_op(hc);
+
+        if (hsop == NULL) break;
+
+        finished = hc_send_batch(hc, &hsop);
+
+        lock_hc(hc);
+        full = hc_pipeline_full(hc);
+        unlock_hc(hc);
+     }
+
+     if (finished != hpc->imp->hp_ok) {
+        hc->curr_op = hsop;  //** Make sure the current op doesn't get lost
+        hc->send_error = 1;
+        hc_engine_close(et, hc, NULL);
+        return(1);
+     }
+
+     //** Check if it's time to close the connection
+     lock_hc(hc);
+     psize = stack_size(hc->pending_stack);
+     if (psize == 0) {
+        if ((time(NULL) - hc->last_used) >= hpc->min_idle) {
+           log_printf(15, "hc_engine_step: ns=%d min_idle(%d) reached.  Shutting down!\n", ns_getid(ns), hpc->min_idle);
+           hc->shutdown_request = 1;
+        }
+        shutdown = hc->shutdown_request;
+     }
+     unlock_hc(hc);
+
+     if ((psize == 0) && (shutdown == 1)) {
+        if (hc->send_error == 0) hc->idle_close = 1;
+        hc_engine_close(et, hc, NULL);
+        return(1);
+     }
+  } while ((pollable == 0) && (psize > 0));
+
+  //** Track if we need a kick to pick up new work.  The que is checked again
+  //** after going idle so a task added while we were marking isn't missed.
+  if ((psize == 0) && (hc->engine_idle == 0)) {
+     hc->engine_idle = 1;
+     apr_atomic_inc32(&(hp->engine_idle));
+     if ((shutdown == 0) && (hportal_que_size(hp) > 0)) hc_engine_schedule(hc);
+  } else if ((psize > 0) && (hc->engine_idle == 1)) {
+     hc->engine_idle = 0;
+     apr_atomic_dec32(&(hp->engine_idle));
+  }
+
+  //** Only poll the socket if we are expecting a response
+  if (pollable == 1) {
+     if ((psize > 0) && (hc->in_pollset == 0)) {
+        apr_pollset_add(et->pollset, &(hc->pfd));
+        hc->in_pollset = 1;
+     } else if ((psize == 0) && (hc->in_pollset == 1)) {
+        apr_pollset_remove(et->pollset, &(hc->pfd));
+        hc->in_pollset = 0;
+     }
+  }
+
+  return(0);
+}
+
+//*************************************************************
+// _hc_engine_claim - Gets the connection ready to be run by a data
+//    worker.  The socket is pulled from the pollset so the engine
+//    thread doesn't keep reporting it while the worker reads.
+//     NOTE: et->lock should be held
+//*************************************************************
+
+void _hc_engine_claim(Hc_engine_thread_t *et, Host_connection_t *hc, int run)
+{
+  hc->busy = 1;
+  hc->run = run;
+  if ((run & HC_RUN_READABLE) != 0) hc->readable = 1;
+  if (hc->in_pollset == 1) {
+     apr_pollset_remove(et->pollset, &(hc->pfd));
+     hc->in_pollset = 0;
+  }
+}
+
+//*************************************************************
+// hc_engine_run - Runs the connection on the calling data worker
+//    until nothing new came in while it was running.
+//*************************************************************
+
+void hc_engine_run(Host_connection_t *hc)
+{
+  Hc_engine_thread_t *et = hc->et;
+  int run;
+
+  do {
+     if (hc_engine_step(et, hc, ((hc->run & HC_RUN_CHECK) != 0) ? 1 : 0) == 1) return;  //** Closed so hands off
+
+     apr_thread_mutex_lock(et->lock);
+     run = hc->rerun;
+     hc->rerun = 0;
+     if (run == 0) {
+        hc->busy = 0;
+     } else {
+        _hc_engine_claim(et, hc, run);
+     }
+     apr_thread_mutex_unlock(et->lock);
+  } while (run != 0);
+}
+
+//*************************************************************
+// _hc_engine_join_exited - Joins any workers that retired.
+//     NOTE: engine->work_lock should be held
+//*************************************************************
+
+void _hc_engine_join_exited(Hc_engine_t *engine)
+{
+  apr_thread_t *th;
+  apr_status_t value;
+
+  while ((th = (apr_thread_t *)pop(engine->exited)) != NULL) {
+     apr_thread_join(&value, th);
+  }
+}
+
+//*************************************************************
+// hc_engine_worker_thread - Data worker.  Runs the connections handed
+//    off by the engine threads.  Exits after sitting idle for
+//    HC_ENGINE_WORKER_IDLE so a burst doesn't leave threads behind.
+//*************************************************************
+
+void *hc_engine_worker_thread(apr_thread_t *th, void *data)
+{
+  Hc_engine_t *engine = (Hc_engine_t *)data;
+  Host_connection_t *hc;
+  apr_thread_t *wth;
+  apr_status_t err;
+
+  apr_thread_mutex_lock(engine->work_lock);
+  while (engine->work_shutdown == 0) {
+     hc = (Host_connection_t *)pop(engine->work_que);
+     if (hc == NULL) {
+        engine->n_idle_workers++;
+        err = apr_thread_cond_timedwait(engine->work_cond, engine->work_lock, apr_time_from_sec(HC_ENGINE_WORKER_IDLE));
+        engine->n_idle_workers--;
+        if ((err == APR_TIMEUP) && (engine->work_shutdown == 0) && (stack_size(engine->work_que) == 0)) {
+           move_to_top(engine->workers);   //** Retire.  The next dispatch joins us
+           while ((wth = (apr_thread_t *)get_ele_data(engine->workers)) != NULL) {
+              if (wth == th) {
+                 delete_current(engine->workers, 1, 0);
+                 break;
+              }
+              move_down(engine->workers);
+           }
+           push(engine->exited, (void *)th);
+           engine->n_workers--;
+           log_printf(15, "hc_engine_worker_thread: Idle worker exiting.  n_workers=%d\n", engine->n_workers);
+           break;
+        }
+        continue;
+     }
+     apr_thread_mutex_unlock(engine->work_lock);
+
+     hc_engine_run(hc);
+
+     apr_thread_mutex_lock(engine->work_lock);
+  }
+  apr_thread_mutex_unlock(engine->work_lock);
+
+  apr_thread_exit(th, 0);
+  return(NULL);
+}
+
+//*************************************************************
+// hc_engine_dispatch - Hands the connection to a data worker.  If a
+//    worker already has it the reasons are just recorded and the worker
+//    runs it again when done.  A new worker is started if all the
+//    existing ones are busy.
+//     NOTE: Only called from the engine thread owning the connection
+//*************************************************************
+
+void hc_engine_dispatch(Hc_engine_thread_t *et, Host_connection_t *hc, int run)
+{
+  Hc_engine_t *engine = et->engine;
+  apr_thread_t *th;
+
+  apr_thread_mutex_lock(et->lock);
+  if (hc->busy == 1) {
+     hc->rerun |= run;
+     apr_thread_mutex_unlock(et->lock);
+     return;
+  }
+  _hc_engine_claim(et, hc, run);
+  apr_thread_mutex_unlock(et->lock);
+
+  apr_thread_mutex_lock(engine->work_lock);
+  _hc_engine_join_exited(engine);
+  move_to_bottom(engine->work_que);
+  insert_below(engine->work_que, (void *)hc);   //** FIFO so connections are served in order
+  if ((stack_size(engine->work_que) > engine->n_idle_workers) && (engine->n_workers < engine->max_workers)) {
+     log_printf(15, "hc_engine_dispatch: Starting data worker %d\n", engine->n_workers);
+     apr_thread_create(&th, NULL, hc_engine_worker_thread, (void *)engine, engine->mpool);
+     push(engine->workers, (void *)th);
+     engine->n_workers++;
+  } else {
+     apr_thread_cond_signal(engine->work_cond);
+  }
+  apr_thread_mutex_unlock(engine->work_lock);
+}
+
+//*************************************************************
+// hc_engine_thread - Main loop for an engine thread
+//*************************************************************
+
+void *hc_engine_thread(apr_thread_t *th, void *data)
+{
+  Hc_engine_thread_t *et = (Hc_engine_thread_t *)data;
+  Hportal_context_t *hpc = et->engine->hpc;
+  Host_connection_t *hc;
+  Stack_t *runq, *reap;
+  const apr_pollfd_t *fds;
+  apr_int32_t i, n;
+  apr_size_t nbytes;
+  Net_timeout_t dt;
+  char buffer[64];
+  time_t check_time;
+  int finished, run;
+
+  log_printf(15, "hc_engine_thread: Starting engine thread %d\n", et->id);
+
+  runq = new_stack();
+  reap = new_stack();
+  set_net_timeout(&dt, 1, 0);
+  check_time = time(NULL) + hpc->check_connection_interval;
+
+  finished = 0;
+  while (finished == 0) {
+     n = 0;
+     if (apr_pollset_poll(et->pollset, dt, &n, &fds) != APR_SUCCESS) n = 0;
+
+     for (i=0; i<n; i++) {
+        hc = (Host_connection_t *)fds[i].client_data;
+        if (hc == NULL) {  //** Wakeup pipe so drain it
+           nbytes = sizeof(buffer);
+           apr_file_read(et->wake_read, buffer, &nbytes);
+        } else {
+           if (hc->run_pending == 0) push(runq, (void *)hc);
+           hc->run_pending |= HC_RUN_READABLE;
+        }
+     }
+
+     //** Pick up everything scheduled from other threads
+     apr_thread_mutex_lock(et->lock);
+     et->wake_pending = 0;
+     while ((hc = (Host_connection_t *)pop(et->ready)) != NULL) {
+        hc->scheduled = 0;
+        if (hc->run_pending == 0) push(runq, (void *)hc);
+        hc->run_pending |= HC_RUN_SCHED;
+     }
+
+     //** Closed connections are handed back after this pass since they can still be on the run list
+     while ((hc = (Host_connection_t *)pop(et->closed)) != NULL) push(reap, (void *)hc);
+
+     //** Periodically visit every connection for idle checks and connection counts
+     if (time(NULL) > check_time) {
+        move_to_top(et->conns);
+        while ((hc = (Host_connection_t *)get_ele_data(et->conns)) != NULL) {
+           if (hc->run_pending == 0) push(runq, (void *)hc);
+           hc->run_pending |= HC_RUN_CHECK;
+           move_down(et->conns);
+        }
+        check_time = time(NULL) + hpc->check_connection_interval;
+     }
+     finished = et->shutdown_request;
+     apr_thread_mutex_unlock(et->lock);
+
+     while ((hc = (Host_connection_t *)pop(runq)) != NULL) {
+        run = hc->run_pending;
+        hc->run_pending = 0;
+        if (hc->state != HC_STATE_CLOSED) hc_engine_dispatch(et, hc, run);
+     }
+
+     while ((hc = (Host_connection_t *)pop(reap)) != NULL) hc_release_finish(hc);
+  }
+
+  free_stack(runq, 0);
+  free_stack(reap, 0);
+
+  log_printf(15, "hc_engine_thread: Exiting engine thread %d\n", et->id);
+
+  apr_thread_exit(th, 0);
+  return(NULL);
+}
+
+//*************************************************************
+// hc_engine_connect_thread - Connect worker.  Makes the connections 
+//    so a slow or dead depot never stalls an engine thread.  As soon
+//    as a connection is made it's scheduled on its engine thread so
+//    it can start taking work.
+//*************************************************************
+
+void *hc_engine_connect_thread(apr_thread_t *th, void *data)
+{
+  Hc_engine_t *engine = (Hc_engine_t *)data;
+  Host_connection_t *hc;
+
+  apr_thread_mutex_lock(engine->connect_lock);
+  while (engine->connect_shutdown == 0) {
+     hc = (Host_connection_t *)pop(engine->connect_que);
+     if (hc == NULL) {
+        apr_thread_cond_wait(engine->connect_cond, engine->connect_lock);
+        continue;
+     }
+     apr_thread_mutex_unlock(engine->connect_lock);
+
+     hc_connect(hc);
+
+     lock_hc(hc);
+     hc->connect_done = 1;
+     unlock_hc(hc);
+     hc_engine_schedule(hc);
+
+     apr_thread_mutex_lock(engine->connect_lock);
+  }
+  apr_thread_mutex_unlock(engine->connect_lock);
+
+  apr_thread_exit(th, 0);
+  return(NULL);
+}
+
+//*************************************************************
+// hc_engine_add - Hands a new connection to the least loaded
+//    engine thread.  The connection is made by a connect worker.
+//*************************************************************
+
+void hc_engine_add(Hc_engine_t *engine, Host_connection_t *hc)
+{
+  Hc_engine_thread_t *et;
+  int i;
+
+  et = &(engine->et[0]);
+  for (i=1; i<engine->n_threads; i++) {
+     if (engine->et[i].n_conn < et->n_conn) et = &(engine->et[i]);
+  }
+
+  log_printf(15, "hc_engine_add: Adding connection to engine thread %d n_conn=%d\n", et->id, et->n_conn);
+
+  hc->et = et;
+  hc->state = HC_STATE_CONNECT;
+  hc->connect_done = 0;
+
+  apr_thread_mutex_lock(et->lock);
+  et->n_conn++;
+  push(et->conns, (void *)hc);
+  hc->engine_pos = get_ptr(et->conns);
+  apr_thread_mutex_unlock(et->lock);
+
+  apr_thread_mutex_lock(engine->connect_lock);
+  move_to_bottom(engine->connect_que);
+  insert_below(engine->connect_que, (void *)hc);   //** FIFO so depots are connected in the order requested
+  apr_thread_cond_signal(engine->connect_cond);
+  apr_thread_mutex_unlock(engine->connect_lock);
+}
+
+//*************************************************************
+// hc_engine_create - Creates and launches the engine threads
+//*************************************************************
+
+Hc_engine_t *hc_engine_create(Hportal_context_t *hpc, int n_threads)
+{
+  Hc_engine_t *engine;
+  Hc_engine_thread_t *et;
+  int i;
+
+  log_printf(15, "hc_engine_create: n_threads=%d\n", n_threads);
+
+  assert((engine = (Hc_engine_t *)malloc(sizeof(Hc_engine_t))) != NULL);
+  assert((engine->et = (Hc_engine_thread_t *)malloc(sizeof(Hc_engine_thread_t)*n_threads)) != NULL);
+  engine->n_threads = n_threads;
+  engine->hpc = hpc;
+  assert(apr_pool_create(&(engine->mpool), NULL) == APR_SUCCESS);
+
+  for (i=0; i<n_threads; i++) {
+     et = &(engine->et[i]);
+     memset(et, 0, sizeof(Hc_engine_thread_t));
+     et->id = i;
+     et->engine = engine;
+     et->conns = new_stack();
+     et->ready = new_stack();
+     et->closed = new_stack();
+     assert(apr_pool_create(&(et->mpool), NULL) == APR_SUCCESS);
+     apr_thread_mutex_create(&(et->lock), APR_THREAD_MUTEX_DEFAULT, et->mpool);
+     assert(apr_pollset_create(&(et->pollset), hpc->max_connections + 16, et->mpool, APR_POLLSET_THREADSAFE) == APR_SUCCESS);  //** Workers (un)register sockets
+
+     //** Add the wakeup pipe
+     assert(apr_file_pipe_create(&(et->wake_read), &(et->wake_write), et->mpool) == APR_SUCCESS);
+     apr_file_pipe_timeout_set(et->wake_read, 0);
+     apr_file_pipe_timeout_set(et->wake_write, 0);
+     et->wake_pfd.p = et->mpool;
+     et->wake_pfd.desc_type = APR_POLL_FILE;
+     et->wake_pfd.reqevents = APR_POLLIN;
+     et->wake_pfd.rtnevents = 0;
+     et->wake_pfd.desc.f = et->wake_read;
+     et->wake_pfd.client_data = NULL;
+     apr_pollset_add(et->pollset, &(et->wake_pfd));
+
+     apr_thread_create(&(et->thread), NULL, hc_engine_thread, (void *)et, et->mpool);
+  }
+
+  //** Launch the connect workers.  There's no point in having more than can connect at once
+  engine->n_connect_threads = (hpc->max_connecting > 0) ? hpc->max_connecting : HC_ENGINE_CONNECT_THREADS;
+  engine->connect_shutdown = 0;
+  engine->connect_que = new_stack();
+  apr_thread_mutex_create(&(engine->connect_lock), APR_THREAD_MUTEX_DEFAULT, engine->mpool);
+  apr_thread_cond_create(&(engine->connect_cond), engine->mpool);
+  assert((engine->connect_thread = (apr_thread_t **)malloc(sizeof(apr_thread_t *)*engine->n_connect_threads)) != NULL);
+  for (i=0; i<engine->n_connect_threads; i++) {
+     apr_thread_create(&(engine->connect_thread[i]), NULL, hc_engine_connect_thread, (void *)engine, engine->mpool);
+  }
+
+  //** The data workers are started as needed
+  engine->work_que = new_stack();
+  engine->workers = new_stack();
+  engine->n_workers = 0;
+  engine->n_idle_workers = 0;
+  engine->exited = new_stack();
+  engine->max_workers = (hpc->engine_workers > 0) ? hpc->engine_workers : HC_ENGINE_WORKERS;
+  engine->work_shutdown = 0;
+  apr_thread_mutex_create(&(engine->work_lock), APR_THREAD_MUTEX_DEFAULT, engine->mpool);
+  apr_thread_cond_create(&(engine->work_cond), engine->mpool);
+
+  return(engine);
+}
+
+//*************************************************************
+// hc_engine_destroy - Shuts down the engine threads.  All the 
+//    connections should already be closed.
+//*************************************************************
+
+void hc_engine_destroy(Hc_engine_t *engine)
+{
+  Hc_engine_thread_t *et;
+  Host_connection_t *hc;
+  apr_thread_t *th;
+  apr_status_t value;
+  int i;
+
+  apr_thread_mutex_lock(engine->connect_lock);
+  engine->connect_shutdown = 1;
+  apr_thread_cond_broadcast(engine->connect_cond);
+  apr_thread_mutex_unlock(engine->connect_lock);
+  for (i=0; i<engine->n_connect_threads; i++) {
+     apr_thread_join(&value, engine->connect_thread[i]);
+  }
+  free(engine->connect_thread);
+  free_stack(engine->connect_que, 0);
+  apr_thread_cond_destroy(engine->connect_cond);
+  apr_thread_mutex_destroy(engine->connect_lock);
+
+  for (i=0; i<engine->n_threads; i++) {
+     et = &(engine->et[i]);
+     apr_thread_mutex_lock(et->lock);
+     et->shutdown_request = 1;
+     _hc_engine_wakeup(et);
+     apr_thread_mutex_unlock(et->lock);
+  }
+
+  for (i=0; i<engine->n_threads; i++) {
+     apr_thread_join(&value, engine->et[i].thread);
+  }
+
+  //** The engine threads are gone so no more work can be handed out
+  apr_thread_mutex_lock(engine->work_lock);
+  engine->work_shutdown = 1;
+  apr_thread_cond_broadcast(engine->work_cond);
+  apr_thread_mutex_unlock(engine->work_lock);
+  while ((th = (apr_thread_t *)pop(engine->workers)) != NULL) {
+     apr_thread_join(&value, th);
+  }
+  _hc_engine_join_exited(engine);
+  free_stack(engine->workers, 0);
+  free_stack(engine->exited, 0);
+  free_stack(engine->work_que, 0);
+  apr_thread_cond_destroy(engine->work_cond);
+  apr_thread_mutex_destroy(engine->work_lock);
+
+  for (i=0; i<engine->n_threads; i++) {
+     et = &(engine->et[i]);
+
+     if (stack_size(et->conns) > 0) {
+        log_printf(1, "hc_engine_destroy: engine thread %d still has %d connections!\n", et->id, stack_size(et->conns));
+     }
+
+     free_stack(et->conns, 0);
+     while ((hc = (Host_connection_t *)pop(et->closed)) != NULL) hc_release_finish(hc);  //** Closed after the thread exited
+     free_stack(et->ready, 0);
+     free_stack(et->closed, 0);
+     apr_pollset_destroy(et->pollset);
+     apr_file_close(et->wake_read);
+     apr_file_close(et->wake_write);
+     apr_thread_mutex_destroy(et->lock);
+     apr_pool_destroy(et->mpool);
+  }
+
+  apr_pool_destroy(engine->mpool);
+  free(engine->et);
+  free(engine);
+}
@@ -52,6 +52,7 @@ Host_connection_t *new_host_connection(apr_pool_t *mpool)
   apr_thread_cond_create(&(hc->send_cond), mpool);
   apr_thread_cond_create(&(hc->recv_cond), mpool);
   hc->pending_stack = new_stack();
+  hc->local_que = new_stack();
   hc->cmd_count = 0;
   hc->curr_workload = 0;
   hc->shutdown_request = 0;
@@ -59,6 +60,28 @@ Host_connection_t *new_host_connection(apr_pool_t *mpool)
   hc->hp = NULL;
   hc->curr_op = NULL;
   hc->last_used = 0;
+  hc->state = HC_STATE_CONNECT;
+  hc->scheduled = 0;
+  hc->run_pending = 0;
+  hc->readable = 0;
+  hc->busy = 0;
+  hc->rerun = 0;
+  hc->run = 0;
+  hc->engine_idle = 0;
+  hc->engine_closing = 0;
+  hc->lost_work = 0;
+  hc->in_pollset = 0;
+  hc->close_waiter = 0;
+  hc->reserved = 0;
+  hc->send_error = 0;
+  hc->idle_close = 0;
+  hc->connect_done = 0;
+  hc->net_connect_status = 0;
+  hc->start_cmds_processed = 0;
+  hc->send_thread = NULL;
+  hc->recv_thread = NULL;
+  hc->engine_pos = NULL;
+  hc->et = NULL;
 
   return(hc);
 }
@@ -71,6 +94,7 @@ void destroy_host_connection(Host_connection_t *hc)
 {
   destroy_netstream(hc->ns);
   free_stack(hc->pending_stack, 0);
+  free_stack(hc->local_que, 0);
   apr_thread_mutex_destroy(hc->lock);
   apr_thread_cond_destroy(hc->send_cond);
   apr_thread_cond_destroy(hc->recv_cond);
@@ -86,6 +110,11 @@ void close_hc(Host_connection_t *hc)
 {
   apr_status_t value;
 
+  if (hc->et != NULL) {  //** Event engine connection so let the engine close it
+     hc_engine_close_wait(hc);
+     return;
+  }
+
   //** Trigger the send thread to shutdown which also closes the recv thread
   log_printf(15, "close_hc: Closing ns=%d\n", ns_getid(hc->ns));
   lock_hc(hc);
@@ -107,7 +136,7 @@ void close_hc(Host_connection_t *hc)
 
    while ((hc2 = (Host_connection_t *)pop(hc->hp->closed_que)) != NULL) {
      if (hc2 != hc) {
-        apr_thread_join(&value, hc2->recv_thread);
+        if (hc2->recv_thread != NULL) apr_thread_join(&value, hc2->recv_thread);
         destroy_host_connection(hc2);
      }
    }
@@ -116,6 +145,21 @@ void close_hc(Host_connection_t *hc)
   destroy_host_connection(hc);
 }
 
+//*************************************************************
+// hc_pipeline_full - Returns 1 if no more ops should be sent on the 
+//   connection until some complete.  The hc lock should be held.
+//*************************************************************
+
+int hc_pipeline_full(Host_connection_t *hc)
+{
+  Hportal_context_t *hpc = hc->hp->context;
+
+  if (hc->curr_workload > hpc->max_workload) return(1);
+  if ((hpc->max_pipeline > 0) && (stack_size(hc->pending_stack) >= hpc->max_pipeline)) return(1);
+
+  return(0);
+}
+
 //*************************************************************
 // check_workload - Waits until the workload is acceptable
 //   before continuing.  It returns the size of the pending stack
@@ -126,7 +170,7 @@ int check_workload(Host_connection_t *hc)
   int psize;
 
   lock_hc(hc);
-  while ((hc->curr_workload > hc->hp->context->max_workload) && (hc->shutdown_request == 0)) {
+  while ((hc_pipeline_full(hc) == 1) && (hc->shutdown_request == 0)) {
      log_printf(15, "check_workload: *workload loop* shutdown_request=%d stack_size=%d curr_workload=%d\n", hc->shutdown_request, stack_size(hc->pending_stack), hc->curr_workload); 
      apr_thread_cond_wait(hc->send_cond, hc->lock); 
   }
@@ -180,36 +224,35 @@ void recv_wait_for_work(Host_connection_t *hc)
 }
 
 //*************************************************************
-// hc_send_thread - Handles the sending phase of a command
+// hc_connect - Makes the connection to the depot and adds the 
+//   connection to the hportal's conn_list
 //*************************************************************
 
-void *hc_send_thread(apr_thread_t *th, void *data)
+void hc_connect(Host_connection_t *hc)
 {
-  Host_connection_t *hc = (Host_connection_t *)data;
   Host_portal_t *hp = hc->hp;  
   NetStream_t *ns = hc->ns;
   Hportal_context_t *hpc = hp->context;
-  Hportal_op_t *hop;
-  Hportal_stack_op_t *hsop;
   Net_timeout_t dt;
-  int finished, psize;
-  int dtime;
 
   //** check if the host is invalid and if so flush the work que
   if (hp->invalid_host == 1) { 
-     log_printf(15, "hc_send_thread: Invalid host to host=%s:%d.  Emptying Que\n", hp->host, hp->port);
+     log_printf(15, "hc_connect: Invalid host to host=%s:%d.  Emptying Que\n", hp->host, hp->port);
      empty_hp_que(hp, hpc->imp->hp_invalid_host);
      hc->net_connect_status = 1;
+  } else if (hportal_sockpool_get(hpc, hp->skey, ns) == 0) {  //** Reuse an idle socket
+     hc->net_connect_status = 0;
   } else {  //** Make the connection
-     set_net_timeout(&dt, 5, 0);
+     set_net_timeout(&dt, hpc->connect_timeout, 0);
+     hpc_connect_slot_get(hpc);
      hc->net_connect_status = hpc->imp->host_connect(ns, hp->connect_context, hp->host, hp->port, dt);
+     hpc_connect_slot_release(hpc);
      if (hc->net_connect_status != 0) {
-        log_printf(5, "hc_send_thread:  Can't connect to %s:%d!, ns=%d\n", hp->host, hp->port, ns_getid(ns));
+        log_printf(5, "hc_connect:  Can't connect to %s:%d!, ns=%d\n", hp->host, hp->port, ns_getid(ns));
      }
   }
 
-  log_printf(15, "hc_send_thread: New connection to host=%s:%d ns=%d\n", hp->host, hp->port, ns_getid(ns));
-  
+  log_printf(15, "hc_connect: New connection to host=%s:%d ns=%d\n", hp->host, hp->port, ns_getid(ns));
 
   //** Store my position in the conn_list **
   hportal_lock(hp);
@@ -217,17 +260,254 @@ void *hc_send_thread(apr_thread_t *th, void *data)
      hp->successful_conn_attempts++;
      hp->failed_conn_attempts = 0;  //** Reset the failed attempts
   } else {
-     log_printf(1, "hc_send_thread: ns=%d failing all commands failed_conn_attempts=%d\n", ns_getid(ns), hp->failed_conn_attempts);
+     log_printf(1, "hc_connect: ns=%d failing all commands failed_conn_attempts=%d\n", ns_getid(ns), hp->failed_conn_attempts);
      hp->failed_conn_attempts++;
   }
   push(hp->conn_list, (void *)hc);
   hc->my_pos = get_ptr(hp->conn_list);
+  hc->start_cmds_processed = hp->cmds_processed; 
   hportal_unlock(hp);
+}
+
+//*************************************************************
+// _hc_close_ns - Closes the connection's socket.  If the connection was
+//   closed for being idle the socket is parked in the idle pool instead.
+//   NOTE: The hc lock should be held
+//*************************************************************
+
+void _hc_close_ns(Host_connection_t *hc)
+{
+  Host_portal_t *hp = hc->hp;
+  Hportal_context_t *hpc = hp->context;
+
+  if ((hc->idle_close == 1) && (hc->send_error == 0) && (hc->net_connect_status == 0) && 
+      (stack_size(hc->pending_stack) == 0)) {
+     if (hportal_sockpool_put(hpc, hp->skey, hc->ns) == 0) return;
+  }
+
+  hpc->imp->host_close_connection(hc->ns);
+}
+
+//*************************************************************
+// hc_send_op - Sends the command and performs the "send" phase
+//   of the op.  On success the op is placed on the pending stack
+//   for the recv side and hp_ok is returned.
+//*************************************************************
+
+int hc_send_op(Host_connection_t *hc, Hportal_stack_op_t *hsop)
+{
+  NetStream_t *ns = hc->ns;
+  Hportal_context_t *hpc = hc->hp->context;
+  Hportal_op_t *hop = hpc->imp->get_hp_op(hsop->op);
+  int finished = hpc->imp->hp_ok;
+
+  log_printf(15, "hc_send_op: Processing new command.. ns=%d\n", ns_getid(ns));
+
+  hop->start_time = hp_time_now();  //** This is changed in the recv phase also
+  hop->end_time = hop->start_time + hop->timeout_ns;
+  hop->sent_time = hop->start_time;
+  if (hop->send_command != NULL) finished = hop->send_command(hsop->op, ns);
+  if (finished == hpc->imp->hp_ok) {
+     lock_hc(hc);
+     hc->last_used = time(NULL);  //** Update  the time.  The recv side does this also
+     hc->curr_workload += hop->workload;  //** Inc the current workload
+     unlock_hc(hc);
+
+     if (hop->send_phase != NULL) finished = hop->send_phase(hsop->op, ns);
+
+     if (finished == hpc->imp->hp_ok) {
+        lock_hc(hc);
+        hc->last_used = time(NULL);  //** Update  the time.  The recv side does this also
+        push(hc->pending_stack, (void *)hsop);  //** Push onto recving stack
+        hc_recv_signal(hc); //** and notify recv thread
+        unlock_hc(hc);
+     }
+  }
+
+  return(finished);
+}
+
+//*************************************************************
+// hc_send_batch - Sends *hsop followed by any other ops that are 
+//   ready, up to batch_commands in all.  Their command lines are held 
+//   by the ns and flushed together so a burst of small ops costs a
+//   single write.  On return *hsop is NULL if everything was sent or
+//   the op that failed.  The recv side parses the responses in order
+//   from the pending stack as usual.
+//*************************************************************
+
+int hc_send_batch(Host_connection_t *hc, Hportal_stack_op_t **hsop)
+{
+  NetStream_t *ns = hc->ns;
+  Hportal_context_t *hpc = hc->hp->context;
+  Hportal_op_t *hop;
+  hp_time_t end_time;
+  int finished, n, full, shutdown;
+
+  if (hpc->batch_commands <= 1) {
+     finished = hc_send_op(hc, *hsop);
+     if (finished == hpc->imp->hp_ok) *hsop = NULL;
+     return(finished);
+  }
+
+  ns_batch_begin(ns);
+
+  n = 0;
+  end_time = 0;
+  do {
+     finished = hc_send_op(hc, *hsop);
+     if (finished != hpc->imp->hp_ok) break;
+
+     hop = hpc->imp->get_hp_op((*hsop)->op);
+     if ((end_time == 0) || (hop->end_time < end_time)) end_time = hop->end_time;
+     *hsop = NULL;  //** It's on the pending stack now
+     n++;
+     if (n >= hpc->batch_commands) break;
+
+     lock_hc(hc);
+     full = hc_pipeline_full(hc);
+     shutdown = hc->shutdown_request;
+     unlock_hc(hc);
+     if ((full == 1) || (shutdown == 1)) break;
+
+     *hsop = hc_get_op(hc);
+  } while (*hsop != NULL);
+
+  //** Flush the batch using the tightest deadline in it
+  if (ns_batch_end(ns, end_time) != NS_OK) {
+     log_printf(5, "hc_send_batch: ns=%d Failed flushing %d commands!\n", ns_getid(ns), n);
+     if (finished == hpc->imp->hp_ok) finished = hpc->imp->dead_connection;
+  }
+
+  log_printf(15, "hc_send_batch: ns=%d sent %d commands finished=%d\n", ns_getid(ns), n, finished);
+
+  return(finished);
+}
+
+//*************************************************************
+// hc_steal_ops - Takes half of the unsent ops from the sibling
+//   connection with the largest local que.  The first op is
+//   returned and the rest are placed on my local que.
+//*************************************************************
+
+Hportal_stack_op_t *hc_steal_ops(Host_connection_t *hc)
+{
+  Host_portal_t *hp = hc->hp;  
+  Host_connection_t *shc, *victim;
+  Hportal_stack_op_t *hsop, *first;
+  Stack_t *stolen;
+  int n, best, victim_id;
+
+  first = NULL;
+  victim = NULL;
+  best = 0;
+
+  //** Holding the hp lock keeps the siblings from being removed 
+  hportal_lock(hp);
+  move_to_top(hp->conn_list);
+  while ((shc = (Host_connection_t *)get_ele_data(hp->conn_list)) != NULL) {
+     if (shc != hc) {
+        lock_hc(shc);
+        n = stack_size(shc->local_que);
+        unlock_hc(shc);
+        if (n > best) { best = n; victim = shc; }
+     }
+     move_down(hp->conn_list);
+  }
+
+  if (victim == NULL) {
+     hportal_unlock(hp);
+     return(NULL);
+  }
+
+  //** Take the most recently claimed ops off the bottom of the victim's que
+  stolen = new_stack();
+  lock_hc(victim);
+  n = (stack_size(victim->local_que) + 1) / 2;
+  while (n > 0) {
+     move_to_bottom(victim->local_que);
+     hsop = (Hportal_stack_op_t *)get_ele_data(victim->local_que);
+     if (hsop == NULL) break;
+     delete_current(victim->local_que, 1, 0);
+     push(stolen, (void *)hsop);
+     n--;
+  }
+  victim_id = ns_getid(victim->ns);  //** victim can be closed once the locks are released
+  unlock_hc(victim);
+  hportal_unlock(hp);
+
+  log_printf(15, "hc_steal_ops: ns=%d stole %d ops from ns=%d\n", ns_getid(hc->ns), stack_size(stolen), victim_id);
+
+  //** Keep the original ordering with the oldest op returned
+  first = (Hportal_stack_op_t *)pop(stolen);
+  if (stack_size(stolen) > 0) {
+     lock_hc(hc);
+     while ((hsop = (Hportal_stack_op_t *)pop(stolen)) != NULL) {
+        move_to_bottom(hc->local_que);
+        insert_below(hc->local_que, (void *)hsop);
+     }
+     unlock_hc(hc);
+  }
+  free_stack(stolen, 0);
+
+  return(first);
+}
+
+//*************************************************************
+// hc_get_op - Gets the next op to send.  My local que is used first 
+//   followed by a batch claimed from the depot que.  If the depot 
+//   que is empty work is stolen from a sibling connection.  Reserved
+//   connections only take high priority ops one at a time.
+//*************************************************************
+
+Hportal_stack_op_t *hc_get_op(Host_connection_t *hc)
+{
+  Host_portal_t *hp = hc->hp;  
+  Hportal_stack_op_t *hsop, *next;
+  int i;
+
+  if (hc->reserved == 1) return(get_hportal_op_prio(hp, HP_PRIO_HIGH));
+
+  lock_hc(hc);
+  hsop = (Hportal_stack_op_t *)pop(hc->local_que);
+  unlock_hc(hc);
+  if (hsop != NULL) return(hsop);
+
+  hsop = get_hportal_op(hp);
+  if (hsop == NULL) return(hc_steal_ops(hc));
+
+  //** Claim a few more while I'm at it
+  for (i=1; i<hp->context->claim_batch; i++) {
+     next = get_hportal_op(hp);
+     if (next == NULL) break;
+     lock_hc(hc);
+     move_to_bottom(hc->local_que);
+     insert_below(hc->local_que, (void *)next);
+     unlock_hc(hc);
+  }
+
+  return(hsop);
+}
+
+//*************************************************************
+// hc_send_thread - Handles the sending phase of a command
+//*************************************************************
+
+void *hc_send_thread(apr_thread_t *th, void *data)
+{
+  Host_connection_t *hc = (Host_connection_t *)data;
+  Host_portal_t *hp = hc->hp;  
+  NetStream_t *ns = hc->ns;
+  Hportal_context_t *hpc = hp->context;
+  Hportal_stack_op_t *hsop;
+  int finished, psize;
+  int dtime;
+
+  hc_connect(hc);
 
   //** Now we start the main loop  
-  hsop = NULL; hop = NULL;
+  hsop = NULL;
   finished = hpc->imp->hp_ok;
-  set_net_timeout(&dt, 1, 0);
 
   if (hc->net_connect_status != 0) finished = hpc->imp->dead_connection;  //** If connect() failed err out
   while (finished == hpc->imp->hp_ok) {
@@ -235,52 +515,30 @@ void *hc_send_thread(apr_thread_t *th, void *data)
      psize = check_workload(hc);
 
      //** Now get the next command **
-     hportal_lock(hp);
-     
-     hsop = _get_hportal_op(hp);
+     hsop = hc_get_op(hc);
      if (hsop == NULL) { 
         lock_hc(hc);
         dtime = hpc->min_idle + (hc->last_used - time(NULL));
         unlock_hc(hc);
         if (dtime > 1) dtime = 1;  //** Sometimes the signals don't quite make it
         log_printf(15, "hc_send_thread: No commands so sleeping.. ns=%d time=" TT " max_wait=%d\n", ns_getid(ns), time(NULL), dtime);
-        hportal_wait(hp, dtime);    //** Wait for a new task
+        hportal_lock(hp);
+        hsop = hportal_wait_for_work(hp, dtime, hc_max_prio(hc));    //** Wait for a new task
         hportal_unlock(hp);
-     } else { //** Got one so let's process it
-        hportal_unlock(hp); 
-        hop = hpc->imp->get_hp_op(hsop->op);
+     }
 
-        log_printf(15, "hc_send_thread: Processing new command.. ns=%d\n", ns_getid(ns));
-
-        hop->start_time = time(NULL);  //** This is changed in the recv phase also
-        hop->end_time = hop->start_time + hop->timeout;
-        if (hop->send_command != NULL) finished = hop->send_command(hsop->op, ns);
-        if (finished == hpc->imp->hp_ok) {
-           lock_hc(hc);
-           hc->last_used = time(NULL);  //** Update  the time.  The recv thread does this also
-           hc->curr_workload += hop->workload;  //** Inc the current workload
-           unlock_hc(hc);
-
-           if (hop->send_phase != NULL) finished = hop->send_phase(hsop->op, ns);
-
-           if (finished == hpc->imp->hp_ok) {
-              lock_hc(hc);
-              hc->last_used = time(NULL);  //** Update  the time.  The recv thread does this also
-              push(hc->pending_stack, (void *)hsop);  //** Push onto recving stack
-              hc_recv_signal(hc); //** and notify recv thread
-              unlock_hc(hc);
-              hsop = NULL;  //** It's on the stack so don't accidentally add it twice if there's a problem
-              hop = NULL;
-           }
-        }
+     if (hsop != NULL) { //** Got one so let's process it along with any others that are ready
+        finished = hc_send_batch(hc, &hsop);  //** hsop is NULL if it's on the stack so it's not added twice if there's a problem
      }
 
      lock_hc(hc);
+     if (finished != hpc->imp->hp_ok) hc->send_error = 1;
 
      if (stack_size(hc->pending_stack) == 0) {
         dtime = time(NULL) - hc->last_used; //** Exit if not busy
         if (dtime >= hpc->min_idle) {
            hc->shutdown_request = 1;
+           if (hc->send_error == 0) hc->idle_close = 1;
            log_printf(15, "hc_send_thread: ns=%d min_idle(%d) reached.  Shutting down! dtime=%d\n", 
               ns_getid(ns), hpc->min_idle, dtime);
         }
@@ -309,6 +567,178 @@ void *hc_send_thread(apr_thread_t *th, void *data)
   return(NULL);
 }
 
+//*************************************************************
+// hc_recv_op - Performs the recv phase for the op at the bottom
+//   of the pending stack and completes it.  Returns 1 if the 
+//   connection should be closed and 0 otherwise.  On a close
+//   the op is *not* completed and should be retried.
+//*************************************************************
+
+int hc_recv_op(Host_connection_t *hc, Hportal_stack_op_t *hsop)
+{
+  NetStream_t *ns = hc->ns;
+  Host_portal_t *hp = hc->hp;  
+  Hportal_context_t *hpc = hp->context;
+  Hportal_op_t *hop = hpc->imp->get_hp_op(hsop->op);
+  int finished, status;
+  int64_t nbytes;
+  hp_time_t latency;
+
+  finished = 0;
+  status = hpc->imp->hp_ok;        
+  hop->start_time = hp_time_now();  //**Start the timer
+  hop->end_time = hop->start_time + hop->timeout_ns;
+
+  if (hop->recv_phase != NULL) status = hop->recv_phase(hsop->op, ns);        
+
+  //** dec the current workload
+  lock_hc(hc);
+  hc->last_used = time(NULL);
+  hc->curr_workload -= hop->workload;  
+  move_to_bottom(hc->pending_stack);
+  delete_current(hc->pending_stack, 1, 0);
+  hc_send_signal(hc);  //** Wake up send_thread if needed
+  unlock_hc(hc);
+
+  if (status == hpc->imp->hp_retry_dead_socket) {
+     log_printf(15, "hc_recv_op:  Dead socket so shutting down ns=%d\n", ns_getid(ns));
+     finished = 1;
+  } else if ((status == hpc->imp->hp_timeout) && (hop->retry_count > 0)) {
+     hop->retry_count--;
+     log_printf(15, "hc_recv_op: Command timed out.  Retrying.. retry_count=%d  ns=%d\n", hop->retry_count, ns_getid(ns));
+     finished = 1;
+  } else {
+     log_printf(15, "hc_recv_op:  marking op as completed status=%d retry_count=%d ns=%d\n", status, hop->retry_count, ns_getid(ns));
+     nbytes = hop->workload;
+     latency = hp_time_now() - hop->sent_time;
+     oplist_mark_completed(hsop->oplist, hsop->op, status);
+     destroy_hportal_op(hsop);
+
+     //**Update the number of commands processed **
+     lock_hc(hc);
+     hc->cmd_count++; 
+     unlock_hc(hc);
+
+     hportal_lock(hp);
+     hp->cmds_processed++; 
+     if (status == hpc->imp->hp_ok) hportal_op_completed(hp, nbytes, latency);
+     hportal_unlock(hp);
+  }
+
+  return(finished);
+}
+
+//*************************************************************
+// hc_release - Resubmits any outstanding tasks and removes the
+//   closed connection from the hportal.  hsop is the op being 
+//   processed by the recv side when the connection was closed.
+//   Engine connections are only removed once the engine thread
+//   has dropped all its references.
+//*************************************************************
+
+void hc_release(Host_connection_t *hc, Hportal_stack_op_t *hsop, int64_t start_cmds_processed)
+{
+  NetStream_t *ns = hc->ns;
+  Host_portal_t *hp = hc->hp;  
+  Hportal_context_t *hpc = hp->context;
+  Hportal_op_t *hop;  
+  int64_t cmds_processed;  
+  int status;
+
+  status = 0;  //** This is used to decide ifthe connection was killed
+
+  //** Push any existing commands to be retried back on the stack **
+  if (hc->net_connect_status != 0) {  //** The connection failed
+     hportal_lock(hp);
+     cmds_processed = start_cmds_processed - hp->cmds_processed; 
+     if (cmds_processed == 0) {  //** Nothing was processed
+        if (hp->n_conn == 0) {  //** I'm the last thread to try and fail to connect so fail all the tasks
+           _hp_fail_tasks(hp, hpc->imp->hp_cant_connect);
+        } else if (hp->failed_conn_attempts > hp->abort_conn_attempts) { //** Can't connect so fail
+           log_printf(1, "hc_release: ns=%d failing all commands failed_conn_attempts=%d\n", ns_getid(ns), hp->failed_conn_attempts);
+           _hp_fail_tasks(hp, hpc->imp->hp_cant_connect);
+        }       
+     }
+     hportal_unlock(hp);
+  } else {
+     log_printf(15, "hc_release: ns=%d stack_size=%d\n", ns_getid(ns), stack_size(hc->pending_stack));
+
+     if (hc->curr_op != NULL) {  //** This is from the sending side
+        log_printf(15, "hc_release: ns=%d Pushing sending thread task on stack\n", ns_getid(ns));
+        submit_hportal(hp, hc->curr_op->oplist, hc->curr_op->op, 1);
+        destroy_hportal_op(hc->curr_op);
+        hc->curr_op = NULL;
+        status = 1;
+     }
+     if (hsop != NULL) {  //** This is my command 
+        log_printf(15, "hc_release: ns=%d Pushing current recving task on stack\n", ns_getid(ns));
+        hop = hpc->imp->get_hp_op(hsop->op);
+        hop->retry_count--;  //** decr in case this command is a problem
+        submit_hportal(hp, hsop->oplist, hsop->op, 1);
+        destroy_hportal_op(hsop);
+        status = 1;
+     }
+
+     //** and everything else on the pending_stack
+     while ((hsop = (Hportal_stack_op_t *)pop(hc->pending_stack)) != NULL) {
+        submit_hportal(hp, hsop->oplist, hsop->op, 1);
+        destroy_hportal_op(hsop);
+        status = 1;
+     }
+  }
+
+  //** Return any claimed ops that were never sent
+  lock_hc(hc);
+  while ((hsop = (Hportal_stack_op_t *)pop(hc->local_que)) != NULL) {
+     unlock_hc(hc);
+     submit_hportal(hp, hsop->oplist, hsop->op, 1);
+     destroy_hportal_op(hsop);
+     lock_hc(hc);
+  }
+  unlock_hc(hc);
+
+  hc->lost_work = status;
+  if (hc->et != NULL) {
+     hc_engine_retire(hc);
+  } else {
+     hc_release_finish(hc);
+  }
+}
+
+//*************************************************************
+// hc_release_finish - Removes the connection from the hportal and
+//   places it on the closed que for reaping.  The connection
+//   can be freed as soon as this is called.
+//*************************************************************
+
+void hc_release_finish(Host_connection_t *hc)
+{
+  Host_portal_t *hp = hc->hp;  
+  Hportal_context_t *hpc = hp->context;
+  int status = hc->lost_work;
+
+  hportal_lock(hp);
+  hp->n_conn--;
+  if (hc->reserved == 1) hp->n_reserved--;
+  move_to_ptr(hp->conn_list, hc->my_pos);
+  delete_current(hp->conn_list, 1, 0);
+  hc->state = HC_STATE_CLOSED;
+  if (hc->close_waiter == 0) {
+     push(hp->closed_que, (void *)hc); //** place myself on the closed que for reaping
+  } else {
+     hportal_signal(hp);  //** close_hc() will destroy the connection
+  }
+
+  if (status == 1) {  //** My connection was lost so update tuning params
+     hp->stable_conn = hp->n_conn;
+     if (hp->stable_conn <= 0) hp->stable_conn = 1;
+     hp->pause_until = time(NULL) + hpc->wait_stable_time;
+  }
+  hportal_unlock(hp);
+
+  check_hportal_connections(hp);
+}
+
 //*************************************************************
 // hc_recv_thread - Handles the recving phase of a command
 //*************************************************************
@@ -321,12 +751,10 @@ void *hc_recv_thread(apr_thread_t *th, void *data)
   Hportal_context_t *hpc = hp->context;
   apr_status_t value;
 
-  int64_t start_cmds_processed, cmds_processed;  
+  int64_t start_cmds_processed;  
   time_t check_time;
-  int finished, status;
-  Net_timeout_t dt;  
+  int finished;
   Hportal_stack_op_t *hsop;  
-  Hportal_op_t *hop;  
 
   log_printf(15, "hc_recv_thread: New thread started! ns=%d\n", ns_getid(ns));
 
@@ -335,8 +763,6 @@ void *hc_recv_thread(apr_thread_t *th, void *data)
   start_cmds_processed = hp->cmds_processed; 
   hportal_unlock(hp);
 
-  set_net_timeout(&dt, 1, 0);
-
   finished = 0;
   check_time = time(NULL) + hpc->check_connection_interval;
 
@@ -347,44 +773,7 @@ void *hc_recv_thread(apr_thread_t *th, void *data)
      unlock_hc(hc);
 
      if (hsop != NULL) {
-        hop = hpc->imp->get_hp_op(hsop->op);
-
-        status = hpc->imp->hp_ok;        
-        hop->start_time = time(NULL);  //**Start the timer
-        hop->end_time = hop->start_time + hop->timeout;
-
-        if (hop->recv_phase != NULL) status = hop->recv_phase(hsop->op, ns);        
-
-        //** dec the current workload
-        lock_hc(hc);
-        hc->last_used = time(NULL);
-        hc->curr_workload -= hop->workload;  
-        move_to_bottom(hc->pending_stack);
-        delete_current(hc->pending_stack, 1, 0);
-        hc_send_signal(hc);  //** Wake up send_thread if needed
-        unlock_hc(hc);
-
-        if (status == hpc->imp->hp_retry_dead_socket) {
-           log_printf(15, "hc_recv_thread:  Dead socket so shutting down ns=%d\n", ns_getid(ns));
-           finished = 1;
-        } else if ((status == hpc->imp->hp_timeout) && (hop->retry_count > 0)) {
-           hop->retry_count--;
-           log_printf(15, "hc_recv_thread: Command timed out.  Retrying.. retry_count=%d  ns=%d\n", hop->retry_count, ns_getid(ns));
-           finished = 1;
-        } else {
-           log_printf(15, "hc_recv_thread:  marking op as completed status=%d retry_count=%d ns=%d\n", status, hop->retry_count, ns_getid(ns));
-           oplist_mark_completed(hsop->oplist, hsop->op, status);
-           free(hsop);
-
-           //**Update the number of commands processed **
-           lock_hc(hc);
-           hc->cmd_count++; 
-           unlock_hc(hc);
-
-           hportal_lock(hp);
-           hp->cmds_processed++; 
-           hportal_unlock(hp);
-        }
+        finished = hc_recv_op(hc, hsop);
      } else {
        lock_hc(hc);
        finished = hc->shutdown_request;
@@ -409,7 +798,8 @@ void *hc_recv_thread(apr_thread_t *th, void *data)
   //** Make sure and trigger the send if their was a problem **
   lock_hc(hc);
 //  if (finished != hpc->imp->hp_retry_dead_socket) { 
-      hpc->imp->host_close_connection(ns);   //** there was an error so kill things
+      if (hsop != NULL) hc->idle_close = 0;  //** Closed in the middle of a command
+      _hc_close_ns(hc);   //** there was an error so kill things
       hc->curr_workload = 0;
       hc->shutdown_request = 1;
 //  }
@@ -423,62 +813,8 @@ void *hc_recv_thread(apr_thread_t *th, void *data)
   //** Wait for send thread to complete **  
   apr_thread_join(&value, hc->send_thread);
 
-  status = 0;  //** This is used to decide ifthe connection was killed
-
-  //** Push any existing commands to be retried back on the stack **
-  if (hc->net_connect_status != 0) {  //** The connection failed
-     hportal_lock(hp);
-     cmds_processed = start_cmds_processed - hp->cmds_processed; 
-     if (cmds_processed == 0) {  //** Nothing was processed
-        if (hp->n_conn == 0) {  //** I'm the last thread to try and fail to connect so fail all the tasks
-           _hp_fail_tasks(hp, hpc->imp->hp_cant_connect);
-        } else if (hp->failed_conn_attempts > hp->abort_conn_attempts) { //** Can't connect so fail
-           log_printf(1, "hc_recv_thread: ns=%d failing all commands failed_conn_attempts=%d\n", ns_getid(ns), hp->failed_conn_attempts);
-           _hp_fail_tasks(hp, hpc->imp->hp_cant_connect);
-        }       
-     }
-     hportal_unlock(hp);
-  } else {
-     log_printf(15, "hc_recv_thread: ns=%d stack_size=%d\n", ns_getid(ns), stack_size(hc->pending_stack));
-
-     if (hc->curr_op != NULL) {  //** This is from the sending thread
-        log_printf(15, "hc_recv_thread: ns=%d Pushing sending thread task on stack\n", ns_getid(ns));
-        submit_hportal(hp, hc->curr_op->oplist, hc->curr_op->op, 1);
-        free(hc->curr_op);
-        status = 1;
-     }
-     if (hsop != NULL) {  //** This is my command 
-        log_printf(15, "hc_recv_thread: ns=%d Pushing current recving task on stack\n", ns_getid(ns));
-        hop = hpc->imp->get_hp_op(hsop->op);
-        hop->retry_count--;  //** decr in case this command is a problem
-        submit_hportal(hp, hsop->oplist, hsop->op, 1);
-        free(hsop);
-        status = 1;
-     }
-
-     //** and everything else on the pending_stack
-     while ((hsop = (Hportal_stack_op_t *)pop(hc->pending_stack)) != NULL) {
-        submit_hportal(hp, hsop->oplist, hsop->op, 1);
-        free(hsop);
-        status = 1;
-     }
-  }
-
-  //** Now remove myself from the hportal
-  hportal_lock(hp);
-  hp->n_conn--;
-  move_to_ptr(hp->conn_list, hc->my_pos);
-  delete_current(hp->conn_list, 1, 0);
-  push(hp->closed_que, (void *)hc); //** place myself on the closed que for reaping
-
-  if (status == 1) {  //** My connection was lost so update tuning params
-     hp->stable_conn = hp->n_conn;
-     if (hp->stable_conn <= 0) hp->stable_conn = 1;
-     hp->pause_until = time(NULL) + hpc->wait_stable_time;
-  }
-  hportal_unlock(hp);
-
-  check_hportal_connections(hp);
+  //** Retry any outstanding commands and remove myself from the hportal
+  hc_release(hc, hsop, start_cmds_processed);
 
   log_printf(15, "hc_recv_thread: Exiting routine! ns=%d\n", ns_getid(ns));
 
@@ -492,7 +828,7 @@ void *hc_recv_thread(apr_thread_t *th, void *data)
 // create_host_connection - Creeats a new depot connection/thread
 //*************************************************************
 
-int create_host_connection(Host_portal_t *hp)
+int create_host_connection(Host_portal_t *hp, int reserved)
 {
   Host_connection_t *hc;
   apr_pool_t *pool;
@@ -503,8 +839,17 @@ int create_host_connection(Host_portal_t *hp)
 
   hc = new_host_connection(pool);
   hc->hp = hp;
+  hc->reserved = reserved;
   hc->last_used = time(NULL);
   
+  if (hp->context->engine_threads > 0) {  //** Use the event engine instead of a thread pair
+     apr_thread_mutex_lock(hp->context->lock);
+     if (hp->context->engine == NULL) hp->context->engine = hc_engine_create(hp->context, hp->context->engine_threads);
+     apr_thread_mutex_unlock(hp->context->lock);
+
+     hc_engine_add(hp->context->engine, hc);
+     return(0);
+  }
 
   apr_thread_create(&(hc->send_thread), NULL, hc_send_thread, (void *)hc, hc->mpool);
   apr_thread_create(&(hc->recv_thread), NULL, hc_recv_thread, (void *)hc, hc->mpool);
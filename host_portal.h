@@ -38,22 +38,61 @@ http://www.accre.vanderbilt.edu
 #include <apr_thread_proc.h>
 #include <apr_thread_mutex.h>
 #include <apr_thread_cond.h>
+#include <apr_poll.h>
+#include <apr_file_io.h>
+#include <time.h>
 #include "fmttypes.h"
 #include "network.h"
 #include "oplist.h"
+#include "mpmc_queue.h"
+#include "slab.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #define HP_COMPACT_TIME 10   //** How often to run the garbage collector
+#define HP_N_SHARDS 64       //** Number of registry shards.  Should be a power of 2
+#define HP_QUE_SIZE   1024   //** Size of the lock free task que.  Extra tasks overflow to the locked que
+#define HP_SCALE_WINDOW (500*HP_NS_PER_MS) //** Autoscaler goodput/latency measurement window
+#define HP_SCALE_MIN_GAIN 0.10    //** Min fractional goodput gain needed to keep adding connections
+#define HP_SCALE_LATENCY_FACTOR 4 //** Stop growing if latency exceeds this multiple of the best seen
+
+   //** Op priority classes.  Lower is more important
+#define HP_PRIO_HIGH    0     //** Small control ops: probe, allocate, modify_count, ...
+#define HP_PRIO_NORMAL  1     //** Normal data transfers
+#define HP_PRIO_BULK    2     //** Large data transfers
+#define HP_N_PRIO       3
+#define HP_PRIO_SCHED_MAX 64  //** Max length of the weighted dequeue schedule
+
+   //** Connection states used by the event engine
+#define HC_STATE_CONNECT  0   //** Waiting to make the connection
+#define HC_STATE_RUNNING  1   //** Connected and processing commands
+#define HC_STATE_CLOSED   2   //** Closed and removed from the hportal
+#define HC_ENGINE_CONNECT_THREADS 16  //** Connect workers used if max_connecting is unlimited
+#define HC_ENGINE_WORKERS  8  //** Default max data workers
+#define HC_ENGINE_WORKER_IDLE 30  //** Secs an idle data worker waits before exiting
+#define HC_RUN_SCHED      1   //** Engine run reasons: Scheduled by another thread
+#define HC_RUN_READABLE   2   //**    Poll flagged the socket as readable
+#define HC_RUN_CHECK      4   //**    Periodic idle and connection count check
+#define HP_SOCKPOOL_SIZE  64  //** Default max number of idle sockets kept for reuse
+#define HP_SOCKPOOL_AGE   30  //** Default max secs an idle socket is kept
+
+struct hc_engine_s;         //** Forward declarations for the event engine
+struct hc_engine_thread_s;
+struct hportal_scale_policy_s;  //** and the autoscaler
+struct hportal_hostport_s;      //** and interned hostports
+
 
 
 typedef struct {   //** Hportal operation
    char *hostport; //** Depot hostname:port:type:...  Unique string for host/connect_context
+   struct hportal_hostport_s *handle; //** Interned hostport if available.  Skips the registry lookup
    void *connect_context;   //** Private information needed to make a host connection
    int  cmp_size;  //** Used for ordering commands within the same host
-   int timeout;    //** Command timeout
+   int priority;   //** Priority class, HP_PRIO_*
+   int timeout;    //** Command timeout in secs as sent to the depot
+   hp_time_t timeout_ns; //** Client side command timeout
    int64_t workload;   //** Workload for measuring channel usage
    int max_workload; //** Max workload for a connection
    int retry_count;//** Number of times retried
@@ -61,8 +100,10 @@ typedef struct {   //** Hportal operation
    int (*send_phase)(void *op, NetStream_t *ns);    //**Handle "sending" side of command
    int (*recv_phase)(void *op, NetStream_t *ns);    //**Handle "receiving" half of command
    int (*destroy_command)(void *op);                //**Destroys the data structure
-   time_t start_time;
-   time_t end_time;
+   hp_time_t start_time;  //** When the current phase started
+   hp_time_t end_time;    //** Deadline for the current phase
+   hp_time_t sent_time;   //** When the command was sent.  Used for measuring latency
+   hp_time_t deadline;    //** Absolute deadline set when the op is 1st queued.  0 = Not queued yet
 }  Hportal_op_t;
 
 
@@ -74,6 +115,7 @@ typedef struct {  //** Hportal specific implementation
   int dead_connection;      //** Dead connection error
   int hp_invalid_host;      //** Can't resolve hostname
   int hp_cant_connect;      //** Can't connect to the host
+  int hp_deadline;          //** Op can't complete before its deadline so it was never sent
   oplist_base_op_t *(*get_base_op)(void *);  //** Returns the oplist base op
   Hportal_op_t *(*get_hp_op)(void *);   //** Returns the hportal_op 
   void *(*dup_connect_context)(void *connect_context);  //** Duplicates a ccon
@@ -82,10 +124,49 @@ typedef struct {  //** Hportal specific implementation
   void (*host_close_connection)(NetStream_t *ns);
 } Hportal_impl_t;
 
-typedef struct {             //** Handle for maintaining all the ecopy connections
+typedef struct {      //** Idle connected socket waiting to be reused
+  char *skey;         //** Hostport the socket is connected to
+  NetStream_t *ns;    //** Connection
+  time_t idle_since;  //** When it was parked
+} Hportal_idle_sock_t;
+
+typedef struct {      //** Idle socket pool counters
+  int64_t hits;       //** Connections made from the pool
+  int64_t misses;     //** Connections that had to dial the depot
+  int64_t puts;       //** Sockets parked in the pool
+  int64_t expired;    //** Sockets closed for being idle longer than max_age
+  int64_t evicted;    //** Sockets closed to keep the pool under max_size
+  int64_t dead;       //** Pooled sockets found closed by the depot
+  int size;           //** Current number of pooled sockets
+} Hportal_sockpool_stats_t;
+
+typedef struct {             //** Global LRU pool of idle sockets shared by all the depots
   apr_thread_mutex_t *lock;
+  Stack_t *lru;              //** Hportal_idle_sock_t list.  Most recently parked on top
+  int max_size;              //** Max sockets kept.  0 disables the pool
+  int max_age;               //** Max secs a socket is kept
+  Hportal_sockpool_stats_t stats;
+} Hportal_sockpool_t;
+
+typedef struct {             //** Registry shard.  Each depot hashes to a single shard
+  apr_thread_mutex_t *lock;  //** Protects the table and next_check
   apr_hash_t *table;         //** Table containing the depot_portal structs
+  apr_hash_t *intern;        //** Interned hostports (Hportal_hostport_t).  Unused ones are freed when the shard is compacted
   apr_pool_t *pool;          //** Memory pool for hash table
+  time_t   next_check;       //** Time for next compact_hportal_shard call
+} Hportal_shard_t;
+
+typedef struct hportal_hostport_s {  //** Interned hostport.  Freed once it has no hportal and no references
+  char *hostport;            //** Stable copy of the hostport string
+  Hportal_shard_t *shard;    //** Shard the hostport hashes to
+  struct host_portal_s *hp;  //** Current hportal or NULL.  Protected by the shard lock
+  volatile apr_uint32_t ref; //** Ops and caches holding the handle.  Only raised from 0 with the shard lock held
+} Hportal_hostport_t;
+
+typedef struct {             //** Handle for maintaining all the ecopy connections
+  apr_thread_mutex_t *lock;  //** Protects the thread counts and engine creation.  Not used for lookups
+  apr_pool_t *pool;          //** Memory pool for the context and shards
+  Hportal_shard_t shard[HP_N_SHARDS]; //** Depot registry split across independently locked shards
   int running_threads;       //** currently running # of connections
   int max_connections;       //** Max aggregate allowed number of threads
   int min_threads;           //** Max allowed number of threads/host
@@ -97,8 +178,25 @@ typedef struct {             //** Handle for maintaining all the ecopy connectio
   int check_connection_interval; //** Max time to wait for a thread to check for a close
   int min_idle;              //** Idle time before closing connection
   int max_retry;             //** Default max number of times to retry an op
+  int max_pipeline;          //** Max number of ops sent but not completed on a connection.  0 = no limit
+  int claim_batch;           //** Number of ops a connection claims from the depot que at once
+  int batch_commands;        //** Max ops whose command lines are flushed together.  0 or 1 = no batching
+  int edf_dispatch;          //** If 1 ops are dispatched earliest deadline first
+  int prio_weight[HP_N_PRIO]; //** Relative share of the dequeues each priority class gets when all have work
+  int prio_sched[HP_PRIO_SCHED_MAX]; //** Interleaved class schedule built from the weights
+  int prio_sched_len;        //** Length of prio_sched
+  int reserve_high;          //** If 1 each depot gets an extra connection only used for HP_PRIO_HIGH ops
   int count;                 //** Internal Counter 
-  time_t   next_check;       //** Time for next compact_dportal call
+  int engine_threads;        //** Number of event engine threads.  0 = Use a send/recv thread pair per connection
+  int engine_workers;        //** Max event engine data workers.  0 = HC_ENGINE_WORKERS
+  int max_connecting;        //** Max connections being established at once.  0 = no limit
+  int n_connecting;          //** Connections currently being established.  Protected by lock
+  int connect_timeout;       //** Connect timeout in secs
+  apr_thread_cond_t *connect_cond; //** Signalled when a connect slot frees up
+  Hportal_sockpool_t sockpool; //** Idle sockets kept for reuse.  Survives hportal compaction
+  struct hc_engine_s *engine; //** Event engine.  Created on the 1st connection if engine_threads > 0
+  struct hportal_scale_policy_s *scale; //** Policy deciding how many connections each depot gets
+  int64_t scale_target;      //** Per depot goodput target in bytes/sec for the goodput policy.  0 = No target
   Net_timeout_t dt;          //** Default wait time
   Hportal_impl_t *imp;       //** Actual implementaion for application
 } Hportal_context_t;
@@ -107,14 +205,43 @@ typedef struct {             //** Handle for maintaining all the ecopy connectio
 typedef struct {      //** Hportal stack operation
   oplist_t *oplist;
   void *op;
+  hp_time_t deadline;   //** Copy of the op's deadline used for EDF ordering
 } Hportal_stack_op_t;
 
-typedef struct {       //** Contains information about the depot including all connections
+typedef struct {     //** Goodput/latency samples used by the autoscaler.  Protected by the hp lock
+  hp_time_t window_start;   //** Start of the current measurement window
+  int64_t window_bytes;     //** Bytes completed in the window
+  int64_t window_ops;       //** Ops completed in the window
+  hp_time_t window_latency; //** Sum of the op latencies in the window
+  double goodput;           //** Smoothed depot goodput in bytes/sec
+  double conn_goodput;      //** Smoothed goodput per connection in bytes/sec
+  double latency;           //** Smoothed op latency in ns
+  double min_latency;       //** Lowest smoothed latency seen
+  hp_time_t min_op_latency; //** Fastest single op seen
+  double max_conn_goodput;  //** Best smoothed goodput per connection seen
+  double last_goodput;      //** Goodput when the connection count was last changed
+  int last_n_conn;          //** Connection count at the last change
+  hp_time_t next_change;    //** Earliest time the connection count can be changed again
+} Hportal_scale_stats_t;
+
+typedef struct {        //** Task ques for a single priority class
+  Mpmc_queue_t *work_que; //** Lock free task que
+  Stack_t *que;           //** Locked task que.  Retries are pushed on top and work_que overflow on the bottom
+  volatile apr_uint32_t n_retry;     //** Number of retried tasks on the top of que
+  volatile apr_uint32_t n_overflow;  //** Number of tasks that overflowed work_que and are at the bottom of que
+  Hportal_stack_op_t **edf_heap; //** Min heap on the op deadline used for EDF dispatch.  Protected by the hp lock
+  volatile apr_uint32_t edf_size; //** Number of ops in edf_heap.  Changed under the hp lock but read without it
+  int edf_max;            //** Allocated size of edf_heap
+} Hportal_que_t;
+
+typedef struct host_portal_s {  //** Contains information about the depot including all connections
   char skey[512];         //** Search key used for lookups its "host:port:type:..." Same as for the op
   char host[512];         //** Hostname
   int port;               //** port 
   int invalid_host;       //** Flag that this host is not resolvable
-  int64_t workload;       //** Amount of work left in the feeder que
+  volatile apr_uint32_t workload_kb; //** Amount of work left in the feeder que in KB.  Updated atomically
+  volatile apr_uint32_t idle_waiters; //** Number of connections waiting on work_cond for a task
+  volatile apr_uint32_t engine_idle;  //** Number of engine connections with nothing outstanding
   int64_t cmds_processed; //** Number of commands processed
   int failed_conn_attempts;     //** Failed net_connects()
   int successful_conn_attempts; //** Successful net_connects()
@@ -124,25 +251,60 @@ typedef struct {       //** Contains information about the depot including all c
   int max_conn;           //** Max allowed connections, normally global_config->max_threads
   int min_conn;           //** Max allowed connections, normally global_config->min_threads 
   time_t pause_until;     //** Forces the system to wait, if needed, before making new conn
+  Hportal_scale_stats_t scale; //** Measured goodput and latency for the autoscaler
   Stack_t *conn_list;     //** List of connections
-  Stack_t *que;           //** Task que
+  Hportal_que_t pq[HP_N_PRIO]; //** Task ques for each priority class
+  volatile apr_uint32_t prio_tick; //** Position in the context's prio_sched
+  int n_reserved;         //** Number of connections reserved for HP_PRIO_HIGH ops
+  Stack_t *expired;       //** Ops that missed their deadline.  Failed once the lock is released
+  volatile apr_uint32_t n_expired; //** Number of ops on expired.  Changed under the hp lock but read without it
   Stack_t *closed_que;    //** List of closed but not reaped connections
-  Stack_t *sync_list;     //** List of dedicated dportal/dc for the traditional IBP sync calls
+  Stack_t *sync_list;     //** Idle connections (Hportal_idle_sock_t) for the traditional IBP sync calls.  MRU on top
+  int n_sync_active;      //** Number of sync calls currently using the hportal
   apr_thread_mutex_t *lock;  //** shared lock
   apr_thread_cond_t *cond;  
+  apr_thread_cond_t *work_cond;  //** Idle connections waiting for a task.  Signalled one at a time
   apr_pool_t *mpool;
   void *connect_context;   //** Private information needed to make a host connection
   Hportal_context_t *context;  //** Specific Hportal implementaion
+  Hportal_hostport_t *handle;  //** Interned hostport pointing back to us
 } Host_portal_t;
 
+typedef struct hportal_scale_policy_s {  //** Connection autoscaling policy
+  const char *name;
+  int (*new_connections)(Host_portal_t *hp);  //** Returns the change in # of connections.  The hp lock is held
+  void (*op_completed)(Host_portal_t *hp, int64_t nbytes, hp_time_t latency);  //** Optional.  The hp lock is held
+} Hportal_scale_policy_t;
+
+extern Hportal_scale_policy_t hp_scale_heuristic;  //** Default.  Grows by 1 connection every wait_stable_time
+extern Hportal_scale_policy_t hp_scale_goodput;    //** Feedback driven using the measured goodput and latency
+
 typedef struct {            //** Individual depot connection in conn_list
    int cmd_count;
    int curr_workload;
    int shutdown_request;
    int net_connect_status;
+   int state;                 //** Connection state.  Only used by the event engine
+   int scheduled;             //** Event engine: On the engine thread's ready list
+   int run_pending;           //** Event engine: HC_RUN_* reasons the connection is on the engine thread's run list
+   int readable;              //** Event engine: Poll flagged the socket as readable
+   int busy;                  //** Event engine: A data worker is running the connection
+   int rerun;                 //** Event engine: HC_RUN_* reasons that came in while busy
+   int run;                   //** Event engine: HC_RUN_* reasons for the worker's current pass
+   int engine_idle;           //** Event engine: Counted in hp->engine_idle
+   int engine_closing;        //** Event engine: Closed and waiting for the engine thread to let go.  Protected by et->lock
+   int lost_work;             //** hc_release() found work on the connection when it closed
+   int in_pollset;            //** Event engine: Socket is registered with the pollset
+   int close_waiter;          //** Event engine: close_hc() is waiting to destroy the connection
+   int connect_done;          //** Event engine: The connect worker finished hc_connect()
+   int send_error;            //** Sending failed so the socket can't be reused
+   int idle_close;            //** Closed for being idle.  The socket can go to the idle pool
+   int reserved;              //** Only handles HP_PRIO_HIGH ops
+   int64_t start_cmds_processed; //** hp->cmds_processed when the connection was made
    time_t last_used;          //** Time the last command completed
    NetStream_t *ns;           //** Socket 
    Stack_t *pending_stack;    //** Local task que. An op  is mpoved from the parent que to here
+   Stack_t *local_que;        //** Claimed ops that haven't been sent yet.  Idle siblings steal from the bottom
    Stack_ele_t *my_pos;       //** My position int the dp conn list
    Hportal_stack_op_t *curr_op;   //** Sending phase op that could have failed
    Host_portal_t *hp;         //** Pointerto parent depot portal with the todo list
@@ -152,9 +314,52 @@ typedef struct {            //** Individual depot connection in conn_list
    apr_thread_cond_t *recv_cond;
    apr_thread_t *send_thread; //** Sending thread
    apr_thread_t *recv_thread; //** recving thread
+   apr_pollfd_t pfd;          //** Event engine: Poll descriptor for the socket
+   Stack_ele_t *engine_pos;   //** Event engine: Position in the engine thread's connection list
+   struct hc_engine_thread_s *et; //** Event engine thread owning the connection or NULL if using threads
    apr_pool_t   *mpool;       //** MEmory pool for 
 } Host_connection_t;
 
+typedef struct hc_engine_thread_s {  //** Single event engine thread.  Drives many connections
+   int id;                    //** Thread index
+   int n_conn;                //** Number of connections owned
+   int shutdown_request;      //** Flags the thread to exit
+   int wake_pending;          //** A wakeup byte is already in the pipe
+   Stack_t *conns;            //** All the connections owned by the thread
+   Stack_t *ready;            //** Connections scheduled for processing by other threads
+   Stack_t *closed;           //** Closed connections to hand back to their hportal once the thread lets go
+   apr_pollset_t *pollset;    //** Sockets with outstanding commands and the wakeup pipe
+   apr_pollfd_t wake_pfd;     //** Poll descriptor for the wakeup pipe
+   apr_file_t *wake_read;     //** Wakeup pipe.  A byte is written to break out of the poll
+   apr_file_t *wake_write;
+   apr_thread_mutex_t *lock;  //** Protects conns, ready, and the scheduled flags
+   apr_thread_t *thread;
+   struct hc_engine_s *engine; //** Parent engine
+   apr_pool_t *mpool;
+} Hc_engine_thread_t;
+
+typedef struct hc_engine_s {  //** Event engine.  Small fixed pool of threads polling all connections
+   int n_threads;
+   Hc_engine_thread_t *et;    //** Array of engine threads
+   int n_connect_threads;     //** Connect workers.  Connections are made off the engine threads
+   apr_thread_t **connect_thread;
+   Stack_t *connect_que;      //** Connections waiting to be made
+   int connect_shutdown;      //** Flags the connect workers to exit
+   apr_thread_mutex_t *connect_lock;  //** Protects connect_que and connect_shutdown
+   apr_thread_cond_t *connect_cond;
+   Stack_t *work_que;         //** Connections waiting on a data worker
+   Stack_t *workers;          //** Data worker threads.  Grown on demand up to max_workers
+   Stack_t *exited;           //** Workers that retired after sitting idle and need joining
+   int n_workers;
+   int n_idle_workers;        //** Workers waiting for a connection
+   int max_workers;           //** Connections wait on the work_que when all are busy
+   int work_shutdown;         //** Flags the data workers to exit
+   apr_thread_mutex_t *work_lock;  //** Protects the work_que and worker counts
+   apr_thread_cond_t *work_cond;
+   Hportal_context_t *hpc;    //** Hportal context
+   apr_pool_t *mpool;
+} Hc_engine_t;
+
 
 extern Net_timeout_t global_dt;
 
@@ -162,26 +367,69 @@ extern Net_timeout_t global_dt;
 #define hportal_trylock(hp)   apr_thread_mutex_trylock(hp->lock)
 #define hportal_lock(hp)   apr_thread_mutex_lock(hp->lock)
 #define hportal_unlock(hp) apr_thread_mutex_unlock(hp->lock)
-#define hportal_signal(hp) apr_thread_cond_broadcast(hp->cond)
+#define hportal_signal(hp) (apr_thread_cond_broadcast(hp->cond), apr_thread_cond_broadcast(hp->work_cond))
+#define hportal_wake_one(hp) apr_thread_cond_signal(hp->work_cond)
+#define HP_WORKLOAD_KB(w) ((apr_uint32_t)(((w) + 1023) >> 10))
+#define hportal_workload(hp) (((int64_t)apr_atomic_read32(&((hp)->workload_kb))) << 10)
+#define hc_max_prio(hc) (((hc)->reserved == 1) ? HP_PRIO_HIGH : HP_N_PRIO-1)
 
 void hportal_wait(Host_portal_t *hp, int dt);
+Hportal_stack_op_t *hportal_wait_for_work(Host_portal_t *hp, int dt, int max_prio);
+int hportal_que_size(Host_portal_t *hp);
 int get_hpc_thread_count(Hportal_context_t *hpc);
 void modify_hpc_thread_count(Hportal_context_t *hpc, int n);
+void hpc_connect_slot_get(Hportal_context_t *hpc);
+void hpc_connect_slot_release(Hportal_context_t *hpc);
 Host_portal_t *create_hportal(Hportal_context_t *hpc, void *connect_context, char *hostport, int min_conn, int max_conn);
 ///???void Host_dportal(Host_portal_t *hp);
 Hportal_context_t *create_hportal_context(Hportal_impl_t *hpi);
 void destroy_hportal_context(Hportal_context_t *hpc);
 void finalize_hportal_context(Hportal_context_t *hpc);
 Hportal_stack_op_t *new_hportal_op(oplist_t *oplist, void *op);
+Slab_t *hportal_op_slab();
 Hportal_stack_op_t *_get_hportal_op(Host_portal_t *hp);
+Hportal_stack_op_t *_dequeue_hportal_op(Host_portal_t *hp, int have_lock, int max_prio);
+Hportal_stack_op_t *get_hportal_op(Host_portal_t *hp);
+Hportal_stack_op_t *get_hportal_op_prio(Host_portal_t *hp, int max_prio);
+void hportal_set_prio_weights(Hportal_context_t *hpc, int *weight);
+void _add_hportal_op(Host_portal_t *hp, oplist_t *oplist, void *op, int addtotop);
 void destroy_hportal_op(Hportal_stack_op_t *hpo);
 void shutdown_hportal(Hportal_context_t *hpc);
-void compact_dportals(Hportal_context_t *hpc);
+void compact_hportals(Hportal_context_t *hpc);
+Hportal_shard_t *hportal_shard(Hportal_context_t *hpc, char *hostport);
+void destroy_hportal(Host_portal_t *hp);
 void _hp_fail_tasks(Host_portal_t *hp, int err_code);
+void _hp_clear_que(Host_portal_t *hp);
+void hportal_fail_expired(Host_portal_t *hp);
 void check_hportal_connections(Host_portal_t *hp);
 Host_portal_t *submit_hportal_sync(Hportal_context_t *hpc, oplist_t *oplist, void *op);
+void _hp_sync_close(Host_portal_t *hp, NetStream_t *ns, int to_pool);
+void _hp_sync_close_all(Host_portal_t *hp);
+NetStream_t *hportal_sync_checkout(Host_portal_t *hp);
+void hportal_sync_checkin(Host_portal_t *hp, NetStream_t *ns);
+int hportal_sync_exec(Host_portal_t *hp, NetStream_t *ns, void *op);
 int submit_hportal(Host_portal_t *dp, oplist_t *oplist, void *op, int addtotop);
 int submit_hp_op(Hportal_context_t *hpc, oplist_t *oplist, void *op);
+Host_portal_t *hportal_get(Hportal_context_t *hpc, char *hostport, void *connect_context);
+Host_portal_t *hportal_get_handle(Hportal_context_t *hpc, Hportal_hostport_t *handle, void *connect_context);
+Hportal_hostport_t *hportal_intern(Hportal_context_t *hpc, char *hostport);
+void hportal_ref_handle(Hportal_hostport_t *h);
+void hportal_release_handle(Hportal_hostport_t *h);
+Host_portal_t *_hportal_get(Hportal_context_t *hpc, Hportal_shard_t *shard, Hportal_hostport_t *handle, char *hostport, void *connect_context);
+int hportal_prewarm(Hportal_context_t *hpc, char *hostport, void *connect_context, int n_conn);
+
+//** Routines from hportal_sockpool.c
+void hportal_sockpool_init(Hportal_context_t *hpc);
+void hportal_sockpool_flush(Hportal_context_t *hpc);
+void hportal_sockpool_destroy(Hportal_context_t *hpc);
+int hportal_sockpool_put(Hportal_context_t *hpc, char *skey, NetStream_t *ns);
+int hportal_sockpool_get(Hportal_context_t *hpc, char *skey, NetStream_t *ns);
+void hportal_sockpool_stats(Hportal_context_t *hpc, Hportal_sockpool_stats_t *stats);
+
+//** Routines for hportal_scale.c
+Hportal_scale_policy_t *hportal_scale_policy_lookup(const char *name);
+void hportal_op_completed(Host_portal_t *hp, int64_t nbytes, hp_time_t latency);
+void hportal_shed_connection(Host_portal_t *hp);
 
 //** Routines for hconnection.c
 #define trylock_hc(a) apr_thread_mutex_trylock(a->lock)
@@ -193,7 +441,26 @@ int submit_hp_op(Hportal_context_t *hpc, oplist_t *oplist, void *op);
 Host_connection_t *new_host_connection();
 void destroy_host_connection(Host_connection_t *hc);
 void close_hc(Host_connection_t *dc);
-int create_host_connection(Host_portal_t *hp);
+int create_host_connection(Host_portal_t *hp, int reserved);
+void _hc_close_ns(Host_connection_t *hc);
+void hc_connect(Host_connection_t *hc);
+int hc_send_op(Host_connection_t *hc, Hportal_stack_op_t *hsop);
+int hc_send_batch(Host_connection_t *hc, Hportal_stack_op_t **hsop);
+Hportal_stack_op_t *hc_get_op(Host_connection_t *hc);
+int hc_pipeline_full(Host_connection_t *hc);
+int hc_recv_op(Host_connection_t *hc, Hportal_stack_op_t *hsop);
+void hc_release(Host_connection_t *hc, Hportal_stack_op_t *hsop, int64_t start_cmds_processed);
+void hc_release_finish(Host_connection_t *hc);
+
+//** Routines for hc_engine.c
+Hc_engine_t *hc_engine_create(Hportal_context_t *hpc, int n_threads);
+void hc_engine_destroy(Hc_engine_t *engine);
+void hc_engine_add(Hc_engine_t *engine, Host_connection_t *hc);
+void hc_engine_schedule(Host_connection_t *hc);
+void hc_engine_notify(Host_portal_t *hp);
+void hc_engine_request_close(Host_connection_t *hc);
+void hc_engine_close_wait(Host_connection_t *hc);
+void hc_engine_retire(Host_connection_t *hc);
 
 #ifdef __cplusplus
 }
@@ -32,6 +32,7 @@ http://www.accre.vanderbilt.edu
 #include <assert.h>
 #include <stdio.h>
 #include <apr_thread_proc.h>
+#include <apr_atomic.h>
 #include "dns_cache.h"
 #include "host_portal.h"
 #include "fmttypes.h"
@@ -53,6 +54,51 @@ void hportal_wait(Host_portal_t *hp, int dt)
    apr_thread_cond_timedwait(hp->cond, hp->lock, t);
 }
 
+//***************************************************************************
+//  hportal_wait_for_work - Waits up to the specified time for a new task.
+//     Submitters only signal if someone is waiting so the waiter count is
+//     bumped *before* the final check of the que.  If a task is found it's
+//     returned.  Only tasks with a priority <= max_prio are used.
+//     NOTE: hp->lock should be held
+//***************************************************************************
+
+Hportal_stack_op_t *hportal_wait_for_work(Host_portal_t *hp, int dt, int max_prio)  
+{
+   apr_interval_time_t t;
+   Hportal_stack_op_t *hsop;
+
+   apr_atomic_inc32(&(hp->idle_waiters));
+
+   hsop = _dequeue_hportal_op(hp, 1, max_prio);
+   if ((hsop == NULL) && (dt >= 0)) {  //** If negative time has run out so don't wait
+      set_net_timeout(&t, dt, 0); 
+      apr_thread_cond_timedwait(hp->work_cond, hp->lock, t);
+   }
+
+   apr_atomic_dec32(&(hp->idle_waiters));
+
+   return(hsop);
+}
+
+//***************************************************************************
+//  hportal_que_size - Returns the number of tasks waiting in the que.
+//     This is only approximate if other threads are adding tasks
+//***************************************************************************
+
+int hportal_que_size(Host_portal_t *hp)
+{
+  Hportal_que_t *pq;
+  int i, n;
+
+  n = 0;
+  for (i=0; i<HP_N_PRIO; i++) {
+     pq = &(hp->pq[i]);
+     n += mpmc_size(pq->work_que) + apr_atomic_read32(&(pq->n_retry)) + apr_atomic_read32(&(pq->n_overflow)) + apr_atomic_read32(&(pq->edf_size));
+  }
+
+  return(n);
+}
+
 
 //***************************************************************************
 // get_hpc_thread_count - Returns the current # of running threads
@@ -81,6 +127,33 @@ void modify_hpc_thread_count(Hportal_context_t *hpc, int n)
 
 }
 
+//***************************************************************************
+// hpc_connect_slot_get - Waits until fewer than max_connecting connections
+//     are being established and claims a slot
+//***************************************************************************
+
+void hpc_connect_slot_get(Hportal_context_t *hpc)
+{
+  apr_thread_mutex_lock(hpc->lock);
+  while ((hpc->max_connecting > 0) && (hpc->n_connecting >= hpc->max_connecting)) {
+     apr_thread_cond_wait(hpc->connect_cond, hpc->lock);
+  }
+  hpc->n_connecting++;
+  apr_thread_mutex_unlock(hpc->lock);
+}
+
+//***************************************************************************
+// hpc_connect_slot_release - Releases a connect slot
+//***************************************************************************
+
+void hpc_connect_slot_release(Hportal_context_t *hpc)
+{
+  apr_thread_mutex_lock(hpc->lock);
+  hpc->n_connecting--;
+  apr_thread_cond_signal(hpc->connect_cond);
+  apr_thread_mutex_unlock(hpc->lock);
+}
+
 //************************************************************************
 //  create_hportal
 //************************************************************************
@@ -88,6 +161,8 @@ void modify_hpc_thread_count(Hportal_context_t *hpc, int n)
 Host_portal_t *create_hportal(Hportal_context_t *hpc, void *connect_context, char *hostport, int min_conn, int max_conn)
 {
   Host_portal_t *hp;
+  Hportal_que_t *pq;
+  int i;
 
 log_printf(15, "create_hportal: hpc=%p\n", hpc);
   assert((hp = (Host_portal_t *)malloc(sizeof(Host_portal_t))) != NULL);
@@ -101,7 +176,12 @@ log_printf(15, "create_hportal: hpc=%p\n", hpc);
 
   host[0] = '\0'; port = 0;
 
-  strncpy(host, string_token(hp2, ":", &bstate, &fin), sizeof(host)-1); host[sizeof(host)-1] = '\0';
+  if (hp2[0] == '[') {  //** IPv6 addresses are bracketed since they contain ':'
+     strncpy(host, string_token(&(hp2[1]), "]", &bstate, &fin), sizeof(host)-1); host[sizeof(host)-1] = '\0';
+     if (bstate[0] == ':') bstate++;
+  } else {
+     strncpy(host, string_token(hp2, ":", &bstate, &fin), sizeof(host)-1); host[sizeof(host)-1] = '\0';
+  }
   port = atoi(bstate);
   free(hp2);
   log_printf(15, "create_hportal: hostport: %s host=%s port=%d\n", hostport, host, port);
@@ -109,7 +189,7 @@ log_printf(15, "create_hportal: hpc=%p\n", hpc);
   strncpy(hp->host, host, sizeof(hp->host)-1);  hp->host[sizeof(hp->host)-1] = '\0';
 
   //** Check if we can resolve the host's IP address
-  char in_addr[6];
+  char in_addr[DNS_ADDR_MAX];
   if (lookup_host(host, in_addr, NULL) != 0) {
      log_printf(1, "create_hportal: Can\'t resolve host address: %s:%d\n", host, port);
      hp->invalid_host = 1;
@@ -122,16 +202,34 @@ log_printf(15, "create_hportal: hpc=%p\n", hpc);
   hp->connect_context = hpc->imp->dup_connect_context(connect_context);
 
   hp->context = hpc;
+  hp->handle = NULL;
   hp->min_conn = min_conn;
   hp->max_conn = max_conn;
-  hp->workload = 0;
+  hp->workload_kb = 0;
+  hp->idle_waiters = 0;
+  hp->engine_idle = 0;
   hp->cmds_processed = 0;
   hp->n_conn = 0;  
   hp->conn_list = new_stack();
   hp->closed_que = new_stack();
-  hp->que = new_stack();
+  for (i=0; i<HP_N_PRIO; i++) {
+     pq = &(hp->pq[i]);
+     pq->work_que = new_mpmc_queue(HP_QUE_SIZE);
+     pq->que = new_stack();
+     pq->n_retry = 0;
+     pq->n_overflow = 0;
+     pq->edf_heap = NULL;
+     pq->edf_size = 0;
+     pq->edf_max = 0;
+  }
+  hp->prio_tick = 0;
+  hp->n_reserved = 0;
+  hp->expired = new_stack();
+  hp->n_expired = 0;
   hp->sync_list = new_stack();
+  hp->n_sync_active = 0;
   hp->pause_until = 0;
+  memset(&(hp->scale), 0, sizeof(hp->scale));
   hp->stable_conn = hpc->max_threads;
   hp->failed_conn_attempts = 0;
   hp->successful_conn_attempts = 0;
@@ -139,6 +237,7 @@ log_printf(15, "create_hportal: hpc=%p\n", hpc);
 
   apr_thread_mutex_create(&(hp->lock), APR_THREAD_MUTEX_DEFAULT, hp->mpool);
   apr_thread_cond_create(&(hp->cond), hp->mpool);
+  apr_thread_cond_create(&(hp->work_cond), hp->mpool);
 
   return(hp);
 }
@@ -153,7 +252,7 @@ void _reap_hportal(Host_portal_t *hp)
    apr_status_t value;
 
    while ((hc = (Host_connection_t *)pop(hp->closed_que)) != NULL) {
-     apr_thread_join(&value, hc->recv_thread);
+     if (hc->recv_thread != NULL) apr_thread_join(&value, hc->recv_thread);
      destroy_host_connection(hc);
    }
 }
@@ -164,17 +263,30 @@ void _reap_hportal(Host_portal_t *hp)
 
 void destroy_hportal(Host_portal_t *hp)
 {
+  int i;
+
   _reap_hportal(hp);
 
+  if (hp->handle != NULL) hp->handle->hp = NULL;  //** Callers hold the shard lock of a registered hportal
+
+  _hp_clear_que(hp);
+  for (i=0; i<HP_N_PRIO; i++) {
+     free_mpmc_queue(hp->pq[i].work_que);
+     free_stack(hp->pq[i].que, 0);  //** Already drained by _hp_clear_que()
+     if (hp->pq[i].edf_heap != NULL) free(hp->pq[i].edf_heap);
+  }
+
   free_stack(hp->conn_list, 1);
-  free_stack(hp->que, 1);
+  free_stack(hp->expired, 0);
   free_stack(hp->closed_que, 1);
-  free_stack(hp->sync_list, 1);
+  _hp_sync_close_all(hp);
+  free_stack(hp->sync_list, 0);
   
   hp->context->imp->destroy_connect_context(hp->connect_context);
 
   apr_thread_mutex_destroy(hp->lock);
   apr_thread_cond_destroy(hp->cond);
+  apr_thread_cond_destroy(hp->work_cond);
 
   apr_pool_destroy(hp->mpool);  
   log_printf(5, "destroy_hportal: Total commands processed: " I64T " (host:%s:%d)\n", hp->cmds_processed,
@@ -183,16 +295,29 @@ void destroy_hportal(Host_portal_t *hp)
 }
 
 //************************************************************************
-// lookup_hportal - Looks up a depot/port in the current list
+// hportal_shard - Returns the registry shard the depot hashes to
+//************************************************************************
+
+Hportal_shard_t *hportal_shard(Hportal_context_t *hpc, char *hostport)
+{
+  unsigned int h = 0;
+  unsigned char *c;
+
+  for (c=(unsigned char *)hostport; *c != '\0'; c++) h = h*33 + *c;
+
+  return(&(hpc->shard[h & (HP_N_SHARDS-1)]));
+}
+
+//************************************************************************
+// _lookup_hportal - Looks up a depot/port in the shard.  The shard lock
+//    should already be held.
 //************************************************************************
 
-Host_portal_t *_lookup_hportal(Hportal_context_t *hpc, char *hostport)
+Host_portal_t *_lookup_hportal(Hportal_shard_t *shard, char *hostport)
 {
   Host_portal_t *hp;
-  
-//log_printf(1, "_lookup_hportal: hpc=%p hpc->table=%p\n", hpc, hpc->table);
-  hp = (Host_portal_t *)(apr_hash_get(hpc->table, hostport, APR_HASH_KEY_STRING));
-//log_printf(1, "_lookup_hportal: hpc=%p hpc->table=%p hp=%p hostport=%s\n", hpc, hpc->table, hp, hostport);
+
+  hp = (Host_portal_t *)(apr_hash_get(shard->table, hostport, APR_HASH_KEY_STRING));
 
   return(hp);
 }
@@ -204,6 +329,9 @@ Host_portal_t *_lookup_hportal(Hportal_context_t *hpc, char *hostport)
 Hportal_context_t *create_hportal_context(Hportal_impl_t *imp)
 {
   Hportal_context_t *hpc;
+  Hportal_shard_t *shard;
+  int weight[HP_N_PRIO];
+  int i;
 
 //log_printf(1, "create_hportal_context: start\n");
 
@@ -212,20 +340,90 @@ Hportal_context_t *create_hportal_context(Hportal_impl_t *imp)
 
 
   assert(apr_pool_create(&(hpc->pool), NULL) == APR_SUCCESS);
-  assert((hpc->table = apr_hash_make(hpc->pool)) != NULL);
-
-//log_printf(15, "create_hportal_context: hpc=%p hpc->table=%p\n", hpc, hpc->table);
-
   apr_thread_mutex_create(&(hpc->lock), APR_THREAD_MUTEX_DEFAULT, hpc->pool);
+  apr_thread_cond_create(&(hpc->connect_cond), hpc->pool);
+  hpc->connect_timeout = 5;
+  hportal_sockpool_init(hpc);
+
+  //** Each shard has its own lock, table, and GC timer so lookups on different depots don't contend
+  for (i=0; i<HP_N_SHARDS; i++) {
+     shard = &(hpc->shard[i]);
+     assert(apr_pool_create(&(shard->pool), hpc->pool) == APR_SUCCESS);
+     assert((shard->table = apr_hash_make(shard->pool)) != NULL);
+     assert((shard->intern = apr_hash_make(shard->pool)) != NULL);
+     apr_thread_mutex_create(&(shard->lock), APR_THREAD_MUTEX_DEFAULT, shard->pool);
+     shard->next_check = time(NULL);
+  }
 
   hpc->imp = imp;
-  hpc->next_check = time(NULL);
+  hpc->compact_interval = HP_COMPACT_TIME;
+  hpc->scale = &hp_scale_heuristic;
   hpc->count = 0;
   set_net_timeout(&(hpc->dt), 1, 0);
 
+  weight[HP_PRIO_HIGH] = 8; weight[HP_PRIO_NORMAL] = 4; weight[HP_PRIO_BULK] = 1;
+  hportal_set_prio_weights(hpc, weight);
+
   return(hpc);
 }
 
+//*************************************************************************
+// hportal_set_prio_weights - Sets the relative share of the dequeues each
+//    priority class gets and builds the interleaved schedule used by
+//    _dequeue_hportal_op().  Each slot goes to the class with the largest
+//    running credit so the classes are spread out instead of bunched.  
+//    A weight of 0 means the class only runs when the others are idle.
+//    Weights that don't fit in the schedule are scaled down keeping their
+//    ratios.  The weights actually used are stored back in weight.
+//*************************************************************************
+
+void hportal_set_prio_weights(Hportal_context_t *hpc, int *weight)
+{
+  int credit[HP_N_PRIO];
+  int64_t sum;
+  int i, j, best, total;
+
+  sum = 0;
+  for (i=0; i<HP_N_PRIO; i++) {
+     if (weight[i] < 0) weight[i] = 0;
+     sum += weight[i];
+  }
+
+  if (sum > HP_PRIO_SCHED_MAX) {  //** Scale them down.  Leave room to round the small ones up to 1
+     log_printf(1, "hportal_set_prio_weights: Weights %d:%d:%d don't fit in the %d slot schedule.  Scaling them down.\n", 
+         weight[HP_PRIO_HIGH], weight[HP_PRIO_NORMAL], weight[HP_PRIO_BULK], HP_PRIO_SCHED_MAX);
+     for (i=0; i<HP_N_PRIO; i++) {
+        if (weight[i] == 0) continue;
+        weight[i] = ((int64_t)weight[i] * (HP_PRIO_SCHED_MAX - HP_N_PRIO)) / sum;
+        if (weight[i] == 0) weight[i] = 1;
+     }
+  }
+
+  total = 0;
+  for (i=0; i<HP_N_PRIO; i++) {
+     hpc->prio_weight[i] = weight[i];
+     total += hpc->prio_weight[i];
+     credit[i] = 0;
+  }
+
+  if (total == 0) {  //** No weights so it's strict priority
+     hpc->prio_sched[0] = HP_PRIO_HIGH;
+     hpc->prio_sched_len = 1;
+     return;
+  }
+
+  for (j=0; j<total; j++) {
+     best = 0;
+     for (i=0; i<HP_N_PRIO; i++) {
+        credit[i] += hpc->prio_weight[i];
+        if (credit[i] > credit[best]) best = i;
+     }
+     credit[best] -= total;
+     hpc->prio_sched[j] = best;
+  }
+  hpc->prio_sched_len = total;
+}
+
 
 //************************************************************************
 // destroy_hportal_context - Destroys a hportal context structure
@@ -235,17 +433,37 @@ void destroy_hportal_context(Hportal_context_t *hpc)
 {
   apr_hash_index_t *hi; 
   Host_portal_t *hp;
+  Hportal_hostport_t *h;
+  Hportal_shard_t *shard;
   void *val;
+  int i;
 
-  for (hi=apr_hash_first(hpc->pool, hpc->table); hi != NULL; hi = apr_hash_next(hi)) {
-     apr_hash_this(hi, NULL, NULL, &val); hp = (Host_portal_t *)val;  
-     apr_hash_set(hpc->table, hp->skey, APR_HASH_KEY_STRING, NULL);
-     destroy_hportal(hp);
+  if (hpc->engine != NULL) hc_engine_destroy(hpc->engine);
+
+  for (i=0; i<HP_N_SHARDS; i++) {
+     shard = &(hpc->shard[i]);
+     apr_thread_mutex_lock(shard->lock);
+     for (hi=apr_hash_first(NULL, shard->table); hi != NULL; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, NULL, NULL, &val); hp = (Host_portal_t *)val;  
+        apr_hash_set(shard->table, hp->skey, APR_HASH_KEY_STRING, NULL);
+        destroy_hportal(hp);
+     }
+     for (hi=apr_hash_first(NULL, shard->intern); hi != NULL; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, NULL, NULL, &val); h = (Hportal_hostport_t *)val;
+        apr_hash_set(shard->intern, h->hostport, APR_HASH_KEY_STRING, NULL);
+        free(h->hostport);
+        free(h);
+     }
+     apr_thread_mutex_unlock(shard->lock);
+
+     apr_thread_mutex_destroy(shard->lock);
+     apr_hash_clear(shard->table);
   }
 
+  hportal_sockpool_destroy(hpc);
+  apr_thread_cond_destroy(hpc->connect_cond);
   apr_thread_mutex_destroy(hpc->lock);  
 
-  apr_hash_clear(hpc->table);
   apr_pool_destroy(hpc->pool);
   
   free(hpc);
@@ -253,6 +471,21 @@ void destroy_hportal_context(Hportal_context_t *hpc)
   return;
 }
 
+//*************************************************************************
+// hportal_op_slab - Returns the slab used for the hportal op wrappers
+//*************************************************************************
+
+pthread_once_t _hportal_op_slab_once = PTHREAD_ONCE_INIT;
+Slab_t *_hportal_op_slab = NULL;
+
+void _hportal_op_slab_init() { _hportal_op_slab = new_slab("hportal_op", sizeof(Hportal_stack_op_t), SLAB_BATCH, SLAB_SHARED_MAX); }
+
+Slab_t *hportal_op_slab()
+{
+  pthread_once(&_hportal_op_slab_once, _hportal_op_slab_init);
+  return(_hportal_op_slab);
+}
+
 //*************************************************************************
 // new_hportal_op - Creates a new hportal operation
 //*************************************************************************
@@ -261,7 +494,7 @@ Hportal_stack_op_t *new_hportal_op(oplist_t *oplist, void *op)
 {
   Hportal_stack_op_t *hpo;
 
-  assert((hpo = (Hportal_stack_op_t *)malloc(sizeof(Hportal_stack_op_t))) != NULL);
+  hpo = (Hportal_stack_op_t *)slab_alloc(hportal_op_slab());
   
   hpo->oplist = oplist;
   hpo->op = op;
@@ -275,48 +508,16 @@ Hportal_stack_op_t *new_hportal_op(oplist_t *oplist, void *op)
 
 void destroy_hportal_op(Hportal_stack_op_t *hpo)
 {
-   free(hpo);
+   slab_free(_hportal_op_slab, hpo);
 }
 
 //************************************************************************
-// shutdown_sync - shuts down the sync hportals
+// shutdown_sync - Closes the idle sync connections
 //************************************************************************
 
-void shutdown_sync(Host_portal_t *hp)
+void shutdown_sync(Host_portal_t *hp, Hportal_shard_t *shard)
 {
-  Host_portal_t *shp;
-  Host_connection_t *hc;
-
-  if (stack_size(hp->sync_list) == 0) return;
-
-  move_to_top(hp->sync_list);
-  while ((shp = (Host_portal_t *)pop(hp->sync_list)) != NULL) {
-     hportal_lock(shp);
-     _reap_hportal(shp);  //** Clean up any closed connections
-
-     if ((shp->n_conn == 0) && (stack_size(shp->que) == 0)) { //** if not used so remove it
-        delete_current(hp->sync_list, 0, 0);  //**Already closed 
-     } else {     //** Force it to close
-        free_stack(shp->que, 1);  //** Empty the que so we don't respawn connections
-        shp->que = new_stack();
-
-        move_to_top(shp->conn_list);
-        hc = (Host_connection_t *)get_ele_data(shp->conn_list);
-
-        hportal_unlock(shp);
-        apr_thread_mutex_unlock(hp->context->lock);
-
-        close_hc(hc);
-
-        apr_thread_mutex_lock(hp->context->lock);
-        hportal_lock(shp);
-     }
-
-     hportal_unlock(shp);
-     destroy_hportal(shp);
-
-//     move_to_top(hp->sync_list);
-  }
+  _hp_sync_close_all(hp);
 }
 
 //*************************************************************************
@@ -327,87 +528,89 @@ void shutdown_hportal(Hportal_context_t *hpc)
 {
   Host_portal_t *hp;
   Host_connection_t *hc;
+  Hportal_shard_t *shard;
   apr_hash_index_t *hi;
   void *val;
+  int i;
 
-  apr_thread_mutex_lock(hpc->lock);
+  for (i=0; i<HP_N_SHARDS; i++) {
+     shard = &(hpc->shard[i]);
+     apr_thread_mutex_lock(shard->lock);
 
-  for (hi=apr_hash_first(hpc->pool, hpc->table); hi != NULL; hi = apr_hash_next(hi)) {
-     apr_hash_this(hi, NULL, NULL, &val); hp = (Host_portal_t *)val;  
-     apr_hash_set(hpc->table, hp->skey, APR_HASH_KEY_STRING, NULL);  //** This removes the key
+     for (hi=apr_hash_first(NULL, shard->table); hi != NULL; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, NULL, NULL, &val); hp = (Host_portal_t *)val;  
+        apr_hash_set(shard->table, hp->skey, APR_HASH_KEY_STRING, NULL);  //** This removes the key
 
-     hportal_lock(hp);
-     _reap_hportal(hp);  //** clean up any closed connections
+        hportal_lock(hp);
+        _reap_hportal(hp);  //** clean up any closed connections
 
-     shutdown_sync(hp);  //** Shutdown any sync connections
+        shutdown_sync(hp, shard);  //** Shutdown any sync connections
 
-     move_to_top(hp->conn_list);
-     while ((hc = (Host_connection_t *)get_ele_data(hp->conn_list)) != NULL) {
-        free_stack(hp->que, 1);  //** Empty the que so we don't respawn connections
-        hp->que = new_stack();
-        hportal_unlock(hp);
-        apr_thread_mutex_unlock(hpc->lock);
+        move_to_top(hp->conn_list);
+        while ((hc = (Host_connection_t *)get_ele_data(hp->conn_list)) != NULL) {
+           _hp_clear_que(hp);  //** Empty the que so we don't respawn connections
+           hportal_unlock(hp);
+           apr_thread_mutex_unlock(shard->lock);
 
-        close_hc(hc);
+           close_hc(hc);
 
-        apr_thread_mutex_lock(hpc->lock);
-        hportal_lock(hp);
+           apr_thread_mutex_lock(shard->lock);
+           hportal_lock(hp);
 
-        move_to_top(hp->conn_list);
-     }     
+           move_to_top(hp->conn_list);
+        }     
 
-     hportal_unlock(hp);
+        hportal_unlock(hp);
 
-     destroy_hportal(hp);
-  }
+        destroy_hportal(hp);
+     }
 
-  apr_thread_mutex_unlock(hpc->lock);
+     apr_thread_mutex_unlock(shard->lock);
+  }
 
   return;  
 }
 
 //************************************************************************
-// compact_hportal_sync - Compacts the sync hportals if needed
+// compact_hportal_sync - Retires sync connections that have been idle
+//    for min_idle.  They go to the context's idle socket pool if it has
+//    room.  The hp lock should be held.
 //************************************************************************
 
 void compact_hportal_sync(Host_portal_t *hp)
 {
-  Host_portal_t *shp;
+  Hportal_context_t *hpc = hp->context;
+  Hportal_idle_sock_t *is;
+  time_t oldest;
 
   if (stack_size(hp->sync_list) == 0) return;
 
-  move_to_top(hp->sync_list);
-  while ((shp = (Host_portal_t *)get_ele_data(hp->sync_list)) != NULL) {
+  oldest = time(NULL) - hpc->min_idle;
+  move_to_bottom(hp->sync_list);   //** Oldest are on the bottom
+  while ((is = (Hportal_idle_sock_t *)get_ele_data(hp->sync_list)) != NULL) {
+     if (is->idle_since > oldest) break;
 
-     hportal_lock(shp);
-     _reap_hportal(shp);  //** Clean up any closed connections
-
-     if ((shp->n_conn == 0) && (stack_size(shp->que) == 0)) { //** if not used so remove it
-        delete_current(hp->sync_list, 0, 0);
-        hportal_unlock(shp);
-        destroy_hportal(shp);
-     } else {
-       hportal_unlock(shp);      
-       move_down(hp->sync_list);
-     }
+     delete_current(hp->sync_list, 1, 0);
+     move_to_bottom(hp->sync_list);
+     _hp_sync_close(hp, is->ns, 1);
+     free(is);
   }
-
-
 }
 
 //************************************************************************
-// compact_hportals - Removes any hportals that are no longer used
+// _compact_hportal_shard - Removes any hportals in the shard that are no
+//    longer used along with any interned hostports that have no hportal
+//    and aren't held by an op.  The shard lock should already be held.
 //************************************************************************
 
-void compact_hportals(Hportal_context_t *hpc)
+void _compact_hportal_shard(Hportal_shard_t *shard)
 {
   apr_hash_index_t *hi;
   Host_portal_t *hp;
+  Hportal_hostport_t *h;
   void *val;
 
-  apr_thread_mutex_lock(hpc->lock);
-
-  for (hi=apr_hash_first(hpc->pool, hpc->table); hi != NULL; hi = apr_hash_next(hi)) {
+  for (hi=apr_hash_first(NULL, shard->table); hi != NULL; hi = apr_hash_next(hi)) {
      apr_hash_this(hi, NULL, NULL, &val); hp = (Host_portal_t *)val;  
 
      hportal_lock(hp);
@@ -416,56 +619,386 @@ void compact_hportals(Hportal_context_t *hpc)
 
      compact_hportal_sync(hp);
 
-     if ((hp->n_conn == 0) && (stack_size(hp->que) == 0) && (stack_size(hp->sync_list) == 0)) { //** if not used so remove it
+     if ((hp->n_conn == 0) && (hportal_que_size(hp) == 0) && (stack_size(hp->sync_list) == 0) && (hp->n_sync_active == 0)) { //** if not used so remove it
        hportal_unlock(hp);
-       apr_hash_set(hpc->table, hp->skey, APR_HASH_KEY_STRING, NULL);  //** This removes the key
+       apr_hash_set(shard->table, hp->skey, APR_HASH_KEY_STRING, NULL);  //** This removes the key
        destroy_hportal(hp);
      } else {
        hportal_unlock(hp);
      }
   }
 
-  apr_thread_mutex_unlock(hpc->lock);
+  //** Drop the interned hostports nobody is using
+  for (hi=apr_hash_first(NULL, shard->intern); hi != NULL; hi = apr_hash_next(hi)) {
+     apr_hash_this(hi, NULL, NULL, &val); h = (Hportal_hostport_t *)val;
+
+     if ((h->hp == NULL) && (apr_atomic_read32(&(h->ref)) == 0)) {
+        apr_hash_set(shard->intern, h->hostport, APR_HASH_KEY_STRING, NULL);
+        free(h->hostport);
+        free(h);
+     }
+  }
+}
+
+//************************************************************************
+// _check_hportal_shard - Runs the GC on the shard if it's time.  Only the
+//    shard being submitted to is compacted so the cost is spread out.
+//    The shard lock should already be held.
+//************************************************************************
+
+void _check_hportal_shard(Hportal_context_t *hpc, Hportal_shard_t *shard)
+{
+   time_t now = time(NULL);
+
+   if (shard->next_check < now) {
+      shard->next_check = now + hpc->compact_interval;
+      log_printf(15, "_check_hportal_shard: Compacting shard %d\n", (int)(shard - hpc->shard));
+      _compact_hportal_shard(shard);
+   }
+}
+
+//************************************************************************
+// compact_hportals - Removes any hportals that are no longer used
+//************************************************************************
+
+void compact_hportals(Hportal_context_t *hpc)
+{
+  Hportal_shard_t *shard;
+  int i;
+
+  for (i=0; i<HP_N_SHARDS; i++) {
+     shard = &(hpc->shard[i]);
+     apr_thread_mutex_lock(shard->lock);
+     _compact_hportal_shard(shard);
+     shard->next_check = time(NULL) + hpc->compact_interval;
+     apr_thread_mutex_unlock(shard->lock);
+  }
+}
+
+//*************************************************************************
+//  _edf_push - Adds the task to the class's EDF heap.  The hp lock should 
+//     be held.
+//*************************************************************************
+
+void _edf_push(Hportal_que_t *pq, Hportal_stack_op_t *hsop)
+{
+  int i, parent;
+
+  if ((int)pq->edf_size == pq->edf_max) {
+     pq->edf_max = (pq->edf_max == 0) ? 64 : 2*pq->edf_max;
+     assert((pq->edf_heap = (Hportal_stack_op_t **)realloc(pq->edf_heap, sizeof(Hportal_stack_op_t *)*pq->edf_max)) != NULL);
+  }
+
+  i = pq->edf_size;
+  while (i > 0) {
+     parent = (i-1) / 2;
+     if (pq->edf_heap[parent]->deadline <= hsop->deadline) break;
+     pq->edf_heap[i] = pq->edf_heap[parent];
+     i = parent;
+  }
+  pq->edf_heap[i] = hsop;
+  apr_atomic_inc32(&(pq->edf_size));  //** Only counted once it's in the heap
+}
+
+//*************************************************************************
+//  _edf_remove_min - Removes the task with the earliest deadline from the
+//     class's EDF heap.  The hp lock should be held.
+//*************************************************************************
+
+Hportal_stack_op_t *_edf_remove_min(Hportal_que_t *pq)
+{
+  Hportal_stack_op_t *hsop, *last;
+  int i, n, child;
+
+  if (pq->edf_size == 0) return(NULL);
+
+  hsop = pq->edf_heap[0];
+  apr_atomic_dec32(&(pq->edf_size));
+  n = pq->edf_size;
+  last = pq->edf_heap[n];
+
+  i = 0;
+  while ((child = 2*i + 1) < n) {
+     if ((child+1 < n) && (pq->edf_heap[child+1]->deadline < pq->edf_heap[child]->deadline)) child++;
+     if (last->deadline <= pq->edf_heap[child]->deadline) break;
+     pq->edf_heap[i] = pq->edf_heap[child];
+     i = child;
+  }
+  pq->edf_heap[i] = last;
+
+  return(hsop);
+}
+
+//*************************************************************************
+//  _edf_get_op - Returns the task with the earliest deadline that can 
+//     still finish in time.  Tasks that can't are moved to the expired que.
+//     The best case time is the fastest op seen plus the transfer at the
+//     best per connection goodput.  The lock should be held.
+//*************************************************************************
+
+Hportal_stack_op_t *_edf_get_op(Host_portal_t *hp, Hportal_que_t *pq)
+{
+  Hportal_stack_op_t *hsop;
+  Hportal_op_t *hop;
+  Hportal_scale_stats_t *s = &(hp->scale);
+  hp_time_t now, best;
+
+  if (pq->edf_size == 0) return(NULL);
+
+  now = hp_time_now();
+  while ((hsop = _edf_remove_min(pq)) != NULL) {
+     hop = hp->context->imp->get_hp_op(hsop->op);
+     best = s->min_op_latency;
+     if (s->max_conn_goodput > 0) best += (hp_time_t)(hop->workload * HP_NS_PER_SEC / s->max_conn_goodput);
+
+     if (now + best <= hsop->deadline) return(hsop);
+
+     log_printf(15, "_edf_get_op: host=%s deadline missed.  now=" I64T " best=" I64T " deadline=" I64T "\n", 
+         hp->skey, now, best, hsop->deadline);
+     apr_atomic_sub32(&(hp->workload_kb), HP_WORKLOAD_KB(hop->workload));
+     push(hp->expired, (void *)hsop);
+     apr_atomic_inc32(&(hp->n_expired));
+  }
+
+  return(NULL);
 }
 
 //*************************************************************************
-//  _add_hportal_op - Adds a task to a hportal que
-//        NOTE:  No locking is performed
+//  hportal_fail_expired - Fails any tasks that missed their deadline.  
+//     They are completed with the lock released so the callback can 
+//     submit new tasks.
+//        NOTE:  hp->lock should NOT be held
+//*************************************************************************
+
+void hportal_fail_expired(Host_portal_t *hp)
+{
+  Hportal_stack_op_t *hsop;
+  Stack_t *expired;
+
+  if (apr_atomic_read32(&(hp->n_expired)) == 0) return;
+
+  hportal_lock(hp);
+  expired = hp->expired;
+  hp->expired = new_stack();
+  apr_atomic_set32(&(hp->n_expired), 0);
+  hportal_unlock(hp);
+
+  while ((hsop = (Hportal_stack_op_t *)pop(expired)) != NULL) {
+     oplist_mark_completed(hsop->oplist, hsop->op, hp->context->imp->hp_deadline);
+     destroy_hportal_op(hsop);
+  }
+  free_stack(expired, 0);
+}
+
+//*************************************************************************
+//  _add_hportal_op - Adds a task to a hportal que.  Normal tasks go on
+//        the lock free que.  Retries (addtotop=1) and any overflow from
+//        the lock free que go on the locked que.  With EDF dispatch 
+//        everything goes on the deadline heap.  Only a single idle
+//        connection is woken up.
+//        NOTE:  hp->lock should NOT be held
 //*************************************************************************
 
 void _add_hportal_op(Host_portal_t *hp, oplist_t *oplist, void *op, int addtotop)
 {
   Hportal_stack_op_t *hsop = new_hportal_op(oplist, op);
   Hportal_op_t *hop = hp->context->imp->get_hp_op(op);
+  Hportal_que_t *pq;
+  int prio;
+
+  prio = hop->priority;
+  if ((prio < 0) || (prio >= HP_N_PRIO)) prio = HP_PRIO_NORMAL;
+  pq = &(hp->pq[prio]);
 
-  hp->workload = hp->workload + hop->workload;
+  apr_atomic_add32(&(hp->workload_kb), HP_WORKLOAD_KB(hop->workload));
+
+  if (hop->deadline == 0) hop->deadline = hp_time_now() + hop->timeout_ns;  //** Retries keep the original
+  hsop->deadline = hop->deadline;
+
+  if (hp->context->edf_dispatch == 1) {
+     hportal_lock(hp);
+     _edf_push(pq, hsop);
+     hportal_unlock(hp);
+  } else if (addtotop == 1) {
+     hportal_lock(hp);
+     push(pq->que, (void *)hsop);
+     apr_atomic_inc32(&(pq->n_retry));
+     hportal_unlock(hp);
+  } else if ((apr_atomic_read32(&(pq->n_overflow)) > 0) || (mpmc_enqueue(pq->work_que, (void *)hsop) != 0)) {
+     //** Once we overflow keep using the locked que until it drains to preserve the order
+     hportal_lock(hp);
+     move_to_bottom(pq->que);
+     insert_below(pq->que, (void *)hsop);
+     apr_atomic_inc32(&(pq->n_overflow));
+     hportal_unlock(hp);
+  }
 
-  if (addtotop == 1) {
-    push(hp->que, (void *)hsop);
+  //** Wake up a single waiting connection if needed.  A reserved connection
+  //** can't take a low priority task so in that case everyone is woken up
+  if (apr_atomic_read32(&(hp->idle_waiters)) > 0) {
+     hportal_lock(hp);
+     if ((prio != HP_PRIO_HIGH) && (hp->n_reserved > 0)) {
+        apr_thread_cond_broadcast(hp->work_cond);
+     } else {
+        hportal_wake_one(hp);
+     }
+     hportal_unlock(hp);
+  }
+
+  //** and kick an idle engine connection.  Busy ones pick up the work when their next response comes in
+  if ((hp->context->engine != NULL) && (apr_atomic_read32(&(hp->engine_idle)) > 0)) {
+     hportal_lock(hp);
+     hc_engine_notify(hp);
+     hportal_unlock(hp);
+  }
+}
+
+//*************************************************************************
+//  _pop_hportal_que - Pops the top task off the class's locked que
+//      NOTE:  hp->lock should be held
+//*************************************************************************
+
+Hportal_stack_op_t *_pop_hportal_que(Hportal_que_t *pq)
+{
+  Hportal_stack_op_t *hsop = (Hportal_stack_op_t *)pop(pq->que);
+
+  if (hsop != NULL) {  //** Retries are always on top
+     if (apr_atomic_read32(&(pq->n_retry)) > 0) {
+        apr_atomic_dec32(&(pq->n_retry));
+     } else {
+        apr_atomic_dec32(&(pq->n_overflow));
+     }
+  }
+
+  return(hsop);
+}
+
+//*************************************************************************
+//  _dequeue_hportal_class - Gets the next task from a single priority class.
+//      Retries are done first followed by the lock free que and then any
+//      overflow.  The lock is only acquired, if have_lock == 0, when the 
+//      locked que or EDF heap is used.  The EDF heap always goes first.
+//*************************************************************************
+
+Hportal_stack_op_t *_dequeue_hportal_class(Host_portal_t *hp, Hportal_que_t *pq, int have_lock)
+{
+  Hportal_stack_op_t *hsop = NULL;
+
+  if (apr_atomic_read32(&(pq->edf_size)) > 0) {
+     if (have_lock == 0) hportal_lock(hp);
+     hsop = _edf_get_op(hp, pq);
+     if (have_lock == 0) hportal_unlock(hp);
+  }
+
+  if ((hsop == NULL) && (apr_atomic_read32(&(pq->n_retry)) > 0)) {
+     if (have_lock == 0) hportal_lock(hp);
+     hsop = _pop_hportal_que(pq);
+     if (have_lock == 0) hportal_unlock(hp);
+  }
+
+  if (hsop == NULL) hsop = (Hportal_stack_op_t *)mpmc_dequeue(pq->work_que);
+
+  if ((hsop == NULL) && (apr_atomic_read32(&(pq->n_overflow)) > 0)) {
+     if (have_lock == 0) hportal_lock(hp);
+     hsop = _pop_hportal_que(pq);
+     if (have_lock == 0) hportal_unlock(hp);
+  }
+
+  return(hsop);
+}
+
+//*************************************************************************
+//  _dequeue_hportal_op - Gets the next task for the depot with a priority
+//      <= max_prio.  The class to try first comes from the context's 
+//      weighted schedule so each class with work gets its share.  If
+//      it's empty the remaining classes are tried from high to low.
+//*************************************************************************
+
+Hportal_stack_op_t *_dequeue_hportal_op(Host_portal_t *hp, int have_lock, int max_prio)
+{
+  Hportal_context_t *hpc = hp->context;
+  Hportal_stack_op_t *hsop;
+  apr_uint32_t tick;
+  int i, first;
+
+  tick = apr_atomic_read32(&(hp->prio_tick));
+  first = hpc->prio_sched[tick % hpc->prio_sched_len];
+  if (first > max_prio) first = HP_PRIO_HIGH;
+
+  hsop = _dequeue_hportal_class(hp, &(hp->pq[first]), have_lock);
+  if (hsop != NULL) {
+     apr_atomic_inc32(&(hp->prio_tick));  //** Only move on to the next slot if it was used
   } else {
-    move_to_bottom(hp->que);
-    insert_below(hp->que, (void *)hsop);
-  };
+     for (i=0; (i<=max_prio) && (hsop == NULL); i++) {
+        if (i != first) hsop = _dequeue_hportal_class(hp, &(hp->pq[i]), have_lock);
+     }
+  }
+
+  if (hsop != NULL) {
+     Hportal_op_t *hop = hpc->imp->get_hp_op(hsop->op);
+     apr_atomic_sub32(&(hp->workload_kb), HP_WORKLOAD_KB(hop->workload));
+  }
 
-  hportal_signal(hp);  //** Send a signal for any tasks listening
+  return(hsop);
 }
 
 //*************************************************************************
 //  _get_hportal_op - Gets the next task for the depot.
-//      NOTE:  No locking is done!
+//      NOTE:  hp->lock should be held
 //*************************************************************************
 
 Hportal_stack_op_t *_get_hportal_op(Host_portal_t *hp)
 {
-  Hportal_stack_op_t *hsop = (Hportal_stack_op_t *)pop(hp->que);
+  return(_dequeue_hportal_op(hp, 1, HP_N_PRIO-1));
+}
+
+//*************************************************************************
+//  get_hportal_op - Gets the next task for the depot.  No locking is 
+//      needed unless there are retries or overflow tasks.
+//      NOTE:  hp->lock should NOT be held
+//*************************************************************************
+
+Hportal_stack_op_t *get_hportal_op(Host_portal_t *hp)
+{
+  return(get_hportal_op_prio(hp, HP_N_PRIO-1));
+}
+
+//*************************************************************************
+//  get_hportal_op_prio - Same as get_hportal_op but only tasks with a
+//      priority <= max_prio are returned.
+//      NOTE:  hp->lock should NOT be held
+//*************************************************************************
+
+Hportal_stack_op_t *get_hportal_op_prio(Host_portal_t *hp, int max_prio)
+{
+  Hportal_stack_op_t *hsop = _dequeue_hportal_op(hp, 0, max_prio);
+
+  hportal_fail_expired(hp);
 
-  if (hsop != NULL) {
-     Hportal_op_t *hop = hp->context->imp->get_hp_op(hsop->op);
-     hp->workload = hp->workload - hop->workload;
-  }
   return(hsop);
 }
 
+//*************************************************************************
+//  _hp_clear_que - Removes and frees all the queued tasks *without*
+//      completing them.  Used during shutdown.
+//      NOTE:  hp->lock should be held
+//*************************************************************************
+
+void _hp_clear_que(Host_portal_t *hp)
+{
+  Hportal_stack_op_t *hsop;
+
+  while ((hsop = _get_hportal_op(hp)) != NULL) {
+     destroy_hportal_op(hsop);
+  }
+  while ((hsop = (Hportal_stack_op_t *)pop(hp->expired)) != NULL) {
+     destroy_hportal_op(hsop);
+  }
+  apr_atomic_set32(&(hp->n_expired), 0);
+
+  apr_atomic_set32(&(hp->workload_kb), 0);
+}
+
 //*************************************************************************
 // find_hc_to_close - Finds a connection to be close
 //*************************************************************************
@@ -473,67 +1006,44 @@ Hportal_stack_op_t *_get_hportal_op(Host_portal_t *hp)
 Host_connection_t *find_hc_to_close(Hportal_context_t *hpc)
 {
   apr_hash_index_t *hi;
-  Host_portal_t *hp, *shp;
-  Host_connection_t *hc, *best_hc, *best_sync;
+  Host_portal_t *hp;
+  Host_connection_t *hc, *best_hc;
+  Hportal_shard_t *shard;
   void *val;
-  int best_workload;
-  int oldest_sync_time;
+  int best_workload, i;
 
   hc = NULL;
   best_hc = NULL;
   best_workload = 100*hpc->max_workload;
-  oldest_sync_time = time(NULL) + 1;
-  best_sync = NULL;
 
-  apr_thread_mutex_lock(hpc->lock);
+  for (i=0; i<HP_N_SHARDS; i++) {
+     shard = &(hpc->shard[i]);
+     apr_thread_mutex_lock(shard->lock);
 
-  for (hi=apr_hash_first(hpc->pool, hpc->table); hi != NULL; hi = apr_hash_next(hi)) {
-     apr_hash_this(hi, NULL, NULL, &val); hp = (Host_portal_t *)val;  
-     apr_hash_set(hpc->table, hp->skey, APR_HASH_KEY_STRING, NULL);  //** This removes the key
+     for (hi=apr_hash_first(NULL, shard->table); hi != NULL; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, NULL, NULL, &val); hp = (Host_portal_t *)val;  
 
-     hportal_lock(hp);
+        hportal_lock(hp);
 
-     //** Scan the async connections
-     move_to_top(hp->conn_list);
-     while ((hc = (Host_connection_t *)get_ele_data(hp->conn_list)) != NULL) {
-        lock_hc(hc);
-        if (hc->curr_workload < best_workload) {
-           best_workload = hc->curr_workload;
-           best_hc = hc;
-        }    
-        move_down(hp->conn_list);
-        unlock_hc(hc);
-     }     
-
-     //** Scan the sync connections
-     move_to_top(hp->sync_list);
-     while ((shp = (Host_portal_t *)get_ele_data(hp->sync_list)) != NULL)  {
-        hportal_lock(shp);
-        if (stack_size(shp->conn_list) > 0) {
-           move_to_top(shp->conn_list);
-           hc = (Host_connection_t *)get_ele_data(shp->conn_list);
+        //** Scan the async connections
+        move_to_top(hp->conn_list);
+        while ((hc = (Host_connection_t *)get_ele_data(hp->conn_list)) != NULL) {
            lock_hc(hc);
-           if (oldest_sync_time > hc->last_used) {
-              best_sync = hc;
-              oldest_sync_time = hc->last_used;              
-           }
+           if (hc->curr_workload < best_workload) {
+              best_workload = hc->curr_workload;
+              best_hc = hc;
+           }    
+           move_down(hp->conn_list);
            unlock_hc(hc);
-        }
-        hportal_unlock(shp);
-        move_down(hp->sync_list);
+        }     
+
+        hportal_unlock(hp);
      }
 
-     hportal_unlock(hp);
+     apr_thread_mutex_unlock(shard->lock);
   }
 
-  apr_thread_mutex_unlock(hpc->lock);
-
-  hc = best_hc;
-  if (best_sync != NULL) {
-     if (best_workload > 0) hc = best_sync;
-  }
-     
-  return(hc);  
+  return(best_hc);  
 }
 
 
@@ -541,17 +1051,23 @@ Host_connection_t *find_hc_to_close(Hportal_context_t *hpc)
 // spawn_new_connection - Creates a new hportal thread/connection
 //*************************************************************************
 
-int spawn_new_connection(Host_portal_t *hp)
+int spawn_new_connection(Host_portal_t *hp, int reserved)
 {
   int n;
 
   n = get_hpc_thread_count(hp->context);
   if (n > hp->context->max_connections) {
        Host_connection_t *hc = find_hc_to_close(hp->context);
-       close_hc(hc);
+       if (hc != NULL) {
+          if (hc->et != NULL) {  //** Can't block since we could be running on the engine thread
+             hc_engine_request_close(hc);
+          } else {
+             close_hc(hc);
+          }
+       }
   }
 
-  return(create_host_connection(hp));
+  return(create_host_connection(hp, reserved));
 }
 
 //*************************************************************************
@@ -564,166 +1080,281 @@ void _hp_fail_tasks(Host_portal_t *hp, int err_code)
 {
   Hportal_stack_op_t *hsop;
 
-  hp->workload = 0;  
-  while ((hsop = (Hportal_stack_op_t *)pop(hp->que)) != NULL) {
+  while ((hsop = _get_hportal_op(hp)) != NULL) {
       oplist_mark_completed(hsop->oplist, hsop->op, err_code);
+      destroy_hportal_op(hsop);
   }
+  while ((hsop = (Hportal_stack_op_t *)pop(hp->expired)) != NULL) {
+      oplist_mark_completed(hsop->oplist, hsop->op, hp->context->imp->hp_deadline);
+      destroy_hportal_op(hsop);
+  }
+  apr_atomic_set32(&(hp->n_expired), 0);
+  apr_atomic_set32(&(hp->workload_kb), 0);
 }
 
 //*************************************************************************
-// check_hportal_connections - checks if the hportal has the appropriate
-//     number of connections and if not spawns them
+// check_hportal_connections - Adds or removes connections as decided
+//    by the context's scaling policy
 //*************************************************************************
 
 void check_hportal_connections(Host_portal_t *hp)
 {
-   int i, total, err;
+   Hportal_scale_policy_t *policy = hp->context->scale;
+   int i, err;
    int n_newconn = 0;
+   int n_shed = 0;
+   int n_reserve = 0;
+
+   if (policy == NULL) policy = &hp_scale_heuristic;
 
    hportal_lock(hp);
 
-   //** Now figure out how many new connections are needed, if any
-   if (stack_size(hp->que) == 0) {
+   n_newconn = policy->new_connections(hp);
+   if (n_newconn < 0) {   //** Too many connections
+      n_shed = -n_newconn;
       n_newconn = 0;
-   } else if (hp->n_conn < hp->min_conn) {
-       n_newconn = hp->min_conn - hp->n_conn;
-   } else {
-       n_newconn = hp->workload / hp->context->max_workload;
-
-       if ((hp->n_conn+n_newconn) > hp->max_conn) {
-          n_newconn = hp->max_conn - hp->n_conn;
-      }
-   }
-
-   i = n_newconn;
-
-   total = n_newconn + hp->n_conn;
-   if (total > hp->stable_conn) {
-      if (time(NULL) > hp->pause_until) {
-         hp->stable_conn++;
-         if (hp->stable_conn > hp->max_conn) {
-            hp->stable_conn = hp->max_conn;
-         } else if (hp->stable_conn == 0) {
-            hp->stable_conn = 1;
-         }
-         n_newconn = 1;
-         hp->pause_until = time(NULL) + hp->context->wait_stable_time;
-      } else {
-        n_newconn = hp->stable_conn - hp->n_conn;
-      }
    }
 
    //** Do a check for invalid or down host
    if (hp->invalid_host == 1) {
-      if ((hp->n_conn == 0) && (stack_size(hp->que) > 0)) n_newconn = 1;   //** If no connections create one to sink the command
+      n_shed = 0;
+      if ((hp->n_conn == 0) && (hportal_que_size(hp) > 0)) n_newconn = 1;   //** If no connections create one to sink the command
    }
 
-   log_printf(15, "check_hportal_connections: host=%s n_conn=%d workload=" I64T " start_new_conn=%d new_conn=%d stable=%d\n", 
-          hp->skey, hp->n_conn, hp->workload, i, n_newconn, hp->stable_conn);
+   //** Add the connection reserved for high priority ops once the depot is in use.
+   //** It's on top of what the policy wants.
+   if ((hp->context->reserve_high == 1) && (hp->n_reserved == 0) && (hp->invalid_host == 0) &&
+       (hp->n_conn + n_newconn > 0)) {
+      n_reserve = 1;
+      hp->n_reserved++;
+   }
+
+   log_printf(15, "check_hportal_connections: host=%s policy=%s n_conn=%d workload=" I64T " new_conn=%d shed=%d reserve=%d\n", 
+          hp->skey, policy->name, hp->n_conn, hportal_workload(hp), n_newconn, n_shed, n_reserve);
 
    //** Update the total # of connections after the operation
    //** n_conn is used instead of conn_list to prevent false positives on a dead depot
-   hp->n_conn = hp->n_conn + n_newconn;  
+   hp->n_conn = hp->n_conn + n_newconn + n_reserve;  
                                          
    hportal_unlock(hp);
 
    //** Spawn the new connections if needed **
    for (i=0; i<n_newconn; i++) {
-       err = spawn_new_connection(hp);
+       err = spawn_new_connection(hp, 0);
 //       if (err != 0) return(err);
    }
+
+   if (n_reserve > 0) spawn_new_connection(hp, 1);
+
+   for (i=0; i<n_shed; i++) hportal_shed_connection(hp);
 }
 
 //*************************************************************************
-// submit_hportal_sync - Returns an empty hportal for a dedicated
-//    sync IBP command *and* submits the command for execution
+// _hp_sync_close - Closes a sync connection.  If to_pool is set and the 
+//    socket is healthy it's handed to the context's idle socket pool.
 //*************************************************************************
 
-Host_portal_t *submit_hportal_sync(Hportal_context_t *hpc, oplist_t *oplist, void *op)
+void _hp_sync_close(Host_portal_t *hp, NetStream_t *ns, int to_pool)
 {
-   Host_portal_t *hp, *shp;
-   Host_connection_t *hc;
-   Hportal_op_t *hop = hpc->imp->get_hp_op(op);
+  Hportal_context_t *hpc = hp->context;
 
-   apr_thread_mutex_lock(hpc->lock);
+  if ((to_pool == 0) || (hportal_sockpool_put(hpc, hp->skey, ns) != 0)) {
+     hpc->imp->host_close_connection(ns);
+  }
+  destroy_netstream(ns);
+}
 
-   //** Check if we should do a garbage run **
-   if (hpc->next_check < time(NULL)) { 
-       hpc->next_check = time(NULL) + hpc->compact_interval;
+//*************************************************************************
+// _hp_sync_close_all - Closes all the idle sync connections.
+//    The hp lock should be held.
+//*************************************************************************
 
-       apr_thread_mutex_unlock(hpc->lock);  
-       compact_hportals(hpc);
-       apr_thread_mutex_lock(hpc->lock);
-   }
+void _hp_sync_close_all(Host_portal_t *hp)
+{
+  Hportal_idle_sock_t *is;
+
+  while ((is = (Hportal_idle_sock_t *)pop(hp->sync_list)) != NULL) {
+     _hp_sync_close(hp, is->ns, 0);
+     free(is);
+  }
+}
+
+//*************************************************************************
+// hportal_sync_checkout - Returns a connected socket for a sync command.
+//    The most recently used idle sync connection is tried 1st, then the
+//    context's idle socket pool, and finally a new connection is made
+//    on the caller's thread.  Returns NULL if the depot can't be reached.
+//*************************************************************************
+
+NetStream_t *hportal_sync_checkout(Host_portal_t *hp)
+{
+  Hportal_context_t *hpc = hp->context;
+  Hportal_idle_sock_t *is;
+  NetStream_t *ns;
+  Net_timeout_t dt;
+  time_t stale;
+  int err;
+
+  stale = time(NULL) - 1;
+  hportal_lock(hp);
+  while ((is = (Hportal_idle_sock_t *)pop(hp->sync_list)) != NULL) {
+     ns = is->ns;
+     if ((is->idle_since > stale) || (ns_poll_fd(ns) == NULL) || (ns_idle_ok(ns) == 1)) {
+        free(is);
+        hportal_unlock(hp);
+        return(ns);
+     }
+
+     log_printf(15, "hportal_sync_checkout: host=%s dropping dead ns=%d\n", hp->skey, ns_getid(ns));
+     _hp_sync_close(hp, ns, 0);
+     free(is);
+  }
+  hportal_unlock(hp);
+
+  ns = new_netstream();
+  if (hportal_sockpool_get(hpc, hp->skey, ns) == 0) return(ns);
+
+  set_net_timeout(&dt, hpc->connect_timeout, 0);
+  hpc_connect_slot_get(hpc);
+  err = hpc->imp->host_connect(ns, hp->connect_context, hp->host, hp->port, dt);
+  hpc_connect_slot_release(hpc);
+
+  hportal_lock(hp);
+  if (err == 0) {
+     hp->successful_conn_attempts++;
+     hp->failed_conn_attempts = 0;
+  } else {
+     hp->failed_conn_attempts++;
+  }
+  hportal_unlock(hp);
+
+  if (err != 0) {
+     log_printf(5, "hportal_sync_checkout: Can't connect to %s:%d!\n", hp->host, hp->port);
+     destroy_netstream(ns);
+     return(NULL);
+  }
+
+  return(ns);
+}
+
+//*************************************************************************
+// hportal_sync_checkin - Returns the sync connection for reuse.  If the
+//    depot already has max_threads idle sync connections it goes to the
+//    context's idle socket pool instead.
+//*************************************************************************
+
+void hportal_sync_checkin(Host_portal_t *hp, NetStream_t *ns)
+{
+  Hportal_idle_sock_t *is;
+
+  hportal_lock(hp);
+  if (stack_size(hp->sync_list) >= hp->context->max_threads) {
+     _hp_sync_close(hp, ns, 1);
+     hportal_unlock(hp);
+     return;
+  }
+
+  assert((is = (Hportal_idle_sock_t *)malloc(sizeof(Hportal_idle_sock_t))) != NULL);
+  is->skey = NULL;
+  is->ns = ns;
+  is->idle_since = time(NULL);
+  push(hp->sync_list, (void *)is);
+  hportal_unlock(hp);
+}
+
+//*************************************************************************
+// hportal_sync_exec - Runs the command on the sync connection.  This
+//    mirrors hc_send_op() and hc_recv_op() but on the caller's thread.
+//*************************************************************************
+
+int hportal_sync_exec(Host_portal_t *hp, NetStream_t *ns, void *op)
+{
+  Hportal_context_t *hpc = hp->context;
+  Hportal_op_t *hop = hpc->imp->get_hp_op(op);
+  int status;
+
+  status = hpc->imp->hp_ok;
+  hop->start_time = hp_time_now();
+  hop->end_time = hop->start_time + hop->timeout_ns;
+  hop->sent_time = hop->start_time;
+  if (hop->send_command != NULL) status = hop->send_command(op, ns);
+  if ((status == hpc->imp->hp_ok) && (hop->send_phase != NULL)) status = hop->send_phase(op, ns);
+  if (status != hpc->imp->hp_ok) return(status);
+
+  hop->start_time = hp_time_now();
+  hop->end_time = hop->start_time + hop->timeout_ns;
+  if (hop->recv_phase != NULL) status = hop->recv_phase(op, ns);
+
+  return(status);
+}
+
+//*************************************************************************
+// submit_hportal_sync - Executes a traditional IBP sync command on the
+//    caller's thread using a pooled connection to the depot.  No 
+//    connection threads are involved.  The op is completed before 
+//    returning.  Returns the depot's hportal or NULL on error.
+//*************************************************************************
+
+Host_portal_t *submit_hportal_sync(Hportal_context_t *hpc, oplist_t *oplist, void *op)
+{
+   Host_portal_t *hp;
+   Hportal_op_t *hop = hpc->imp->get_hp_op(op);
+   Hportal_shard_t *shard = (hop->handle != NULL) ? hop->handle->shard : hportal_shard(hpc, hop->hostport);
+   NetStream_t *ns;
+   int status, retry;
+
+   apr_thread_mutex_lock(shard->lock);
 
    //** Find it in the list or make a new one
-   hp = _lookup_hportal(hpc, hop->hostport);
+   hp = _hportal_get(hpc, shard, hop->handle, hop->hostport, hop->connect_context);
    if (hp == NULL) {
-      log_printf(15, "submit_hportal_sync: New host: %s\n", hop->hostport);
-      hp = create_hportal(hpc, hop->connect_context, hop->hostport, hpc->min_threads, hpc->max_threads);
-      if (hp == NULL) {
-          log_printf(15, "submit_hportal_sync: create_hportal failed!\n");
-          apr_thread_mutex_unlock(hpc->lock);
-          return(NULL);
-      }
-      apr_hash_set(hpc->table, hp->skey, APR_HASH_KEY_STRING, (const void *)hp);      
+      apr_thread_mutex_unlock(shard->lock);
+      return(NULL);
    }
 
-   apr_thread_mutex_unlock(hpc->lock);
+   hportal_lock(hp);
+   hp->n_sync_active++;   //** Keeps the hportal from being compacted while we use it
+   hportal_unlock(hp);
+
+   apr_thread_mutex_unlock(shard->lock);
 
    log_printf(15, "submit_hportal_sync: start opid=%d\n", oplist->id);
 
-   //** Scan the sync list for a free connection
-   hportal_lock(hp);
-   move_to_top(hp->sync_list);
-   while ((shp = (Host_portal_t *)get_ele_data(hp->sync_list)) != NULL)  {
-      if (hportal_trylock(shp) == 0) {
-         log_printf(15, "submit_hportal_sync: opid=%d shp->wl=" I64T " stack_size=%d\n", oplist->id, shp->workload, stack_size(shp->que));
-
-         if (stack_size(shp->que) == 0) {
-            if (stack_size(shp->conn_list) > 0) {
-               move_to_top(shp->conn_list);
-               hc = (Host_connection_t *)get_ele_data(shp->conn_list);
-               if (trylock_hc(hc) == 0) {
-                  if ((stack_size(hc->pending_stack) == 0) && (hc->curr_workload == 0)) {
-                     log_printf(15, "submit_hportal_sync(A): before submit ns=%d opid=%d wl=%d\n",ns_getid(hc->ns), oplist->id, hc->curr_workload);
-                     unlock_hc(hc);
-                     hportal_unlock(shp);
-                     submit_hportal(shp, oplist, op, 1);
-                     log_printf(15, "submit_hportal_sync(A): after submit ns=%d opid=%d\n",ns_getid(hc->ns), oplist->id);
-                     hportal_unlock(hp);
-                     return(shp);
-                  }
-                  unlock_hc(hc);
-               }
-            } else {
-              hportal_unlock(shp);
-              log_printf(15, "submit_hportal_sync(B): opid=%d\n", oplist->id);
-              submit_hportal(shp, oplist, op, 1);
-              hportal_unlock(hp);
-              return(shp);
-            }
+   if (hp->invalid_host == 1) {
+      status = hpc->imp->hp_invalid_host;
+   } else {
+      do {
+         retry = 0;
+         ns = hportal_sync_checkout(hp);
+         if (ns == NULL) {
+            status = hpc->imp->hp_cant_connect;
+            break;
          }
 
-         hportal_unlock(shp);
-      }
+         status = hportal_sync_exec(hp, ns, op);
 
-      move_down(hp->sync_list);  //** Move to the next hp in the list
+         if ((status == hpc->imp->hp_retry_dead_socket) || (status == hpc->imp->dead_connection) ||
+             (status == hpc->imp->hp_timeout) || (status == hpc->imp->hp_generic_err)) {
+            _hp_sync_close(hp, ns, 0);  //** The connection state is unknown so drop it
+            if (((status == hpc->imp->hp_retry_dead_socket) || (status == hpc->imp->hp_timeout)) && (hop->retry_count > 0)) {
+               hop->retry_count--;
+               retry = 1;
+               log_printf(15, "submit_hportal_sync: Retrying opid=%d status=%d retry_count=%d\n", oplist->id, status, hop->retry_count);
+            }
+         } else {
+            hportal_sync_checkin(hp, ns);
+         }
+      } while (retry == 1);
    }
 
-   //** If I made it here I have to add a new hportal
-   shp = create_hportal(hpc, hop->connect_context, hop->hostport, 1, 1);
-   if (shp == NULL) {
-      log_printf(15, "submit_hportal_sync: create_hportal failed!\n");
-      hportal_unlock(hp);
-      return(NULL);
-   }
-   push(hp->sync_list, (void *)shp);
-   submit_hportal(shp, oplist, op, 1);
-   
+   hportal_lock(hp);
+   hp->n_sync_active--;
+   if (status == hpc->imp->hp_ok) hp->cmds_processed++;
    hportal_unlock(hp);
 
-   return(shp);
+   oplist_mark_completed(oplist, op, status);
+
+   return(hp);
 }
 
 //*************************************************************************
@@ -733,9 +1364,7 @@ Host_portal_t *submit_hportal_sync(Hportal_context_t *hpc, oplist_t *oplist, voi
 
 int submit_hportal(Host_portal_t *hp, oplist_t *oplist, void *op, int addtotop)
 {
-   hportal_lock(hp);
    _add_hportal_op(hp, oplist, op, addtotop);  //** Add the task
-   hportal_unlock(hp);
 
    //** Now figure out how many new connections are needed, if any
    check_hportal_connections(hp);
@@ -750,36 +1379,186 @@ int submit_hportal(Host_portal_t *hp, oplist_t *oplist, void *op, int addtotop)
 int submit_hp_op(Hportal_context_t *hpc, oplist_t *oplist, void *op)
 {
    Hportal_op_t *hop = hpc->imp->get_hp_op(op);
+   Host_portal_t *hp;
 
-   apr_thread_mutex_lock(hpc->lock);
+   if (hop->handle != NULL) {
+      hp = hportal_get_handle(hpc, hop->handle, hop->connect_context);
+   } else {
+      hp = hportal_get(hpc, hop->hostport, hop->connect_context);
+   }
 
-   //** Check if we should do a garbage run **
-   if (hpc->next_check < time(NULL)) { 
-       hpc->next_check = time(NULL) + hpc->compact_interval;
+   if (hp == NULL) return(1);
 
-       apr_thread_mutex_unlock(hpc->lock);  
-       log_printf(15, "submit_hp_op: Calling compact_hportals\n");
-       compact_hportals(hpc);
-       apr_thread_mutex_lock(hpc->lock);
-   }
+   return(submit_hportal(hp, oplist, op, 0));
+}
+
+//*************************************************************************
+// _hportal_intern - Returns the interned hostport creating it if needed.
+//     No reference is taken.  The shard lock should be held.
+//*************************************************************************
+
+Hportal_hostport_t *_hportal_intern(Hportal_shard_t *shard, char *hostport)
+{
+   Hportal_hostport_t *h;
+
+   h = (Hportal_hostport_t *)apr_hash_get(shard->intern, hostport, APR_HASH_KEY_STRING);
+   if (h != NULL) return(h);
+
+   assert((h = (Hportal_hostport_t *)malloc(sizeof(Hportal_hostport_t))) != NULL);
+   assert((h->hostport = strdup(hostport)) != NULL);
+   h->shard = shard;
+   h->ref = 0;
+   h->hp = _lookup_hportal(shard, hostport);
+   if (h->hp != NULL) h->hp->handle = h;
+   apr_hash_set(shard->intern, h->hostport, APR_HASH_KEY_STRING, h);
+
+   return(h);
+}
+
+//*************************************************************************
+// hportal_intern - Returns a stable handle for the hostport.  Ops carrying
+//     the handle go straight to the depot's hportal without hashing the
+//     hostport.  The caller gets a reference which it drops with
+//     hportal_release_handle().  Handles with no references and no hportal
+//     are freed when their shard is compacted.
+//*************************************************************************
+
+Hportal_hostport_t *hportal_intern(Hportal_context_t *hpc, char *hostport)
+{
+   Hportal_shard_t *shard = hportal_shard(hpc, hostport);
+   Hportal_hostport_t *h;
+
+   apr_thread_mutex_lock(shard->lock);
+   h = _hportal_intern(shard, hostport);
+   apr_atomic_inc32(&(h->ref));
+   apr_thread_mutex_unlock(shard->lock);
 
-//log_printf(1, "submit_hp_op: hpc=%p hpc->table=%p\n",hpc, hpc->table);
-   Host_portal_t *hp = _lookup_hportal(hpc, hop->hostport);
+   return(h);
+}
+
+//*************************************************************************
+// hportal_ref_handle - Adds a reference to the handle.  The caller must
+//     already hold one so the count can't be raised from 0 without the
+//     shard lock.
+//*************************************************************************
+
+void hportal_ref_handle(Hportal_hostport_t *h)
+{
+   apr_atomic_inc32(&(h->ref));
+}
+
+//*************************************************************************
+// hportal_release_handle - Drops a reference to the handle
+//*************************************************************************
+
+void hportal_release_handle(Hportal_hostport_t *h)
+{
+   apr_atomic_dec32(&(h->ref));
+}
+
+//*************************************************************************
+// _hportal_get - Returns the hportal creating it if needed.  The handle
+//     is used if provided.  The shard lock should be held.
+//*************************************************************************
+
+Host_portal_t *_hportal_get(Hportal_context_t *hpc, Hportal_shard_t *shard, Hportal_hostport_t *handle, char *hostport, void *connect_context)
+{
+   Host_portal_t *hp;
+
+   //** Check if we should do a garbage run on this shard **
+   _check_hportal_shard(hpc, shard);
+
+   if ((handle != NULL) && (handle->hp != NULL)) return(handle->hp);  //** Fast path
+
+   hp = _lookup_hportal(shard, hostport);
    if (hp == NULL) {
-      log_printf(15, "submit_op: New host: %s\n", hop->hostport);
-      hp = create_hportal(hpc, hop->connect_context, hop->hostport, hpc->min_threads, hpc->max_threads);
+      log_printf(15, "hportal_get: New host: %s\n", hostport);
+      hp = create_hportal(hpc, connect_context, hostport, hpc->min_threads, hpc->max_threads);
       if (hp == NULL) {
-          log_printf(15, "submit_op: create_hportal failed!\n");
-          return(1);
+          log_printf(15, "hportal_get: create_hportal failed!\n");
+          return(NULL);
       }
-      log_printf(15, "submit_op: New host.. hp->skey=%s\n", hp->skey);
-      apr_hash_set(hpc->table, hp->skey, APR_HASH_KEY_STRING, (const void *)hp);      
-Host_portal_t *hp2 = _lookup_hportal(hpc, hop->hostport);
-log_printf(15, "submit_op: after lookup hp2=%p\n", hp2);
+      log_printf(15, "hportal_get: New host.. hp->skey=%s\n", hp->skey);
+      apr_hash_set(shard->table, hp->skey, APR_HASH_KEY_STRING, (const void *)hp);      
    }
 
-   apr_thread_mutex_unlock(hpc->lock);
+   if (hp->handle == NULL) {
+      hp->handle = (handle != NULL) ? handle : _hportal_intern(shard, hp->skey);
+      hp->handle->hp = hp;
+   }
 
-   return(submit_hportal(hp, oplist, op, 0));
+   return(hp);
+}
+
+//*************************************************************************
+// hportal_get - Returns the hportal for the hostport creating it if 
+//     needed.  Returns NULL if it can't be created.
+//*************************************************************************
+
+Host_portal_t *hportal_get(Hportal_context_t *hpc, char *hostport, void *connect_context)
+{
+   Hportal_shard_t *shard = hportal_shard(hpc, hostport);
+   Host_portal_t *hp;
+
+   apr_thread_mutex_lock(shard->lock);
+   hp = _hportal_get(hpc, shard, NULL, hostport, connect_context);
+   apr_thread_mutex_unlock(shard->lock);
+
+   return(hp);
+}
+
+//*************************************************************************
+// hportal_get_handle - Same as hportal_get() but using an interned 
+//     hostport so no hashing is needed if the hportal exists.
+//*************************************************************************
+
+Host_portal_t *hportal_get_handle(Hportal_context_t *hpc, Hportal_hostport_t *handle, void *connect_context)
+{
+   Host_portal_t *hp;
+
+   apr_thread_mutex_lock(handle->shard->lock);
+   hp = _hportal_get(hpc, handle->shard, handle, handle->hostport, connect_context);
+   apr_thread_mutex_unlock(handle->shard->lock);
+
+   return(hp);
+}
+
+//*************************************************************************
+// hportal_prewarm - Creates the depot's hportal and opens connections 
+//     ahead of the first op so it doesn't pay for the DNS lookup and
+//     connect.  The depot is brought up to n_conn connections, limited
+//     by max_conn.  The new connections count as stable so the scaling
+//     policy doesn't ramp them up again.  They are still closed if they
+//     sit idle for min_idle.  Returns the number of connections opened
+//     or -1 if the host is invalid.
+//*************************************************************************
+
+int hportal_prewarm(Hportal_context_t *hpc, char *hostport, void *connect_context, int n_conn)
+{
+   Host_portal_t *hp;
+   int i, n;
+
+   hp = hportal_get(hpc, hostport, connect_context);
+   if (hp == NULL) return(-1);
+
+   hportal_lock(hp);
+   if (hp->invalid_host == 1) {
+      hportal_unlock(hp);
+      log_printf(1, "hportal_prewarm: Invalid host %s\n", hostport);
+      return(-1);
+   }
+
+   if (n_conn > hp->max_conn) n_conn = hp->max_conn;
+   n = n_conn - hp->n_conn;
+   if (n < 0) n = 0;
+   hp->n_conn = hp->n_conn + n;
+   if (hp->stable_conn < hp->n_conn) hp->stable_conn = hp->n_conn;
+   hportal_unlock(hp);
+
+   log_printf(5, "hportal_prewarm: host=%s opening %d connections\n", hostport, n);
+
+   for (i=0; i<n; i++) spawn_new_connection(hp, 0);
+
+   return(n);
 }
 
@@ -0,0 +1,313 @@
+/*
+Advanced Computing Center for Research and Education Proprietary License
+Version 1.0 (April 2006)
+
+Copyright (c) 2006, Advanced Computing Center for Research and Education,
+ Vanderbilt University, All rights reserved.
+
+This Work is the sole and exclusive property of the Advanced Computing Center
+for Research and Education department at Vanderbilt University.  No right to
+disclose or otherwise disseminate any of the information contained herein is
+granted by virtue of your possession of this software except in accordance with
+the terms and conditions of a separate License Agreement entered into with
+Vanderbilt University.
+
+THE AUTHOR OR COPYRIGHT HOLDERS PROVIDES THE "WORK" ON AN "AS IS" BASIS,
+WITHOUT WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT
+LIMITED TO THE WARRANTIES OF MERCHANTABILITY, TITLE, FITNESS FOR A PARTICULAR
+PURPOSE, AND NON-INFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+Vanderbilt University
+Advanced Computing Center for Research and Education
+230 Appleton Place
+Nashville, TN 37203
+http://www.accre.vanderbilt.edu
+*/ 
+
+//*****************************************************
+// hportal_perf - Microbenchmark for the hportal task
+//      que.  Measures submit/dequeue throughput as the
+//      number of submitting threads and depot
+//      connections grows.  No network traffic is
+//      generated.  The tasks are just passed from the
+//      submitting threads to the "connection" threads.
+//*****************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <apr_time.h>
+#include <apr_atomic.h>
+#include <apr_thread_proc.h>
+#include "host_portal.h"
+#include "dns_cache.h"
+#include "fmttypes.h"
+#include "log.h"
+
+typedef struct {   //** Dummy op.  Only the Hportal_op_t is needed
+  Hportal_op_t hop;
+} perf_op_t;
+
+typedef struct {   //** Test parameters shared by all threads
+  Host_portal_t *hp;
+  perf_op_t *op;
+  int n_ops;
+  int n_producers;
+  int use_locked;
+  volatile apr_uint32_t n_done;
+} perf_test_t;
+
+typedef struct {   //** Per thread arguments
+  perf_test_t *t;
+  int id;
+} perf_arg_t;
+
+//*************************************************************************
+//  Hportal implementation stubs
+//*************************************************************************
+
+oplist_base_op_t *perf_get_base_op(void *op) { return(NULL); }
+Hportal_op_t *perf_get_hp_op(void *op) { return(&(((perf_op_t *)op)->hop)); }
+void *perf_dup_connect_context(void *cc) { return(NULL); }
+void perf_destroy_connect_context(void *cc) { return; }
+int perf_connect(NetStream_t *ns, void *cc, char *host, int port, Net_timeout_t timeout) { return(1); }
+void perf_close_connection(NetStream_t *ns) { return; }
+
+Hportal_impl_t perf_imp = { 0, 1, 2, 3, 4, 5, 6, 7,
+    perf_get_base_op,
+    perf_get_hp_op,
+    perf_dup_connect_context,
+    perf_destroy_connect_context,
+    perf_connect,
+    perf_close_connection };
+
+//*************************************************************************
+// locked_add - Previous que scheme.  Locked stack with a broadcast on 
+//     every add.  Used as the baseline.
+//*************************************************************************
+
+void locked_add(Host_portal_t *hp, void *op)
+{
+  hportal_lock(hp);
+  move_to_bottom(hp->pq[HP_PRIO_NORMAL].que);
+  insert_below(hp->pq[HP_PRIO_NORMAL].que, (void *)new_hportal_op(NULL, op));
+  apr_thread_cond_broadcast(hp->cond);
+  hportal_unlock(hp);
+}
+
+//*************************************************************************
+// locked_get - Previous que scheme.  Waits up to 1 sec for a task.
+//*************************************************************************
+
+Hportal_stack_op_t *locked_get(Host_portal_t *hp)
+{
+  Hportal_stack_op_t *hsop;
+
+  hportal_lock(hp);
+  hsop = (Hportal_stack_op_t *)pop(hp->pq[HP_PRIO_NORMAL].que);
+  if (hsop == NULL) {
+     hportal_wait(hp, 1);
+     hsop = (Hportal_stack_op_t *)pop(hp->pq[HP_PRIO_NORMAL].que);
+  }
+  hportal_unlock(hp);
+
+  return(hsop);
+}
+
+//*************************************************************************
+// producer_thread - Submits the thread's share of the tasks
+//*************************************************************************
+
+void *producer_thread(apr_thread_t *th, void *data)
+{
+  perf_arg_t *a = (perf_arg_t *)data;
+  perf_test_t *t = a->t;
+  int i;
+
+  for (i=a->id; i<t->n_ops; i = i + t->n_producers) {
+     if (t->use_locked == 1) {
+        locked_add(t->hp, &(t->op[i]));
+     } else {
+        _add_hportal_op(t->hp, NULL, &(t->op[i]), 0);
+     }
+  }
+
+  apr_thread_exit(th, 0);
+  return(NULL);
+}
+
+//*************************************************************************
+// connection_thread - Pulls tasks off the que like hc_send_thread until
+//     all the tasks are processed
+//*************************************************************************
+
+void *connection_thread(apr_thread_t *th, void *data)
+{
+  perf_arg_t *a = (perf_arg_t *)data;
+  perf_test_t *t = a->t;
+  Host_portal_t *hp = t->hp;
+  Hportal_stack_op_t *hsop;
+
+  while (apr_atomic_read32(&(t->n_done)) < (apr_uint32_t)t->n_ops) {
+     if (t->use_locked == 1) {
+        hsop = locked_get(hp);
+     } else {
+        hsop = get_hportal_op(hp);
+        if (hsop == NULL) {
+           hportal_lock(hp);
+           hsop = hportal_wait_for_work(hp, 1, HP_N_PRIO-1);
+           hportal_unlock(hp);
+        }
+     }
+
+     if (hsop != NULL) {
+        destroy_hportal_op(hsop);
+        if ((apr_atomic_inc32(&(t->n_done)) + 1) == (apr_uint32_t)t->n_ops) {
+           hportal_lock(hp); hportal_signal(hp); hportal_unlock(hp);  //** Wake everyone up so they can exit
+        }
+     }
+  }
+
+  apr_thread_exit(th, 0);
+  return(NULL);
+}
+
+//*************************************************************************
+// run_test - Runs a single producer/connection combination and returns
+//     the number of ops/sec
+//*************************************************************************
+
+double run_test(perf_test_t *t, int n_producers, int n_conn, apr_pool_t *mpool)
+{
+  apr_thread_t **th;
+  perf_arg_t *arg;
+  apr_status_t value;
+  apr_time_t stime, dtime;
+  int i, n;
+
+  n = n_producers + n_conn;
+  assert((th = (apr_thread_t **)malloc(sizeof(apr_thread_t *)*n)) != NULL);
+  assert((arg = (perf_arg_t *)malloc(sizeof(perf_arg_t)*n)) != NULL);
+
+  t->n_producers = n_producers;
+  apr_atomic_set32(&(t->n_done), 0);
+
+  stime = apr_time_now();
+
+  for (i=0; i<n_conn; i++) {
+     arg[i].t = t; arg[i].id = i;
+     apr_thread_create(&(th[i]), NULL, connection_thread, (void *)&(arg[i]), mpool);
+  }
+  for (i=0; i<n_producers; i++) {
+     arg[n_conn+i].t = t; arg[n_conn+i].id = i;
+     apr_thread_create(&(th[n_conn+i]), NULL, producer_thread, (void *)&(arg[n_conn+i]), mpool);
+  }
+
+  for (i=0; i<n; i++) apr_thread_join(&value, th[i]);
+
+  dtime = apr_time_now() - stime;
+
+  free(th);
+  free(arg);
+
+  return((1.0*t->n_ops) / (1.0*dtime / APR_USEC_PER_SEC));
+}
+
+//*************************************************************************
+//*************************************************************************
+
+int main(int argc, char **argv)
+{
+  int i, j, k, max_producers, max_conn, start_option;
+  double ops_sec;
+  perf_test_t t;
+  Hportal_context_t *hpc;
+  apr_pool_t *mpool;
+
+  if (argc < 2) {
+     printf("\n");
+     printf("hportal_perf [-d log_level] [-locked] [-p max_producers] [-c max_connections] n_ops\n");
+     printf("\n");
+     printf("-d log_level        - Enable debug output.  log_level=0..20\n");
+     printf("-locked             - Use the old locked stack and broadcast wakeups for comparison\n");
+     printf("-p max_producers    - Max number of submitting threads.  Default is 8\n");
+     printf("-c max_connections  - Max number of depot connections pulling tasks.  Default is 16\n");
+     printf("n_ops               - Number of tasks to push through the que for each test\n");
+     printf("\n");
+     printf("The producer and connection counts are doubled from 1 to the max values\n");
+     printf("\n");
+     return(-1);
+  }
+
+  t.use_locked = 0;
+  max_producers = 8;
+  max_conn = 16;
+
+  i = 1;
+  do {
+     start_option = i;
+
+     if (strcmp(argv[i], "-d") == 0) { //** Enable debugging
+        i++;
+        set_log_level(atoi(argv[i]));
+        i++;
+     } else if (strcmp(argv[i], "-locked") == 0) { //** Use the old que
+        t.use_locked = 1;
+        i++;
+     } else if (strcmp(argv[i], "-p") == 0) { //** Max producers
+        i++;
+        max_producers = atoi(argv[i]);
+        i++;
+     } else if (strcmp(argv[i], "-c") == 0) { //** Max connections
+        i++;
+        max_conn = atoi(argv[i]);
+        i++;
+     }
+  } while ((start_option < i) && (i < argc));
+
+  if (i >= argc) {
+     printf("Missing n_ops!\n");
+     return(-1);
+  }
+  t.n_ops = atoi(argv[i]);
+
+  assert(apr_initialize() == APR_SUCCESS);
+  apr_pool_create(&mpool, NULL);
+  dns_cache_init(10);
+
+  hpc = create_hportal_context(&perf_imp);
+  hpc->max_workload = 10*1024*1024;
+  t.hp = create_hportal(hpc, NULL, "localhost:6714:0:0", 1, 1);
+
+  assert((t.op = (perf_op_t *)malloc(sizeof(perf_op_t)*t.n_ops)) != NULL);
+  memset(t.op, 0, sizeof(perf_op_t)*t.n_ops);
+  for (i=0; i<t.n_ops; i++) {
+     t.op[i].hop.workload = 10*1024;
+     t.op[i].hop.priority = HP_PRIO_NORMAL;
+  }
+
+  printf("Que type: %s   n_ops: %d\n", (t.use_locked == 1) ? "locked stack + broadcast" : "lock free + single wakeup", t.n_ops);
+  printf("producers  connections        ops/sec\n");
+  printf("---------  -----------  -------------\n");
+
+  for (j=1; j<=max_producers; j = j*2) {
+     for (k=1; k<=max_conn; k = k*2) {
+        ops_sec = run_test(&t, j, k, mpool);
+        printf("%9d  %11d  %13.0lf\n", j, k, ops_sec);
+        flush_log();
+     }
+  }
+
+  free(t.op);
+  destroy_hportal(t.hp);
+  destroy_hportal_context(hpc);
+  finalize_dns_cache();
+  apr_pool_destroy(mpool);
+  apr_terminate();
+
+  return(0);
+}
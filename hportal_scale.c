@@ -0,0 +1,262 @@
+/*
+Advanced Computing Center for Research and Education Proprietary License
+Version 1.0 (April 2006)
+
+Copyright (c) 2006, Advanced Computing Center for Research and Education,
+ Vanderbilt University, All rights reserved.
+
+This Work is the sole and exclusive property of the Advanced Computing Center
+for Research and Education department at Vanderbilt University.  No right to
+disclose or otherwise disseminate any of the information contained herein is
+granted by virtue of your possession of this software except in accordance with
+the terms and conditions of a separate License Agreement entered into with
+Vanderbilt University.
+
+THE AUTHOR OR COPYRIGHT HOLDERS PROVIDES THE "WORK" ON AN "AS IS" BASIS,
+WITHOUT WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT
+LIMITED TO THE WARRANTIES OF MERCHANTABILITY, TITLE, FITNESS FOR A PARTICULAR
+PURPOSE, AND NON-INFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+Vanderbilt University
+Advanced Computing Center for Research and Education
+230 Appleton Place
+Nashville, TN 37203
+http://www.accre.vanderbilt.edu
+*/ 
+
+//*************************************************************************
+//*************************************************************************
+
+//*************************************************************************
+//  Connection autoscaling policies.  check_hportal_connections() asks the
+//  context's policy how many connections to add, or remove, for a depot.
+//*************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "host_portal.h"
+#include "log.h"
+
+//*************************************************************************
+// hportal_op_completed - Adds a completed op to the depot's goodput and
+//    latency samples.  The hp lock should be held.
+//*************************************************************************
+
+void hportal_op_completed(Host_portal_t *hp, int64_t nbytes, hp_time_t latency)
+{
+  Hportal_scale_stats_t *s = &(hp->scale);
+  Hportal_scale_policy_t *policy = hp->context->scale;
+  hp_time_t now, dt;
+  double g, l;
+
+  now = hp_time_now();
+
+  dt = now - s->window_start;
+  if (dt > 10*HP_SCALE_WINDOW) {  //** The depot was idle so start a new window
+     s->window_start = now - latency;
+     s->window_bytes = 0;
+     s->window_ops = 0;
+     s->window_latency = 0;
+     dt = latency;
+  }
+
+  s->window_bytes += nbytes;
+  s->window_ops++;
+  s->window_latency += latency;
+  if ((s->min_op_latency == 0) || (latency < s->min_op_latency)) s->min_op_latency = latency;
+
+  if (dt >= HP_SCALE_WINDOW) {  //** Close out the window and update the averages
+     g = (double)s->window_bytes * HP_NS_PER_SEC / dt;
+     l = (double)s->window_latency / s->window_ops;
+
+     s->goodput = (s->goodput == 0) ? g : (s->goodput + g) / 2;
+     s->latency = (s->latency == 0) ? l : (s->latency + l) / 2;
+     if ((s->min_latency == 0) || (s->latency < s->min_latency)) s->min_latency = s->latency;
+     if (hp->n_conn > 0) s->conn_goodput = s->goodput / hp->n_conn;
+     if (s->conn_goodput > s->max_conn_goodput) s->max_conn_goodput = s->conn_goodput;
+
+     log_printf(15, "hportal_op_completed: host=%s n_conn=%d goodput=%lf conn_goodput=%lf latency=%lf min_latency=%lf\n", 
+         hp->skey, hp->n_conn, s->goodput, s->conn_goodput, s->latency, s->min_latency);
+
+     s->window_start = now;
+     s->window_bytes = 0;
+     s->window_ops = 0;
+     s->window_latency = 0;
+  }
+
+  if ((policy != NULL) && (policy->op_completed != NULL)) policy->op_completed(hp, nbytes, latency);
+}
+
+//*************************************************************************
+// hportal_shed_connection - Asks the least loaded connection to close.
+//    Outstanding commands are finished and unsent ones are requeued.
+//*************************************************************************
+
+void hportal_shed_connection(Host_portal_t *hp)
+{
+  Host_connection_t *hc, *best;
+  int best_workload;
+
+  best = NULL;
+  best_workload = 0;
+
+  hportal_lock(hp);
+  move_to_top(hp->conn_list);
+  while ((hc = (Host_connection_t *)get_ele_data(hp->conn_list)) != NULL) {
+     lock_hc(hc);
+     if ((hc->shutdown_request == 0) && (hc->reserved == 0) && ((best == NULL) || (hc->curr_workload < best_workload))) {
+        best = hc;
+        best_workload = hc->curr_workload;
+     }
+     unlock_hc(hc);
+     move_down(hp->conn_list);
+  }
+
+  if (best != NULL) {
+     log_printf(15, "hportal_shed_connection: host=%s n_conn=%d closing ns=%d\n", hp->skey, hp->n_conn, ns_getid(best->ns));
+     if (best->et != NULL) {
+        hc_engine_request_close(best);
+     } else {
+        lock_hc(best);
+        best->shutdown_request = 1;
+        hc_send_signal(best);
+        unlock_hc(best);
+     }
+  }
+  hportal_unlock(hp);
+}
+
+//*************************************************************************
+// heuristic_new_connections - Original policy.  Adds connections based
+//    on the que's workload but only 1 every wait_stable_time.
+//*************************************************************************
+
+int heuristic_new_connections(Host_portal_t *hp)
+{
+   int i, total;
+   int n_newconn = 0;
+
+   //** Now figure out how many new connections are needed, if any
+   if (hportal_que_size(hp) == 0) {
+      n_newconn = 0;
+   } else if (hp->n_conn < hp->min_conn) {
+       n_newconn = hp->min_conn - hp->n_conn;
+   } else {
+       n_newconn = hportal_workload(hp) / hp->context->max_workload;
+
+       if ((hp->n_conn+n_newconn) > hp->max_conn) {
+          n_newconn = hp->max_conn - hp->n_conn;
+      }
+   }
+
+   i = n_newconn;
+
+   total = n_newconn + hp->n_conn;
+   if (total > hp->stable_conn) {
+      if (time(NULL) > hp->pause_until) {
+         hp->stable_conn++;
+         if (hp->stable_conn > hp->max_conn) {
+            hp->stable_conn = hp->max_conn;
+         } else if (hp->stable_conn == 0) {
+            hp->stable_conn = 1;
+         }
+         n_newconn = 1;
+         hp->pause_until = time(NULL) + hp->context->wait_stable_time;
+      } else {
+        n_newconn = hp->stable_conn - hp->n_conn;
+      }
+   }
+
+   log_printf(15, "heuristic_new_connections: host=%s n_conn=%d workload=" I64T " start_new_conn=%d new_conn=%d stable=%d\n", 
+          hp->skey, hp->n_conn, hportal_workload(hp), i, n_newconn, hp->stable_conn);
+
+   return(n_newconn);
+}
+
+//*************************************************************************
+// goodput_new_connections - Sizes the connection pool from the measured 
+//    goodput.  With a target the pool is sized to reach it using the 
+//    per connection goodput.  Otherwise connections are doubled as long 
+//    as each step improves the goodput by HP_SCALE_MIN_GAIN.  Growth stops
+//    if the latency shows the depot is overloaded.
+//*************************************************************************
+
+int goodput_new_connections(Host_portal_t *hp)
+{
+   Hportal_context_t *hpc = hp->context;
+   Hportal_scale_stats_t *s = &(hp->scale);
+   hp_time_t now;
+   int n, want, backlog;
+   double gain;
+
+   backlog = hportal_que_size(hp);
+   if (backlog == 0) return(0);
+   if (hp->n_conn < hp->min_conn) return(hp->min_conn - hp->n_conn);
+   if (hp->n_conn == 0) return(1);
+
+   now = hp_time_now();
+   if (now < s->next_change) return(0);
+   if (time(NULL) < hp->pause_until) return(0);  //** Still recovering from a lost connection
+
+   n = hp->n_conn;
+   if (s->conn_goodput <= 0) {   //** No samples yet so grow like TCP slow start
+      want = 2*n;
+   } else if (hpc->scale_target > 0) {  //** Size the pool to reach the target
+      want = (int)((hpc->scale_target + s->conn_goodput - 1) / s->conn_goodput);
+      if (want < n-1) want = n-1;   //** Back off gently
+   } else if (s->last_n_conn == 0) {  //** 1st decision
+      want = 2*n;
+   } else if (n > s->last_n_conn) {   //** We grew last time so see if it helped
+      gain = (s->last_goodput > 0) ? (s->goodput - s->last_goodput) / s->last_goodput : 1;
+      want = (gain >= HP_SCALE_MIN_GAIN) ? 2*n : n;
+   } else {   //** Holding steady or lost connections so probe with 1 more
+      want = n+1;
+   }
+
+   //** Don't add connections if the depot is already overloaded
+   if ((want > n) && (s->min_latency > 0) && (s->latency > HP_SCALE_LATENCY_FACTOR * s->min_latency)) {
+      want = (s->goodput < s->last_goodput) ? n-1 : n;
+   }
+
+   if (want > n + backlog) want = n + backlog;  //** No point having more connections than tasks
+   if (want > hp->max_conn) want = hp->max_conn;
+   if (want < hp->min_conn) want = hp->min_conn;
+   if (want < 1) want = 1;
+
+   if (want != n) {
+      s->last_goodput = s->goodput;
+      s->last_n_conn = n;
+      s->next_change = now + 2*HP_SCALE_WINDOW;  //** Give the new connections time to be measured
+   } else {
+      s->last_goodput = s->goodput;
+      s->last_n_conn = n;
+      s->next_change = now + hpc->wait_stable_time * HP_NS_PER_SEC;  //** Plateau so wait before probing again
+   }
+
+   log_printf(15, "goodput_new_connections: host=%s n_conn=%d want=%d goodput=%lf conn_goodput=%lf latency=%lf target=" I64T "\n", 
+          hp->skey, n, want, s->goodput, s->conn_goodput, s->latency, hpc->scale_target);
+
+   return(want - n);
+}
+
+Hportal_scale_policy_t hp_scale_heuristic = { "heuristic", heuristic_new_connections, NULL };
+Hportal_scale_policy_t hp_scale_goodput = { "goodput", goodput_new_connections, NULL };
+
+//*************************************************************************
+// hportal_scale_policy_lookup - Returns the built in policy with the 
+//    given name or NULL if it doesn't exist.
+//*************************************************************************
+
+Hportal_scale_policy_t *hportal_scale_policy_lookup(const char *name)
+{
+  if (strcmp(name, hp_scale_heuristic.name) == 0) return(&hp_scale_heuristic);
+  if (strcmp(name, hp_scale_goodput.name) == 0) return(&hp_scale_goodput);
+
+  return(NULL);
+}
+
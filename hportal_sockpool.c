@@ -0,0 +1,226 @@
+/*
+Advanced Computing Center for Research and Education Proprietary License
+Version 1.0 (April 2006)
+
+Copyright (c) 2006, Advanced Computing Center for Research and Education,
+ Vanderbilt University, All rights reserved.
+
+This Work is the sole and exclusive property of the Advanced Computing Center
+for Research and Education department at Vanderbilt University.  No right to
+disclose or otherwise disseminate any of the information contained herein is
+granted by virtue of your possession of this software except in accordance with
+the terms and conditions of a separate License Agreement entered into with
+Vanderbilt University.
+
+THE AUTHOR OR COPYRIGHT HOLDERS PROVIDES THE "WORK" ON AN "AS IS" BASIS,
+WITHOUT WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT
+LIMITED TO THE WARRANTIES OF MERCHANTABILITY, TITLE, FITNESS FOR A PARTICULAR
+PURPOSE, AND NON-INFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+Vanderbilt University
+Advanced Computing Center for Research and Education
+230 Appleton Place
+Nashville, TN 37203
+http://www.accre.vanderbilt.edu
+*/ 
+
+//*************************************************************************
+//*************************************************************************
+
+//*************************************************************************
+//  Idle socket pool.  Healthy connections that are closed for being idle
+//  are parked here instead of being closed.  New connections to the same
+//  hostport take one from the pool instead of dialing the depot.  The
+//  pool belongs to the context so it survives hportal compaction.  It's 
+//  a single LRU list bounded by size and age.
+//*************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "host_portal.h"
+#include "log.h"
+
+//*************************************************************************
+// _sockpool_destroy_entry - Closes the socket and frees the entry
+//*************************************************************************
+
+void _sockpool_destroy_entry(Hportal_idle_sock_t *is)
+{
+  destroy_netstream(is->ns);
+  free(is->skey);
+  free(is);
+}
+
+//*************************************************************************
+// _sockpool_expire - Closes any sockets that have been idle too long.
+//    They're at the bottom since the list is in LRU order.  
+//    NOTE: The pool lock should be held
+//*************************************************************************
+
+void _sockpool_expire(Hportal_sockpool_t *sp)
+{
+  Hportal_idle_sock_t *is;
+  time_t oldest;
+
+  oldest = time(NULL) - sp->max_age;
+  move_to_bottom(sp->lru);
+  while ((is = (Hportal_idle_sock_t *)get_ele_data(sp->lru)) != NULL) {
+     if (is->idle_since > oldest) break;
+
+     delete_current(sp->lru, 1, 0);   //** This moves curr up
+     move_to_bottom(sp->lru);
+     log_printf(15, "_sockpool_expire: host=%s ns=%d\n", is->skey, ns_getid(is->ns));
+     _sockpool_destroy_entry(is);
+     sp->stats.expired++;
+  }
+}
+
+//*************************************************************************
+// hportal_sockpool_init - Initializes the context's socket pool
+//*************************************************************************
+
+void hportal_sockpool_init(Hportal_context_t *hpc)
+{
+  Hportal_sockpool_t *sp = &(hpc->sockpool);
+
+  memset(sp, 0, sizeof(Hportal_sockpool_t));
+  apr_thread_mutex_create(&(sp->lock), APR_THREAD_MUTEX_DEFAULT, hpc->pool);
+  sp->lru = new_stack();
+  sp->max_size = HP_SOCKPOOL_SIZE;
+  sp->max_age = HP_SOCKPOOL_AGE;
+}
+
+//*************************************************************************
+// hportal_sockpool_flush - Closes all the pooled sockets
+//*************************************************************************
+
+void hportal_sockpool_flush(Hportal_context_t *hpc)
+{
+  Hportal_sockpool_t *sp = &(hpc->sockpool);
+  Hportal_idle_sock_t *is;
+
+  apr_thread_mutex_lock(sp->lock);
+  while ((is = (Hportal_idle_sock_t *)pop(sp->lru)) != NULL) {
+     _sockpool_destroy_entry(is);
+  }
+  apr_thread_mutex_unlock(sp->lock);
+}
+
+//*************************************************************************
+// hportal_sockpool_destroy - Closes the pooled sockets and frees the pool
+//*************************************************************************
+
+void hportal_sockpool_destroy(Hportal_context_t *hpc)
+{
+  hportal_sockpool_flush(hpc);
+  free_stack(hpc->sockpool.lru, 0);
+  apr_thread_mutex_destroy(hpc->sockpool.lock);
+}
+
+//*************************************************************************
+// hportal_sockpool_put - Parks the idle connection in the pool.  On 
+//    success the socket is moved out of ns, leaving it unconnected, and
+//    0 is returned.  Otherwise 1 is returned and the caller should 
+//    close ns.
+//*************************************************************************
+
+int hportal_sockpool_put(Hportal_context_t *hpc, char *skey, NetStream_t *ns)
+{
+  Hportal_sockpool_t *sp = &(hpc->sockpool);
+  Hportal_idle_sock_t *is;
+
+  if (sp->max_size <= 0) return(1);
+  if (ns_idle_ok(ns) == 0) return(1);
+
+  assert((is = (Hportal_idle_sock_t *)malloc(sizeof(Hportal_idle_sock_t))) != NULL);
+  is->skey = strdup(skey);
+  is->ns = new_netstream();
+  is->idle_since = time(NULL);
+  ns_move(is->ns, ns);
+
+  log_printf(15, "hportal_sockpool_put: host=%s ns=%d\n", skey, ns_getid(is->ns));
+
+  apr_thread_mutex_lock(sp->lock);
+  push(sp->lru, (void *)is);
+  sp->stats.puts++;
+
+  _sockpool_expire(sp);
+
+  //** Drop the least recently used if we're over the limit
+  while (stack_size(sp->lru) > sp->max_size) {
+     move_to_bottom(sp->lru);
+     is = (Hportal_idle_sock_t *)get_ele_data(sp->lru);
+     delete_current(sp->lru, 1, 0);
+     _sockpool_destroy_entry(is);
+     sp->stats.evicted++;
+  }
+  apr_thread_mutex_unlock(sp->lock);
+
+  return(0);
+}
+
+//*************************************************************************
+// hportal_sockpool_get - Looks for a pooled connection to the hostport.  
+//    If one is found it's moved into ns and 0 is returned.  Otherwise 
+//    1 is returned and the caller should make a new connection.
+//*************************************************************************
+
+int hportal_sockpool_get(Hportal_context_t *hpc, char *skey, NetStream_t *ns)
+{
+  Hportal_sockpool_t *sp = &(hpc->sockpool);
+  Hportal_idle_sock_t *is;
+
+  if (sp->max_size <= 0) return(1);
+
+  apr_thread_mutex_lock(sp->lock);
+  _sockpool_expire(sp);
+
+  move_to_top(sp->lru);
+  while ((is = (Hportal_idle_sock_t *)get_ele_data(sp->lru)) != NULL) {
+     if (strcmp(is->skey, skey) != 0) {
+        move_down(sp->lru);
+        continue;
+     }
+
+     delete_current(sp->lru, 0, 0);
+
+     if (ns_idle_ok(is->ns) == 1) {  //** Got a good one
+        sp->stats.hits++;
+        apr_thread_mutex_unlock(sp->lock);
+
+        log_printf(15, "hportal_sockpool_get: Reusing host=%s ns=%d\n", skey, ns_getid(is->ns));
+        ns_move(ns, is->ns);
+        _sockpool_destroy_entry(is);
+        return(0);
+     }
+
+     //** The depot closed it while it was idle
+     _sockpool_destroy_entry(is);
+     sp->stats.dead++;
+     move_to_top(sp->lru);
+  }
+
+  sp->stats.misses++;
+  apr_thread_mutex_unlock(sp->lock);
+
+  return(1);
+}
+
+//*************************************************************************
+// hportal_sockpool_stats - Returns a copy of the pool's counters
+//*************************************************************************
+
+void hportal_sockpool_stats(Hportal_context_t *hpc, Hportal_sockpool_stats_t *stats)
+{
+  Hportal_sockpool_t *sp = &(hpc->sockpool);
+
+  apr_thread_mutex_lock(sp->lock);
+  *stats = sp->stats;
+  stats->size = stack_size(sp->lru);
+  apr_thread_mutex_unlock(sp->lock);
+}
@@ -52,8 +52,18 @@ extern "C" {
 #define IBP_ST_RES   3         //** Used to get the list or resources from the depot
 #define MAX_KEY_SIZE 256
 
+typedef struct {         //** Per depot TCP buffer size override
+   char *host;
+   int tcpsize;
+} ibp_depot_tcpsize_t;
+
 typedef struct {
    int tcpsize;         //** TCP R/W buffer size.  If 0 then OS default is used
+   int ns_bufsize;      //** Size of each connection's receive ring buffer
+   int connect_stagger; //** ms before the next address of a multi-homed depot is tried
+   int dns_ttl;         //** Secs a resolved hostname is cached
+   int dns_refresh;     //** Used hostnames are re-resolved in the background this many secs before expiring
+   int dns_neg_ttl;     //** Max secs a failed hostname lookup is cached
    int min_idle;        //** Connection minimum idle time before disconnecting
    int min_threads;     //** Min and max threads allowed to a depot
    int max_threads;     //** Max number of simultaneous connection to a depot
@@ -64,7 +74,27 @@ typedef struct {
    int abort_conn_attempts; //** If this many failed connection requests occur in a row we abort
    int check_connection_interval;  //**# of secs to wait between checks if we need more connections to a depot
    int max_retry;        //** Max number of times to retry a command before failing.. only for dead socket retries
+   int engine_threads;   //** Number of event engine threads.  If 0 each connection gets its own send/recv threads
+   int engine_workers;   //** Max event engine data workers.  They're started as needed and exit when idle
+   int max_connecting;   //** Max connections being established at once.  0 = no limit
+   int connect_timeout;  //** Connect timeout in secs
+   int sockpool_size;    //** Max idle sockets kept for reuse.  0 disables the pool
+   int sockpool_max_age; //** Max secs an idle socket is kept
+   int max_pipeline;     //** Max number of commands in flight on a single connection.  0 = only limited by max_workload
+   int claim_batch;      //** Number of commands a connection claims from the depot que at once
+   int batch_commands;   //** Max commands whose lines are flushed together.  0 = no batching
+   Hportal_scale_policy_t *scale_policy; //** Policy used to decide the # of connections to a depot
+   int64_t scale_target; //** Per depot goodput target in bytes/sec for the goodput policy.  0 = No target
+   int edf_dispatch;     //** If 1 commands are sent earliest deadline first and ones that can't finish in time fail early
+   int prio_weight[HP_N_PRIO]; //** Relative dequeue share for the high, normal, and bulk priority classes
+   int prio_bulk_size;   //** Reads/writes/copies this size or larger go in the bulk class
+   int reserve_high;     //** If 1 each depot gets an extra connection only used for high priority commands
+   int coalesce_reads;   //** If 1 adjacent reads on the same cap in an oplist are merged into a single IBP_LOAD
+   int coalesce_writes;  //** If 1 adjacent writes on the same cap in an oplist are merged into a single IBP_WRITE
+   int coalesce_max_size; //** Max size of a merged read or write
    ibp_connect_context_t cc[IBP_MAX_NUM_CMDS+1];  //** Default connection contexts for EACH command
+   int n_depot_tcpsize;  //** Number of per depot TCP buffer size overrides
+   ibp_depot_tcpsize_t *depot_tcpsize; //** Per depot TCP buffer sizes from the [ibp_depot_tcpsize] group
 } ibp_config_t;
 
 extern Hportal_context_t *_hpc_config;
@@ -72,8 +102,10 @@ extern ibp_config_t *_ibp_config;
 
 typedef struct {  //** Read/Write operation 
    ibp_cap_t *cap;
-   char       key[MAX_KEY_SIZE];
-   char       typekey[MAX_KEY_SIZE];
+   char      *key;        //** Points to key_buf or into an ibp_cap_handle_t
+   char      *typekey;
+   char       key_buf[MAX_KEY_SIZE];
+   char       typekey_buf[MAX_KEY_SIZE];
    char *buf;
    int offset;
    int size;
@@ -82,6 +114,17 @@ typedef struct {  //** Read/Write operation
 //   int counter;
 } ibp_op_rw_t;
 
+typedef struct {  //** Several reads or writes on the same cap merged into a single IBP_LOAD or IBP_WRITE
+   char       key[MAX_KEY_SIZE];
+   char       typekey[MAX_KEY_SIZE];
+   int offset;
+   int size;
+   int overlap;      //** If 1 some of the ranges overlap
+   int n_ops;
+   struct _ibp_op_s **ops;  //** Original ops sorted by offset
+   oplist_t *oplist;        //** oplist the original ops belong to
+} ibp_op_coalesce_t;
+
 typedef struct { //** MERGE allocoation op
    char mkey[MAX_KEY_SIZE];      //** Master key
    char mtypekey[MAX_KEY_SIZE];  
@@ -176,6 +219,7 @@ typedef struct _ibp_op_s { //** Individual IO operation
      ibp_op_merge_alloc_t  merge_op;
      ibp_op_probe_t  probe_op;
      ibp_op_rw_t     rw_op;
+     ibp_op_coalesce_t coalesce_op;
      ibp_op_copy_t   copy_op;
      ibp_op_depot_modify_t depot_modify_op;
      ibp_op_depot_inq_t depot_inq_op;
@@ -186,18 +230,30 @@ typedef struct _ibp_op_s { //** Individual IO operation
 } ibp_op_t;
 
 //** ibp_op.c **
+//** All op timeouts are in secs.  Use ibp_op_set_timeout_ms() for finer control.
 ibp_op_t *new_ibp_op();
+Slab_t *ibp_op_slab();
+void ibp_op_set_priority(ibp_op_t *op, int priority);
 void init_ibp_base_op(ibp_op_t *op, char *logstr, int timeout, int workload, char *hostport, 
      int cmp_size, int primary_cmd, int sub_cmd, oplist_app_notify_t *an, ibp_connect_context_t *cc);
 ibp_op_t *new_ibp_rw_op(int rw_type, ibp_cap_t *cap, int offset, int size,                           
      int (*next_block)(int, void *, int *, char **), void *arg, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc);
 void set_ibp_rw_op(ibp_op_t *op, int rw_type, ibp_cap_t *cap, int offset, int size,
      int (*next_block)(int, void *, int *, char **), void *arg, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc);
+ibp_op_t *new_ibp_handle_rw_op(int rw_type, ibp_cap_handle_t *ch, int offset, int size,
+     int (*next_block)(int, void *, int *, char **), void *arg, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc);
+void set_ibp_handle_rw_op(ibp_op_t *op, int rw_type, ibp_cap_handle_t *ch, int offset, int size,
+     int (*next_block)(int, void *, int *, char **), void *arg, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc);
+ibp_op_t *new_ibp_handle_read_op(ibp_cap_handle_t *ch, int offset, int size, char *buffer, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc);
+void set_ibp_handle_read_op(ibp_op_t *op, ibp_cap_handle_t *ch, int offset, int size, char *buffer, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc);
+ibp_op_t *new_ibp_handle_write_op(ibp_cap_handle_t *ch, int offset, int size, char *buffer, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc);
+void set_ibp_handle_write_op(ibp_op_t *op, ibp_cap_handle_t *ch, int offset, int size, char *buffer, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc);
 void set_ibp_user_read_op(ibp_op_t *op, ibp_cap_t *cap, int offset, int size,
        int (*next_block)(int, void *, int *, char **), void *arg, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc);
 ibp_op_t *new_ibp_user_read_op(ibp_cap_t *cap, int offset, int size,
        int (*next_block)(int, void *, int *, char **), void *arg, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc);
 ibp_op_t *new_ibp_read_op(ibp_cap_t *cap, int offset, int size, char *buffer, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc);
+ibp_op_t *new_ibp_coalesce_op(oplist_t *oplist, int rw_type, ibp_op_t **ops, int n_ops);
 void set_ibp_read_op(ibp_op_t *op, ibp_cap_t *cap, int offset, int size, char *buffer, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc);
 void set_ibp_user_write_op(ibp_op_t *op, ibp_cap_t *cap, int offset, int size,
        int (*next_block)(int, void *, int *, char **), void *arg, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc);
@@ -265,6 +321,11 @@ void free_ibp_op(ibp_op_t *iop);
 void finalize_ibp_op(ibp_op_t *iop);
 int ibp_op_status(ibp_op_t *op);
 int ibp_op_id(ibp_op_t *op);
+void ibp_op_set_timeout_ms(ibp_op_t *op, int timeout_ms);
+int ibp_prewarm_depots(ibp_depot_t *depot_list, int n, int conns_per_depot);
+Hportal_hostport_t *ibp_hostport(char *host, int port, ibp_connect_context_t *cc);
+void ibp_hostport_cache_init();
+void ibp_hostport_cache_destroy();
 
 //** ibp_oplist.c **
 oplist_t *new_ibp_oplist(oplist_app_notify_t *an);
@@ -278,6 +339,17 @@ void ibp_set_abort_attempts(int n);
 int  ibp_get_abort_attempts();
 void ibp_set_tcpsize(int n);
 int  ibp_get_tcpsize();
+int  ibp_get_depot_tcpsize(char *host);
+void ibp_set_ns_bufsize(int n);
+int  ibp_get_ns_bufsize();
+void ibp_set_connect_stagger(int ms);
+int  ibp_get_connect_stagger();
+void ibp_set_dns_ttl(int secs);
+int  ibp_get_dns_ttl();
+void ibp_set_dns_refresh(int secs_ahead);
+int  ibp_get_dns_refresh();
+void ibp_set_dns_neg_ttl(int max_secs);
+int  ibp_get_dns_neg_ttl();
 void ibp_set_min_depot_threads(int n);
 int  ibp_get_min_depot_threads();
 void ibp_set_max_depot_threads(int n);
@@ -294,6 +366,40 @@ void ibp_set_check_interval(int n);
 int  ibp_get_check_interval();
 void ibp_set_max_retry(int n);
 int  ibp_get_max_retry();
+void ibp_set_engine_threads(int n);
+int  ibp_get_engine_threads();
+void ibp_set_engine_workers(int n);
+int  ibp_get_engine_workers();
+void ibp_set_max_connecting(int n);
+int  ibp_get_max_connecting();
+void ibp_set_connect_timeout(int n);
+int  ibp_get_connect_timeout();
+void ibp_set_sockpool(int size, int max_age);
+void ibp_sockpool_stats(Hportal_sockpool_stats_t *stats);
+void ibp_set_max_pipeline(int n);
+int  ibp_get_max_pipeline();
+void ibp_set_claim_batch(int n);
+int  ibp_get_claim_batch();
+void ibp_set_batch_commands(int n);
+int  ibp_get_batch_commands();
+void ibp_set_scale_policy(Hportal_scale_policy_t *policy);
+Hportal_scale_policy_t *ibp_get_scale_policy();
+void ibp_set_scale_target(int64_t bytes_sec);
+int64_t ibp_get_scale_target();
+void ibp_set_edf_dispatch(int n);
+int  ibp_get_edf_dispatch();
+void ibp_set_prio_weight(int prio, int weight);
+int  ibp_get_prio_weight(int prio);
+void ibp_set_prio_bulk_size(int n);
+int  ibp_get_prio_bulk_size();
+void ibp_set_reserve_high(int n);
+int  ibp_get_reserve_high();
+void ibp_set_coalesce_reads(int n);
+int  ibp_get_coalesce_reads();
+void ibp_set_coalesce_writes(int n);
+int  ibp_get_coalesce_writes();
+void ibp_set_coalesce_max_size(int n);
+int  ibp_get_coalesce_max_size();
 int ibp_load_config(char *fname);
 void set_ibp_config(ibp_config_t *cfg);
 void default_ibp_config();
@@ -134,7 +134,8 @@
 # define   IBP_E_AUTHENTICATION_FAILED -60
 # define   IBP_E_INVALID_HOST          -61
 # define   IBP_E_CANT_CONNECT          -62
-# define   IBP_MAX_ERROR              63
+# define   IBP_E_DEADLINE_EXPIRED      -63
+# define   IBP_MAX_ERROR              64
 
 
 # define E_USAGE		-101
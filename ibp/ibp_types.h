@@ -31,6 +31,8 @@ http://www.accre.vanderbilt.edu
 #ifndef _IBP_TYPES_H_
 #define _IBP_TYPES_H_
 
+#include "../network.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -38,6 +40,7 @@ extern "C" {
 typedef struct {    //*** Holds the data for the different network connection types
    int type;           //** Type of connection as defined in network.h
    void *data;         //** Generic container for context data
+   ns_sockopt_t sockopt;  //** Socket tuning for NS_TYPE_SOCK connections.  Zero it for the OS defaults
 } ibp_connect_context_t;
 
 typedef struct ibp_attributes ibp_attributes_t;
@@ -48,6 +51,16 @@ typedef struct ibp_capstatus ibp_capstatus_t;
 typedef char ibp_cap_t;
 typedef struct ibp_set_of_caps ibp_capset_t;
 
+#define IBP_CAP_FIELD_SIZE 256   //** Size of each parsed cap field.  Same as parse_cap() expects
+
+typedef struct {  //** Pre-parsed capability.  Parse once and reuse it for many ops
+   ibp_cap_t *cap;                       //** Copy of the cap string
+   char host[IBP_CAP_FIELD_SIZE];
+   int  port;
+   char key[IBP_CAP_FIELD_SIZE];
+   char typekey[IBP_CAP_FIELD_SIZE];
+} ibp_cap_handle_t;
+
 typedef struct {  //** RID list structure
    int n;
    rid_t *rl;
@@ -75,6 +88,8 @@ void set_ibp_timer(ibp_timer_t *t, int client_timeout, int server_timeout);
 void get_ibp_timer(ibp_timer_t *t, int *client_timeout, int *server_timeout);
 void destroy_ibp_cap(ibp_cap_t *cap);
 ibp_cap_t *dup_ibp_cap(ibp_cap_t *src);
+ibp_cap_handle_t *new_ibp_cap_handle(ibp_cap_t *cap);
+void destroy_ibp_cap_handle(ibp_cap_handle_t *ch);
 ibp_capset_t *new_ibp_capset();
 void destroy_ibp_capset(ibp_capset_t *caps);
 void copy_ibp_capset(ibp_capset_t *src, ibp_capset_t *dest);
@@ -57,7 +57,7 @@ void _ibp_destroy_connect_context(void *connect_context);
 int _ibp_connect(NetStream_t *ns, void *connect_context, char *host, int port, Net_timeout_t timeout);
 
 Hportal_impl_t _ibp_imp = { IBP_OK, ERR_RETRY_DEADSOCKET, IBP_E_CLIENT_TIMEOUT, IBP_E_GENERIC, IBP_E_CONNECTION,
-    IBP_E_INVALID_HOST, IBP_E_CANT_CONNECT, 
+    IBP_E_INVALID_HOST, IBP_E_CANT_CONNECT, IBP_E_DEADLINE_EXPIRED,
     _get_ibp_base_op,
     _get_ibp_hp_op,
     _ibp_dup_connect_context,
@@ -130,17 +130,18 @@ void _ibp_destroy_connect_context(void *connect_context)
 int _ibp_connect(NetStream_t *ns, void *connect_context, char *host, int port, Net_timeout_t timeout)
 {
   ibp_connect_context_t *cc = (ibp_connect_context_t *)connect_context;
+  int tcpsize = ibp_get_depot_tcpsize(host);
 
   if (cc != NULL) {
      switch(cc->type) {
        case NS_TYPE_SOCK:
-          ns_config_sock(ns, _ibp_config->tcpsize);
+          ns_config_sock_opt(ns, tcpsize, &(cc->sockopt));
           break;
        case NS_TYPE_PHOEBUS:
-          ns_config_phoebus(ns, cc->data, _ibp_config->tcpsize);
+          ns_config_phoebus(ns, cc->data, tcpsize);
           break;
        case NS_TYPE_1_SSL:
-          ns_config_1_ssl(ns, -1, _ibp_config->tcpsize);
+          ns_config_1_ssl(ns, -1, tcpsize);
           break;
        case NS_TYPE_2_SSL:
 //****          ns_config_2_ssl(ns, -1);
@@ -150,7 +151,7 @@ int _ibp_connect(NetStream_t *ns, void *connect_context, char *host, int port, N
           return(1);
       }
   } else {
-     ns_config_sock(ns, _ibp_config->tcpsize);
+     ns_config_sock(ns, tcpsize);
   }
 
   return(net_connect(ns, host, port, timeout));
@@ -165,6 +166,16 @@ void ibp_set_abort_attempts(int n) { _ibp_config->abort_conn_attempts = n;};
 int  ibp_get_abort_attempts() { return(_ibp_config->abort_conn_attempts); };
 void ibp_set_tcpsize(int n) { _ibp_config->tcpsize = n;};
 int  ibp_get_tcpsize() { return(_ibp_config->tcpsize); };
+void ibp_set_ns_bufsize(int n) { _ibp_config->ns_bufsize = n; set_network_bufsize(n);};
+int  ibp_get_ns_bufsize() { return(_ibp_config->ns_bufsize); };
+void ibp_set_connect_stagger(int ms) { _ibp_config->connect_stagger = ms; sock_set_connect_stagger(ms);};
+int  ibp_get_connect_stagger() { return(_ibp_config->connect_stagger); };
+void ibp_set_dns_ttl(int secs) { _ibp_config->dns_ttl = secs; dns_cache_set_ttl(secs);};
+int  ibp_get_dns_ttl() { return(_ibp_config->dns_ttl); };
+void ibp_set_dns_refresh(int secs_ahead) { _ibp_config->dns_refresh = secs_ahead; dns_cache_set_refresh(secs_ahead);};
+int  ibp_get_dns_refresh() { return(_ibp_config->dns_refresh); };
+void ibp_set_dns_neg_ttl(int max_secs) { _ibp_config->dns_neg_ttl = max_secs; dns_cache_set_neg_ttl(max_secs);};
+int  ibp_get_dns_neg_ttl() { return(_ibp_config->dns_neg_ttl); };
 void ibp_set_min_depot_threads(int n) { _ibp_config->min_threads = n; _hpc_config->min_threads = n;};
 int  ibp_get_min_depot_threads() { return(_ibp_config->min_threads); };
 void ibp_set_max_depot_threads(int n) { _ibp_config->max_threads = n; _hpc_config->max_threads = n;};
@@ -181,6 +192,79 @@ void ibp_set_check_interval(int n) { _ibp_config->check_connection_interval = n;
 int  ibp_get_check_interval() { return(_ibp_config->check_connection_interval); };
 void ibp_set_max_retry(int n) { _ibp_config->max_retry = n; _hpc_config->max_retry = n;};
 int  ibp_get_max_retry() { return(_ibp_config->max_retry); };
+void ibp_set_engine_threads(int n) { _ibp_config->engine_threads = n; _hpc_config->engine_threads = n;};
+int  ibp_get_engine_threads() { return(_ibp_config->engine_threads); };
+void ibp_set_engine_workers(int n) { _ibp_config->engine_workers = n; _hpc_config->engine_workers = n;};
+int  ibp_get_engine_workers() { return(_ibp_config->engine_workers); };
+void ibp_set_max_connecting(int n) { _ibp_config->max_connecting = n; _hpc_config->max_connecting = n;};
+int  ibp_get_max_connecting() { return(_ibp_config->max_connecting); };
+void ibp_set_connect_timeout(int n) { _ibp_config->connect_timeout = n; _hpc_config->connect_timeout = n;};
+int  ibp_get_connect_timeout() { return(_ibp_config->connect_timeout); };
+void ibp_set_sockpool(int size, int max_age) { _ibp_config->sockpool_size = size; _ibp_config->sockpool_max_age = max_age; 
+                                               _hpc_config->sockpool.max_size = size; _hpc_config->sockpool.max_age = max_age;};
+void ibp_sockpool_stats(Hportal_sockpool_stats_t *stats) { hportal_sockpool_stats(_hpc_config, stats); };
+void ibp_set_max_pipeline(int n) { _ibp_config->max_pipeline = n; _hpc_config->max_pipeline = n;};
+int  ibp_get_max_pipeline() { return(_ibp_config->max_pipeline); };
+void ibp_set_claim_batch(int n) { _ibp_config->claim_batch = n; _hpc_config->claim_batch = n;};
+int  ibp_get_claim_batch() { return(_ibp_config->claim_batch); };
+void ibp_set_batch_commands(int n) { _ibp_config->batch_commands = n; _hpc_config->batch_commands = n;};
+int  ibp_get_batch_commands() { return(_ibp_config->batch_commands); };
+void ibp_set_scale_policy(Hportal_scale_policy_t *policy) { _ibp_config->scale_policy = policy; _hpc_config->scale = policy;};
+Hportal_scale_policy_t *ibp_get_scale_policy() { return(_ibp_config->scale_policy); };
+void ibp_set_scale_target(int64_t bytes_sec) { _ibp_config->scale_target = bytes_sec; _hpc_config->scale_target = bytes_sec;};
+int64_t ibp_get_scale_target() { return(_ibp_config->scale_target); };
+void ibp_set_edf_dispatch(int n) { _ibp_config->edf_dispatch = n; _hpc_config->edf_dispatch = n;};
+int  ibp_get_edf_dispatch() { return(_ibp_config->edf_dispatch); };
+void ibp_set_prio_weight(int prio, int weight)
+{
+  if ((prio < 0) || (prio >= HP_N_PRIO)) {
+     log_printf(0, "ibp_set_prio_weight: Invalid priority class %d!\n", prio);
+     return;
+  }
+
+  _ibp_config->prio_weight[prio] = weight;
+  hportal_set_prio_weights(_hpc_config, _ibp_config->prio_weight);
+};
+int  ibp_get_prio_weight(int prio) { return(((prio < 0) || (prio >= HP_N_PRIO)) ? -1 : _ibp_config->prio_weight[prio]); };
+void ibp_set_prio_bulk_size(int n) { _ibp_config->prio_bulk_size = n; };
+int  ibp_get_prio_bulk_size() { return(_ibp_config->prio_bulk_size); };
+void ibp_set_reserve_high(int n) { _ibp_config->reserve_high = n; _hpc_config->reserve_high = n;};
+int  ibp_get_reserve_high() { return(_ibp_config->reserve_high); };
+void ibp_set_coalesce_reads(int n) { _ibp_config->coalesce_reads = n; };
+int  ibp_get_coalesce_reads() { return(_ibp_config->coalesce_reads); };
+void ibp_set_coalesce_writes(int n) { _ibp_config->coalesce_writes = n; };
+int  ibp_get_coalesce_writes() { return(_ibp_config->coalesce_writes); };
+void ibp_set_coalesce_max_size(int n) { _ibp_config->coalesce_max_size = n; };
+int  ibp_get_coalesce_max_size() { return(_ibp_config->coalesce_max_size); };
+
+//**********************************************************
+// ibp_get_depot_tcpsize - Returns the TCP buffer size to use for the
+//     depot.  This is the global tcpsize unless it's overridden.
+//     The hportal only has the depot's resolved address so name keys
+//     are matched on what they resolve to.
+//**********************************************************
+
+int ibp_get_depot_tcpsize(char *host)
+{
+  char ip_list[DNS_LIST_MAX][DNS_IP_LEN];
+  int i, j, n;
+
+  for (i=0; i<_ibp_config->n_depot_tcpsize; i++) {
+     if (strcmp(_ibp_config->depot_tcpsize[i].host, host) == 0) return(_ibp_config->depot_tcpsize[i].tcpsize);
+  }
+
+  for (i=0; i<_ibp_config->n_depot_tcpsize; i++) {
+     n = lookup_host_addrs(_ibp_config->depot_tcpsize[i].host, ip_list, DNS_LIST_MAX);
+     for (j=0; j<n; j++) {
+        if (strcmp(ip_list[j], host) == 0) {
+           log_printf(15, "ibp_get_depot_tcpsize: host=%s matched %s tcpsize=%d\n", host, _ibp_config->depot_tcpsize[i].host, _ibp_config->depot_tcpsize[i].tcpsize);
+           return(_ibp_config->depot_tcpsize[i].tcpsize);
+        }
+     }
+  }
+
+  return(_ibp_config->tcpsize);
+}
 
 //**********************************************************
 // set_ibp_config - Sets the ibp config options
@@ -199,6 +283,89 @@ void set_ibp_config(ibp_config_t *cfg)
   _hpc_config->abort_conn_attempts = cfg->abort_conn_attempts;
   _hpc_config->check_connection_interval = cfg->check_connection_interval;
   _hpc_config->max_retry = cfg->max_retry;
+  _hpc_config->engine_threads = cfg->engine_threads;
+  _hpc_config->engine_workers = cfg->engine_workers;
+  _hpc_config->max_connecting = cfg->max_connecting;
+  _hpc_config->connect_timeout = cfg->connect_timeout;
+  _hpc_config->sockpool.max_size = cfg->sockpool_size;
+  _hpc_config->sockpool.max_age = cfg->sockpool_max_age;
+  _hpc_config->max_pipeline = cfg->max_pipeline;
+  _hpc_config->claim_batch = cfg->claim_batch;
+  _hpc_config->batch_commands = cfg->batch_commands;
+  _hpc_config->scale = cfg->scale_policy;
+  _hpc_config->scale_target = cfg->scale_target;
+  _hpc_config->edf_dispatch = cfg->edf_dispatch;
+  _hpc_config->reserve_high = cfg->reserve_high;
+  set_network_bufsize(cfg->ns_bufsize);
+  sock_set_connect_stagger(cfg->connect_stagger);
+  dns_cache_set_ttl(cfg->dns_ttl);
+  dns_cache_set_refresh(cfg->dns_refresh);
+  dns_cache_set_neg_ttl(cfg->dns_neg_ttl);
+  hportal_set_prio_weights(_hpc_config, _ibp_config->prio_weight);
+}
+
+//**********************************************************
+// sockopt_load - Loads the socket tuning for a CC.  The keys are 
+//     prefixed with the CC name, eg ibp_load.tcp_nodelay, except for 
+//     the default CC which uses the bare key names.
+//**********************************************************
+
+void sockopt_load(inip_file_t *kf, char *name, ns_sockopt_t *opt)
+{
+  char key[256];
+  char *prefix, *str;
+
+  prefix = (strcmp(name, "default") == 0) ? "" : name;
+  snprintf(key, sizeof(key), "%s%stcp_nodelay", prefix, (prefix[0] == '\0') ? "" : ".");
+  opt->nodelay = inip_get_integer(kf, "ibp_connect", key, opt->nodelay);
+  snprintf(key, sizeof(key), "%s%stcp_keepalive", prefix, (prefix[0] == '\0') ? "" : ".");
+  opt->keepalive = inip_get_integer(kf, "ibp_connect", key, opt->keepalive);
+  snprintf(key, sizeof(key), "%s%stcp_keepidle", prefix, (prefix[0] == '\0') ? "" : ".");
+  opt->keepidle = inip_get_integer(kf, "ibp_connect", key, opt->keepidle);
+  snprintf(key, sizeof(key), "%s%stcp_keepintvl", prefix, (prefix[0] == '\0') ? "" : ".");
+  opt->keepintvl = inip_get_integer(kf, "ibp_connect", key, opt->keepintvl);
+  snprintf(key, sizeof(key), "%s%stcp_keepcnt", prefix, (prefix[0] == '\0') ? "" : ".");
+  opt->keepcnt = inip_get_integer(kf, "ibp_connect", key, opt->keepcnt);
+  snprintf(key, sizeof(key), "%s%stcp_notsent_lowat", prefix, (prefix[0] == '\0') ? "" : ".");
+  opt->notsent_lowat = inip_get_integer(kf, "ibp_connect", key, opt->notsent_lowat);
+  snprintf(key, sizeof(key), "%s%stcp_congestion", prefix, (prefix[0] == '\0') ? "" : ".");
+  str = inip_get_string(kf, "ibp_connect", key, NULL);
+  if (str != NULL) {
+     strncpy(opt->congestion, str, sizeof(opt->congestion)-1);
+     opt->congestion[sizeof(opt->congestion)-1] = '\0';
+     free(str);
+  }
+}
+
+//**********************************************************
+// depot_tcpsize_load - Loads the per depot TCP buffer sizes from the
+//     [ibp_depot_tcpsize] group.  Each key is a depot host name or address.
+//**********************************************************
+
+void depot_tcpsize_load(inip_file_t *kf, ibp_config_t *cfg)
+{
+  inip_group_t *g;
+  inip_element_t *ele;
+  int n;
+
+  //** Drop any overrides from a previous load
+  for (n=0; n<cfg->n_depot_tcpsize; n++) free(cfg->depot_tcpsize[n].host);
+  if (cfg->depot_tcpsize != NULL) free(cfg->depot_tcpsize);
+  cfg->depot_tcpsize = NULL;
+  cfg->n_depot_tcpsize = 0;
+
+  for (g = inip_first_group(kf); g != NULL; g = g->next) {
+     if (strcmp(g->group, "ibp_depot_tcpsize") != 0) continue;
+
+     for (ele = g->list; ele != NULL; ele = ele->next) {
+        n = cfg->n_depot_tcpsize;
+        assert((cfg->depot_tcpsize = (ibp_depot_tcpsize_t *)realloc(cfg->depot_tcpsize, sizeof(ibp_depot_tcpsize_t)*(n+1))) != NULL);
+        cfg->depot_tcpsize[n].host = strdup(ele->key);
+        cfg->depot_tcpsize[n].tcpsize = atoi(ele->value);
+        cfg->n_depot_tcpsize++;
+        log_printf(5, "depot_tcpsize_load: host=%s tcpsize=%d\n", ele->key, cfg->depot_tcpsize[n].tcpsize);
+     }
+  }
 }
 
 //**********************************************************
@@ -209,6 +376,8 @@ void cc_load(inip_file_t *kf, char *name, ibp_connect_context_t *cc)
 {
   char *type = inip_get_string(kf, "ibp_connect", name, NULL);
 
+  sockopt_load(kf, name, &(cc->sockopt));
+
   if (type == NULL) return;
   
   if (strcmp(type, "socket") == 0) {
@@ -234,6 +403,7 @@ void ibp_cc_load(inip_file_t *kf, ibp_config_t *cfg)
   ibp_connect_context_t cc;
 
   //** Set everything to the default **
+  cc = cfg->cc[IBP_LOAD];
   cc.type = NS_TYPE_SOCK;
   cc_load(kf, "default", &cc);
   for (i=0; i<=IBP_MAX_NUM_CMDS; i++) cfg->cc[i] = cc;
@@ -250,6 +420,8 @@ void ibp_cc_load(inip_file_t *kf, ibp_config_t *cfg)
   cc_load(kf, "ibp_alias_manage", &(cfg->cc[IBP_ALIAS_MANAGE]));
   cc_load(kf, "ibp_rename", &(cfg->cc[IBP_RENAME]));
   cc_load(kf, "ibp_phoebus_send", &(cfg->cc[IBP_PHOEBUS_SEND]));
+
+  depot_tcpsize_load(kf, cfg);
 }
 
 
@@ -260,6 +432,8 @@ void ibp_cc_load(inip_file_t *kf, ibp_config_t *cfg)
 int ibp_load_config(char *fname)
 {
   inip_file_t *keyfile;
+  Hportal_scale_policy_t *policy;
+  char *str;
 
   //* Load the config file
   keyfile = inip_read(fname);
@@ -270,6 +444,11 @@ int ibp_load_config(char *fname)
 
   _ibp_config->abort_conn_attempts = inip_get_integer(keyfile, "ibp_async", "abort_attempts", _ibp_config->abort_conn_attempts);
   _ibp_config->tcpsize = inip_get_integer(keyfile, "ibp_async", "tcpsize", _ibp_config->tcpsize);
+  _ibp_config->ns_bufsize = inip_get_integer(keyfile, "ibp_async", "ns_bufsize", _ibp_config->ns_bufsize);
+  _ibp_config->connect_stagger = inip_get_integer(keyfile, "ibp_async", "connect_stagger_ms", _ibp_config->connect_stagger);
+  _ibp_config->dns_ttl = inip_get_integer(keyfile, "ibp_async", "dns_ttl", _ibp_config->dns_ttl);
+  _ibp_config->dns_refresh = inip_get_integer(keyfile, "ibp_async", "dns_refresh", _ibp_config->dns_refresh);
+  _ibp_config->dns_neg_ttl = inip_get_integer(keyfile, "ibp_async", "dns_neg_ttl", _ibp_config->dns_neg_ttl);
   _ibp_config->min_threads = inip_get_integer(keyfile, "ibp_async", "min_depot_threads", _ibp_config->min_threads);
   _ibp_config->max_threads = inip_get_integer(keyfile, "ibp_async", "max_depot_threads", _ibp_config->max_threads);
   _ibp_config->max_connections = inip_get_integer(keyfile, "ibp_async", "max_connections", _ibp_config->max_connections);
@@ -278,6 +457,36 @@ int ibp_load_config(char *fname)
   _ibp_config->wait_stable_time = inip_get_integer(keyfile, "ibp_async", "wait_stable_time", _ibp_config->wait_stable_time);
   _ibp_config->check_connection_interval = inip_get_integer(keyfile, "ibp_async", "check_interval", _ibp_config->check_connection_interval);
   _ibp_config->max_retry = inip_get_integer(keyfile, "ibp_async", "max_retry", _ibp_config->max_retry);
+  _ibp_config->engine_threads = inip_get_integer(keyfile, "ibp_async", "engine_threads", _ibp_config->engine_threads);
+  _ibp_config->engine_workers = inip_get_integer(keyfile, "ibp_async", "engine_workers", _ibp_config->engine_workers);
+  _ibp_config->max_connecting = inip_get_integer(keyfile, "ibp_async", "max_connecting", _ibp_config->max_connecting);
+  _ibp_config->connect_timeout = inip_get_integer(keyfile, "ibp_async", "connect_timeout", _ibp_config->connect_timeout);
+  _ibp_config->sockpool_size = inip_get_integer(keyfile, "ibp_async", "sockpool_size", _ibp_config->sockpool_size);
+  _ibp_config->sockpool_max_age = inip_get_integer(keyfile, "ibp_async", "sockpool_max_age", _ibp_config->sockpool_max_age);
+  _ibp_config->max_pipeline = inip_get_integer(keyfile, "ibp_async", "max_pipeline", _ibp_config->max_pipeline);
+  _ibp_config->claim_batch = inip_get_integer(keyfile, "ibp_async", "claim_batch", _ibp_config->claim_batch);
+  _ibp_config->batch_commands = inip_get_integer(keyfile, "ibp_async", "batch_commands", _ibp_config->batch_commands);
+  _ibp_config->scale_target = inip_get_integer(keyfile, "ibp_async", "autoscale_target_mbps", _ibp_config->scale_target/125000) * 125000;
+  _ibp_config->edf_dispatch = inip_get_integer(keyfile, "ibp_async", "edf_dispatch", _ibp_config->edf_dispatch);
+  _ibp_config->prio_weight[HP_PRIO_HIGH] = inip_get_integer(keyfile, "ibp_async", "prio_weight_high", _ibp_config->prio_weight[HP_PRIO_HIGH]);
+  _ibp_config->prio_weight[HP_PRIO_NORMAL] = inip_get_integer(keyfile, "ibp_async", "prio_weight_normal", _ibp_config->prio_weight[HP_PRIO_NORMAL]);
+  _ibp_config->prio_weight[HP_PRIO_BULK] = inip_get_integer(keyfile, "ibp_async", "prio_weight_bulk", _ibp_config->prio_weight[HP_PRIO_BULK]);
+  _ibp_config->prio_bulk_size = inip_get_integer(keyfile, "ibp_async", "prio_bulk_size", _ibp_config->prio_bulk_size);
+  _ibp_config->reserve_high = inip_get_integer(keyfile, "ibp_async", "reserve_high_conn", _ibp_config->reserve_high);
+  _ibp_config->coalesce_reads = inip_get_integer(keyfile, "ibp_async", "coalesce_reads", _ibp_config->coalesce_reads);
+  _ibp_config->coalesce_writes = inip_get_integer(keyfile, "ibp_async", "coalesce_writes", _ibp_config->coalesce_writes);
+  _ibp_config->coalesce_max_size = inip_get_integer(keyfile, "ibp_async", "coalesce_max_size", _ibp_config->coalesce_max_size);
+
+  str = inip_get_string(keyfile, "ibp_async", "autoscale", NULL);
+  if (str != NULL) {
+     policy = hportal_scale_policy_lookup(str);
+     if (policy != NULL) {
+        _ibp_config->scale_policy = policy;
+     } else {
+        log_printf(0, "ibp_load_config: Invalid autoscale policy: %s\n", str);
+     }
+     free(str);
+  }
 
   ibp_cc_load(keyfile, _ibp_config);
 
@@ -299,6 +508,11 @@ void default_ibp_config()
   int i;
 
   _ibp_config->tcpsize = 0;
+  _ibp_config->ns_bufsize = NS_BUFSIZE_DEFAULT;
+  _ibp_config->connect_stagger = 250;
+  _ibp_config->dns_ttl = 600;
+  _ibp_config->dns_refresh = 30;
+  _ibp_config->dns_neg_ttl = 300;
   _ibp_config->min_idle = 30;
   _ibp_config->min_threads = 1;
   _ibp_config->max_threads = 4;
@@ -309,9 +523,34 @@ void default_ibp_config()
   _ibp_config->abort_conn_attempts = 4;
   _ibp_config->check_connection_interval = 2;
   _ibp_config->max_retry = 2;
+  _ibp_config->engine_threads = 0;
+  _ibp_config->engine_workers = HC_ENGINE_WORKERS;
+  _ibp_config->max_connecting = 32;
+  _ibp_config->connect_timeout = 5;
+  _ibp_config->sockpool_size = HP_SOCKPOOL_SIZE;
+  _ibp_config->sockpool_max_age = HP_SOCKPOOL_AGE;
+  _ibp_config->max_pipeline = 64;
+  _ibp_config->claim_batch = 4;
+  _ibp_config->batch_commands = 0;
+  _ibp_config->scale_policy = &hp_scale_heuristic;
+  _ibp_config->scale_target = 0;
+  _ibp_config->edf_dispatch = 0;
+  _ibp_config->prio_weight[HP_PRIO_HIGH] = 8;
+  _ibp_config->prio_weight[HP_PRIO_NORMAL] = 4;
+  _ibp_config->prio_weight[HP_PRIO_BULK] = 1;
+  _ibp_config->prio_bulk_size = 1024*1024;
+  _ibp_config->reserve_high = 0;
+  _ibp_config->coalesce_reads = 0;
+  _ibp_config->coalesce_writes = 0;
+  _ibp_config->coalesce_max_size = 1024*1024;
+
+  _ibp_config->n_depot_tcpsize = 0;
+  _ibp_config->depot_tcpsize = NULL;
 
   for (i=0; i<=IBP_MAX_NUM_CMDS; i++) {
+     memset(&(_ibp_config->cc[i]), 0, sizeof(ibp_connect_context_t));
      _ibp_config->cc[i].type = NS_TYPE_SOCK;
+     _ibp_config->cc[i].sockopt.nodelay = 1;  //** Small request/response exchanges shouldn't wait on Nagle
   }
 
   phoebus_init();
@@ -335,6 +574,7 @@ void ibp_init()
   ibp_configure_signals();
 
   _hpc_config = create_hportal_context(&_ibp_imp);
+  ibp_hostport_cache_init();
   default_ibp_config();  
 
   apr_pool_create(&(_ibp_mpool), NULL);
@@ -350,6 +590,7 @@ void ibp_init()
 void ibp_finalize()
 {
   shutdown_hportal(_hpc_config);
+  ibp_hostport_cache_destroy();
   destroy_hportal_context(_hpc_config);
 
   finalize_dns_cache();
@@ -55,7 +55,8 @@ int parse_cap(ibp_cap_t *cap, char *host, int *port, char *key, char *typekey)
      return(1);
   }
 
-  char *temp = strdup(cap);
+  char buf[1024];
+  char *temp = (strlen(cap) < sizeof(buf)) ? strcpy(buf, cap) : strdup(cap);  //** Only hit the heap for huge caps
   char *ptr;
   ptr = string_token(temp, "/", &bstate, &finished); //** gets the ibp:/
 //log_printf(15, "1 ptr=%s\n", ptr);
@@ -69,7 +70,7 @@ int parse_cap(ibp_cap_t *cap, char *host, int *port, char *key, char *typekey)
   strncpy(key, string_token(NULL, "/", &bstate, &finished), 255);
   strncpy(typekey, string_token(NULL, "/", &bstate, &finished), 255);
 
-  free(temp);
+  if (temp != buf) free(temp);
 
 //  log_printf(15, "parse_cap: CAP=%s * parsed=%s:%d/%s/%s\n", cap, host, *port, key, typekey);
 
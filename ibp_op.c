@@ -42,18 +42,49 @@ http://www.accre.vanderbilt.edu
 #include "dns_cache.h"
 
 Net_timeout_t global_dt = 1*1000000;
-int write_block(NetStream_t *ns, time_t end_time, char *buffer, int size);
+int write_block(NetStream_t *ns, hp_time_t end_time, char *buffer, int size);
 int status_get_recv(void *gop, NetStream_t *ns);
-
-//*************************************************************
-// set_hostport - Sets the hostport string
+int write_data(NetStream_t *ns, hp_time_t end_time, ibp_op_rw_t *cmd);
+int write_block_v(NetStream_t *ns, hp_time_t end_time, struct iovec *iov, int iovcnt, int size, int more);
+int write_data_pos(NetStream_t *ns, hp_time_t end_time, ibp_op_rw_t *cmd, int pos, char *header, int more);
+int coalesce_command(void *gop, NetStream_t *ns);
+int coalesce_read_recv(void *gop, NetStream_t *ns);
+int coalesce_read_scatter(NetStream_t *ns, hp_time_t end_time, ibp_op_coalesce_t *cmd);
+int coalesce_write_send(void *gop, NetStream_t *ns);
+int coalesce_write_recv(void *gop, NetStream_t *ns);
+int coalesce_destroy(void *gop);
+
+#define IBP_HOSTPORT_STRIPES 16   //** Should be a power of 2
+
+typedef struct ibp_hostport_s {   //** Interned hostport for a host/port/connect context
+   char *host;
+   int port;
+   int type;                      //** Connect context type
+   unsigned int key;              //** Phoebus path key.  0 otherwise
+   time_t expire;                 //** The host is resolved again after this.  Dropped by the next sweep once stale
+   Hportal_hostport_t *handle;    //** Holds a reference
+   struct ibp_hostport_s *next;   //** Other ports and contexts for the same host
+} ibp_hostport_t;
+
+typedef struct {                  //** Each host hashes to a single stripe
+   apr_thread_mutex_t *lock;
+   apr_hash_t *table;             //** host -> ibp_hostport_t list
+   apr_pool_t *pool;
+   time_t next_sweep;             //** When stale entries are next dropped
+} ibp_hostport_stripe_t;
+
+ibp_hostport_stripe_t _hostport_stripe[IBP_HOSTPORT_STRIPES];
+
+//*************************************************************
+// set_hostport - Sets the hostport string.  Returns 0 on success or
+//   1 if the host couldn't be resolved and the name was used instead.
 //   This needs to be changed for each type of NS connection
 //*************************************************************
 
-void set_hostport(char *hostport, int max_size, char *host, int port, ibp_connect_context_t *cc)
+int set_hostport(char *hostport, int max_size, char *host, int port, ibp_connect_context_t *cc)
 {
   char in_addr[DNS_ADDR_MAX];
-  char ip[64];
+  char ip[DNS_IP_LEN+2];
   int type;
 
   type = (cc == NULL) ? NS_TYPE_SOCK : cc->type;
@@ -62,11 +93,16 @@ void set_hostport(char *hostport, int max_size, char *host, int port, ibp_connec
      log_printf(1, "set_hostport:  Failed to lookup host: %s\n", host);
      hostport[max_size-1] = '\0';
      snprintf(hostport, max_size-1, "%s:%d:%d:0", host, port, type);   
-     return;
+     return(1);
   }
 
 //  inet_ntop(AF_INET, (void *)in_addr, ip, 63);
-  ip[63] = '\0';
+  ip[DNS_IP_LEN-1] = '\0';
+  if (strchr(ip, ':') != NULL) {  //** Bracket IPv6 addresses so the hostport can still be split on ':'
+     memmove(&(ip[1]), ip, strlen(ip)+1);
+     ip[0] = '[';
+     strcat(ip, "]");
+  }
 
   hostport[max_size-1] = '\0';
   if (type == NS_TYPE_PHOEBUS) {
@@ -76,6 +112,226 @@ void set_hostport(char *hostport, int max_size, char *host, int port, ibp_connec
   }
 
   log_printf(15, "set_hostport: host=%s hostport=%s\n", host, hostport);
+
+  return(0);
+}
+
+//*************************************************************
+// ibp_hostport_cache_init - Creates the host/port -> interned 
+//    hostport table
+//*************************************************************
+
+void ibp_hostport_cache_init()
+{
+  ibp_hostport_stripe_t *s;
+  int i;
+
+  for (i=0; i<IBP_HOSTPORT_STRIPES; i++) {
+     s = &(_hostport_stripe[i]);
+     assert(apr_pool_create(&(s->pool), NULL) == APR_SUCCESS);
+     assert((s->table = apr_hash_make(s->pool)) != NULL);
+     apr_thread_mutex_create(&(s->lock), APR_THREAD_MUTEX_DEFAULT, s->pool);
+     s->next_sweep = 0;
+  }
+}
+
+//*************************************************************
+// ibp_hostport_cache_destroy - Destroys the hostport table.  Should
+//    be called when the hportal context is destroyed since it owns 
+//    the handles.  The handle references aren't dropped since the 
+//    context frees them all.
+//*************************************************************
+
+void ibp_hostport_cache_destroy()
+{
+  apr_hash_index_t *hi;
+  ibp_hostport_t *e, *next;
+  void *val;
+  int i;
+
+  for (i=0; i<IBP_HOSTPORT_STRIPES; i++) {
+     for (hi=apr_hash_first(NULL, _hostport_stripe[i].table); hi != NULL; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, NULL, NULL, &val);
+        for (e = (ibp_hostport_t *)val; e != NULL; e = next) {
+           next = e->next;
+           free(e->host);
+           free(e);
+        }
+     }
+     apr_thread_mutex_destroy(_hostport_stripe[i].lock);
+     apr_pool_destroy(_hostport_stripe[i].pool);
+  }
+}
+
+//*************************************************************
+// _ibp_hostport_sweep - Drops the stale entries in the stripe along 
+//    with their handle references so the table only holds hosts used
+//    within the last DNS TTL or so.  The stripe lock should be held.
+//*************************************************************
+
+void _ibp_hostport_sweep(ibp_hostport_stripe_t *s, time_t now)
+{
+  apr_hash_index_t *hi;
+  ibp_hostport_t *e, *next, *keep;
+  Stack_t *heads;
+  void *val;
+
+  heads = new_stack();
+  for (hi=apr_hash_first(NULL, s->table); hi != NULL; hi = apr_hash_next(hi)) {
+     apr_hash_this(hi, NULL, NULL, &val);
+     push(heads, val);
+  }
+
+  while ((e = (ibp_hostport_t *)pop(heads)) != NULL) {
+     apr_hash_set(s->table, e->host, APR_HASH_KEY_STRING, NULL);  //** The key may be any entry's host so drop it 1st
+
+     keep = NULL;
+     for (; e != NULL; e = next) {
+        next = e->next;
+        if (e->expire > now) {
+           e->next = keep;
+           keep = e;
+        } else {
+           hportal_release_handle(e->handle);
+           free(e->host);
+           free(e);
+        }
+     }
+
+     if (keep != NULL) apr_hash_set(s->table, keep->host, APR_HASH_KEY_STRING, keep);
+  }
+
+  free_stack(heads, 0);
+}
+
+//*************************************************************
+// ibp_hostport - Returns the interned hostport for the host, port and
+//    connect context.  The host is only resolved and the hostport 
+//    formatted again once the entry is older than the DNS TTL.  The
+//    caller gets a reference to the handle and should drop it with
+//    hportal_release_handle().
+//*************************************************************
+
+Hportal_hostport_t *ibp_hostport(char *host, int port, ibp_connect_context_t *cc)
+{
+  char hoststr[1024];
+  ibp_hostport_stripe_t *s;
+  ibp_hostport_t *e, *head;
+  Hportal_hostport_t *handle;
+  unsigned int h, key;
+  unsigned char *c;
+  int type, err;
+  time_t now;
+
+  type = (cc == NULL) ? NS_TYPE_SOCK : cc->type;
+  key = (type == NS_TYPE_PHOEBUS) ? phoebus_get_key((phoebus_t *)cc->data) : 0;
+
+  h = 0;
+  for (c=(unsigned char *)host; *c != '\0'; c++) h = h*33 + *c;
+  s = &(_hostport_stripe[h & (IBP_HOSTPORT_STRIPES-1)]);
+
+  now = time(NULL);
+  apr_thread_mutex_lock(s->lock);
+  head = (ibp_hostport_t *)apr_hash_get(s->table, host, APR_HASH_KEY_STRING);
+  for (e=head; e != NULL; e = e->next) {
+     if ((e->port == port) && (e->type == type) && (e->key == key)) break;
+  }
+  if ((e != NULL) && (e->expire > now)) {  //** Got a hit
+     handle = e->handle;
+     hportal_ref_handle(handle);  //** The entry's reference keeps it alive until we have ours
+     apr_thread_mutex_unlock(s->lock);
+     return(handle);
+  }
+  apr_thread_mutex_unlock(s->lock);
+
+  //** Miss or stale so format it again.  The lookup is done without the lock.
+  err = set_hostport(hoststr, sizeof(hoststr), host, port, cc);
+  handle = hportal_intern(_hpc_config, hoststr);  //** This reference goes to the entry
+
+  apr_thread_mutex_lock(s->lock);
+  if (s->next_sweep < now) {
+     s->next_sweep = now + _ibp_config->dns_ttl;
+     _ibp_hostport_sweep(s, now);
+  }
+  head = (ibp_hostport_t *)apr_hash_get(s->table, host, APR_HASH_KEY_STRING);
+  for (e=head; e != NULL; e = e->next) {
+     if ((e->port == port) && (e->type == type) && (e->key == key)) break;
+  }
+  if (e == NULL) {
+     assert((e = (ibp_hostport_t *)malloc(sizeof(ibp_hostport_t))) != NULL);
+     assert((e->host = strdup(host)) != NULL);
+     e->handle = NULL;
+     e->port = port;
+     e->type = type;
+     e->key = key;
+     e->next = head;
+     apr_hash_set(s->table, e->host, APR_HASH_KEY_STRING, e);
+  }
+  if (e->handle != NULL) hportal_release_handle(e->handle);
+  e->handle = handle;
+  e->expire = now + ((err == 0) ? _ibp_config->dns_ttl : 1);  //** Unresolved hosts are retried quickly
+  hportal_ref_handle(handle);  //** ..and this one to the caller
+  apr_thread_mutex_unlock(s->lock);
+
+  return(handle);
+}
+
+//*************************************************************
+// _ibp_op_hostport - Sets the op's hostport
+//*************************************************************
+
+void _ibp_op_hostport(ibp_op_t *op, char *host, int port, ibp_connect_context_t *cc)
+{
+  op->hop.handle = ibp_hostport(host, port, cc);
+  op->hop.hostport = op->hop.handle->hostport;
+}
+
+//*************************************************************
+// ibp_prewarm_depots - Resolves the depots and opens conns_per_depot
+//    connections to each ahead of time.  The load and write connect
+//    contexts are used since they carry the bulk of the I/O.  Returns
+//    the number of depots that couldn't be prewarmed.
+//*************************************************************
+
+int ibp_prewarm_depots(ibp_depot_t *depot_list, int n, int conns_per_depot)
+{
+  Hportal_hostport_t *h, *h2;
+  ibp_connect_context_t *cc;
+  int i, nbad;
+
+  nbad = 0;
+  for (i=0; i<n; i++) {
+     cc = &(_ibp_config->cc[IBP_LOAD]);
+     h = ibp_hostport(depot_list[i].host, depot_list[i].port, cc);
+     if (hportal_prewarm(_hpc_config, h->hostport, cc, conns_per_depot) < 0) nbad++;
+
+     //** Writes only need their own connections if they use a different connect context
+     cc = &(_ibp_config->cc[IBP_WRITE]);
+     h2 = ibp_hostport(depot_list[i].host, depot_list[i].port, cc);
+     if (h2 != h) hportal_prewarm(_hpc_config, h2->hostport, cc, conns_per_depot);
+
+     hportal_release_handle(h);
+     hportal_release_handle(h2);
+  }
+
+  log_printf(5, "ibp_prewarm_depots: n=%d conns_per_depot=%d failed=%d\n", n, conns_per_depot, nbad);
+
+  return(nbad);
+}
+
+//*************************************************************
+// deadline_dt - Returns how long a socket call can wait without
+//    going past the deadline.  This is capped at global_dt.
+//*************************************************************
+
+Net_timeout_t deadline_dt(hp_time_t now, hp_time_t end_time)
+{
+  Net_timeout_t dt = (end_time - now) / 1000;  //** Net timeouts are in usec
+
+  if (dt > global_dt) return(global_dt);
+  if (dt < 1) dt = 1;
+
+  return(dt);
 }
 
 //*************************************************************
@@ -90,7 +346,7 @@ int send_command(NetStream_t *ns, char *command)
   log_printf(15, "send_command: ns=%d command=%s\n", ns_getid(ns), command);
 
   int len = strlen(command);
-  time_t t = time(NULL) + 5;  //** Should be fixed with an actual time!
+  hp_time_t t = hp_time_now() + 5*HP_NS_PER_SEC;  //** Should be fixed with an actual time!
   int n = write_block(ns, t, command, len);
 //  int n = write_netstream(ns, command, len, dt);
 //  if (n !=  len) {
@@ -107,20 +363,23 @@ int send_command(NetStream_t *ns, char *command)
 //    command timeout
 //*************************************************************
 
-int readline_with_timeout(NetStream_t *ns, char *buffer, int size, time_t end_time)
+int readline_with_timeout(NetStream_t *ns, char *buffer, int size, hp_time_t end_time)
 {
   int nbytes, n, nleft;
   int err;
+  hp_time_t now;
 
   log_printf(15, "readline_with_timeout: START ns=%d size=%d\n", ns_getid(ns), size);
   nbytes = 0;
   err = 0;
   nleft = size;
-  while ((err == 0) && (time(NULL) <= end_time) && (nleft > 0)){
-     n = readline_netstream_raw(ns, &(buffer[nbytes]), nleft, global_dt, &err);
+  now = hp_time_now();
+  while ((err == 0) && (now <= end_time) && (nleft > 0)){
+     n = readline_netstream_raw(ns, &(buffer[nbytes]), nleft, deadline_dt(now, end_time), &err);
      nleft = nleft - n;
      nbytes = nbytes + n;
-     log_printf(15, "readline_with_timeout: nbytes=%d nleft=%d err=%d time=" TT " end_time=" TT " ns=%d buffer=%s\n", nbytes, nleft, err, time(NULL), end_time, ns_getid(ns), buffer);
+     if (err == 0) now = hp_time_now();  //** Only need the clock if the line isn't complete
+     log_printf(15, "readline_with_timeout: nbytes=%d nleft=%d err=%d time=" I64T " end_time=" I64T " ns=%d buffer=%s\n", nbytes, nleft, err, now, end_time, ns_getid(ns), buffer);
   }
 
   if (err > 0) {
@@ -130,7 +389,7 @@ int readline_with_timeout(NetStream_t *ns, char *buffer, int size, time_t end_ti
 //     close_netstream(ns);    //** Either the connection is dead or there is a problem
      if (err == 0) {
         if (nbytes < size) {
-           log_printf(15, "readline_with_timeout: END Client timeout time=" TT " end_time=" TT "ns=%d\n", time(NULL), end_time, ns_getid(ns));
+           log_printf(15, "readline_with_timeout: END Client timeout time=" I64T " end_time=" I64T "ns=%d\n", now, end_time, ns_getid(ns));
         } else {
            log_printf(0, "readline_with_timeout:  END Out of sync issue!! nbytes=%d size=%d ns=%d\n", nbytes, size, ns_getid(ns));
            flush_log();
@@ -167,6 +426,19 @@ int ibp_op_id(ibp_op_t *op)
   return(bop_get_id(&(op->bop)));
 }
 
+//*************************************************************
+// ibp_op_set_timeout_ms - Overrides the op's client timeout with one
+//    in ms.  Should be called after the op is built and before it's
+//    submitted.  The depot only takes secs so it gets the timeout
+//    rounded up.
+//*************************************************************
+
+void ibp_op_set_timeout_ms(ibp_op_t *op, int timeout_ms)
+{
+  op->hop.timeout_ns = (hp_time_t)timeout_ms * HP_NS_PER_MS;
+  op->hop.timeout = (timeout_ms + 999) / 1000;
+}
+
 //*************************************************************
 //  finalize_ibp_op - Frees an I/O operation.  Does not free
 //        op structure itself!
@@ -176,7 +448,25 @@ void finalize_ibp_op(ibp_op_t *iop)
 {
   if (iop->hop.destroy_command != NULL) iop->hop.destroy_command(iop);
 
-  free(iop->hop.hostport);
+  if (iop->hop.handle != NULL) {
+     hportal_release_handle(iop->hop.handle);
+     iop->hop.handle = NULL;
+  }
+}
+
+//*************************************************************
+// ibp_op_slab - Returns the slab ops are allocated from
+//*************************************************************
+
+pthread_once_t _ibp_op_slab_once = PTHREAD_ONCE_INIT;
+Slab_t *_ibp_op_slab = NULL;
+
+void _ibp_op_slab_init() { _ibp_op_slab = new_slab("ibp_op", sizeof(ibp_op_t), SLAB_BATCH, SLAB_SHARED_MAX); }
+
+Slab_t *ibp_op_slab()
+{
+  pthread_once(&_ibp_op_slab_once, _ibp_op_slab_init);
+  return(_ibp_op_slab);
 }
 
 //*************************************************************
@@ -186,7 +476,7 @@ void finalize_ibp_op(ibp_op_t *iop)
 void free_ibp_op(ibp_op_t *iop)
 {
    finalize_ibp_op(iop);
-   free(iop);
+   slab_free(_ibp_op_slab, iop);
 }
 
 //*************************************************************
@@ -195,11 +485,31 @@ void free_ibp_op(ibp_op_t *iop)
 
 ibp_op_t *new_ibp_op()
 {
-  return((ibp_op_t *)malloc(sizeof(ibp_op_t)));
+  return((ibp_op_t *)slab_alloc(ibp_op_slab()));
+}
+
+//*************************************************************
+// ibp_op_set_priority - Overrides the op's priority class.  Should be
+//    called before the op is submitted.
+//*************************************************************
+
+void ibp_op_set_priority(ibp_op_t *op, int priority)
+{
+  op->hop.priority = priority;
 }
 
 //*************************************************************
-// init_ibp_base_op - initializes  generic op variables
+// _ibp_data_priority - Returns the priority class for a data transfer
+//*************************************************************
+
+int _ibp_data_priority(int size)
+{
+  return((size >= _ibp_config->prio_bulk_size) ? HP_PRIO_BULK : HP_PRIO_NORMAL);
+}
+
+//*************************************************************
+// init_ibp_base_op - initializes  generic op variables.  Ops default
+//    to the high priority class.  Data transfers change it.
 //*************************************************************
 
 void init_ibp_base_op(ibp_op_t *op, char *logstr, int timeout, int workload, char *hostport, 
@@ -210,11 +520,19 @@ void init_ibp_base_op(ibp_op_t *op, char *logstr, int timeout, int workload, cha
   bop_set_notify(&(op->bop), an);
   op->primary_cmd = primary_cmd;
   op->sub_cmd = sub_cmd;
+  op->hop.timeout_ns = (hp_time_t)timeout * HP_NS_PER_SEC;
+  op->hop.deadline = 0;
   op->hop.timeout = timeout;
   op->hop.retry_count = _ibp_config->max_retry;
   op->hop.workload = workload;
-  op->hop.hostport = hostport;
+  op->hop.handle = NULL;
+  op->hop.hostport = NULL;
+  if (hostport != NULL) {  //** The hostport is interned so the caller keeps ownership of its copy
+     op->hop.handle = hportal_intern(_hpc_config, hostport);
+     op->hop.hostport = op->hop.handle->hostport;
+  }
   op->hop.cmp_size = cmp_size;
+  op->hop.priority = HP_PRIO_HIGH;
   op->hop.send_command = NULL;
   op->hop.send_phase = NULL;
   op->hop.recv_phase = NULL;
@@ -315,6 +633,32 @@ ibp_op_t *new_ibp_read_op(ibp_cap_t *cap, int offset, int size, char *buffer, in
    return(op);
 }
 
+//*************************************************************
+// set_ibp_handle_read_op - Generates a new read operation from a
+//    parsed cap
+//*************************************************************
+
+void set_ibp_handle_read_op(ibp_op_t *op, ibp_cap_handle_t *ch, int offset, int size, char *buffer, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
+{
+   set_ibp_handle_rw_op(op, IBP_READ, ch, offset, size, default_next_block, (void *)&(op->rw_op), timeout, an, cc);
+   op->rw_op.buf = buffer;
+}
+
+//*************************************************************
+// new_ibp_handle_read_op - Generates a new read operation from a
+//    parsed cap
+//*************************************************************
+
+ibp_op_t *new_ibp_handle_read_op(ibp_cap_handle_t *ch, int offset, int size, char *buffer, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
+{
+   ibp_op_t *op = new_ibp_handle_rw_op(IBP_READ, ch, offset, size, default_next_block, NULL, timeout, an, cc);
+   if (op == NULL) return(NULL);
+   op->rw_op.buf = buffer;
+   op->rw_op.arg = (void *)&(op->rw_op);
+
+   return(op);
+}
+
 //*************************************************************
 
 int read_command(void *gop, NetStream_t *ns)
@@ -337,48 +681,118 @@ int read_command(void *gop, NetStream_t *ns)
   return(err);
 }
 
+//*************************************************************
+// read_block_v - Reads directly into the iovec buffers.  The iovec
+//    is consumed as the data arrives.
 //*************************************************************
 
-int read_block(NetStream_t *ns, time_t end_time, char *buffer, int size)
+int read_block_v(NetStream_t *ns, hp_time_t end_time, struct iovec *iov, int iovcnt, int size)
 {
-  int nbytes, pos, nleft, err;
+  int nbytes, nleft, err;
+  hp_time_t now;
 
-  pos = 0;
   nleft = size;
   err = IBP_OK;
-  while ((nleft > 0) && (err == IBP_OK) && (time(NULL) <= end_time)) {
-     nbytes = read_netstream(ns, &(buffer[pos]), nleft, global_dt);
-     log_printf(15, "read_block: ns=%d size=%d nleft=%d nbytes=%d pos=%d time=" TT "\n", ns_getid(ns), 
-         size, nleft, nbytes, pos, time(NULL)); 
+  now = hp_time_now();
+  while ((nleft > 0) && (err == IBP_OK) && (now <= end_time)) {
+     nbytes = readv_netstream(ns, iov, iovcnt, deadline_dt(now, end_time));
+     log_printf(15, "read_block_v: ns=%d size=%d nleft=%d nbytes=%d iovcnt=%d time=" I64T "\n", ns_getid(ns), 
+         size, nleft, nbytes, iovcnt, now); 
 
      if (nbytes > 0) {
-        pos = pos + nbytes;
         nleft = nleft - nbytes;
+        while ((iovcnt > 0) && (nbytes >= (int)iov->iov_len)) {  //** Skip the filled buffers
+           nbytes = nbytes - iov->iov_len;
+           iov++; iovcnt--;
+        }
+        if (nbytes > 0) {
+           iov->iov_base = (char *)iov->iov_base + nbytes;
+           iov->iov_len = iov->iov_len - nbytes;
+        }
      } else if (nbytes < 0) {
-        log_printf(0, "read_block: (read) ns=%d len=%d Error!  closed connection!\n", 
+        log_printf(0, "read_block_v: (read) ns=%d len=%d Error!  closed connection!\n", 
            ns_getid(ns), size);
         err = ERR_RETRY_DEADSOCKET;
      }
+
+     if (nleft > 0) now = hp_time_now();  //** Short read so check the clock
   }
 
-  if ((nleft > 0) && (time(NULL) > end_time)) {
-     log_printf(0, "read_block: (read) ns=%d len=%d Error!  client timeout!\n", 
+  if ((nleft > 0) && (now > end_time)) {
+     log_printf(0, "read_block_v: (read) ns=%d len=%d Error!  client timeout!\n", 
          ns_getid(ns), size);
      err = IBP_E_CLIENT_TIMEOUT;
-//     close_netstream(ns);
   }
 
   return(err);
 }
 
+//*************************************************************
+// read_block - Reads size bytes straight into buffer
+//*************************************************************
+
+int read_block(NetStream_t *ns, hp_time_t end_time, char *buffer, int size)
+{
+  struct iovec iov;
+
+  iov.iov_base = buffer;
+  iov.iov_len = size;
+
+  return(read_block_v(ns, end_time, &iov, 1, size));
+}
+
+//*************************************************************
+// read_data_pos - Reads the op's data from the stream into the buffers
+//    provided by next_block() starting at pos
+//*************************************************************
+
+int read_data_pos(NetStream_t *ns, hp_time_t end_time, ibp_op_rw_t *cmd, int pos)
+{
+  int nbytes, nleft, err;
+  char *rbuf;
+
+  nleft = cmd->size - pos;
+  err = IBP_OK;
+  while ((nleft > 0) && (err == IBP_OK)) {   //** read_block() enforces the deadline
+     cmd->next_block(pos, cmd->arg, &nbytes, &rbuf);
+     if (nbytes > nleft) nbytes = nleft;
+
+     err = read_block(ns, end_time, rbuf, nbytes);
+
+     log_printf(15, "read_data: ns=%d size=%d nleft=%d nbytes=%d pos=%d\n", ns_getid(ns), 
+         cmd->size, nleft, nbytes, pos); 
+
+     if (err == IBP_OK) {
+        pos = pos + nbytes;
+        nleft = nleft - nbytes;
+     }
+  }
+
+  if (err == IBP_OK) {  //** Call the next block routine to process the last chunk
+     cmd->next_block(pos, cmd->arg, &nbytes, NULL);
+  }
+
+  return(err);
+}
+
+//*************************************************************
+// read_data - Reads the op's data from the stream into the buffers
+//    provided by next_block()
+//*************************************************************
+
+int read_data(NetStream_t *ns, hp_time_t end_time, ibp_op_rw_t *cmd)
+{
+  return(read_data_pos(ns, end_time, cmd, 0));
+}
+
 //*************************************************************
 
 int read_recv(void *gop, NetStream_t *ns)
 {
   ibp_op_t *op = (ibp_op_t *)gop;
-  int nbytes, status, pos, nleft, err;
+  int nbytes, status, err;
   char buffer[1024];
-  char *bstate, *rbuf;
+  char *bstate;
   ibp_op_rw_t *cmd;
 
   cmd = &(op->rw_op);
@@ -404,37 +818,341 @@ int read_recv(void *gop, NetStream_t *ns)
 //  return(read_block(ns, op->hop.end_time, cmd->buf, cmd->size));
 //-----------
 
-//  cmd->counter = 0;
-  pos = 0;
-  nleft = cmd->size;
+  err = read_data(ns, op->hop.end_time, cmd);
+
+  if (err == IBP_E_CLIENT_TIMEOUT) {
+     log_printf(0, "read_recv: (read) ns=%d cap=%s offset=%d len=%d Error!  client timeout!\n", 
+         ns_getid(ns), cmd->cap, cmd->offset, cmd->size);
+     err = IBP_E_CLIENT_TIMEOUT;
+  }
+
+  return(err);
+}
+
+//=============================================================
+//  Coalesced read/write routines
+//=============================================================
+
+//*************************************************************
+// new_ibp_coalesce_op - Merges several reads or writes on the same 
+//    cap into a single IBP_LOAD or IBP_WRITE.  The ops should be 
+//    sorted by offset and each should start at or before the end of
+//    the previous ones.  Writes can't overlap.  The original ops are
+//    completed by the caller using the merged op's status.  The merged
+//    op gets the tightest (smallest) member timeout so no member waits
+//    longer than it asked for.
+//*************************************************************
+
+ibp_op_t *new_ibp_coalesce_op(oplist_t *oplist, int rw_type, ibp_op_t **ops, int n_ops)
+{
+  ibp_op_t *op, *rop;
+  ibp_op_coalesce_t *cmd;
+  hp_time_t timeout;
+  int i, end;
+
+  op = new_ibp_op();
+  if (op == NULL) return(NULL);
+
+  cmd = &(op->coalesce_op);
+  cmd->offset = ops[0]->rw_op.offset;
+  cmd->overlap = 0;
+  timeout = ops[0]->hop.timeout_ns;
+  end = cmd->offset;
+  for (i=0; i<n_ops; i++) {
+     rop = ops[i];
+     if (rop->rw_op.offset < end) cmd->overlap = 1;
+     if ((rop->rw_op.offset + rop->rw_op.size) > end) end = rop->rw_op.offset + rop->rw_op.size;
+     if (rop->hop.timeout_ns < timeout) timeout = rop->hop.timeout_ns;
+  }
+  cmd->size = end - cmd->offset;
+
+  if ((rw_type == IBP_WRITE) && (cmd->overlap == 1)) {
+     log_printf(0, "new_ibp_coalesce_op: Overlapping writes can't be merged!  offset=%d n_ops=%d\n", cmd->offset, n_ops);
+     slab_free(_ibp_op_slab, op);
+     return(NULL);
+  }
+
+  init_ibp_base_op(op, "coalesce", (timeout + HP_NS_PER_SEC - 1) / HP_NS_PER_SEC, _ibp_config->new_command + cmd->size, NULL, 
+       cmd->size, rw_type, IBP_NOP, NULL, (ibp_connect_context_t *)ops[0]->hop.connect_context);
+  ibp_op_set_timeout_ms(op, timeout / HP_NS_PER_MS);  //** Keep any sub-sec timeouts
+  op->hop.handle = ops[0]->hop.handle;
+  if (op->hop.handle != NULL) hportal_ref_handle(op->hop.handle);
+  op->hop.hostport = ops[0]->hop.hostport;
+  op->hop.priority = _ibp_data_priority(cmd->size);
+
+  strncpy(cmd->key, ops[0]->rw_op.key, sizeof(cmd->key));
+  strncpy(cmd->typekey, ops[0]->rw_op.typekey, sizeof(cmd->typekey));
+  cmd->oplist = oplist;
+  cmd->n_ops = n_ops;
+  assert((cmd->ops = (ibp_op_t **)malloc(sizeof(ibp_op_t *)*n_ops)) != NULL);
+  memcpy(cmd->ops, ops, sizeof(ibp_op_t *)*n_ops);
+
+  log_printf(15, "new_ibp_coalesce_op: hostport=%s rw_type=%d n_ops=%d offset=%d size=%d overlap=%d\n", 
+       op->hop.hostport, rw_type, n_ops, cmd->offset, cmd->size, cmd->overlap);
+
+  op->hop.send_command = coalesce_command;
+  op->hop.destroy_command = coalesce_destroy;
+  if (rw_type == IBP_WRITE) {
+     op->hop.send_command = NULL;   //** Sent along with the data
+     op->hop.send_phase = coalesce_write_send;
+     op->hop.recv_phase = coalesce_write_recv;
+  } else {
+     op->hop.send_phase = NULL;
+     op->hop.recv_phase = coalesce_read_recv;
+  }
+
+  return(op);
+}
+
+//*************************************************************
+// coalesce_header - Formats the merged IBP_LOAD/IBP_WRITE command
+//*************************************************************
+
+void coalesce_header(ibp_op_t *op, char *buffer, int bsize)
+{
+  ibp_op_coalesce_t *cmd = &(op->coalesce_op);
+
+  snprintf(buffer, bsize, "%d %d %s %s %d %d %d\n", 
+     IBPv040, (op->primary_cmd == IBP_WRITE) ? IBP_WRITE : IBP_LOAD, cmd->key, cmd->typekey, cmd->offset, cmd->size, op->hop.timeout);
+}
+
+//*************************************************************
+
+int coalesce_command(void *gop, NetStream_t *ns)
+{
+  ibp_op_t *op = (ibp_op_t *)gop;
+  char buffer[1024]; 
+  int err;
+
+  coalesce_header(op, buffer, sizeof(buffer));
+
+  err = send_command(ns, buffer);
+  if (err != IBP_OK) {
+     log_printf(10, "coalesce_command: Error with send_command()! ns=%d\n", ns_getid(ns));
+  }
+
+  return(err);
+}
+
+//*************************************************************
+// coalesce_write_send - Sends the merged IBP_WRITE command and
+//    gathers the payload straight from each original op's buffers.
+//    The command and the first block of each op go out in a single
+//    gather write.  An op whose first block doesn't cover the whole op
+//    flushes the gather and sends the rest with write_data_pos().
+//*************************************************************
+
+int coalesce_write_send(void *gop, NetStream_t *ns)
+{
+  ibp_op_t *op = (ibp_op_t *)gop;
+  ibp_op_coalesce_t *cmd = &(op->coalesce_op);
+  ibp_op_rw_t *wcmd;
+  struct iovec *iov;
+  char header[1024];
+  char *wbuf;
+  int i, n, nbytes, size, more, err;
+
+  coalesce_header(op, header, sizeof(header));
+  log_printf(15, "coalesce_write_send: ns=%d n_ops=%d command=%s\n", ns_getid(ns), cmd->n_ops, header);
+
+  assert((iov = (struct iovec *)malloc(sizeof(struct iovec)*(cmd->n_ops+1))) != NULL);
+  iov[0].iov_base = header;
+  iov[0].iov_len = strlen(header);
+  n = 1;
+  size = iov[0].iov_len;
+
   err = IBP_OK;
-  while ((nleft > 0) && (err == IBP_OK) && (time(NULL) <= op->hop.end_time)) {
+  for (i=0; (i<cmd->n_ops) && (err == IBP_OK); i++) {
+     wcmd = &(cmd->ops[i]->rw_op);
+     wcmd->next_block(0, wcmd->arg, &nbytes, &wbuf);
+     if (nbytes > wcmd->size) nbytes = wcmd->size;
+     iov[n].iov_base = wbuf;
+     iov[n].iov_len = nbytes;
+     n++;
+     size += nbytes;
+
+     more = (i < cmd->n_ops-1) ? 1 : 0;
+     if ((nbytes < wcmd->size) || (more == 0)) {  //** Flush what we have
+        err = write_block_v(ns, op->hop.end_time, iov, n, size, (nbytes < wcmd->size) ? 1 : more);
+        if (err == IBP_OK) err = write_data_pos(ns, op->hop.end_time, wcmd, nbytes, NULL, more);
+        n = 0;
+        size = 0;
+     }
+  }
+
+  free(iov);
+
+  return(err);
+}
+
+//*************************************************************
+
+int coalesce_write_recv(void *gop, NetStream_t *ns)
+{
+  ibp_op_t *op = (ibp_op_t *)gop;
+  ibp_op_coalesce_t *cmd = &(op->coalesce_op);
+  char buffer[1024]; 
+  int err, status, nbytes;
+  char *bstate;
+
+  err = readline_with_timeout(ns, buffer, sizeof(buffer), op->hop.end_time);
+  if (err != IBP_OK) return(err);
+
+  status = atoi(buffer);
+  if (status == IBP_OK) {
+     err = readline_with_timeout(ns, buffer, sizeof(buffer), op->hop.end_time);
+     if (err != IBP_OK) return(err);
+
+     status = atoi(string_token(buffer, " ", &bstate, &err));
+     nbytes = atol(string_token(NULL, " ", &bstate, &err));
+     if ((status == IBP_OK) && (nbytes != cmd->size)) status = IBP_E_GENERIC;
+  }
+
+  if (status != IBP_OK) {
+     log_printf(15, "coalesce_write_recv: ns=%d offset=%d len=%d n_ops=%d Error!  status=%d buffer=%s\n", 
+        ns_getid(ns), cmd->offset, cmd->size, cmd->n_ops, status, buffer);
+  }
+
+  return(status);
+}
+
+//*************************************************************
+// copy_data - Copies the data into the buffers provided by 
+//    next_block()
+//*************************************************************
+
+void copy_data(char *data, ibp_op_rw_t *cmd)
+{
+  int nbytes, pos;
+  char *rbuf;
+
+  pos = 0;
+  while (pos < cmd->size) {
      cmd->next_block(pos, cmd->arg, &nbytes, &rbuf);
+     if (nbytes > (cmd->size - pos)) nbytes = cmd->size - pos;
+     memcpy(rbuf, &(data[pos]), nbytes);
+     pos = pos + nbytes;
+  }
 
-     err = read_block(ns, op->hop.end_time, rbuf, nbytes);
+  cmd->next_block(pos, cmd->arg, &nbytes, NULL);
+}
 
-     log_printf(15, "read_recv: ns=%d size=%d nleft=%d nbytes=%d pos=%d time=" TT "\n", ns_getid(ns), 
-         cmd->size, nleft, nbytes, pos, time(NULL)); 
+//*************************************************************
+// coalesce_read_scatter - Receives a merged read straight into the 
+//    original ops' buffers.  The first block of each op is gathered
+//    into a single iovec.  Ops whose first block doesn't cover the 
+//    whole op flush the iovec and finish with read_data_pos().
+//*************************************************************
 
-     if (err == IBP_OK) {
-        pos = pos + nbytes;
-        nleft = nleft - nbytes;
+int coalesce_read_scatter(NetStream_t *ns, hp_time_t end_time, ibp_op_coalesce_t *cmd)
+{
+  int i, j, first, n, nbytes, last, size, err;
+  struct iovec *iov;
+  ibp_op_rw_t *rcmd;
+  char *rbuf;
+
+  assert((iov = (struct iovec *)malloc(sizeof(struct iovec)*cmd->n_ops)) != NULL);
+
+  err = IBP_OK;
+  first = 0;
+  n = 0;
+  size = 0;
+  for (i=0; (i<cmd->n_ops) && (err == IBP_OK); i++) {
+     rcmd = &(cmd->ops[i]->rw_op);
+     rcmd->next_block(0, rcmd->arg, &nbytes, &rbuf);
+     if (nbytes > rcmd->size) nbytes = rcmd->size;
+     last = nbytes;
+     iov[n].iov_base = rbuf;
+     iov[n].iov_len = nbytes;
+     n++;
+     size += nbytes;
+
+     if ((nbytes < rcmd->size) || (i == cmd->n_ops-1)) {  //** Flush what we have
+        err = read_block_v(ns, end_time, iov, n, size);
+
+        //** Finish up the ops that were completely received
+        for (j=first; (j<i) && (err == IBP_OK); j++) {
+           cmd->ops[j]->rw_op.next_block(cmd->ops[j]->rw_op.size, cmd->ops[j]->rw_op.arg, &nbytes, NULL);
+        }
+
+        //** and the last one which may still have more blocks
+        if (err == IBP_OK) err = read_data_pos(ns, end_time, rcmd, last);
+
+        first = i+1;
+        n = 0;
+        size = 0;
      }
   }
 
-  if ((nleft > 0) && (time(NULL) > op->hop.end_time)) {
-     log_printf(0, "read_recv: (read) ns=%d cap=%s offset=%d len=%d Error!  client timeout!\n", 
-         ns_getid(ns), cmd->cap, cmd->offset, cmd->size);
-     err = IBP_E_CLIENT_TIMEOUT;
+  free(iov);
+
+  return(err);
+}
+
+//*************************************************************
+// coalesce_read_recv - Scatters the merged read back to the 
+//    original ops.  If none of the ranges overlap the data goes 
+//    straight into each op's buffers.  Otherwise it's read into a
+//    temporary buffer and copied.
+//*************************************************************
+
+int coalesce_read_recv(void *gop, NetStream_t *ns)
+{
+  ibp_op_t *op = (ibp_op_t *)gop;
+  int nbytes, status, err, i;
+  char buffer[1024];
+  char *bstate, *data;
+  ibp_op_coalesce_t *cmd;
+  ibp_op_rw_t *rcmd;
+
+  cmd = &(op->coalesce_op);
+
+  err = readline_with_timeout(ns, buffer, sizeof(buffer), op->hop.end_time);
+  if (err != IBP_OK) return(err);
+
+  status = IBP_E_GENERIC;
+  status = atoi(string_token(buffer, " ", &bstate, &err));
+  nbytes = atol(string_token(NULL, " ", &bstate, &err));
+  if ((status != IBP_OK) || (nbytes != cmd->size)) {
+     log_printf(15, "coalesce_read_recv: ns=%d offset=%d len=%d n_ops=%d Error!  status=%d bytes=!%s!\n", 
+          ns_getid(ns), cmd->offset, cmd->size, cmd->n_ops, status, buffer);
+     return(status);
   }
 
-  if (err == IBP_OK) {  //** Call the next block routine to process the last chunk
-     cmd->next_block(pos, cmd->arg, &nbytes, NULL);
+  err = IBP_OK;
+  if (cmd->overlap == 0) {
+     err = coalesce_read_scatter(ns, op->hop.end_time, cmd);
+  } else {
+     assert((data = (char *)malloc(cmd->size)) != NULL);
+     err = read_block(ns, op->hop.end_time, data, cmd->size);
+     if (err == IBP_OK) {
+        for (i=0; i<cmd->n_ops; i++) {
+           rcmd = &(cmd->ops[i]->rw_op);
+           copy_data(&(data[rcmd->offset - cmd->offset]), rcmd);
+        }
+     }
+     free(data);
+  }
+
+  if (err == IBP_E_CLIENT_TIMEOUT) {
+     log_printf(0, "coalesce_read_recv: ns=%d offset=%d len=%d Error!  client timeout!\n", 
+         ns_getid(ns), cmd->offset, cmd->size);
   }
 
   return(err);
 }
 
+//*************************************************************
+
+int coalesce_destroy(void *gop)
+{
+  ibp_op_t *op = (ibp_op_t *)gop;
+
+  free(op->coalesce_op.ops);
+
+  return(0);
+}
+
 //=============================================================
 //  Write routines
 //=============================================================
@@ -487,78 +1205,117 @@ ibp_op_t *new_ibp_write_op(ibp_cap_t *cap, int offset, int size, char *buffer, i
    return(op);
 }
 
+//*************************************************************
+// set_ibp_handle_write_op - Generates a new write operation from a
+//    parsed cap
 //*************************************************************
 
-int write_command(void *gop, NetStream_t *ns)
+void set_ibp_handle_write_op(ibp_op_t *op, ibp_cap_handle_t *ch, int offset, int size, char *buffer, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  ibp_op_t *op = (ibp_op_t *)gop;
-  char buffer[1024]; 
-  int err;
-  ibp_op_rw_t *cmd;
-
-  cmd = &(op->rw_op);
+   set_ibp_handle_rw_op(op, IBP_WRITE, ch, offset, size, default_next_block, (void *)&(op->rw_op), timeout, an, cc);
+   op->rw_op.buf = buffer;
+}
 
-  snprintf(buffer, sizeof(buffer), "%d %d %s %s %d %d %d\n", 
-       IBPv040, IBP_WRITE, cmd->key, cmd->typekey, cmd->offset, cmd->size, op->hop.timeout);
+//*************************************************************
+// new_ibp_handle_write_op - Creates a new write operation from a
+//    parsed cap
+//*************************************************************
 
-  err = send_command(ns, buffer);
-  if (err != IBP_OK) {
-     log_printf(10, "read_command: Error with send_command()! ns=%d\n", ns_getid(ns));
-  }
+ibp_op_t *new_ibp_handle_write_op(ibp_cap_handle_t *ch, int offset, int size, char *buffer, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
+{
+   ibp_op_t *op = new_ibp_handle_rw_op(IBP_WRITE, ch, offset, size, default_next_block, NULL, timeout, an, cc);
+   if (op == NULL) return(NULL);
+   op->rw_op.buf = buffer;
+   op->rw_op.arg = (void *)&(op->rw_op);
 
-  return(err);
+   return(op);
 }
 
+//*************************************************************
+// write_block_v - Sends all the iovec buffers.  The iovec is
+//    consumed as the data goes out.  more flags that additional data
+//    follows so the stream can hold back partial packets.
 //*************************************************************
 
-int write_block(NetStream_t *ns, time_t end_time, char *buffer, int size)
+int write_block_v(NetStream_t *ns, hp_time_t end_time, struct iovec *iov, int iovcnt, int size, int more)
 {
-  int pos, nleft, nbytes, err;
+  int nleft, nbytes, err;
+  hp_time_t now;
 
-  pos = 0;
   nleft = size;
   nbytes = -100;
   err = IBP_OK;
+  now = hp_time_now();
   while ((nleft > 0) && (err == IBP_OK)) {
-     nbytes = write_netstream(ns, &(buffer[pos]), nleft, global_dt);
-     log_printf(15, "write_block: ns=%d size=%d nleft=%d nbytes=%d pos=%d time=" TT "\n", ns_getid(ns), size, nleft, 
-             nbytes, pos, time(NULL));
-
-     if (time(NULL) > end_time) {
-        log_printf(15, "write_send: ns=%d Command timed out! to=" TT " ct=" TT " \n", ns_getid(ns), end_time, time(NULL));
-        err = IBP_E_CLIENT_TIMEOUT;
+     nbytes = writev_netstream(ns, iov, iovcnt, more, deadline_dt(now, end_time));
+     log_printf(15, "write_block_v: ns=%d size=%d nleft=%d nbytes=%d iovcnt=%d time=" I64T "\n", ns_getid(ns), size, nleft, 
+             nbytes, iovcnt, now);
+
+     if (nbytes < nleft) {  //** Short write so check the clock
+        now = hp_time_now();
+        if (now > end_time) {
+           log_printf(15, "write_block_v: ns=%d Command timed out! to=" I64T " ct=" I64T " \n", ns_getid(ns), end_time, now);
+           err = IBP_E_CLIENT_TIMEOUT;
+        }
      }
 
      if (nbytes < 0) {
         err = ERR_RETRY_DEADSOCKET;   //** Error with write
      } else if (nbytes > 0) {   //** Normal write
-        pos = pos + nbytes;
-        nleft = size - pos;
+        nleft = nleft - nbytes;
+        while ((iovcnt > 0) && (nbytes >= (int)iov->iov_len)) {  //** Skip the sent buffers
+           nbytes = nbytes - iov->iov_len;
+           iov++; iovcnt--;
+        }
+        if (nbytes > 0) {
+           iov->iov_base = (char *)iov->iov_base + nbytes;
+           iov->iov_len = iov->iov_len - nbytes;
+        }
         err = IBP_OK;
      }
   }
 
-  log_printf(15, "write_block: END ns=%d size=%d nleft=%d nbytes=%d pos=%d\n", ns_getid(ns), size, nleft, nbytes, pos);
+  log_printf(15, "write_block_v: END ns=%d size=%d nleft=%d\n", ns_getid(ns), size, nleft);
 
   return(err);
 }
 
+//*************************************************************
+// write_block - Sends size bytes from buffer
 //*************************************************************
 
-int write_send(void *gop, NetStream_t *ns)
+int write_block(NetStream_t *ns, hp_time_t end_time, char *buffer, int size)
 {
-  ibp_op_t *iop = (ibp_op_t *)gop;
-  int pos, nleft, nbytes, err, block_error;
-  ibp_op_rw_t *cmd = &(iop->rw_op);
-  char *buffer;
+  struct iovec iov;
 
-//  return(write_block(ns, iop->hop.end_time, cmd->buf, cmd->size));
+  iov.iov_base = buffer;
+  iov.iov_len = size;
 
-  pos = 0;
-  nleft = cmd->size;
+  return(write_block_v(ns, end_time, &iov, 1, size, 0));
+}
+
+//*************************************************************
+// write_data_pos - Sends the op's data starting at pos using the 
+//    buffers provided by next_block().  If a header is given it goes
+//    out in the same call as the first block.  more flags that more 
+//    data follows this op.
+//*************************************************************
+
+int write_data_pos(NetStream_t *ns, hp_time_t end_time, ibp_op_rw_t *cmd, int pos, char *header, int more)
+{
+  int nleft, nbytes, err, block_error, n, hlen;
+  struct iovec iov[2];
+  char *buffer;
+
+  nleft = cmd->size - pos;
   nbytes = -100;
   err = IBP_OK;
   block_error = 0;
+  hlen = (header == NULL) ? 0 : strlen(header);
+  if ((nleft <= 0) && (hlen > 0)) {   //** No data just the header
+     err = write_block(ns, end_time, header, hlen);
+  }
+
   while ((nleft > 0) && (err == IBP_OK)) {
      cmd->next_block(pos, cmd->arg, &nbytes, &buffer);
      if (nbytes > nleft) {
@@ -567,11 +1324,19 @@ int write_send(void *gop, NetStream_t *ns)
         block_error = 1;
      }
 
-     log_printf(15, "write_send: ns=%d size=%d nleft=%d nbytes=%d pos=%d time=" TT "\n", ns_getid(ns), cmd->size, nleft, 
-             nbytes, pos, time(NULL));
-     err = write_block(ns, iop->hop.end_time, buffer, nbytes);
+     log_printf(15, "write_send: ns=%d size=%d nleft=%d nbytes=%d pos=%d\n", ns_getid(ns), cmd->size, nleft, 
+             nbytes, pos);
+
+     n = 0;
+     if (hlen > 0) {
+        iov[n].iov_base = header;  iov[n].iov_len = hlen;  n++;
+     }
+     iov[n].iov_base = buffer;  iov[n].iov_len = nbytes;  n++;
      pos = pos + nbytes;
      nleft = cmd->size - pos;
+
+     err = write_block_v(ns, end_time, iov, n, hlen + nbytes, (nleft > 0) ? 1 : more);
+     hlen = 0;
   }
 
   log_printf(15, "write_send: END ns=%d size=%d nleft=%d nbytes=%d pos=%d\n", ns_getid(ns), cmd->size, nleft, nbytes, pos);
@@ -580,6 +1345,47 @@ int write_send(void *gop, NetStream_t *ns)
   return(err);
 }
 
+//*************************************************************
+// write_data - Sends the op's data using the buffers provided by
+//    next_block()
+//*************************************************************
+
+int write_data(NetStream_t *ns, hp_time_t end_time, ibp_op_rw_t *cmd)
+{
+  return(write_data_pos(ns, end_time, cmd, 0, NULL, 0));
+}
+
+//*************************************************************
+// write_send - Sends the IBP_WRITE or IBP_STORE command along with
+//    the payload.  The command line is gathered with the first block
+//    so small writes go out in a single packet.
+//*************************************************************
+
+int write_send(void *gop, NetStream_t *ns)
+{
+  ibp_op_t *op = (ibp_op_t *)gop;
+  ibp_op_rw_t *cmd = &(op->rw_op);
+  char buffer[1024];
+  int err;
+
+  if (op->primary_cmd == IBP_STORE) {
+     snprintf(buffer, sizeof(buffer), "%d %d %s %s %d %d\n", 
+          IBPv040, IBP_STORE, cmd->key, cmd->typekey, cmd->size, op->hop.timeout);
+  } else {
+     snprintf(buffer, sizeof(buffer), "%d %d %s %s %d %d %d\n", 
+          IBPv040, IBP_WRITE, cmd->key, cmd->typekey, cmd->offset, cmd->size, op->hop.timeout);
+  }
+
+  log_printf(15, "write_send: ns=%d command=%s\n", ns_getid(ns), buffer);
+
+  err = write_data_pos(ns, op->hop.end_time, cmd, 0, buffer, 0);
+  if (err != IBP_OK) {
+     log_printf(10, "write_send: Error=%d! ns=%d command=!%s!\n", err, ns_getid(ns), buffer);
+  }
+
+  return(err);
+}
+
 //*************************************************************
 
 int write_recv(void *gop, NetStream_t *ns)
@@ -632,29 +1438,6 @@ int write_recv(void *gop, NetStream_t *ns)
 //  IBP append routines
 //=============================================================
 
-//*************************************************************
-
-int append_command(void *gop, NetStream_t *ns)
-{
-  ibp_op_t *op = (ibp_op_t *)gop;
-  char buffer[1024]; 
-  int err;
-  ibp_op_rw_t *cmd;
-
-  cmd = &(op->rw_op);
-
-  snprintf(buffer, sizeof(buffer), "%d %d %s %s %d %d\n", 
-       IBPv040, IBP_STORE, cmd->key, cmd->typekey, cmd->size, op->hop.timeout);
-
-  err = send_command(ns, buffer);
-  if (err != IBP_OK) {
-     log_printf(10, "append_command: Error with send_command()! ns=%d\n", ns_getid(ns));
-  }
-
-  return(err);
-}
-
-
 //*************************************************************
 // new_ibp_write_op - Creates/Generates a new write operation
 //*************************************************************
@@ -663,7 +1446,9 @@ ibp_op_t *new_ibp_append_op(ibp_cap_t *cap, int size, char *buffer, int timeout,
 {
    ibp_op_t *op = new_ibp_rw_op(IBP_STORE, cap, 0, size, default_next_block, NULL, timeout, an, cc);
    if (op == NULL) return(NULL);
-   op->hop.send_command = append_command;
+   op->hop.send_command = NULL;
+   op->hop.send_phase = write_send;
+   op->hop.recv_phase = write_recv;
    op->rw_op.buf = buffer;
    op->rw_op.arg = (void *)&(op->rw_op);
    return(op);
@@ -679,7 +1464,7 @@ void set_ibp_append_op(ibp_op_t *op, ibp_cap_t *cap, int size, char *buffer, int
    set_ibp_rw_op(op, IBP_STORE, cap, 0, size, default_next_block, (void *)&(op->rw_op), timeout, an, cc); 
 
    op->rw_op.buf = buffer;
-   op->hop.send_command = append_command;
+   op->hop.send_command = NULL;   //** write_send() sends the command with the data
    op->hop.send_phase = write_send;
    op->hop.recv_phase = write_recv;
 }
@@ -688,25 +1473,19 @@ void set_ibp_append_op(ibp_op_t *op, ibp_cap_t *cap, int size, char *buffer, int
 //=============================================================
 
 //*************************************************************
-// set_ibp_rw_op - Generates a new IO operation
+// _ibp_rw_op_init - Fills in the common R/W fields once the cap's key
+//    and typekey are set
 //*************************************************************
 
-void set_ibp_rw_op(ibp_op_t *op, int rw_type, ibp_cap_t *cap, int offset, int size, 
-     int (*next_block)(int, void *, int *, char **), void *arg, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
+void _ibp_rw_op_init(ibp_op_t *op, int rw_type, ibp_cap_t *cap, char *host, int port, int offset, int size, 
+     int (*next_block)(int, void *, int *, char **), void *arg, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
-  int port;
-  char host[256];
-  ibp_op_rw_t *cmd;
+  ibp_op_rw_t *cmd = &(op->rw_op);
 
-  init_ibp_base_op(op, "rw", timeout, _ibp_config->new_command + size, NULL, size, rw_type, IBP_NOP, an, cc);
-  
-  cmd = &(op->rw_op);
+  op->hop.priority = _ibp_data_priority(size);
 
-  parse_cap(cap, host, &port, cmd->key, cmd->typekey);
   if (cc==NULL) cc = &(_ibp_config->cc[rw_type]);
-  set_hostport(hoststr, sizeof(hoststr), host, port, cc);
-  op->hop.hostport = strdup(hoststr);
+  _ibp_op_hostport(op, host, port, cc);
 
   cmd->cap = cap;
   cmd->size = size;
@@ -715,7 +1494,7 @@ void set_ibp_rw_op(ibp_op_t *op, int rw_type, ibp_cap_t *cap, int offset, int si
   cmd->arg = arg;
 
   if (rw_type == IBP_WRITE) { 
-     op->hop.send_command = write_command;
+     op->hop.send_command = NULL;   //** write_send() sends the command with the data
      op->hop.send_phase = write_send;
      op->hop.recv_phase = write_recv;
   } else {
@@ -723,7 +1502,44 @@ void set_ibp_rw_op(ibp_op_t *op, int rw_type, ibp_cap_t *cap, int offset, int si
      op->hop.send_phase = NULL;
      op->hop.recv_phase = read_recv;
   }
+}
+
+//*************************************************************
+// set_ibp_rw_op - Generates a new IO operation
+//*************************************************************
+
+void set_ibp_rw_op(ibp_op_t *op, int rw_type, ibp_cap_t *cap, int offset, int size, 
+     int (*next_block)(int, void *, int *, char **), void *arg, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
+{
+  int port;
+  char host[256];
+  ibp_op_rw_t *cmd;
+
+  init_ibp_base_op(op, "rw", timeout, _ibp_config->new_command + size, NULL, size, rw_type, IBP_NOP, an, cc);
+  
+  cmd = &(op->rw_op);
+  cmd->key = cmd->key_buf;
+  cmd->typekey = cmd->typekey_buf;
+  parse_cap(cap, host, &port, cmd->key, cmd->typekey);
+
+  _ibp_rw_op_init(op, rw_type, cap, host, port, offset, size, next_block, arg, cc);
+}
+
+//*************************************************************
+// set_ibp_handle_rw_op - Same as set_ibp_rw_op() but using a parsed
+//    cap.  Nothing is parsed or copied.  The handle must not be
+//    destroyed until the op completes.
+//*************************************************************
+
+void set_ibp_handle_rw_op(ibp_op_t *op, int rw_type, ibp_cap_handle_t *ch, int offset, int size, 
+     int (*next_block)(int, void *, int *, char **), void *arg, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
+{
+  init_ibp_base_op(op, "rw", timeout, _ibp_config->new_command + size, NULL, size, rw_type, IBP_NOP, an, cc);
+  
+  op->rw_op.key = ch->key;
+  op->rw_op.typekey = ch->typekey;
 
+  _ibp_rw_op_init(op, rw_type, ch->cap, ch->host, ch->port, offset, size, next_block, arg, cc);
 }
 
 //*************************************************************
@@ -741,6 +1557,21 @@ ibp_op_t *new_ibp_rw_op(int rw_type, ibp_cap_t *cap, int offset, int size,
   return(op);
 }
 
+//*************************************************************
+// new_ibp_handle_rw_op - Creates a new IO operation from a parsed cap
+//*************************************************************
+
+ibp_op_t *new_ibp_handle_rw_op(int rw_type, ibp_cap_handle_t *ch, int offset, int size,
+     int (*next_block)(int, void *, int *, char **), void *arg, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
+{
+  ibp_op_t *op = new_ibp_op();
+  if (op == NULL) return(NULL);
+
+  set_ibp_handle_rw_op(op, rw_type, ch, offset, size, next_block, arg, timeout, an, cc);
+
+  return(op);
+}
+
 //=============================================================
 //  Allocate routines
 //=============================================================
@@ -852,17 +1683,16 @@ int allocate_recv(void *gop, NetStream_t *ns)
 void set_ibp_alloc_op(ibp_op_t *op, ibp_capset_t *caps, int size, ibp_depot_t *depot, 
        ibp_attributes_t *attr, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
   ibp_op_alloc_t *cmd;
 
 //log_printf(15, "set_ibp_alloc_op: start. _hpc_config=%p\n", _hpc_config);
 
   if (cc==NULL) cc = &(_ibp_config->cc[IBP_ALLOCATE]);
-  set_hostport(hoststr, sizeof(hoststr), depot->host, depot->port, cc);
 
 //log_printf(15, "set_ibp_alloc_op: before init_ibp_base_op\n");
 
-  init_ibp_base_op(op, "alloc", timeout, 10*_ibp_config->new_command, strdup(hoststr), 1, IBP_ALLOCATE, IBP_NOP, an, cc);
+  init_ibp_base_op(op, "alloc", timeout, 10*_ibp_config->new_command, NULL, 1, IBP_ALLOCATE, IBP_NOP, an, cc);
+  _ibp_op_hostport(op, depot->host, depot->port, cc);
 //log_printf(15, "set_ibp_alloc_op: after init_ibp_base_op\n");
 
   cmd = &(op->alloc_op);
@@ -897,7 +1727,6 @@ ibp_op_t *new_ibp_alloc_op(ibp_capset_t *caps, int size, ibp_depot_t *depot, ibp
 void set_ibp_split_alloc_op(ibp_op_t *op, ibp_cap_t *mcap, ibp_capset_t *caps, int size, 
        ibp_attributes_t *attr, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
   char host[256];
   ibp_op_alloc_t *cmd;
   int port;
@@ -908,8 +1737,7 @@ void set_ibp_split_alloc_op(ibp_op_t *op, ibp_cap_t *mcap, ibp_capset_t *caps, i
 
   parse_cap(mcap, host, &port, cmd->key, cmd->typekey);
   if (cc==NULL) cc = &(_ibp_config->cc[IBP_SPLIT_ALLOCATE]);
-  set_hostport(hoststr, sizeof(hoststr), host, port, cc);
-  op->hop.hostport = strdup(hoststr);
+  _ibp_op_hostport(op, host, port, cc);
 
   cmd = &(op->alloc_op);
   cmd->caps = caps;
@@ -965,7 +1793,6 @@ int rename_command(void *gop, NetStream_t *ns)
 
 void set_ibp_rename_op(ibp_op_t *op, ibp_capset_t *caps, ibp_cap_t *mcap, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
   char host[256];
   ibp_op_alloc_t *cmd;
   int port;
@@ -978,8 +1805,7 @@ log_printf(15, "set_ibp_rename_op: start. _hpc_config=%p\n", _hpc_config);
 
   parse_cap(mcap, host, &port, cmd->key, cmd->typekey);
   if (cc==NULL) cc = &(_ibp_config->cc[IBP_RENAME]);
-  set_hostport(hoststr, sizeof(hoststr), host, port, cc);
-  op->hop.hostport = strdup(hoststr);
+  _ibp_op_hostport(op, host, port, cc);
 
   cmd->caps = caps;
 
@@ -1033,7 +1859,6 @@ int merge_command(void *gop, NetStream_t *ns)
 void set_ibp_merge_alloc_op(ibp_op_t *op, ibp_cap_t *mcap, ibp_cap_t *ccap, int timeout, 
     oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
   char host[256];
   char chost[256];
   ibp_op_merge_alloc_t *cmd;
@@ -1047,8 +1872,7 @@ void set_ibp_merge_alloc_op(ibp_op_t *op, ibp_cap_t *mcap, ibp_cap_t *ccap, int
 
   parse_cap(mcap, host, &port, cmd->mkey, cmd->mtypekey);
   if (cc==NULL) cc = &(_ibp_config->cc[IBP_MERGE_ALLOCATE]);
-  set_hostport(hoststr, sizeof(hoststr), host, port, cc);
-  op->hop.hostport = strdup(hoststr);
+  _ibp_op_hostport(op, host, port, cc);
 
   parse_cap(ccap, chost, &cport, cmd->ckey, cmd->ctypekey);
 
@@ -1102,7 +1926,6 @@ int alias_allocate_command(void *gop, NetStream_t *ns)
 void set_ibp_alias_alloc_op(ibp_op_t *op, ibp_capset_t *caps, ibp_cap_t *mcap, int offset, int size, 
    int duration, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
   char host[256];
   ibp_op_alloc_t *cmd;
   int port;
@@ -1115,8 +1938,7 @@ void set_ibp_alias_alloc_op(ibp_op_t *op, ibp_capset_t *caps, ibp_cap_t *mcap, i
 
   parse_cap(mcap, host, &port, cmd->key, cmd->typekey);
   if (cc==NULL) cc = &(_ibp_config->cc[IBP_ALIAS_ALLOCATE]);
-  set_hostport(hoststr, sizeof(hoststr), host, port, cc);
-  op->hop.hostport = strdup(hoststr);
+  _ibp_op_hostport(op, host, port, cc);
 
   cmd->offset = offset;
   cmd->size = size;
@@ -1229,7 +2051,6 @@ int status_get_recv(void *gop, NetStream_t *ns)
 
 void set_ibp_generic_modify_count_op(int command, ibp_op_t *op, ibp_cap_t *cap, ibp_cap_t *mcap, int mode, int captype, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
   int port;
   char host[256];
   ibp_op_probe_t *cmd;
@@ -1253,8 +2074,7 @@ void set_ibp_generic_modify_count_op(int command, ibp_op_t *op, ibp_cap_t *cap,
 
   parse_cap(cap, host, &port, cmd->key, cmd->typekey);
   if (cc==NULL) cc = &(_ibp_config->cc[command]);
-  set_hostport(hoststr, sizeof(hoststr), host, port, cc);
-  op->hop.hostport = strdup(hoststr);
+  _ibp_op_hostport(op, host, port, cc);
 
   if (command == IBP_ALIAS_MANAGE) parse_cap(mcap, host, &port, cmd->mkey, cmd->mtypekey);
 
@@ -1351,7 +2171,6 @@ int modify_alloc_command(void *gop, NetStream_t *ns)
 void set_ibp_modify_alloc_op(ibp_op_t *op, ibp_cap_t *cap, size_t size, time_t duration, int reliability, 
      int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
   int port;
   char host[256];
   ibp_op_modify_alloc_t *cmd;
@@ -1362,8 +2181,7 @@ void set_ibp_modify_alloc_op(ibp_op_t *op, ibp_cap_t *cap, size_t size, time_t d
 
   parse_cap(cap, host, &port, cmd->key, cmd->typekey);
   if (cc==NULL) cc = &(_ibp_config->cc[IBP_MANAGE]);
-  set_hostport(hoststr, sizeof(hoststr), host, port, cc);
-  op->hop.hostport = strdup(hoststr);
+  _ibp_op_hostport(op, host, port, cc);
 
   cmd->cap = cap;
   cmd->size = size;
@@ -1427,7 +2245,6 @@ int alias_modify_alloc_command(void *gop, NetStream_t *ns)
 void set_ibp_alias_modify_alloc_op(ibp_op_t *op, ibp_cap_t *cap, ibp_cap_t *mcap, size_t offset, size_t size, time_t duration, 
      int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
   int port;
   char host[256];
   ibp_op_modify_alloc_t *cmd;
@@ -1438,8 +2255,7 @@ void set_ibp_alias_modify_alloc_op(ibp_op_t *op, ibp_cap_t *cap, ibp_cap_t *mcap
 
   parse_cap(cap, host, &port, cmd->key, cmd->typekey);
   if (cc==NULL) cc = &(_ibp_config->cc[IBP_ALIAS_MANAGE]);
-  set_hostport(hoststr, sizeof(hoststr), host, port, cc);
-  op->hop.hostport = strdup(hoststr);
+  _ibp_op_hostport(op, host, port, cc);
 
   parse_cap(mcap, host, &port, cmd->mkey, cmd->mtypekey);
 
@@ -1572,7 +2388,6 @@ int probe_recv(void *gop, NetStream_t *ns)
 
 void set_ibp_probe_op(ibp_op_t *op, ibp_cap_t *cap, ibp_capstatus_t *probe, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
   int port;
   char host[256];
   ibp_op_probe_t *cmd;
@@ -1583,8 +2398,7 @@ void set_ibp_probe_op(ibp_op_t *op, ibp_cap_t *cap, ibp_capstatus_t *probe, int
 
   parse_cap(cap, host, &port, cmd->key, cmd->typekey);
   if (cc==NULL) cc = &(_ibp_config->cc[IBP_MANAGE]);
-  set_hostport(hoststr, sizeof(hoststr), host, port, cc);
-  op->hop.hostport = strdup(hoststr);
+  _ibp_op_hostport(op, host, port, cc);
 
   cmd->cap = cap;
   cmd->probe = probe;
@@ -1673,7 +2487,6 @@ int alias_probe_recv(void *gop, NetStream_t *ns)
 
 void set_ibp_alias_probe_op(ibp_op_t *op, ibp_cap_t *cap, ibp_alias_capstatus_t *probe, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
   int port;
   char host[256];
   ibp_op_probe_t *cmd;
@@ -1684,8 +2497,7 @@ void set_ibp_alias_probe_op(ibp_op_t *op, ibp_cap_t *cap, ibp_alias_capstatus_t
 
   parse_cap(cap, host, &port, cmd->key, cmd->typekey);
   if (cc==NULL) cc = &(_ibp_config->cc[IBP_ALIAS_MANAGE]);
-  set_hostport(hoststr, sizeof(hoststr), host, port, cc);
-  op->hop.hostport = strdup(hoststr);
+  _ibp_op_hostport(op, host, port, cc);
 
   cmd->cap = cap;
   cmd->alias_probe = probe;
@@ -1779,19 +2591,18 @@ int copy_recv(void *gop, NetStream_t *ns)
 void set_ibp_copyappend_op(ibp_op_t *op, int ns_type, char *path, ibp_cap_t *srccap, ibp_cap_t *destcap, int src_offset, int size, 
         int src_timeout, int  dest_timeout, int dest_client_timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
   int port;
   char host[256];
   ibp_op_copy_t *cmd;
 
   init_ibp_base_op(op, "copyappend", src_timeout, _ibp_config->new_command + size, NULL, size, IBP_SEND, IBP_NOP, an, cc);
+  op->hop.priority = _ibp_data_priority(size);
   
   cmd = &(op->copy_op);
   
   parse_cap(srccap, host, &port, cmd->src_key, cmd->src_typekey);
   if (cc==NULL) cc = &(_ibp_config->cc[IBP_SEND]);
-  set_hostport(hoststr, sizeof(hoststr), host, port, cc);
-  op->hop.hostport = strdup(hoststr);
+  _ibp_op_hostport(op, host, port, cc);
 
   cmd->ibp_command = IBP_SEND;
   if (ns_type == NS_TYPE_PHOEBUS) { 
@@ -1867,19 +2678,18 @@ void set_ibp_copy_op(ibp_op_t *op, int mode, int ns_type, char *path, ibp_cap_t
         int src_offset, int dest_offset, int size, int src_timeout, int  dest_timeout, 
         int dest_client_timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
   int port;
   char host[256];
   ibp_op_copy_t *cmd;
 
   init_ibp_base_op(op, "copy", src_timeout, _ibp_config->new_command + size, NULL, size, IBP_SEND, IBP_NOP, an, cc);
+  op->hop.priority = _ibp_data_priority(size);
   
   cmd = &(op->copy_op);
   
   parse_cap(srccap, host, &port, cmd->src_key, cmd->src_typekey);
   if (cc==NULL) cc = &(_ibp_config->cc[IBP_SEND]);
-  set_hostport(hoststr, sizeof(hoststr), host, port, cc);
-  op->hop.hostport = strdup(hoststr);
+  _ibp_op_hostport(op, host, port, cc);
 
   cmd->ibp_command = mode;
   if (ns_type == NS_TYPE_PHOEBUS) { 
@@ -2099,14 +2909,13 @@ int depot_inq_recv(void *gop, NetStream_t *ns)
 
 void set_ibp_depot_inq_op(ibp_op_t *op, ibp_depot_t *depot, char *password, ibp_depotinfo_t *di, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
   ibp_op_depot_inq_t *cmd = &(op->depot_inq_op);
 
   if (cc==NULL) cc = &(_ibp_config->cc[IBP_STATUS]);
-  set_hostport(hoststr, sizeof(hoststr), depot->host, depot->port, cc);
 
-  init_ibp_base_op(op, "depot_inq", timeout, _ibp_config->new_command, strdup(hoststr), 
+  init_ibp_base_op(op, "depot_inq", timeout, _ibp_config->new_command, NULL, 
          _ibp_config->new_command, IBP_STATUS, IBP_ST_INQ, an, cc);
+  _ibp_op_hostport(op, depot->host, depot->port, cc);
   
   cmd->depot = depot;
   cmd->password = password;
@@ -2195,14 +3004,13 @@ int depot_version_recv(void *gop, NetStream_t *ns)
 
 void set_ibp_version_op(ibp_op_t *op, ibp_depot_t *depot, char *buffer, int buffer_size, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
-  char hoststr[1024];
   ibp_op_version_t *cmd = &(op->ver_op);
 
   if (cc==NULL) cc = &(_ibp_config->cc[IBP_STATUS]);
-  set_hostport(hoststr, sizeof(hoststr), depot->host, depot->port, cc);
 
-  init_ibp_base_op(op, "depot_version", timeout, _ibp_config->new_command, strdup(hoststr), 
+  init_ibp_base_op(op, "depot_version", timeout, _ibp_config->new_command, NULL, 
          _ibp_config->new_command, IBP_STATUS, IBP_ST_VERSION, an, cc);
+  _ibp_op_hostport(op, depot->host, depot->port, cc);
   
   cmd->depot = depot;
   cmd->buffer = buffer;
@@ -2296,14 +3104,13 @@ int query_res_recv(void *gop, NetStream_t *ns)
 void set_ibp_query_resources_op(ibp_op_t *op, ibp_depot_t *depot, ibp_ridlist_t *rlist, int timeout, oplist_app_notify_t *an, ibp_connect_context_t *cc)
 {
 {
-  char hoststr[1024];
   ibp_op_rid_inq_t *cmd = &(op->rid_op);
 
   if (cc==NULL) cc = &(_ibp_config->cc[IBP_STATUS]);
-  set_hostport(hoststr, sizeof(hoststr), depot->host, depot->port, cc);
 
-  init_ibp_base_op(op, "query_resources", timeout, _ibp_config->new_command, strdup(hoststr), 
+  init_ibp_base_op(op, "query_resources", timeout, _ibp_config->new_command, NULL, 
          _ibp_config->new_command, IBP_STATUS, IBP_ST_RES, an, cc);
+  _ibp_op_hostport(op, depot->host, depot->port, cc);
   
   cmd->depot = depot;
   cmd->rlist = rlist;
@@ -39,6 +39,8 @@ oplist_base_op_t *_ibp_get_base_op(void *op);
 void _ibp_op_finalize(void *op);
 void _ibp_op_free(void *op);
 void _ibp_submit_op(oplist_t *oplist, void *op);
+void _ibp_submit_list(oplist_t *oplist);
+void _ibp_coalesce_notify(oplist_t *oplist, void *op);
 void sort_oplist(oplist_t *iolist);
 
 static oplist_implementation_t _ibp_imp = {IBP_OK, IBP_E_GENERIC, NULL, 
@@ -47,7 +49,18 @@ static oplist_implementation_t _ibp_imp = {IBP_OK, IBP_E_GENERIC, NULL,
         _ibp_op_free,
         sort_oplist, 
         NULL,
-        _ibp_submit_op };
+        _ibp_submit_op,
+        _ibp_submit_list };
+
+//** Internal oplist holding the merged reads/writes.  Completing a merged op completes the originals
+static oplist_implementation_t _ibp_coalesce_imp = {IBP_OK, IBP_E_GENERIC, NULL, 
+        _ibp_get_base_op,
+        _ibp_op_finalize,
+        _ibp_op_free,
+        NULL, 
+        _ibp_coalesce_notify,
+        _ibp_submit_op,
+        NULL };
 
 
 //*************************************************************
@@ -75,11 +88,168 @@ void _ibp_op_free(void *op)
 
 void _ibp_submit_op(oplist_t *oplist, void *op)
 {
- log_printf(15, "_ibp_submit_op: hpc=%p hpc->tablle=%p\n", _hpc_config, _hpc_config->table);
+ log_printf(15, "_ibp_submit_op: hpc=%p\n", _hpc_config);
 
   submit_hp_op(_hpc_config, oplist, op);
 }
 
+//*************************************************************
+// compare_rw_ops - Orders reads/writes by depot, cap, and offset
+//*************************************************************
+
+int compare_rw_ops(const void *arg1, const void *arg2)
+{
+  int cmp;
+  ibp_op_t *op1, *op2;
+
+  op1 = *(ibp_op_t **)arg1;
+  op2 = *(ibp_op_t **)arg2;
+
+  cmp = strcmp(op1->hop.hostport, op2->hop.hostport);
+  if (cmp == 0) cmp = strcmp(op1->rw_op.key, op2->rw_op.key);
+  if (cmp == 0) cmp = strcmp(op1->rw_op.typekey, op2->rw_op.typekey);
+  if (cmp == 0) {
+     if (op1->rw_op.offset > op2->rw_op.offset) {
+        cmp = 1;
+     } else if (op1->rw_op.offset < op2->rw_op.offset) {
+        cmp = -1;
+     }
+  }
+
+  return(cmp);
+}
+
+//*************************************************************
+// _ibp_coalesce_notify - Completes the original ops once the
+//    merged op finishes.  If the depot rejected the merged op
+//    the originals are retried individually so only the bad ones fail.
+//*************************************************************
+
+void _ibp_coalesce_notify(oplist_t *oplist, void *op)
+{
+  ibp_op_t *cop = (ibp_op_t *)op;
+  ibp_op_coalesce_t *cmd = &(cop->coalesce_op);
+  int i, status, retry;
+
+  status = ibp_op_status(cop);
+  switch (status) {
+     case IBP_OK:
+     case IBP_E_CLIENT_TIMEOUT:
+     case IBP_E_DEADLINE_EXPIRED:
+     case IBP_E_CONNECTION:
+     case IBP_E_INVALID_HOST:
+     case IBP_E_CANT_CONNECT:
+        retry = 0;
+        break;
+     default:
+        retry = 1;
+  }
+
+  log_printf(15, "_ibp_coalesce_notify: hostport=%s n_ops=%d status=%d retry=%d\n", cop->hop.hostport, cmd->n_ops, status, retry);
+
+  for (i=0; i<cmd->n_ops; i++) {
+     if (retry == 1) {
+        _ibp_submit_op(cmd->oplist, cmd->ops[i]);
+     } else {
+        oplist_mark_completed(cmd->oplist, cmd->ops[i], status);
+     }
+  }
+}
+
+//*************************************************************
+// _ibp_coalesce_ops - Merges runs of ops on the same cap into single
+//    commands and submits them.  The ops should be sorted with
+//    compare_rw_ops().  Reads can touch or overlap but writes have to
+//    be strictly adjacent.
+//*************************************************************
+
+void _ibp_coalesce_ops(oplist_t *oplist, ibp_op_t **ops, int n, int rw_type, oplist_t **coal)
+{
+  ibp_op_t *op, *cop;
+  int i, j, end, max_size;
+
+  max_size = _ibp_config->coalesce_max_size;
+  i = 0;
+  while (i < n) {
+     end = ops[i]->rw_op.offset + ops[i]->rw_op.size;
+     for (j=i+1; j<n; j++) {  //** Hostports are interned so a pointer compare is enough
+        op = ops[j];
+        if (op->hop.hostport != ops[i]->hop.hostport) break;
+        if ((op->rw_op.key != ops[i]->rw_op.key) &&    //** Ops from the same cap handle share the keys
+            ((strcmp(op->rw_op.key, ops[i]->rw_op.key) != 0) || (strcmp(op->rw_op.typekey, ops[i]->rw_op.typekey) != 0))) break;
+        if (op->rw_op.offset > end) break;   //** There's a gap
+        if ((rw_type == IBP_WRITE) && (op->rw_op.offset != end)) break;  //** Overlapping writes
+        if ((op->rw_op.offset + op->rw_op.size) > end) {
+           if ((op->rw_op.offset + op->rw_op.size - ops[i]->rw_op.offset) > max_size) break;
+           end = op->rw_op.offset + op->rw_op.size;
+        }
+     }
+
+     cop = ((j - i) > 1) ? new_ibp_coalesce_op(oplist, rw_type, &(ops[i]), j-i) : NULL;
+     if (cop == NULL) {
+        for (; i<j; i++) _ibp_submit_op(oplist, ops[i]);
+     } else {
+        if (*coal == NULL) *coal = new_oplist(&_ibp_coalesce_imp, NULL);
+        add_oplist(*coal, cop);
+     }
+
+     i = j;
+  }
+}
+
+//*************************************************************
+// _ibp_submit_list - Submits all the tasks.  If enabled, reads or 
+//    writes on the same cap with adjacent ranges are merged into a 
+//    single command.  Everything else is submitted as is.
+//*************************************************************
+
+void _ibp_submit_list(oplist_t *oplist)
+{
+  ibp_op_t **reads, **writes, *op;
+  oplist_t *coal;
+  int i, n, nreads, nwrites, max_size;
+
+  n = stack_size(oplist->list);
+  max_size = _ibp_config->coalesce_max_size;
+  nreads = 0;  nwrites = 0;
+  reads = NULL;  writes = NULL;
+  if (_ibp_config->coalesce_reads == 1) assert((reads = (ibp_op_t **)malloc(sizeof(ibp_op_t *)*n)) != NULL);
+  if (_ibp_config->coalesce_writes == 1) assert((writes = (ibp_op_t **)malloc(sizeof(ibp_op_t *)*n)) != NULL);
+
+  move_to_top(oplist->list);
+  for (i=0; i<n; i++) {
+     op = (ibp_op_t *)get_ele_data(oplist->list);
+     if ((reads != NULL) && (op->primary_cmd == IBP_READ) && (op->rw_op.size < max_size)) {
+        reads[nreads] = op;
+        nreads++;
+     } else if ((writes != NULL) && (op->primary_cmd == IBP_WRITE) && (op->rw_op.size < max_size)) {
+        writes[nwrites] = op;
+        nwrites++;
+     } else {
+        _ibp_submit_op(oplist, op);
+     }
+     move_down(oplist->list);
+  }
+
+  coal = NULL;
+  if (nreads > 0) {
+     qsort((void *)reads, nreads, sizeof(ibp_op_t *), compare_rw_ops);
+     _ibp_coalesce_ops(oplist, reads, nreads, IBP_READ, &coal);
+  }
+  if (nwrites > 0) {
+     qsort((void *)writes, nwrites, sizeof(ibp_op_t *), compare_rw_ops);
+     _ibp_coalesce_ops(oplist, writes, nwrites, IBP_WRITE, &coal);
+  }
+
+  if (reads != NULL) free(reads);
+  if (writes != NULL) free(writes);
+
+  if (coal != NULL) {
+     oplist_start_execution(coal);
+     oplist_finished_submission(coal, OPLIST_AUTO_FREE);
+  }
+}
+
 //*************************************************************
 // init_ibp_oplist - Initializes a task list container
 //*************************************************************
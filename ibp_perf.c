@@ -679,6 +679,7 @@ int main(int argc, char **argv)
   char *ppath;
   phoebus_t pcc;
   char pstr[2048];
+  Hportal_sockpool_stats_t pstats;
 
   base_caps = NULL;
 
@@ -746,6 +747,7 @@ int main(int argc, char **argv)
 
   if (strcmp(argv[i], "-phoebus") == 0) { //** Check if we want Phoebus transfers
      cc = (ibp_connect_context_t *)malloc(sizeof(ibp_connect_context_t));
+     memset(cc, 0, sizeof(ibp_connect_context_t));
      cc->type = NS_TYPE_PHOEBUS;
      i++;
 
@@ -861,6 +863,13 @@ int main(int argc, char **argv)
     printf("Connection Type: SOCKET\n");
   }
   printf("TCP buffer size: %dkb (0 defaults to OS)\n", ibp_get_tcpsize()/1024);
+  if (cc == NULL) {
+     printf("Socket options (ibp_load): %s\n", ns_sockopt_string(&(_ibp_config->cc[IBP_LOAD].sockopt), buffer, sizeof(buffer)));
+     printf("Socket options (ibp_write): %s\n", ns_sockopt_string(&(_ibp_config->cc[IBP_WRITE].sockopt), buffer, sizeof(buffer)));
+  }
+  for (i=0; i<_ibp_config->n_depot_tcpsize; i++) {
+     printf("TCP buffer size override: %s %dkb\n", _ibp_config->depot_tcpsize[i].host, _ibp_config->depot_tcpsize[i].tcpsize/1024);
+  }
   printf("\n");
 
   printf("======= Bulk transfer options =======\n");
@@ -1043,6 +1052,9 @@ printf("-----------------------------\n"); fflush(stdout);
   }  
 
   printf("Final network connection counter: %d\n", network_counter(NULL));
+  ibp_sockpool_stats(&pstats);
+  printf("Idle socket pool: hits=" I64T " misses=" I64T " parked=" I64T " expired=" I64T " evicted=" I64T " dead=" I64T " size=%d\n",
+      pstats.hits, pstats.misses, pstats.puts, pstats.expired, pstats.evicted, pstats.dead, pstats.size);
 
   ibp_finalize();  //** Shutdown IBP
 
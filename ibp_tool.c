@@ -42,10 +42,11 @@ http://www.accre.vanderbilt.edu
 #include "network.h"
 #include "log.h"
 #include "ibp.h"
+#include "dns_cache.h"
 
 #define table_len(t) (sizeof(t) / sizeof(char *))
 
-const char *_ibp_error_map[63];
+const char *_ibp_error_map[IBP_MAX_ERROR];
 const char *_ibp_subcmd_map[45];
 const char *_ibp_st_map[6];
 const char *_ibp_rel_map[3];
@@ -131,6 +132,7 @@ void init_tables()
    _ibp_error_map[-IBP_E_AUTHENTICATION_FAILED] = "IBP_E_AUTHENTICATION_FAILED";
    _ibp_error_map[-IBP_E_INVALID_HOST] = "IBP_E_INVALID_HOST";
    _ibp_error_map[-IBP_E_CANT_CONNECT] = "IBP_E_CANT_CONNECT";
+   _ibp_error_map[-IBP_E_DEADLINE_EXPIRED] = "IBP_E_DEADLINE_EXPIRED";
 
    _ibp_subcmd_map[IBP_PROBE] = "IBP_PROBE";
    _ibp_subcmd_map[IBP_INCR] = "IBP_INCR";
@@ -576,7 +578,8 @@ int cmd_ridlist(ibp_connect_context_t *cc, char **argv, int argc)
 
 int main(int argc, char **argv)
 {
-  int i, tcpsize;
+  int i, tcpsize, dns_stats;
+  DNS_cache_stats_t dstats;
   phoebus_t pcc;
   char *ppath = NULL;
   char **cmd_args;
@@ -586,7 +589,7 @@ int main(int argc, char **argv)
   if (argc < 2) {
      printf("\n");
      printf("ibp_tool -t\n");
-     printf("ibp_tool [-d debug_level] [-config ibp.cfg] [-phoebus ppath] [-tcpsize] -c ibp_command\n");
+     printf("ibp_tool [-d debug_level] [-config ibp.cfg] [-phoebus ppath] [-tcpsize] [-dns_stats] -c ibp_command\n");
      printf("\n");
      printf("-t                  - Print out the various IBP constants table\n");
      printf("-d debug_level      - Enable debug output.  debug_level=0..20\n");
@@ -594,6 +597,7 @@ int main(int argc, char **argv)
      printf("-phoebus            - Use Phoebus protocol for data transfers.\n");
      printf("   gateway_list     - Comma separated List of phoebus hosts/ports, eg gateway1/1234,gateway2/4321\n");
      printf("-tcpsize tcpbufsize - Use this value, in KB, for the TCP send/recv buffer sizes\n");
+     printf("-dns_stats          - Print the DNS cache stats after the command completes\n");
      printf("-c ibp_command      - Execute an ibp_command defined below\n");
      printf("   ibp_allocate host port rid reliability type duration(sec) size(bytes) timeout(sec)\n");
      printf("   ibp_split_allocate master_cap reliability type duration(sec) size(bytes) timeout(sec)\n");
@@ -632,6 +636,7 @@ int main(int argc, char **argv)
 
   if (strcmp(argv[i], "-phoebus") == 0) { //** Check if we want Phoebus transfers
      cc = (ibp_connect_context_t *)malloc(sizeof(ibp_connect_context_t));
+     memset(cc, 0, sizeof(ibp_connect_context_t));
      cc->type = NS_TYPE_PHOEBUS;
      i++;
 
@@ -648,6 +653,11 @@ int main(int argc, char **argv)
      i++;
   }
 
+  dns_stats = 0;
+  if (strcmp(argv[i], "-dns_stats") == 0) { //** Print the DNS cache stats at the end
+     dns_stats = 1;
+     i++;
+  }
 
   if (strcmp(argv[i], "-c") == 0) {
      i++;
@@ -692,6 +702,14 @@ int main(int argc, char **argv)
 
 //  printf("Final network connection counter: %d\n", network_counter(NULL));
 
+  if (dns_stats == 1) {
+     dns_cache_stats(&dstats);
+     printf("DNS cache: hits=" I64T " misses=" I64T " negative_hits=" I64T " size=%d\n", dstats.hits, dstats.misses, dstats.neg_hits, dstats.size);
+     printf("DNS resolver: calls=" I64T " failures=" I64T " refreshes=" I64T " avg_latency=%.3lfms max_latency=%.3lfms\n",
+        dstats.resolves, dstats.failures, dstats.refreshes, 
+        (dstats.resolves > 0) ? dstats.resolve_us / (1000.0 * dstats.resolves) : 0.0, dstats.max_resolve_us / 1000.0);
+  }
+
   ibp_finalize();  //** Shutdown IBP
 
   return(0);
@@ -33,6 +33,7 @@ http://www.accre.vanderbilt.edu
 #include <assert.h>
 #include "ibp.h"
 #include "log.h"
+#include "ibp_misc.h"
 
 //*****************************************************************
 //  new_ibp_depot -Creates a new ibp_depot_t structure
@@ -179,6 +180,41 @@ ibp_cap_t *dup_ibp_cap(ibp_cap_t *src)
   return(strdup(src));
 }
 
+//*****************************************************************
+// new_ibp_cap_handle - Parses the cap into a handle that can be used
+//     to build ops without parsing the cap each time.  Returns NULL 
+//     if the cap can't be parsed.
+//*****************************************************************
+
+ibp_cap_handle_t *new_ibp_cap_handle(ibp_cap_t *cap)
+{
+  ibp_cap_handle_t *ch;
+
+  if (cap == NULL) return(NULL);
+
+  ch = (ibp_cap_handle_t *)malloc(sizeof(ibp_cap_handle_t));
+  assert(ch != NULL);
+
+  if (parse_cap(cap, ch->host, &(ch->port), ch->key, ch->typekey) != 0) {
+     free(ch);
+     return(NULL);
+  }
+  ch->cap = strdup(cap);
+
+  return(ch);
+}
+
+//*****************************************************************
+// destroy_ibp_cap_handle - Destroys the cap handle.  Any ops using it
+//     must be finished.
+//*****************************************************************
+
+void destroy_ibp_cap_handle(ibp_cap_handle_t *ch)
+{
+  free(ch->cap);
+  free(ch);
+}
+
 //===================================================================
 
 //*****************************************************************
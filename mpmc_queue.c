@@ -0,0 +1,160 @@
+/*
+Advanced Computing Center for Research and Education Proprietary License
+Version 1.0 (April 2006)
+
+Copyright (c) 2006, Advanced Computing Center for Research and Education,
+ Vanderbilt University, All rights reserved.
+
+This Work is the sole and exclusive property of the Advanced Computing Center
+for Research and Education department at Vanderbilt University.  No right to
+disclose or otherwise disseminate any of the information contained herein is
+granted by virtue of your possession of this software except in accordance with
+the terms and conditions of a separate License Agreement entered into with
+Vanderbilt University.
+
+THE AUTHOR OR COPYRIGHT HOLDERS PROVIDES THE "WORK" ON AN "AS IS" BASIS,
+WITHOUT WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT
+LIMITED TO THE WARRANTIES OF MERCHANTABILITY, TITLE, FITNESS FOR A PARTICULAR
+PURPOSE, AND NON-INFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+Vanderbilt University
+Advanced Computing Center for Research and Education
+230 Appleton Place
+Nashville, TN 37203
+http://www.accre.vanderbilt.edu
+*/ 
+
+//*************************************************************************
+// mpmc_queue - Bounded lock free multi-producer/multi-consumer FIFO
+//    using apr_atomic.  Based on the classic sequence number per cell
+//    ring buffer.  The CAS on the position counters and the atomic
+//    update of the cell sequence act as the memory barriers protecting
+//    the data pointer.
+//*************************************************************************
+
+#include <stdlib.h>
+#include <assert.h>
+#include <apr_atomic.h>
+#include "mpmc_queue.h"
+
+//*************************************************************************
+// new_mpmc_queue - Creates a new queue.  The size is rounded up to the
+//    next power of 2.
+//*************************************************************************
+
+Mpmc_queue_t *new_mpmc_queue(int size)
+{
+  Mpmc_queue_t *q;
+  apr_uint32_t i, n;
+
+  n = 2;
+  while (n < (apr_uint32_t)size) n = n << 1;
+
+  assert((q = (Mpmc_queue_t *)malloc(sizeof(Mpmc_queue_t))) != NULL);
+  assert((q->cell = (Mpmc_cell_t *)malloc(sizeof(Mpmc_cell_t)*n)) != NULL);
+
+  q->mask = n - 1;
+  for (i=0; i<n; i++) {
+     q->cell[i].seq = i;
+     q->cell[i].data = NULL;
+  }
+
+  q->enqueue_pos = 0;
+  q->dequeue_pos = 0;
+
+  return(q);
+}
+
+//*************************************************************************
+// free_mpmc_queue - Frees the queue.  Any stored data is *not* freed.
+//*************************************************************************
+
+void free_mpmc_queue(Mpmc_queue_t *q)
+{
+  free(q->cell);
+  free(q);
+}
+
+//*************************************************************************
+// mpmc_enqueue - Adds data to the end of the queue.  Returns 0 on success
+//    and 1 if the queue is full.
+//*************************************************************************
+
+int mpmc_enqueue(Mpmc_queue_t *q, void *data)
+{
+  Mpmc_cell_t *cell;
+  apr_uint32_t pos, seq, old;
+  apr_int32_t dif;
+
+  pos = apr_atomic_read32(&(q->enqueue_pos));
+  for (;;) {
+     cell = &(q->cell[pos & q->mask]);
+     seq = apr_atomic_read32(&(cell->seq));
+     dif = (apr_int32_t)(seq - pos);
+     if (dif == 0) {  //** Cell is free so try and claim it
+        old = apr_atomic_cas32(&(q->enqueue_pos), pos+1, pos);
+        if (old == pos) break;
+        pos = old;
+     } else if (dif < 0) {  //** Consumers haven't freed the cell so we're full
+        return(1);
+     } else {  //** Another producer beat us to it
+        pos = apr_atomic_read32(&(q->enqueue_pos));
+     }
+  }
+
+  cell->data = data;
+  apr_atomic_inc32(&(cell->seq));  //** seq = pos+1 flags the cell as full
+
+  return(0);
+}
+
+//*************************************************************************
+// mpmc_dequeue - Removes the item at the front of the queue.  Returns NULL
+//    if the queue is empty.
+//*************************************************************************
+
+void *mpmc_dequeue(Mpmc_queue_t *q)
+{
+  Mpmc_cell_t *cell;
+  apr_uint32_t pos, seq, old;
+  apr_int32_t dif;
+  void *data;
+
+  pos = apr_atomic_read32(&(q->dequeue_pos));
+  for (;;) {
+     cell = &(q->cell[pos & q->mask]);
+     seq = apr_atomic_read32(&(cell->seq));
+     dif = (apr_int32_t)(seq - (pos+1));
+     if (dif == 0) {  //** Cell is full so try and claim it
+        old = apr_atomic_cas32(&(q->dequeue_pos), pos+1, pos);
+        if (old == pos) break;
+        pos = old;
+     } else if (dif < 0) {  //** Nothing there
+        return(NULL);
+     } else {  //** Another consumer beat us to it
+        pos = apr_atomic_read32(&(q->dequeue_pos));
+     }
+  }
+
+  data = cell->data;
+  apr_atomic_add32(&(cell->seq), q->mask);  //** seq = pos + size frees the cell for the next lap
+
+  return(data);
+}
+
+//*************************************************************************
+// mpmc_size - Returns the approximate number of items in the queue
+//*************************************************************************
+
+int mpmc_size(Mpmc_queue_t *q)
+{
+  apr_uint32_t n;
+
+  n = apr_atomic_read32(&(q->enqueue_pos)) - apr_atomic_read32(&(q->dequeue_pos));
+  if (n > q->mask + 1) n = 0;  //** Caught the counters mid update
+
+  return(n);
+}
@@ -0,0 +1,74 @@
+/*
+Advanced Computing Center for Research and Education Proprietary License
+Version 1.0 (April 2006)
+
+Copyright (c) 2006, Advanced Computing Center for Research and Education,
+ Vanderbilt University, All rights reserved.
+
+This Work is the sole and exclusive property of the Advanced Computing Center
+for Research and Education department at Vanderbilt University.  No right to
+disclose or otherwise disseminate any of the information contained herein is
+granted by virtue of your possession of this software except in accordance with
+the terms and conditions of a separate License Agreement entered into with
+Vanderbilt University.
+
+THE AUTHOR OR COPYRIGHT HOLDERS PROVIDES THE "WORK" ON AN "AS IS" BASIS,
+WITHOUT WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT
+LIMITED TO THE WARRANTIES OF MERCHANTABILITY, TITLE, FITNESS FOR A PARTICULAR
+PURPOSE, AND NON-INFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+Vanderbilt University
+Advanced Computing Center for Research and Education
+230 Appleton Place
+Nashville, TN 37203
+http://www.accre.vanderbilt.edu
+*/ 
+
+//*************************************************************************
+// mpmc_queue - Bounded lock free multi-producer/multi-consumer FIFO.
+//    Each cell carries a sequence number which tells producers and
+//    consumers if the cell is free or full for the current lap around
+//    the ring.  The capacity must be a power of 2.
+//*************************************************************************
+
+#ifndef __MPMC_QUEUE_H_
+#define __MPMC_QUEUE_H_
+
+#include <apr_atomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MPMC_PAD 64   //** Keeps the producer and consumer counters on separate cache lines
+
+typedef struct {
+   volatile apr_uint32_t seq;  //** Cell sequence number
+   void * volatile data;       //** Stored pointer
+} Mpmc_cell_t;
+
+typedef struct {
+   char pad0[MPMC_PAD];
+   volatile apr_uint32_t enqueue_pos;   //** Next slot for producers
+   char pad1[MPMC_PAD];
+   volatile apr_uint32_t dequeue_pos;   //** Next slot for consumers
+   char pad2[MPMC_PAD];
+   apr_uint32_t mask;       //** size - 1
+   Mpmc_cell_t *cell;       //** Ring buffer
+} Mpmc_queue_t;
+
+Mpmc_queue_t *new_mpmc_queue(int size);
+void free_mpmc_queue(Mpmc_queue_t *q);
+int mpmc_enqueue(Mpmc_queue_t *q, void *data);
+void *mpmc_dequeue(Mpmc_queue_t *q);
+int mpmc_size(Mpmc_queue_t *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
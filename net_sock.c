@@ -38,8 +38,15 @@ http://www.accre.vanderbilt.edu
 //#include <sys/uio.h>
 //#include <netdb.h>
 //#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
 #include <apr_network_io.h>
 #include <apr_poll.h>
+#include <apr_portable.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
@@ -55,6 +62,10 @@ http://www.accre.vanderbilt.edu
 #include "net_sock.h"
 //#include "net_fd.h"
 
+#define SOCK_CONNECT_MAX DNS_LIST_MAX   //** Max addresses tried for a connect
+
+int _sock_connect_stagger = 250;  //** ms before the next address is raced
+
 //*********************************************************************
 // sock_set_peer - Gets the remote sockets hostname 
 //*********************************************************************
@@ -85,6 +96,18 @@ int sock_status(net_sock_t *nsock)
   return(1);
 }
 
+//*********************************************************************
+//  sock_fd - Returns the APR socket so it can be added to a pollset
+//*********************************************************************
+
+apr_socket_t *sock_fd(net_sock_t *nsock)
+{
+  network_sock_t *sock = (network_sock_t *)nsock;   
+  if (sock == NULL) return(NULL);
+
+  return(sock->fd);
+}
+
 //*********************************************************************
 //  sock_close - Base socket close call
 //*********************************************************************
@@ -97,7 +120,7 @@ int sock_close(net_sock_t *nsock)
 
 //log_printf(15, "sock_close: closing fd=%d\n", sock->fd); 
 
-  apr_socket_close(sock->fd);
+  if (sock->fd != NULL) apr_socket_close(sock->fd);
   if (sock->pollset != NULL) apr_pollset_destroy(sock->pollset);
   apr_pool_destroy(sock->mpool);
 
@@ -128,6 +151,42 @@ long int sock_write(net_sock_t *nsock, const void *buf, size_t count, Net_timeou
   return(nbytes);
 }
 
+//*********************************************************************
+//  sock_writev - Gather write.  If more data is coming the socket is
+//     corked so the pieces go out as full packets.  It's uncorked, which
+//     flushes anything held back, on the last piece.
+//*********************************************************************
+
+long int sock_writev(net_sock_t *nsock, const struct iovec *iov, int iovcnt, int more, Net_timeout_t tm)
+{
+  int err, i;
+  apr_size_t nbytes, total;
+  network_sock_t *sock = (network_sock_t *)nsock;   
+
+  if (sock == NULL) return(-1);   //** If closed return
+
+  if (more != sock->corked) {
+     apr_socket_opt_set(sock->fd, APR_TCP_NOPUSH, more);
+     sock->corked = more;
+  }
+
+  apr_socket_timeout_set(sock->fd, tm);
+  nbytes = 0;
+  err = apr_socket_sendv(sock->fd, iov, iovcnt, &nbytes);
+
+  if (sock->corked == 1) {  //** Don't leave the socket corked if the caller may not come back
+     for (i=0, total=0; i<iovcnt; i++) total += iov[i].iov_len;
+     if ((err != APR_SUCCESS) || (nbytes < total)) {
+        apr_socket_opt_set(sock->fd, APR_TCP_NOPUSH, 0);
+        sock->corked = 0;
+     }
+  }
+
+  if ((err != APR_SUCCESS) && (err != APR_TIMEUP)) nbytes = -1;
+
+  return(nbytes);
+}
+
 //*********************************************************************
 //  sock_read
 //*********************************************************************
@@ -150,28 +209,295 @@ long int sock_read(net_sock_t *nsock, void *buf, size_t count, Net_timeout_t tm)
 }
 
 //*********************************************************************
-// sock_connect - Creates a connection to a remote host
+// sock_readv - Scatter read into several buffers with a single syscall.
+//    APR has no recvv so this works on the OS socket directly.
+//*********************************************************************
+
+long int sock_readv(net_sock_t *nsock, const struct iovec *iov, int iovcnt, Net_timeout_t tm)
+{
+  apr_os_sock_t fd;
+  struct pollfd pfd;
+  long int nbytes;
+  int err;
+  network_sock_t *sock = (network_sock_t *)nsock;   
+
+  if (sock == NULL) return(-1);   //** If closed return
+  if (apr_os_sock_get(&fd, sock->fd) != APR_SUCCESS) return(-1);
+
+  nbytes = readv(fd, iov, iovcnt);
+  if (nbytes > 0) return(nbytes);
+  if (nbytes == 0) return(-1);   //** Remote side closed
+  if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) return(-1);
+
+  //** Nothing there yet so wait for it
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  err = poll(&pfd, 1, (tm < 0) ? -1 : (int)((tm + 999) / 1000));
+  if (err == 0) return(0);    //** Timed out
+  if ((err < 0) && (errno == EINTR)) return(0);
+  if (err < 0) return(-1);
+
+  nbytes = readv(fd, iov, iovcnt);
+  if (nbytes > 0) return(nbytes);
+  if ((nbytes < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) return(0);
+
+  return(-1);
+}
+
+//*********************************************************************
+// sock_apply_options - Applies the extra socket tuning.  The options
+//    APR doesn't know about are set on the OS socket directly.  Failures
+//    are logged and otherwise ignored.
+//*********************************************************************
+
+void sock_apply_options(network_sock_t *sock, apr_socket_t *fd)
+{
+  ns_sockopt_t *opt = &(sock->opt);
+  apr_os_sock_t osfd;
+  int err;
+
+  if (opt->nodelay == 1) apr_socket_opt_set(fd, APR_TCP_NODELAY, 1);
+  if (opt->keepalive == 1) apr_socket_opt_set(fd, APR_SO_KEEPALIVE, 1);
+
+  if (apr_os_sock_get(&osfd, fd) != APR_SUCCESS) return;
+
+  err = 0;
+#ifdef TCP_KEEPIDLE
+  if ((opt->keepalive == 1) && (opt->keepidle > 0)) err |= setsockopt(osfd, IPPROTO_TCP, TCP_KEEPIDLE, &(opt->keepidle), sizeof(int));
+#endif
+#ifdef TCP_KEEPINTVL
+  if ((opt->keepalive == 1) && (opt->keepintvl > 0)) err |= setsockopt(osfd, IPPROTO_TCP, TCP_KEEPINTVL, &(opt->keepintvl), sizeof(int));
+#endif
+#ifdef TCP_KEEPCNT
+  if ((opt->keepalive == 1) && (opt->keepcnt > 0)) err |= setsockopt(osfd, IPPROTO_TCP, TCP_KEEPCNT, &(opt->keepcnt), sizeof(int));
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+  if (opt->notsent_lowat > 0) err |= setsockopt(osfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &(opt->notsent_lowat), sizeof(int));
+#endif
+#ifdef TCP_CONGESTION
+  if (opt->congestion[0] != '\0') err |= setsockopt(osfd, IPPROTO_TCP, TCP_CONGESTION, opt->congestion, strlen(opt->congestion));
+#endif
+
+  if (err != 0) log_printf(1, "sock_apply_options: Failed setting some socket options! errno=%d congestion=%s\n", errno, opt->congestion);
+}
+
+//*********************************************************************
+// sock_set_connect_stagger - Sets how long, in ms, a connect attempt
+//     gets before the next address is tried in parallel
+//*********************************************************************
+
+void sock_set_connect_stagger(int ms) { _sock_connect_stagger = ms; }
+int sock_get_connect_stagger() { return(_sock_connect_stagger); }
+
+//*********************************************************************
+// sock_addr_list - Builds the list of addresses to try for the host.
+//     All the addresses of a multi-homed host are used and the address
+//     families are interleaved, starting with the preferred one.
+//*********************************************************************
+
+int sock_addr_list(network_sock_t *sock, const char *hostname, int port, apr_sockaddr_t **sa_list, int max)
+{
+  char ip_list[DNS_LIST_MAX][DNS_IP_LEN];
+  const char *names[DNS_LIST_MAX];
+  apr_sockaddr_t *found[SOCK_CONNECT_MAX];
+  int used[SOCK_CONNECT_MAX];
+  apr_sockaddr_t *sa;
+  int i, n, n_names, nfound, family;
+
+  n_names = lookup_host_addrs(hostname, ip_list, DNS_LIST_MAX);
+  if (n_names <= 0) {
+     names[0] = hostname;
+     n_names = 1;
+  } else {
+     for (i=0; i<n_names; i++) names[i] = ip_list[i];
+  }
+
+  if (max > SOCK_CONNECT_MAX) max = SOCK_CONNECT_MAX;
+  nfound = 0;
+  for (i=0; (i<n_names) && (nfound<max); i++) {
+     if (apr_sockaddr_info_get(&sa, names[i], APR_UNSPEC, port, 0, sock->mpool) != APR_SUCCESS) continue;
+     for (; (sa != NULL) && (nfound<max); sa = sa->next) {
+        used[nfound] = 0;
+        found[nfound] = sa;
+        nfound++;
+     }
+  }
+
+  if (nfound == 0) return(0);
+
+  //** Alternate the families so a broken IPv6 or IPv4 path only costs one stagger
+  family = found[0]->family;
+  for (n=0; n<nfound; n++) {
+     for (i=0; i<nfound; i++) {
+        if ((used[i] == 0) && (found[i]->family == family)) break;
+     }
+     if (i == nfound) {
+        for (i=0; used[i] == 1; i++) ;
+     }
+     used[i] = 1;
+     sa_list[n] = found[i];
+     family = (found[i]->family == APR_INET6) ? APR_INET : APR_INET6;
+  }
+
+  return(nfound);
+}
+
+//*********************************************************************
+// sock_connect_start - Creates a socket for the address and starts a
+//     nonblocking connect.  Returns APR_SUCCESS if the connection was
+//     made, an EINPROGRESS status if it's pending, or the error.
+//*********************************************************************
+
+int sock_connect_start(network_sock_t *sock, apr_sockaddr_t *sa, apr_socket_t **fd)
+{
+   int err;
+
+   err = apr_socket_create(fd, sa->family, SOCK_STREAM, APR_PROTO_TCP, sock->mpool);
+   if (err != APR_SUCCESS) {
+      *fd = NULL;
+      return(err);
+   }
+
+   if (sock->tcpsize > 0) {
+      apr_socket_opt_set(*fd, APR_SO_SNDBUF, sock->tcpsize);
+      apr_socket_opt_set(*fd, APR_SO_RCVBUF, sock->tcpsize);
+   }
+   sock_apply_options(sock, *fd);
+
+   apr_socket_timeout_set(*fd, 0);
+   err = apr_socket_connect(*fd, sa);
+   if ((err != APR_SUCCESS) && (!APR_STATUS_IS_EINPROGRESS(err))) {
+      apr_socket_close(*fd);
+      *fd = NULL;
+   }
+
+   return(err);
+}
+
+//*********************************************************************
+// sock_connect_race - Connects to the first address that answers.  The
+//     next address is started every stagger ms, or right away if an
+//     attempt fails, and all the attempts run in parallel.  This way a
+//     blackholed address doesn't eat the whole timeout.
+//*********************************************************************
+
+int sock_connect_race(network_sock_t *sock, apr_sockaddr_t **sa_list, int n, Net_timeout_t timeout)
+{
+   apr_socket_t *fd[SOCK_CONNECT_MAX];
+   struct pollfd pfd[SOCK_CONNECT_MAX];
+   int slot[SOCK_CONNECT_MAX];
+   apr_os_sock_t osfd;
+   apr_time_t now, end_time, next_start;
+   socklen_t len;
+   int i, next, npending, winner, err, soerr, dt;
+
+   now = apr_time_now();
+   end_time = now + timeout;
+   next_start = now;
+   next = 0;
+   winner = -1;
+   err = APR_TIMEUP;
+   for (i=0; i<n; i++) fd[i] = NULL;
+
+   while (winner == -1) {
+      //** Start the next address if it's time
+      if ((next < n) && (now >= next_start)) {
+         err = sock_connect_start(sock, sa_list[next], &(fd[next]));
+         if (err == APR_SUCCESS) {
+            winner = next;
+            break;
+         }
+         log_printf(15, "sock_connect_race: started address %d of %d err=%d\n", next, n, err);
+         next_start = (fd[next] == NULL) ? now : now + _sock_connect_stagger*1000;
+         next++;
+      }
+
+      //** Poll the pending attempts
+      npending = 0;
+      for (i=0; i<next; i++) {
+         if (fd[i] == NULL) continue;
+         apr_os_sock_get(&osfd, fd[i]);
+         pfd[npending].fd = osfd;
+         pfd[npending].events = POLLOUT;
+         pfd[npending].revents = 0;
+         slot[npending] = i;
+         npending++;
+      }
+
+      if ((npending == 0) && (next >= n)) break;  //** Everything failed
+      if (now >= end_time) { err = APR_TIMEUP; break; }
+
+      dt = ((next < n) && (next_start < end_time)) ? next_start - now : end_time - now;
+      dt = (dt < 0) ? 0 : dt / 1000;
+      if (npending > 0) {
+         poll(pfd, npending, dt);
+      } else if (dt > 0) {
+         apr_sleep(dt*1000);
+      }
+
+      for (i=0; i<npending; i++) {
+         if (pfd[i].revents == 0) continue;
+
+         soerr = 0; len = sizeof(soerr);
+         getsockopt(pfd[i].fd, SOL_SOCKET, SO_ERROR, &soerr, &len);
+         if (soerr == 0) {
+            winner = slot[i];
+            break;
+         }
+
+         log_printf(10, "sock_connect_race: address %d failed errno=%d\n", slot[i], soerr);
+         apr_socket_close(fd[slot[i]]);
+         fd[slot[i]] = NULL;
+         err = soerr;
+         next_start = now;   //** Start the next one immediately
+      }
+
+      now = apr_time_now();
+   }
+
+   //** Close the losers
+   for (i=0; i<next; i++) {
+      if ((i != winner) && (fd[i] != NULL)) apr_socket_close(fd[i]);
+   }
+
+   if (winner == -1) return((err == APR_SUCCESS) ? APR_TIMEUP : err);
+
+   sock->fd = fd[winner];
+   sock->sa = sa_list[winner];
+   apr_socket_connect(sock->fd, sock->sa);  //** Returns EISCONN but lets APR record the peer
+   apr_socket_timeout_set(sock->fd, timeout);
+
+   return(APR_SUCCESS);
+}
+
+//*********************************************************************
+// sock_connect - Creates a connection to a remote host.  Both IPv4 and
+//     IPv6 are supported.  If the host has several addresses they are
+//     raced with sock_connect_race().
 //*********************************************************************
 
 int sock_connect(net_sock_t *nsock, const char *hostname, int port, Net_timeout_t timeout)
 {  
-   int err;
+   int err, n;
    network_sock_t *sock = (network_sock_t *)nsock;   
+   apr_sockaddr_t *sa_list[SOCK_CONNECT_MAX];
 
    if (sock == NULL) return(-1);   //** If NULL exit
 
    if (sock->fd != NULL) apr_socket_close(sock->fd);
+   sock->fd = NULL;
   
    sock->sa = NULL;
 //log_printf(0, " sock_connect: hostname=%s:%d\n", hostname, port);
-//   err = apr_sockaddr_info_get(&(sock->sa), hostname, APR_INET, port, APR_IPV4_ADDR_OK, sock->mpool);
-   err = apr_sockaddr_info_get(&(sock->sa), hostname, APR_INET, port, 0, sock->mpool);
-//log_printf(0, "sock_connect: apr_sockaddr_info_get: err=%d\n", err);
-//if (sock->sa == NULL) log_printf(0, "sock_connect: apr_sockaddr_info_get: sock->sa == NULL\n");
+   n = sock_addr_list(sock, hostname, port, sa_list, SOCK_CONNECT_MAX);
+   if (n == 0) return(-1);
 
-   if (err != APR_SUCCESS) return(err);
-   
-   err = apr_socket_create(&(sock->fd), APR_INET, SOCK_STREAM, APR_PROTO_TCP, sock->mpool);
+   if (n > 1) return(sock_connect_race(sock, sa_list, n, timeout));
+
+   //** Only 1 address so just do a normal blocking connect
+   sock->sa = sa_list[0];
+   err = apr_socket_create(&(sock->fd), sock->sa->family, SOCK_STREAM, APR_PROTO_TCP, sock->mpool);
 //log_printf(0, "sock_connect: apr_sockcreate: err=%d\n", err);
    if (err != APR_SUCCESS) return(err);
 
@@ -182,6 +508,7 @@ int sock_connect(net_sock_t *nsock, const char *hostname, int port, Net_timeout_
       apr_socket_opt_set(sock->fd, APR_SO_SNDBUF, sock->tcpsize);
       apr_socket_opt_set(sock->fd, APR_SO_RCVBUF, sock->tcpsize);
    }
+   sock_apply_options(sock, sock->fd);
 
    return(apr_socket_connect(sock->fd, sock->sa));
 }
@@ -291,6 +618,17 @@ int sock_listen(net_sock_t *nsock, int max_pending)
 }
 
 
+//*********************************************************************
+// ns_config_sock_opt - Configure the connection to use standard sockets 
+//     with the extra socket tuning in opt
+//*********************************************************************
+
+void ns_config_sock_opt(NetStream_t *ns, int tcpsize, ns_sockopt_t *opt)
+{
+  ns_config_sock(ns, tcpsize);
+  if (opt != NULL) ((network_sock_t *)ns->sock)->opt = *opt;
+}
+
 //*********************************************************************
 // ns_config_sock - Configure the connection to use standard sockets 
 //*********************************************************************
@@ -313,10 +651,13 @@ void ns_config_sock(NetStream_t *ns, int tcpsize)
   sock->tcpsize = tcpsize;
   ns->connect = sock_connect;
   ns->sock_status = sock_status;
+  ns->sock_fd = sock_fd;
   ns->set_peer = sock_set_peer;
   ns->close = sock_close;
   ns->read = sock_read;
+  ns->readv = sock_readv;
   ns->write = sock_write;
+  ns->writev = sock_writev;
   ns->accept = sock_accept;
   ns->bind = sock_bind;
   ns->listen = sock_listen;
@@ -50,6 +50,8 @@ typedef struct {  //** Contains the private raw socket network fields
   apr_pool_t *mpool;
   int tcpsize;
   int state;
+  int corked;     //** TCP_CORK is currently set
+  ns_sockopt_t opt; //** Extra socket tuning applied on connect
 } network_sock_t;
 
 #ifdef __cplusplus
@@ -58,15 +60,21 @@ extern "C" {
 
 void sock_set_peer(net_sock_t *sock, char *address, int add_size);
 int sock_status(net_sock_t *sock);
+apr_socket_t *sock_fd(net_sock_t *sock);
 int sock_close(net_sock_t *sock);
 long int sock_write(net_sock_t *sock, const void *buf, size_t count, Net_timeout_t tm);
+long int sock_writev(net_sock_t *sock, const struct iovec *iov, int iovcnt, int more, Net_timeout_t tm);
 long int sock_read(net_sock_t *sock, void *buf, size_t count, Net_timeout_t tm);
+long int sock_readv(net_sock_t *sock, const struct iovec *iov, int iovcnt, Net_timeout_t tm);
 int sock_connect(net_sock_t *sock, const char *hostname, int port, Net_timeout_t timeout);
+void sock_set_connect_stagger(int ms);
+int sock_get_connect_stagger();
 int sock_connection_request(net_sock_t *nsock, int timeout);
 net_sock_t *sock_accept(net_sock_t *nsock);
 int sock_bind(net_sock_t *nsock, char *address, int port);
 int sock_listen(net_sock_t *nsock, int max_pending);
 void ns_config_sock(NetStream_t *ns, int tcpsize);
+void ns_config_sock_opt(NetStream_t *ns, int tcpsize, ns_sockopt_t *opt);
 
 #ifdef __cplusplus
 }
@@ -37,6 +37,8 @@ http://www.accre.vanderbilt.edu
 #include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <apr_portable.h>
 #include "network.h"
 #include "debug.h"
 #include "log.h"
@@ -49,6 +51,7 @@ http://www.accre.vanderbilt.edu
 #include "net_phoebus.h"
 
 int tcp_bufsize = 0;   //** 0 means use the default TCP buffer sizes for the OS
+int ns_bufsize = NS_BUFSIZE_DEFAULT;  //** Default size of each NS receive ring buffer
 
 //*** These are used for counters to track connections
 int _cuid_counter = 0;
@@ -84,6 +87,43 @@ int ns_generate_id() {
 void set_network_tcpsize(int tcpsize)  { tcp_bufsize = tcpsize; }
 int get_network_tcpsize(int tcpsize)  { return(tcp_bufsize); }
 
+//*********************************************************************
+// _ns_bufsize_clamp - Forces the ring buffer size into the allowed range
+//*********************************************************************
+
+int _ns_bufsize_clamp(int bufsize)
+{
+  if (bufsize < N_BUFSIZE) bufsize = N_BUFSIZE;
+  if (bufsize > NS_BUFSIZE_MAX) bufsize = NS_BUFSIZE_MAX;
+  return(bufsize);
+}
+
+//*********************************************************************
+// set/get_network_bufsize - Sets/gets the default receive ring buffer
+//     size used for new connections
+//*********************************************************************
+
+void set_network_bufsize(int bufsize)  { ns_bufsize = _ns_bufsize_clamp(bufsize); }
+int get_network_bufsize()  { return(ns_bufsize); }
+
+//*********************************************************************
+// ns_sockopt_string - Prints the socket options that are set
+//*********************************************************************
+
+char *ns_sockopt_string(ns_sockopt_t *opt, char *buffer, int size)
+{
+  int n;
+
+  n = snprintf(buffer, size, "nodelay=%d keepalive=%d", opt->nodelay, opt->keepalive);
+  if ((opt->keepalive == 1) && (n < size)) {
+     n += snprintf(&(buffer[n]), size-n, " (idle=%ds intvl=%ds cnt=%d)", opt->keepidle, opt->keepintvl, opt->keepcnt);
+  }
+  if (n < size) n += snprintf(&(buffer[n]), size-n, " notsent_lowat=%d", opt->notsent_lowat);
+  if (n < size) snprintf(&(buffer[n]), size-n, " congestion=%s", (opt->congestion[0] == '\0') ? "OS default" : opt->congestion);
+
+  return(buffer);
+}
+
 //*********************************************************************
 //  connection_is_pending - Returns if a new connection is needed
 //*********************************************************************
@@ -192,16 +232,19 @@ void _ns_init(NetStream_t *ns, int incid)
   ns->sock = NULL;
   ns->close = NULL;
   ns->read = NULL;
+  ns->readv = NULL;
   ns->write = NULL;
+  ns->writev = NULL;
   ns->sock_status = NULL;
   ns->set_peer = NULL;
   ns->connect = NULL;
+  ns->sock_fd = NULL;
   ns->nm = NULL;
 
   ns->last_read = time(NULL);
   ns->last_write = time(NULL);
   ns->start = 0;
-  ns->end = -1;
+  ns->used = 0;
   memset(ns->peer_address, 0, sizeof(ns->peer_address));
 
   if (incid == 1)  ns->id = ns_generate_id();
@@ -224,20 +267,28 @@ void ns_init(NetStream_t *ns)
 // ns_clone - Clones the ns settings from one ns to another.
 //     The sock is also copied but it can lead to problems if
 //     not used properly.  Normally this field should be set to NULL
+//     The destination keeps its own locks and ring buffer.
 //*********************************************************************
 
 void ns_clone(NetStream_t *dest_ns, NetStream_t *src_ns)
 {
   apr_thread_mutex_t *rl, *wl;
+  char *buffer, *wbuffer;
+  int bufsize;
 
-   //** Need to preserve the locks   
+   //** Need to preserve the locks and buffers
    rl = dest_ns->read_lock; wl = dest_ns->write_lock;
+   buffer = dest_ns->buffer; bufsize = dest_ns->bufsize;
+   wbuffer = dest_ns->wbuffer;
 
    lock_ns(src_ns);
    memcpy(dest_ns, src_ns, sizeof(NetStream_t));
    unlock_ns(src_ns);
 
    dest_ns->read_lock = rl; dest_ns->write_lock = wl;
+   dest_ns->buffer = buffer; dest_ns->bufsize = bufsize;
+   dest_ns->start = 0; dest_ns->used = 0;
+   dest_ns->wbuffer = wbuffer; dest_ns->wused = 0; dest_ns->batch = 0;
 }
 
 //*********************************************************************
@@ -504,6 +555,8 @@ void teardown_netstream(NetStream_t *ns)
 void destroy_netstream(NetStream_t *ns)
 {
   teardown_netstream(ns);
+  free(ns->buffer);
+  if (ns->wbuffer != NULL) free(ns->wbuffer);
   free(ns);
 }
 
@@ -526,7 +579,13 @@ NetStream_t *new_netstream()
 
   apr_thread_mutex_create(&(ns->read_lock), APR_THREAD_MUTEX_DEFAULT,_net_pool);
   apr_thread_mutex_create(&(ns->write_lock), APR_THREAD_MUTEX_DEFAULT,_net_pool);
- 
+
+  ns->bufsize = ns_bufsize;
+  assert((ns->buffer = (char *)malloc(ns->bufsize)) != NULL);
+  ns->wbuffer = NULL;   //** Only allocated if batching is used
+  ns->wused = 0;
+  ns->batch = 0;
+
   _ns_init(ns, 0);
   ns->id = ns->cuid = -1;
 
@@ -565,13 +624,61 @@ void network_destroy(Network_t *net)
   free(net);
 }
 
-//********************************************************************* 
+//*********************************************************************
+// _ns_write - Sends the data along with anything held in the batch 
+//    buffer.  The held data always goes first.  Returns the number of
+//    the caller's bytes sent which is 0 if only held data went out.
+//    The write lock should be held.
+//*********************************************************************
+
+int _ns_write(NetStream_t *ns, struct iovec *iov, int iovcnt, int more, Net_timeout_t timeout)
+{
+   struct iovec sviov[16], *viov;
+   int i, n, nbytes;
+
+   if (ns->wused == 0) {
+      if (ns->writev != NULL) return(ns->writev(ns->sock, iov, iovcnt, more, timeout));
+      return(ns->write(ns->sock, iov[0].iov_base, iov[0].iov_len, timeout));
+   }
+
+   //** Prepend the held data
+   viov = sviov;
+   n = 1;
+   if (ns->writev != NULL) {
+      if (iovcnt >= 16) {  //** Too big for the stack copy
+         assert((viov = (struct iovec *)malloc(sizeof(struct iovec)*(iovcnt+1))) != NULL);
+      }
+      viov[0].iov_base = ns->wbuffer;
+      viov[0].iov_len = ns->wused;
+      for (i=0; i<iovcnt; i++) viov[n++] = iov[i];
+      nbytes = ns->writev(ns->sock, viov, n, more, timeout);
+      if (viov != sviov) free(viov);
+   } else {
+      nbytes = ns->write(ns->sock, ns->wbuffer, ns->wused, timeout);
+   }
+
+   if (nbytes < 0) return(nbytes);
+
+   if (nbytes < ns->wused) {  //** Didn't even get the held data out
+      memmove(ns->wbuffer, &(ns->wbuffer[nbytes]), ns->wused - nbytes);
+      ns->wused = ns->wused - nbytes;
+      return(0);
+   }
+
+   nbytes = nbytes - ns->wused;
+   ns->wused = 0;
+   return(nbytes);
+}
+
+//*********************************************************************
 // write_netstream - Writes characters to the stream with a max wait
-//********************************************************************* 
+//    If batching is enabled small writes are held until ns_batch_end()
+//*********************************************************************
 
 int write_netstream(NetStream_t *ns, const char *buffer, int bsize, Net_timeout_t timeout)
 {
    int total_bytes;
+   struct iovec iov;
    
    lock_write_ns(ns);
 
@@ -586,8 +693,17 @@ int write_netstream(NetStream_t *ns, const char *buffer, int bsize, Net_timeout_
       unlock_write_ns(ns);
       return(0); 
    }
-  
-   total_bytes = ns->write(ns->sock, (void *)buffer, bsize, timeout);
+
+   if ((ns->batch == 1) && (ns->wused + bsize <= NS_WBUFSIZE)) {  //** Hold it for the batch
+      memcpy(&(ns->wbuffer[ns->wused]), buffer, bsize);
+      ns->wused = ns->wused + bsize;
+      unlock_write_ns(ns);
+      return(bsize);
+   }
+
+   iov.iov_base = (void *)buffer;
+   iov.iov_len = bsize;
+   total_bytes = _ns_write(ns, &iov, 1, 0, timeout);
 
    if (total_bytes == -1) {
       log_printf(10, "write_netstream:  Dead connection! ns=%d\n", ns_getid(ns));
@@ -600,6 +716,133 @@ int write_netstream(NetStream_t *ns, const char *buffer, int bsize, Net_timeout_
    return(total_bytes); 
 }
 
+//*********************************************************************
+// writev_netstream - Sends several buffers with a single call.  If more
+//    is set the caller has more data coming so the stream can hold back
+//    a partial packet.  Streams without a gather write just send the 
+//    first buffer.  Small writes are held if batching is enabled.
+//*********************************************************************
+
+int writev_netstream(NetStream_t *ns, struct iovec *iov, int iovcnt, int more, Net_timeout_t timeout)
+{
+   int total_bytes, i;
+
+   lock_write_ns(ns);
+
+   if (ns->sock_status(ns->sock) != 1) {
+      log_printf(15, "writev_netstream: Dead connection!  ns=%d\n", ns->id);
+      unlock_write_ns(ns);
+      return(-1);
+   }
+
+   if (iovcnt == 0) {
+      unlock_write_ns(ns);
+      return(0);
+   }
+
+   if (ns->batch == 1) {  //** See if it all fits in the batch buffer
+      for (i=0, total_bytes=0; i<iovcnt; i++) total_bytes += iov[i].iov_len;
+      if (ns->wused + total_bytes <= NS_WBUFSIZE) {
+         for (i=0; i<iovcnt; i++) {
+            memcpy(&(ns->wbuffer[ns->wused]), iov[i].iov_base, iov[i].iov_len);
+            ns->wused = ns->wused + iov[i].iov_len;
+         }
+         unlock_write_ns(ns);
+         return(total_bytes);
+      }
+   }
+
+   total_bytes = _ns_write(ns, iov, iovcnt, more, timeout);
+
+   if (total_bytes == -1) {
+      log_printf(10, "writev_netstream:  Dead connection! ns=%d\n", ns_getid(ns));
+   }
+
+   ns->last_write = time(NULL);
+
+   unlock_write_ns(ns);
+
+   return(total_bytes);
+}
+
+//*********************************************************************
+// hp_time_now - Returns the current monotonic time in ns
+//*********************************************************************
+
+hp_time_t hp_time_now()
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return((hp_time_t)ts.tv_sec * HP_NS_PER_SEC + ts.tv_nsec);
+}
+
+//*********************************************************************
+// ns_batch_begin - Starts batching small writes.  They're held in a
+//    buffer and sent with the next large write or by ns_batch_end()
+//*********************************************************************
+
+void ns_batch_begin(NetStream_t *ns)
+{
+   lock_write_ns(ns);
+   if (ns->wbuffer == NULL) assert((ns->wbuffer = (char *)malloc(NS_WBUFSIZE)) != NULL);
+   ns->batch = 1;
+   unlock_write_ns(ns);
+}
+
+//*********************************************************************
+// ns_batch_end - Stops batching and flushes any held writes.  Blocks 
+//    until they're sent or end_time, a hp_time_now() deadline, is
+//    reached.  Returns NS_OK, NS_TIMEOUT, or NS_SOCKET.  On failure the
+//    held data is dropped.
+//*********************************************************************
+
+int ns_batch_end(NetStream_t *ns, hp_time_t end_time)
+{
+   int nbytes, err;
+   Net_timeout_t dt;
+   hp_time_t now;
+
+   err = NS_OK;
+   now = hp_time_now();
+
+   lock_write_ns(ns);
+   ns->batch = 0;
+   log_printf(15, "ns_batch_end: ns=%d wused=%d\n", ns->id, ns->wused);
+   while ((ns->wused > 0) && (err == NS_OK)) {
+      if (ns->sock_status(ns->sock) != 1) {
+         err = NS_SOCKET;
+         break;
+      }
+
+      dt = (end_time - now) / 1000;  //** Net timeouts are in usec
+      if (dt > 1000000) dt = 1000000;
+      if (dt < 1) dt = 1;
+      nbytes = ns->write(ns->sock, ns->wbuffer, ns->wused, dt);
+      if (nbytes < 0) {
+         err = NS_SOCKET;
+      } else if (nbytes > 0) {
+         memmove(ns->wbuffer, &(ns->wbuffer[nbytes]), ns->wused - nbytes);
+         ns->wused = ns->wused - nbytes;
+      }
+
+      if ((ns->wused > 0) && (err == NS_OK)) {  //** Short write so check the clock
+         now = hp_time_now();
+         if (now > end_time) err = NS_TIMEOUT;
+      }
+   }
+
+   if (err != NS_OK) {
+      log_printf(10, "ns_batch_end: ns=%d Error flushing batch! err=%d wused=%d\n", ns->id, err, ns->wused);
+      ns->wused = 0;
+   }
+
+   ns->last_write = time(NULL);
+   unlock_write_ns(ns);
+
+   return(err);
+}
+
 //********************************************************************* 
 //  write_netstream_block - Same as write_netstream but blocks until the
 //     data is sent or end_time is reached
@@ -725,13 +968,117 @@ int scan_and_copy_stream(char *inbuf, int insize, char *outbuf, int outsize, int
    return(nbytes+1);
 }
 
+//*********************************************************************
+// _ns_ring_copy - Copies up to size bytes out of the ring buffer and
+//     removes them from the ring.  Returns the number of bytes copied.
+//     The read lock should be held.
+//*********************************************************************
+
+int _ns_ring_copy(NetStream_t *ns, char *buffer, int size)
+{
+  int n, nleft;
+
+  if (size > ns->used) size = ns->used;
+  if (size <= 0) return(0);
+
+  n = ns->bufsize - ns->start;   //** Contiguous piece before the wrap
+  if (n > size) n = size;
+  memcpy(buffer, &(ns->buffer[ns->start]), n);
+  nleft = size - n;
+  if (nleft > 0) memcpy(&(buffer[n]), ns->buffer, nleft);
+
+  ns->start = (ns->start + size) % ns->bufsize;
+  ns->used = ns->used - size;
+  if (ns->used == 0) ns->start = 0;
+
+  return(size);
+}
+
+//*********************************************************************
+// _ns_ring_fill - Pulls as much data as is available off the socket into
+//     the free space of the ring buffer with a single read.  Returns the
+//     bytes read or -1 on error.  The read lock should be held.
+//*********************************************************************
+
+int _ns_ring_fill(NetStream_t *ns, Net_timeout_t timeout)
+{
+  int pos, n, nbytes;
+
+  if (ns->used == 0) ns->start = 0;
+  if (ns->used >= ns->bufsize) return(0);   //** No room
+
+  pos = (ns->start + ns->used) % ns->bufsize;
+  n = (pos < ns->start) ? ns->start - pos : ns->bufsize - pos;
+
+  nbytes = ns->read(ns->sock, (void *)&(ns->buffer[pos]), n, timeout);
+  if (nbytes > 0) ns->used = ns->used + nbytes;
+
+  return(nbytes);
+}
+
+//*********************************************************************
+// _ns_ring_scanline - Copies characters from the ring buffer until a
+//     '\r' or '\n' is found or the output buffer is full.  The read lock
+//     should be held.
+//*********************************************************************
+
+int _ns_ring_scanline(NetStream_t *ns, char *buffer, int size, int *finished)
+{
+  int n, nbytes;
+
+  *finished = 0;
+  if (ns->used == 0) return(0);
+
+  //** Scan the contiguous piece up to the wrap
+  n = ns->bufsize - ns->start;
+  if (n > ns->used) n = ns->used;
+  nbytes = scan_and_copy_stream(&(ns->buffer[ns->start]), n, buffer, size, finished);
+
+  //** and then the wrapped piece if needed
+  if ((*finished == 0) && (nbytes == n) && (ns->used > n)) {
+     nbytes += scan_and_copy_stream(ns->buffer, ns->used - n, &(buffer[nbytes]), size - nbytes, finished);
+  }
+
+  ns->start = (ns->start + nbytes) % ns->bufsize;
+  ns->used = ns->used - nbytes;
+  if (ns->used == 0) ns->start = 0;
+
+  return(nbytes);
+}
+
+//*********************************************************************
+// ns_set_bufsize - Resizes the receive ring buffer preserving any
+//     buffered data
+//*********************************************************************
+
+void ns_set_bufsize(NetStream_t *ns, int bufsize)
+{
+  char *buf;
+
+  bufsize = _ns_bufsize_clamp(bufsize);
+
+  lock_read_ns(ns);
+  if (bufsize < ns->used) bufsize = ns->used;  //** Don't drop any data
+  if (bufsize != ns->bufsize) {
+     assert((buf = (char *)malloc(bufsize)) != NULL);
+     ns->used = _ns_ring_copy(ns, buf, ns->used);
+     free(ns->buffer);
+     ns->buffer = buf;
+     ns->bufsize = bufsize;
+     ns->start = 0;
+  }
+  unlock_read_ns(ns);
+}
+
 //********************************************************************* 
-// read_netstream - Reads characters fomr the stream with a max wait
+// read_netstream - Reads characters fomr the stream with a max wait.
+//    Buffered data is returned first.  Otherwise small reads refill the
+//    ring buffer and large reads go directly into the caller's buffer.
 //********************************************************************* 
 
 int read_netstream(NetStream_t *ns, char *buffer, int size, Net_timeout_t timeout)
 {
-   int total_bytes, i;
+   int total_bytes;
 
    if (size == 0) return(0);
 
@@ -746,20 +1093,13 @@ int read_netstream(NetStream_t *ns, char *buffer, int size, Net_timeout_t timeou
    total_bytes = 0;
 
    //*** 1st grab anything currently in the network buffer ***
-   if (ns->end >= ns->start) {
-       i = ns->end - ns->start + 1;
-       if (i>size) {
-          total_bytes = size;
-          memcpy(buffer, &(ns->buffer[ns->start]), size);
-          ns->start = ns->start + total_bytes;
-       } else {
-          total_bytes = i;
-          memcpy(buffer, &(ns->buffer[ns->start]), i);
-          ns->start = 0;
-          ns->end = -1;
-       }
-   } else {  //*** Now grab some data off the network port ****
+   if (ns->used > 0) {
+      total_bytes = _ns_ring_copy(ns, buffer, size);
+   } else if (size >= ns->bufsize) {  //*** Big read so skip the extra copy ****
       total_bytes = ns->read(ns->sock, (void *)buffer, size, timeout);
+   } else {  //*** Refill the ring and hand back what was asked for ****
+      total_bytes = _ns_ring_fill(ns, timeout);
+      if (total_bytes > 0) total_bytes = _ns_ring_copy(ns, buffer, size);
    }
 
    debug_code(  
@@ -781,6 +1121,49 @@ int read_netstream(NetStream_t *ns, char *buffer, int size, Net_timeout_t timeou
    return(total_bytes);
 }
 
+//*********************************************************************
+// readv_netstream - Reads directly into the caller's buffers.  Any
+//    bytes already sitting in the ring buffer are handed off first.
+//    Otherwise the data is pulled off the socket straight into the
+//    iovec without going through the ring.  Returns the number of bytes
+//    read, 0 on timeout, or -1 if the connection is dead.
+//*********************************************************************
+
+int readv_netstream(NetStream_t *ns, struct iovec *iov, int iovcnt, Net_timeout_t timeout)
+{
+   int total_bytes, i, n;
+
+   if (iovcnt == 0) return(0);
+
+   lock_read_ns(ns);
+
+   if (ns->sock_status(ns->sock) != 1) {
+      log_printf(15, "readv_netstream: Dead connection!  ns=%d\n", ns->id);
+      unlock_read_ns(ns);
+      return(-1);
+   }
+
+   total_bytes = 0;
+   if (ns->used > 0) {  //** Leftover from parsing the response line
+      for (i=0; (i<iovcnt) && (ns->used > 0); i++) {
+         n = _ns_ring_copy(ns, (char *)iov[i].iov_base, iov[i].iov_len);
+         total_bytes += n;
+      }
+   } else if ((ns->readv != NULL) && (iovcnt > 1)) {
+      total_bytes = ns->readv(ns->sock, iov, iovcnt, timeout);
+   } else {
+      total_bytes = ns->read(ns->sock, iov[0].iov_base, iov[0].iov_len, timeout);
+   }
+
+   if (total_bytes < 0) log_printf(10, "readv_netstream:  Dead connection! ns=%d\n", ns_getid(ns));
+
+   ns->last_read = time(NULL);
+
+   unlock_read_ns(ns);
+
+   return(total_bytes);
+}
+
 //*********************************************************************
 // readline_netstream_raw - Performs an attempt to read a complete line
 //    if it fails it returns the partial read
@@ -788,84 +1171,48 @@ int read_netstream(NetStream_t *ns, char *buffer, int size, Net_timeout_t timeou
 
 int readline_netstream_raw(NetStream_t *ns, char *buffer, int bsize, Net_timeout_t timeout, int *status)
 {
-   int nbytes, total_bytes, i;
+   int nbytes, total_bytes;
    int size = bsize - 1;
    int finished = 0;
 
    *status = 0;
 
    //*** 1st grab anything currently in the network buffer ***
-   total_bytes = 0;
    lock_read_ns(ns);
-   i = ns->end - ns->start + 1;
-   debug_printf(15, "readline_netstream_raw: ns=%d buffer pos start=%d end=%d\n", ns->id, ns->start, ns->end);
-   if (i > 0) {
-       total_bytes = scan_and_copy_stream(&(ns->buffer[ns->start]), i, buffer, size, &finished);
-       ns->start = ns->start + total_bytes;
-       if (ns->start > ns->end) {
-          ns->start = 0;
-          ns->end = -1;
-       }
-  
-       if (finished == 1) {
-          *status = 1;
-          total_bytes--;
-          buffer[total_bytes] = '\0';   //** Make sure and NULL terminate the string remove the \n
-          debug_printf(15, "readline_stream_raw: BUFFER ns=%d Command : %s * nbytes=%d\n", ns->id, buffer,total_bytes); flush_debug();
-          unlock_read_ns(ns);
-          return(total_bytes);
-       }
-   }
-   unlock_read_ns(ns);
+   debug_printf(15, "readline_netstream_raw: ns=%d buffer pos start=%d used=%d\n", ns->id, ns->start, ns->used);
+   total_bytes = _ns_ring_scanline(ns, buffer, size, &finished);
 
-   //*** Now grab the data off the network port ****
+   //*** Now refill the ring off the network port and try again ****
    nbytes = 0;
-   if (finished == 0) {
-      nbytes = read_netstream(ns, ns->buffer, N_BUFSIZE, timeout);  //**there should be 0 bytes in buffer now
-      debug_printf(15, "readline_netstream_raw: ns=%d Command : !", ns->id);
-      for (i=0; i< nbytes; i++) debug_printf(15, "%c", ns->buffer[i]);
-      debug_printf(15, "! * nbytes =%d\n", nbytes); flush_debug();
+   if ((finished == 0) && (total_bytes < size)) {
+      if (ns->sock_status(ns->sock) != 1) {
+         nbytes = -1;
+      } else {
+         nbytes = _ns_ring_fill(ns, timeout);
+         ns->last_read = time(NULL);
+      }
+      debug_printf(15, "readline_netstream_raw: ns=%d filled nbytes=%d used=%d\n", ns->id, nbytes, ns->used);
 
       if (nbytes > 0) {
-         lock_read_ns(ns);
-         i = scan_and_copy_stream(ns->buffer, nbytes, &(buffer[total_bytes]), size-total_bytes, &finished);
-         unlock_read_ns(ns);
-         total_bytes += i;
+         total_bytes += _ns_ring_scanline(ns, &(buffer[total_bytes]), size-total_bytes, &finished);
       }
    }
-  
+   unlock_read_ns(ns);
+
    buffer[total_bytes] = '\0';   //** Make sure and NULL terminate the string
 
-   if (finished == 1) {  //*** Push the unprocessed characters back onto the stream buffer ****
+   if (finished == 1) {
       *status = 1;
       total_bytes--;
       buffer[total_bytes] = '\0';   //** Make sure and NULL terminate the string remove the \n
-      lock_read_ns(ns);
-      ns->start = i;
-      ns->end = nbytes-1;
-      if (ns->start > ns->end) {
-         ns->start = 0;
-         ns->end = -1;
-      }
-      unlock_read_ns(ns);
-
       debug_printf(15, "readline_stream_raw: ns=%d Command : %s * nbytes=%d\n", ns->id, buffer,total_bytes); flush_debug();
-   } else if (nbytes == -1) {  //** Socket error
+   } else if (nbytes < 0) {  //** Socket error
       *status = -1;
       debug_printf(15, "readline_stream_raw: Socket error! ns=%d nbytes=%d  buffer=%s\n", ns->id, total_bytes, buffer); flush_debug();
       return(0);
    } else {       //*** Not enough space in input buffer
       *status = 0;
-      lock_read_ns(ns);
-      ns->start = i;
-      ns->end = nbytes-1;
-      if (ns->start > ns->end) {
-         ns->start = 0;
-         ns->end = -1;
-      }
-      unlock_read_ns(ns);
       debug_printf(15, "readline_stream_raw: Out of buffer space or nothing read! ns=%d nbytes=%d  buffer=%s\n", ns->id, total_bytes, buffer); flush_debug();
-//      return(-1);   //**Force the socket to be closed
    }         
 
    return(total_bytes);
@@ -889,6 +1236,78 @@ int readline_netstream(NetStream_t *ns, char *buffer, int bsize, Net_timeout_t t
   return(n);
 }
 
+//*********************************************************************
+// ns_read_pending - Returns the number of bytes already buffered and
+//    waiting to be read
+//*********************************************************************
+
+int ns_read_pending(NetStream_t *ns)
+{
+  int n;
+
+  lock_read_ns(ns);
+  n = ns->used;
+  unlock_read_ns(ns);
+
+  if (n < 0) n = 0;
+
+  return(n);
+}
+
+//*********************************************************************
+// ns_poll_fd - Returns the underlying APR socket for use with a pollset
+//    or NULL if the connection type can't be polled
+//*********************************************************************
+
+apr_socket_t *ns_poll_fd(NetStream_t *ns)
+{
+  if ((ns->sock == NULL) || (ns->sock_fd == NULL)) return(NULL);
+
+  return(ns->sock_fd(ns->sock));
+}
+
+//*********************************************************************
+// ns_idle_ok - Returns 1 if the idle connection can be reused.  Nothing
+//    should be buffered and the socket shouldn't be readable since that
+//    means the peer closed it or sent something unexpected.  Connections
+//    that can't be polled are never reused.
+//*********************************************************************
+
+int ns_idle_ok(NetStream_t *ns)
+{
+  apr_socket_t *fd;
+  apr_os_sock_t osfd;
+  struct pollfd pfd;
+
+  if ((ns->sock == NULL) || (ns_read_pending(ns) > 0)) return(0);
+
+  fd = ns_poll_fd(ns);
+  if (fd == NULL) return(0);
+  if (apr_os_sock_get(&osfd, fd) != APR_SUCCESS) return(0);
+
+  pfd.fd = osfd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  if (poll(&pfd, 1, 0) != 0) return(0);
+
+  return(1);
+}
+
+//*********************************************************************
+// ns_move - Moves the connection from src_ns to dest_ns.  src_ns is 
+//    left unconnected, so closing it is a no-op, but it keeps its 
+//    locks and buffers.
+//*********************************************************************
+
+void ns_move(NetStream_t *dest_ns, NetStream_t *src_ns)
+{
+  ns_clone(dest_ns, src_ns);
+
+  lock_ns(src_ns);
+  _ns_init(src_ns, 0);
+  unlock_ns(src_ns);
+}
+
 //*********************************************************************
 //  accept_pending_connection - Accepts a pending connection and stores
 //    it in the provided ns.  The ns should be uninitialize, ie closed
@@ -35,6 +35,11 @@ http://www.accre.vanderbilt.edu
 
 #define N_BUFSIZE  1024
 
+#define NS_BUFSIZE_DEFAULT  65536     //** Default size of the receive ring buffer
+#define NS_BUFSIZE_MAX      1048576   //** Max size allowed for the receive ring buffer
+#define NS_WBUFSIZE         16384     //** Size of the send side batching buffer
+
+#include <sys/uio.h>
 #include <apr_network_io.h>
 #include <apr_thread_proc.h>
 #include <apr_thread_mutex.h>
@@ -74,27 +79,47 @@ extern "C" {
 
 typedef apr_interval_time_t Net_timeout_t;
 
+typedef int64_t hp_time_t;  //** Monotonic time in ns.  Used for all op deadlines
+#define HP_NS_PER_MS  1000000LL
+#define HP_NS_PER_SEC 1000000000LL
+
 typedef void net_sock_t;
 
+typedef struct {         //** Optional socket tuning.  0 or empty leaves the OS default alone
+   int nodelay;          //** 1 = Disable Nagle's algorithm (TCP_NODELAY)
+   int keepalive;        //** 1 = Send keepalive probes on idle connections
+   int keepidle;         //** Idle secs before the 1st keepalive probe
+   int keepintvl;        //** Secs between keepalive probes
+   int keepcnt;          //** Unanswered probes before the connection is dropped
+   int notsent_lowat;    //** Max unsent bytes queued in the kernel (TCP_NOTSENT_LOWAT)
+   char congestion[32];  //** Congestion control algorithm (TCP_CONGESTION), eg cubic or bbr
+} ns_sockopt_t;
+
 struct ns_monitor_s;   //** Forward declaration
 
 typedef struct {
    int id;                  //ID for tracking purposes
    int cuid;                //Unique ID for the connection.  Changes each time the connection is open/closed
-   int start;               //Starting position of buffer data
-   int end;                 //End position of buffer data
+   int start;               //Starting position of buffer data in the ring
+   int used;                //Number of bytes currently buffered
+   int bufsize;             //Size of the ring buffer
    int sock_type;           //Socket type
    net_sock_t *sock;        //Private socket data.  Depends on socket type
    time_t last_read;        //Last time this connection was used
    time_t last_write;        //Last time this connection was used
-   char buffer[N_BUFSIZE];  //intermediate buffer for the conection
+   char *buffer;            //intermediate ring buffer for the conection
+   char *wbuffer;           //Send side buffer used to batch small writes
+   int wused;               //Bytes waiting in wbuffer
+   int batch;               //Small writes are being batched
    apr_thread_mutex_t *read_lock;    //Read lock
    apr_thread_mutex_t *write_lock;   //Write lock
    char peer_address[128];
    struct ns_monitor_s *nm;      //THis is only used for an accept call to tell which bind was accepted
    int (*close)(net_sock_t *sock);  //** Close socket
    long int(*write)(net_sock_t *sock, const void *buf, size_t count, Net_timeout_t tm);
+   long int (*writev)(net_sock_t *sock, const struct iovec *iov, int iovcnt, int more, Net_timeout_t tm);  //** Optional gather write
    long int (*read)(net_sock_t *sock, void *buf, size_t count, Net_timeout_t tm);
+   long int (*readv)(net_sock_t *sock, const struct iovec *iov, int iovcnt, Net_timeout_t tm);  //** Optional scatter read
    void (*set_peer)(net_sock_t *sock, char *address, int add_size);
    int (*sock_status)(net_sock_t *sock);
    int (*connect)(net_sock_t *sock, const char *hostname, int port, Net_timeout_t timeout);
@@ -102,6 +127,7 @@ typedef struct {
    int (*bind)(net_sock_t *sock, char *address, int port);
    int (*listen)(net_sock_t *sock, int max_pending);
    int (*connection_request)(net_sock_t *sock, int timeout);
+   apr_socket_t *(*sock_fd)(net_sock_t *sock);  //** Returns the APR socket for polling or NULL if not pollable
 } NetStream_t;
 
 typedef struct ns_monitor_s {   //** Struct used to handle ports being monitored
@@ -132,6 +158,15 @@ typedef struct {
 #define ns_getid(ns) ns->id
 void set_network_tcpsize(int tcpsize);
 int get_network_tcpsize(int tcpsize);
+void set_network_bufsize(int bufsize);
+int get_network_bufsize();
+void ns_set_bufsize(NetStream_t *ns, int bufsize);
+int readv_netstream(NetStream_t *ns, struct iovec *iov, int iovcnt, Net_timeout_t timeout);
+int writev_netstream(NetStream_t *ns, struct iovec *iov, int iovcnt, int more, Net_timeout_t timeout);
+void ns_batch_begin(NetStream_t *ns);
+char *ns_sockopt_string(ns_sockopt_t *opt, char *buffer, int size);
+int ns_batch_end(NetStream_t *ns, hp_time_t end_time);
+hp_time_t hp_time_now();
 int ns_merge_ssl(NetStream_t *ns1, NetStream_t *ns2);
 int ns_socket2ssl(NetStream_t *ns);
 void set_ns_slave(NetStream_t *ns, int slave);
@@ -155,6 +190,10 @@ int read_netstream_block(NetStream_t *ns, time_t end_time, char *buffer, int siz
 int read_netstream(NetStream_t *ns, char *buffer, int size, Net_timeout_t timeout);
 int readline_netstream_raw(NetStream_t *ns, char *buffer, int size, Net_timeout_t timeout, int *status);
 int readline_netstream(NetStream_t *ns, char *buffer, int size, Net_timeout_t timeout);
+int ns_read_pending(NetStream_t *ns);
+apr_socket_t *ns_poll_fd(NetStream_t *ns);
+int ns_idle_ok(NetStream_t *ns);
+void ns_move(NetStream_t *dest_ns, NetStream_t *src_ns);
 int accept_pending_connection(Network_t *net, NetStream_t *ns);
 Net_timeout_t *set_net_timeout(Net_timeout_t *tm, int sec, int us);
 void ns_init(NetStream_t *ns);
@@ -376,6 +376,12 @@ void oplist_start_execution(oplist_t *oplist)
 
   oplist->started_execution = 1;
 
+  if (oplist->imp->submit_list != NULL) {  //** Let the implementation combine tasks if it wants
+     oplist->imp->submit_list(oplist);
+     unlock_oplist(oplist);
+     return;
+  }
+
   n = stack_size(oplist->list);
   move_to_top(oplist->list);
   for (i=0; i<n; i++) {
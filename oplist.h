@@ -74,6 +74,7 @@ typedef struct {     //** routines needed for implmentingthe op/oplist framework
    void (*oplist_sort_tasks)(oplist_t *oplist);        //**optional
    void (*notify)(oplist_t *oplist, void *op);  
    void (*submit_op)(oplist_t *oplist, void *op);
+   void (*submit_list)(oplist_t *oplist);      //**optional.  Submits all the tasks at once.  The oplist is locked
 } oplist_implementation_t;
 
 struct oplist_s {
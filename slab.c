@@ -0,0 +1,222 @@
+/*
+Advanced Computing Center for Research and Education Proprietary License
+Version 1.0 (April 2006)
+
+Copyright (c) 2006, Advanced Computing Center for Research and Education,
+ Vanderbilt University, All rights reserved.
+
+This Work is the sole and exclusive property of the Advanced Computing Center
+for Research and Education department at Vanderbilt University.  No right to
+disclose or otherwise disseminate any of the information contained herein is
+granted by virtue of your possession of this software except in accordance with
+the terms and conditions of a separate License Agreement entered into with
+Vanderbilt University.
+
+THE AUTHOR OR COPYRIGHT HOLDERS PROVIDES THE "WORK" ON AN "AS IS" BASIS,
+WITHOUT WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT
+LIMITED TO THE WARRANTIES OF MERCHANTABILITY, TITLE, FITNESS FOR A PARTICULAR
+PURPOSE, AND NON-INFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+Vanderbilt University
+Advanced Computing Center for Research and Education
+230 Appleton Place
+Nashville, TN 37203
+http://www.accre.vanderbilt.edu
+*/ 
+
+//*************************************************************************
+//*************************************************************************
+
+//*************************************************************************
+//  Slab allocator.  See slab.h for the design.  Plain pthreads are used
+//  since stacks and ops can be created before APR is initialized.
+//*************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "slab.h"
+
+int _slab_enabled = 1;   //** If 0 every alloc/free goes to malloc.  Used for comparisons
+
+//*************************************************************************
+// slab_set_enabled - Turns the caching on or off.  Should only be 
+//     changed when no objects are outstanding.
+//*************************************************************************
+
+void slab_set_enabled(int enabled) { _slab_enabled = enabled; }
+int slab_get_enabled() { return(_slab_enabled); }
+
+//*************************************************************************
+// _slab_thread_exit - Hands a dying thread's free list to the shared list
+//*************************************************************************
+
+void _slab_thread_exit(void *arg)
+{
+  Slab_cache_t *c = (Slab_cache_t *)arg;
+  Slab_t *s = c->slab;
+  Slab_obj_t *o;
+
+  pthread_mutex_lock(&(s->lock));
+  while ((o = c->free) != NULL) {
+     c->free = o->next;
+     if (s->n_shared < s->max_shared) {
+        o->next = s->shared;
+        s->shared = o;
+        s->n_shared++;
+     } else {
+        free(o);
+        s->stats.frees++;
+     }
+  }
+  pthread_mutex_unlock(&(s->lock));
+
+  free(c);
+}
+
+//*************************************************************************
+// new_slab - Creates a new slab for objects of the given size.  Slabs
+//     live for the life of the process.
+//*************************************************************************
+
+Slab_t *new_slab(const char *name, size_t size, int batch, int max_shared)
+{
+  Slab_t *s;
+
+  assert((s = (Slab_t *)malloc(sizeof(Slab_t))) != NULL);
+  memset(s, 0, sizeof(Slab_t));
+
+  strncpy(s->name, name, sizeof(s->name)-1);
+  s->size = (size < sizeof(Slab_obj_t)) ? sizeof(Slab_obj_t) : size;
+  s->batch = batch;
+  s->max_shared = max_shared;
+  s->shared = NULL;
+  s->n_shared = 0;
+  pthread_mutex_init(&(s->lock), NULL);
+  assert(pthread_key_create(&(s->key), _slab_thread_exit) == 0);
+
+  return(s);
+}
+
+//*************************************************************************
+// _slab_cache - Returns the thread's free list creating it if needed
+//*************************************************************************
+
+Slab_cache_t *_slab_cache(Slab_t *s)
+{
+  Slab_cache_t *c;
+
+  c = (Slab_cache_t *)pthread_getspecific(s->key);
+  if (c == NULL) {
+     assert((c = (Slab_cache_t *)malloc(sizeof(Slab_cache_t))) != NULL);
+     c->slab = s;
+     c->free = NULL;
+     c->n = 0;
+     pthread_setspecific(s->key, c);
+  }
+
+  return(c);
+}
+
+//*************************************************************************
+// slab_alloc - Returns an object.  The contents are undefined.
+//*************************************************************************
+
+void *slab_alloc(Slab_t *s)
+{
+  Slab_cache_t *c;
+  Slab_obj_t *o;
+  int i;
+
+  if (_slab_enabled == 1) {
+     c = _slab_cache(s);
+
+     if (c->free == NULL) {  //** Refill from the shared list
+        pthread_mutex_lock(&(s->lock));
+        for (i=0; (i<s->batch) && (s->shared != NULL); i++) {
+           o = s->shared;
+           s->shared = o->next;
+           o->next = c->free;
+           c->free = o;
+        }
+        s->n_shared -= i;
+        c->n += i;
+        if (i > 0) s->stats.refills++;
+        pthread_mutex_unlock(&(s->lock));
+     }
+
+     if (c->free != NULL) {
+        o = c->free;
+        c->free = o->next;
+        c->n--;
+        return((void *)o);
+     }
+  }
+
+  __sync_fetch_and_add(&(s->stats.mallocs), 1);
+
+  o = (Slab_obj_t *)malloc(s->size);
+  assert(o != NULL);
+
+  return((void *)o);
+}
+
+//*************************************************************************
+// slab_free - Returns the object to the slab
+//*************************************************************************
+
+void slab_free(Slab_t *s, void *ptr)
+{
+  Slab_cache_t *c;
+  Slab_obj_t *o = (Slab_obj_t *)ptr;
+  int i;
+
+  if (ptr == NULL) return;
+
+  if (_slab_enabled == 0) {
+     __sync_fetch_and_add(&(s->stats.frees), 1);
+     free(ptr);
+     return;
+  }
+
+  c = _slab_cache(s);
+  o->next = c->free;
+  c->free = o;
+  c->n++;
+
+  if (c->n <= 2*s->batch) return;
+
+  //** Too many so spill a batch to the shared list
+  pthread_mutex_lock(&(s->lock));
+  s->stats.spills++;
+  for (i=0; i<s->batch; i++) {
+     o = c->free;
+     c->free = o->next;
+     if (s->n_shared < s->max_shared) {
+        o->next = s->shared;
+        s->shared = o;
+        s->n_shared++;
+     } else {
+        free(o);
+        s->stats.frees++;
+     }
+  }
+  c->n -= s->batch;
+  pthread_mutex_unlock(&(s->lock));
+}
+
+//*************************************************************************
+// slab_stats - Returns the slab's counters
+//*************************************************************************
+
+void slab_stats(Slab_t *s, Slab_stats_t *stats)
+{
+  pthread_mutex_lock(&(s->lock));
+  *stats = s->stats;
+  stats->n_shared = s->n_shared;
+  pthread_mutex_unlock(&(s->lock));
+}
@@ -0,0 +1,95 @@
+/*
+Advanced Computing Center for Research and Education Proprietary License
+Version 1.0 (April 2006)
+
+Copyright (c) 2006, Advanced Computing Center for Research and Education,
+ Vanderbilt University, All rights reserved.
+
+This Work is the sole and exclusive property of the Advanced Computing Center
+for Research and Education department at Vanderbilt University.  No right to
+disclose or otherwise disseminate any of the information contained herein is
+granted by virtue of your possession of this software except in accordance with
+the terms and conditions of a separate License Agreement entered into with
+Vanderbilt University.
+
+THE AUTHOR OR COPYRIGHT HOLDERS PROVIDES THE "WORK" ON AN "AS IS" BASIS,
+WITHOUT WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT
+LIMITED TO THE WARRANTIES OF MERCHANTABILITY, TITLE, FITNESS FOR A PARTICULAR
+PURPOSE, AND NON-INFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+Vanderbilt University
+Advanced Computing Center for Research and Education
+230 Appleton Place
+Nashville, TN 37203
+http://www.accre.vanderbilt.edu
+*/ 
+
+//*************************************************************************
+// slab - Fixed size object cache.  Each thread keeps a private free list
+//    so allocs and frees normally take no lock.  Objects freed on a 
+//    different thread than they were allocated on just land on the
+//    freeing thread's list.  When a list gets too long a batch is moved
+//    to the shared list which the other threads refill from.  Memory is
+//    only returned to malloc when the shared list is full.
+//*************************************************************************
+
+#ifndef __SLAB_H_
+#define __SLAB_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SLAB_BATCH       64     //** Objects moved between a thread and the shared list at a time
+#define SLAB_SHARED_MAX  8192   //** Max objects kept on the shared list
+
+typedef struct slab_obj_s {    //** Overlays a free object
+   struct slab_obj_s *next;
+} Slab_obj_t;
+
+typedef struct {               //** Slab counters
+   int64_t mallocs;            //** Objects that had to come from malloc
+   int64_t frees;              //** Objects returned to malloc
+   int64_t refills;            //** Batches a thread took from the shared list
+   int64_t spills;             //** Batches a thread gave to the shared list
+   int n_shared;               //** Objects currently on the shared list
+} Slab_stats_t;
+
+typedef struct slab_s {
+   char name[32];
+   size_t size;                //** Object size
+   int batch;
+   int max_shared;
+   Slab_obj_t *shared;         //** Shared free list
+   int n_shared;
+   Slab_stats_t stats;         //** Protected by the lock
+   pthread_mutex_t lock;
+   pthread_key_t key;          //** Per thread Slab_cache_t
+} Slab_t;
+
+typedef struct {               //** Per thread free list
+   Slab_t *slab;
+   Slab_obj_t *free;
+   int n;
+} Slab_cache_t;
+
+Slab_t *new_slab(const char *name, size_t size, int batch, int max_shared);
+void *slab_alloc(Slab_t *s);
+void slab_free(Slab_t *s, void *ptr);
+void slab_stats(Slab_t *s, Slab_stats_t *stats);
+void slab_set_enabled(int enabled);
+int slab_get_enabled();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,210 @@
+/*
+Advanced Computing Center for Research and Education Proprietary License
+Version 1.0 (April 2006)
+
+Copyright (c) 2006, Advanced Computing Center for Research and Education,
+ Vanderbilt University, All rights reserved.
+
+This Work is the sole and exclusive property of the Advanced Computing Center
+for Research and Education department at Vanderbilt University.  No right to
+disclose or otherwise disseminate any of the information contained herein is
+granted by virtue of your possession of this software except in accordance with
+the terms and conditions of a separate License Agreement entered into with
+Vanderbilt University.
+
+THE AUTHOR OR COPYRIGHT HOLDERS PROVIDES THE "WORK" ON AN "AS IS" BASIS,
+WITHOUT WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT
+LIMITED TO THE WARRANTIES OF MERCHANTABILITY, TITLE, FITNESS FOR A PARTICULAR
+PURPOSE, AND NON-INFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+Vanderbilt University
+Advanced Computing Center for Research and Education
+230 Appleton Place
+Nashville, TN 37203
+http://www.accre.vanderbilt.edu
+*/ 
+
+//*****************************************************
+// slab_perf - Microbenchmark for the op slab caches.
+//      Each thread repeatedly builds a batch of read
+//      ops, wraps them in hportal tasks, ques them on
+//      stacks and then tears everything down.  No
+//      network traffic is generated.  The test is run
+//      with the slabs disabled and enabled and the
+//      number of mallocs per op is reported.
+//*****************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <apr_time.h>
+#include <apr_thread_proc.h>
+#include "ibp.h"
+#include "host_portal.h"
+#include "stack.h"
+#include "slab.h"
+#include "log.h"
+
+typedef struct {   //** Test parameters shared by all threads
+  ibp_cap_t *cap;
+  char *buffer;
+  int n_ops;
+  int batch;
+} perf_test_t;
+
+//*************************************************************************
+// op_thread - Builds and destroys n_ops ops in batches
+//*************************************************************************
+
+void *op_thread(apr_thread_t *th, void *arg)
+{
+  perf_test_t *t = (perf_test_t *)arg;
+  Stack_t *list, *que;
+  ibp_op_t *op;
+  Hportal_stack_op_t *hsop;
+  int i, n;
+
+  list = new_stack();
+  que = new_stack();
+
+  for (n=0; n<t->n_ops; n += t->batch) {
+     for (i=0; i<t->batch; i++) {
+        op = new_ibp_read_op(t->cap, 0, 1024, t->buffer, 10, NULL, NULL);
+        push(list, op);
+        push(que, new_hportal_op(NULL, op));
+     }
+
+     while ((hsop = (Hportal_stack_op_t *)pop(que)) != NULL) destroy_hportal_op(hsop);
+     while ((op = (ibp_op_t *)pop(list)) != NULL) free_ibp_op(op);
+  }
+
+  free_stack(list, 0);
+  free_stack(que, 0);
+
+  apr_thread_exit(th, 0);
+  return(NULL);
+}
+
+//*************************************************************************
+// run_test - Runs the test with the given number of threads and returns
+//     the ops/sec.  The mallocs made by the slabs are returned in mallocs.
+//*************************************************************************
+
+double run_test(perf_test_t *t, int n_threads, int64_t *mallocs, apr_pool_t *mpool)
+{
+  apr_thread_t **th;
+  apr_status_t value;
+  apr_time_t stime, dtime;
+  Slab_t *slab[3];
+  Slab_stats_t st;
+  int64_t start;
+  int i;
+
+  slab[0] = ibp_op_slab();
+  slab[1] = hportal_op_slab();
+  slab[2] = stack_ele_slab();
+
+  start = 0;
+  for (i=0; i<3; i++) { slab_stats(slab[i], &st); start += st.mallocs; }
+
+  assert((th = (apr_thread_t **)malloc(sizeof(apr_thread_t *)*n_threads)) != NULL);
+
+  stime = apr_time_now();
+  for (i=0; i<n_threads; i++) {
+     apr_thread_create(&(th[i]), NULL, op_thread, (void *)t, mpool);
+  }
+  for (i=0; i<n_threads; i++) apr_thread_join(&value, th[i]);
+  dtime = apr_time_now() - stime;
+
+  free(th);
+
+  *mallocs = -start;
+  for (i=0; i<3; i++) { slab_stats(slab[i], &st); *mallocs += st.mallocs; }
+
+  return((1.0*t->n_ops*n_threads) / (1.0*dtime / APR_USEC_PER_SEC));
+}
+
+//*************************************************************************
+//*************************************************************************
+
+int main(int argc, char **argv)
+{
+  int i, j, max_threads, start_option;
+  int64_t mallocs;
+  double ops_sec;
+  perf_test_t t;
+  apr_pool_t *mpool;
+
+  if (argc < 2) {
+     printf("\n");
+     printf("slab_perf [-d log_level] [-t max_threads] [-b batch] n_ops\n");
+     printf("\n");
+     printf("-d log_level     - Enable debug output.  log_level=0..20\n");
+     printf("-t max_threads   - Max number of threads creating ops.  Default is 8\n");
+     printf("-b batch         - Number of ops outstanding per thread.  Default is 64\n");
+     printf("n_ops            - Number of ops each thread creates and destroys\n");
+     printf("\n");
+     printf("The thread count is doubled from 1 to max_threads.  Each combination is\n");
+     printf("run with the slabs disabled (plain malloc) and enabled.\n");
+     printf("\n");
+     return(-1);
+  }
+
+  max_threads = 8;
+  t.batch = 64;
+
+  i = 1;
+  do {
+     start_option = i;
+
+     if (strcmp(argv[i], "-d") == 0) { //** Enable debugging
+        i++;
+        set_log_level(atoi(argv[i]));
+        i++;
+     } else if (strcmp(argv[i], "-t") == 0) { //** Max threads
+        i++;
+        max_threads = atoi(argv[i]);
+        i++;
+     } else if (strcmp(argv[i], "-b") == 0) { //** Batch size
+        i++;
+        t.batch = atoi(argv[i]);
+        i++;
+     }
+  } while ((start_option < i) && (i < argc));
+
+  if (i >= argc) {
+     printf("Missing n_ops!\n");
+     return(-1);
+  }
+  t.n_ops = atoi(argv[i]);
+  if (t.batch < 1) t.batch = 1;
+
+  ibp_init();
+  apr_pool_create(&mpool, NULL);
+
+  t.cap = "ibp://localhost:6714/0#slabperfkey/1234/READ";
+  assert((t.buffer = (char *)malloc(1024)) != NULL);
+
+  printf("n_ops: %d per thread  batch: %d\n", t.n_ops, t.batch);
+  printf("threads  slab     mallocs/op        ops/sec\n");
+  printf("-------  ----  -------------  -------------\n");
+
+  for (j=1; j<=max_threads; j = j*2) {
+     for (i=0; i<2; i++) {
+        slab_set_enabled(i);
+        ops_sec = run_test(&t, j, &mallocs, mpool);
+        printf("%7d  %4s  %13.4lf  %13.0lf\n", j, (i == 0) ? "off" : "on", (1.0*mallocs) / (1.0*t.n_ops*j), ops_sec);
+        flush_log();
+     }
+  }
+
+  free(t.buffer);
+  apr_pool_destroy(mpool);
+  ibp_finalize();
+
+  return(0);
+}
@@ -29,13 +29,30 @@ http://www.accre.vanderbilt.edu
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include "stack.h"
+#include "slab.h"
 
 #define MOVE_NOTHING 0
 #define MOVE_TOP     1
 #define MOVE_BOTTOM  2
 #define MOVE_BOTH    3
 
+pthread_once_t _stack_slab_once = PTHREAD_ONCE_INIT;
+Slab_t *_stack_slab = NULL;
+
+void _stack_slab_init() { _stack_slab = new_slab("stack_ele", sizeof(Stack_ele_t), SLAB_BATCH, 4*SLAB_SHARED_MAX); }
+
+//**************************************
+// stack_ele_slab - Returns the slab used
+//     for the stack elements
+//**************************************
+
+Slab_t *stack_ele_slab() {
+   pthread_once(&_stack_slab_once, _stack_slab_init);
+   return(_stack_slab);
+}
+
 //**************************************
 // check_ends - Checks to see if an
 //     insert effects top/bottom
@@ -142,7 +159,7 @@ void push_link(Stack_t *stack, Stack_ele_t *ele) {
 void push(Stack_t *stack, void *data) {
    Stack_ele_t *ele;
 
-   ele = (Stack_ele_t *)malloc(sizeof(Stack_ele_t));
+   ele = (Stack_ele_t *)slab_alloc(stack_ele_slab());
    ele->data = data;
 
    push_link(stack, ele);
@@ -170,7 +187,7 @@ void *pop(Stack_t *stack) {
    if (ele == NULL) return(NULL);
 
    data = ele->data;
-   free(ele);
+   slab_free(_stack_slab, ele);
 
    return(data);
 //--------------
@@ -185,7 +202,7 @@ void *pop(Stack_t *stack) {
       } else {
          stack->bottom = NULL;   //** Empty stack
       }
-      free(ele);
+      slab_free(_stack_slab, ele);
    } else {
      data = NULL;
    }
@@ -323,7 +340,7 @@ int insert_link_below(Stack_t *stack, Stack_ele_t *ele) {
 int insert_below(Stack_t *stack, void *data) {
   Stack_ele_t *ele;
 
-  ele =(Stack_ele_t *) malloc(sizeof(Stack_ele_t));
+  ele = (Stack_ele_t *)slab_alloc(stack_ele_slab());
   ele->data = data;
 
   return(insert_link_below(stack, ele));
@@ -369,7 +386,7 @@ int insert_link_above(Stack_t *stack, Stack_ele_t *ele) {
 int insert_above(Stack_t *stack, void *data) {
   Stack_ele_t *ele;
 
-  ele =(Stack_ele_t *) malloc(sizeof(Stack_ele_t));
+  ele = (Stack_ele_t *)slab_alloc(stack_ele_slab());
   ele->data = data;
 
   return(insert_link_above(stack, ele));
@@ -424,7 +441,7 @@ int delete_current(Stack_t *stack, int mv_up, int data_also)
 
   if (ele != NULL) {
      if (data_also) free(ele->data);
-     free(ele);
+     slab_free(_stack_slab, ele);
      return(1);
   } else {
      return(0);
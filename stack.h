@@ -34,6 +34,8 @@ http://www.accre.vanderbilt.edu
 extern "C" {
 #endif
 
+struct slab_s;
+
 typedef struct stack_ele {
   void *data;
   struct stack_ele *down, *up;
@@ -66,6 +68,7 @@ Stack_ele_t *stack_unlink_current(Stack_t *stack, int mv_up);
 int delete_current(Stack_t *, int, int);
 Stack_ele_t *get_ptr(Stack_t *);
 int move_to_ptr(Stack_t *, Stack_ele_t *);
+struct slab_s *stack_ele_slab();
 
 #ifdef __cplusplus
 }